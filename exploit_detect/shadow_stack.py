@@ -35,37 +35,28 @@ pyrebox_print = None
 target_procname = None
 target_pgd = None
 
-def opcode_range(callback_name, params):
+def branch(params):
     global cm
     from ipython_shell import start_shell
     import api
 
     cpu_index = params["cpu_index"]
     cpu = params["cpu"]
-    cur_pc = params["cur_pc"]
-    next_pc = params["next_pc"]
-    insn_size = params["insn_size"]
+    source = params["source"]
+    target = params["target"]
     pgd = api.get_running_process(cpu_index)
 
-    opcode = cm.get_trigger_var(callback_name, "opcode")
-
     if TARGET_LONG_SIZE == 4:
-        pyrebox_print("Stack not matching at %08x: %08x PGD: %x" % (cur_pc, next_pc, pgd))
+        pyrebox_print("Stack not matching at %08x: %08x PGD: %x" % (source, target, pgd))
     else:
-        pyrebox_print("Stack not matching at %016x: %016x PGD: %x" % (cur_pc, next_pc, pgd))
+        pyrebox_print("Stack not matching at %016x: %016x PGD: %x" % (source, target, pgd))
 
     start_shell()
 
 def do_print_shadow(line):
     import api
     global cm
-    cm.call_trigger_function("call_e8", "print_shadow_stack")
-    cm.call_trigger_function("call_ff", "print_shadow_stack")
-    cm.call_trigger_function("call_9a", "print_shadow_stack")
-    cm.call_trigger_function("ret_c3", "print_shadow_stack")
-    cm.call_trigger_function("ret_cb", "print_shadow_stack")
-    cm.call_trigger_function("ret_c2", "print_shadow_stack")
-    cm.call_trigger_function("ret_ca", "print_shadow_stack")
+    cm.call_trigger_function("branch", "print_shadow_stack")
 
 
 def module_entry_point(params):
@@ -89,61 +80,17 @@ def module_entry_point(params):
     # Get running process
     pgd = api.get_running_process(cpu_index)
 
-    #E8 cw   CALL rel16  Call near, relative, displacement relative to next instruction
-    #E8 cd   CALL rel32  Call near, relative, displacement relative to next instruction
-    #FF /2   CALL r/m16  Call near, absolute indirect, address given in r/m16
-    #FF /2   CALL r/m32  Call near, absolute indirect, address given in r/m32
-    #9A cd   CALL ptr16:16   Call far, absolute, address given in operand
-    #9A cp   CALL ptr16:32   Call far, absolute, address given in operand
-    #FF /3   CALL m16:16 Call far, absolute indirect, address given in m16:16
-    #FF /3   CALL m16:32 Call far, absolute indirect, address given in m16:32
-
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(opcode_range,"call_e8"), name="call_e8", start_opcode=0xE8, end_opcode=0xE8)
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(opcode_range,"call_ff"), name="call_ff", start_opcode=0xFF, end_opcode=0xFF)
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(opcode_range,"call_9a"), name="call_9a", start_opcode=0x9A, end_opcode=0x9A)
-
-    #C3 RET NP Valid Valid Near return to calling procedure.
-    #CB RET NP Valid Valid Far return to calling procedure.
-    #C2 iw RET imm16 I Valid Valid Near return to calling procedure and pop imm16 bytes from stack.
-    #CA iw RET imm16 I Valid Valid Far return to calling procedure and pop imm16 bytes from stack.
-
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(opcode_range, "ret_c3"), name="ret_c3", start_opcode=0xC3, end_opcode=0xC3)
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(opcode_range, "ret_cb"), name="ret_cb", start_opcode=0xCB, end_opcode=0xCB)
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(opcode_range, "ret_c2"), name="ret_c2", start_opcode=0xC2, end_opcode=0xC2)
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(opcode_range, "ret_ca"), name="ret_ca", start_opcode=0xCA, end_opcode=0xCA)
-
-    cm.add_trigger("call_e8", "exploit_detect/trigger_shadow_stack.so")
-    cm.set_trigger_var("call_e8", "pgd", pgd)
-    cm.set_trigger_var("call_e8", "thread_independent", 0)
-
-    cm.add_trigger("call_ff", "exploit_detect/trigger_shadow_stack.so")
-    cm.set_trigger_var("call_ff", "pgd", pgd)
-    cm.set_trigger_var("call_ff", "thread_independent", 0)
-
-
-    cm.add_trigger("call_9a", "exploit_detect/trigger_shadow_stack.so")
-    cm.set_trigger_var("call_9a", "pgd", pgd)
-    cm.set_trigger_var("call_9a", "thread_independent", 0)
-
-
-    cm.add_trigger("ret_c3", "exploit_detect/trigger_shadow_stack.so")
-    cm.set_trigger_var("ret_c3", "pgd", pgd)
-    cm.set_trigger_var("ret_c3", "thread_independent", 0)
-
-
-    cm.add_trigger("ret_cb", "exploit_detect/trigger_shadow_stack.so")
-    cm.set_trigger_var("ret_cb", "pgd", pgd)
-    cm.set_trigger_var("ret_cb", "thread_independent", 0)
-
-
-    cm.add_trigger("ret_c2", "exploit_detect/trigger_shadow_stack.so")
-    cm.set_trigger_var("ret_c2", "pgd", pgd)
-    cm.set_trigger_var("ret_c2", "thread_independent", 0)
-
-
-    cm.add_trigger("ret_ca", "exploit_detect/trigger_shadow_stack.so")
-    cm.set_trigger_var("ret_ca", "pgd", pgd)
-    cm.set_trigger_var("ret_ca", "thread_independent", 0)
+    # The branch callback reports the near and far calls (E8, FF /2, 9A, FF /3)
+    # with their return address, and the returns (C3, CB, C2, CA) with their
+    # destination, so the trigger does not need to decode the instructions.
+    # Jumps are not instrumented.
+    cm.add_callback(CallbackManager.BRANCH_CB, branch, name="branch",
+                    branch_kinds=api.BRANCH_KIND_CALL | api.BRANCH_KIND_CALL_INDIRECT |
+                                 api.BRANCH_KIND_RET | api.BRANCH_KIND_FAR)
+
+    cm.add_trigger("branch", "exploit_detect/trigger_shadow_stack.so")
+    cm.set_trigger_var("branch", "pgd", pgd)
+    cm.set_trigger_var("branch", "thread_independent", 0)
 
     pyrebox_print("Started monitoring process")
 
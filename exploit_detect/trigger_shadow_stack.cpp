@@ -73,7 +73,7 @@ extern "C"{
 
     // Define trigger type. This type is checked when trigger is loaded
     callback_type_t get_type(){
-        return OPCODE_RANGE_CB;
+        return BRANCH_CB;
     }
     // Trigger, return 1 if event should be passed to python callback 
     int trigger(callback_handle_t handle, callback_params_t params){
@@ -90,109 +90,37 @@ extern "C"{
 #else
 #error TARGET_LONG_SIZE undefined
 #endif
-        uint8_t buffer[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+        pyrebox_target_ulong cur_pgd = get_pgd(params.branch_params.cpu);
 
-        uint8_t opcodes[] = {0xff, 0xe8, 0x9a, 0xc3, 0xcb, 0xc2, 0xca};
-
-        pyrebox_target_ulong cur_pgd = get_pgd(params.opcode_range_params.cpu);
-
-        pyrebox_target_ulong insn_size = params.opcode_range_params.insn_size;
-        if (insn_size > 15){
-            insn_size = 15;
-        }
-        
-        tid = get_tid(params.opcode_range_params.cpu, cur_pgd);
+        tid = get_tid(params.branch_params.cpu, cur_pgd);
 
         // Only user-space -> user-space transitions
-        if (cur_pgd == target_pgd && params.opcode_range_params.cur_pc < system_space_limit && params.opcode_range_params.next_pc < system_space_limit){
-            // Double check the instruction that produced the callback
-            // Read insn_size bytes from cur_pc
-            if (qemu_virtual_memory_rw_with_pgd(cur_pgd, params.opcode_range_params.cur_pc, (uint8_t*) buffer, insn_size, 0) == 0){
-                // Skip the prefixes and find the opcode
-                int found = -1;
-                for (unsigned int i = 0; (i < insn_size) && found == -1; ++i){
-                    for (unsigned int j = 0; j < sizeof(opcodes) && found == -1; ++j){
-                        if (buffer[i] == opcodes[j]){
-                            found = i;
-                        }
-                    }
+        if (cur_pgd == target_pgd && params.branch_params.source < system_space_limit && params.branch_params.target < system_space_limit){
+            if (shadow_stack.find(tid) == shadow_stack.end()){
+                shadow_stack[tid] = unordered_set<pyrebox_target_ulong>(); 
+            }
+            if (params.branch_params.kind & (BRANCH_KIND_CALL | BRANCH_KIND_CALL_INDIRECT)){
+                if (shadow_stack[tid].find(params.branch_params.return_addr) == shadow_stack[tid].end()){
+                    shadow_stack[tid].insert(params.branch_params.return_addr);
                 }
-                if(found != -1){
-                    if (buffer[found] == 0xff){
-                        if (found <= (int)(insn_size - 2)){
-                            uint8_t reg = buffer[found+1] & 0x38;
-                            if (reg == 0x10 || reg == 0x18){
-                                //buffer[found] 
-                                if (shadow_stack.find(tid) == shadow_stack.end()){
-                                    shadow_stack[tid] = unordered_set<pyrebox_target_ulong>(); 
-                                }
-                                pyrebox_target_ulong next_pos = params.opcode_range_params.cur_pc + insn_size;
-                                if (shadow_stack[tid].find(next_pos) == shadow_stack[tid].end()){
-                                    shadow_stack[tid].insert(next_pos);
-                                }
-                                return 0;
-                            } else {
-                                return 0;
-                            }
-                        } else {
-                            // if (found <= (insn_size - 2){
-                            return 0;
-                        }
-                    }
-                    else{
-                        // if (buffer[found] == 0xff){
-                        // In order to understand the reference count, etc, read trigger_getset_var_example.cpp
-                        if (buffer[found] == 0xe8 || buffer[found] == 0x9a){
-                            pyrebox_target_ulong next_pos = params.opcode_range_params.cur_pc + insn_size;
-                            if (shadow_stack.find(tid) == shadow_stack.end()){
-                                shadow_stack[tid] = unordered_set<pyrebox_target_ulong>(); 
-                            }
-                            if (shadow_stack[tid].find(next_pos) == shadow_stack[tid].end()){
-                                shadow_stack[tid].insert(next_pos);
-                            }
-                            return 0;
-                        } else {
-                            if (shadow_stack.find(tid) == shadow_stack.end()){
-                                shadow_stack[tid] = unordered_set<pyrebox_target_ulong>(); 
-                            }
-                            if (shadow_stack[tid].find(params.opcode_range_params.next_pc) == shadow_stack[tid].end()){
-                                PyObject* new_var = Py_BuildValue("i", buffer[found]);
-                                PyObject* old_var = (PyObject*)get_var(handle,"opcode");
-                                if (old_var != 0)
-                                {
-                                    //Delete the variable without freeing its memory.
-                                    delete_var(handle,"opcode",0);
-                                }
-                                //Now, we can set the var
-                                set_var(handle,"opcode",new_var);
-                                return 1;
-                            } else {
-                                return 0;
-                            }
-                        }
-                    }
+                return 0;
+            } else if (params.branch_params.kind & BRANCH_KIND_RET){
+                // Return to an address that was not pushed by any call
+                if (shadow_stack[tid].find(params.branch_params.target) == shadow_stack[tid].end()){
+                    return 1;
                 } else {
-                    // if(found != -1){
                     return 0;
                 }
             } else {
-                //if (qemu_virtual_memory_rw_with_pgd(cur_pgd, params.opcode_range_params.cur_pc, (uint8_t*) buffer, insn_size, 0) == 0){)
                 return 0;
             }
         } else {
-            // if (cur_pgd == *target_pgd && params.opcode_range_params.cur_pc < system_space_limit && params.opcode_range_params.next_pc < system_space_limit){
+            // if (cur_pgd == *target_pgd && params.branch_params.source < system_space_limit && params.branch_params.target < system_space_limit){
             return 0;
         }
     }
     void clean(callback_handle_t handle)
     {
-        PyObject* old_var = (PyObject*)get_var(handle,"opcode");
-        if (old_var != 0)
-        {
-            //Delete the variable without freeing its memory.
-            delete_var(handle,"opcode",0);
-        }
-
         //This call will iterate all the variables created, and for those pointing
         //to some memory, it will free the memory. It will erase completely the list
         //of variables.
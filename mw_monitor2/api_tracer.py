@@ -447,87 +447,93 @@ def module_entry_point(params):
     
     cb_func = functools.partial(opcodes, proc = new_proc)
 
-    #E8 cw   CALL rel16  Call near, relative, displacement relative to next instruction
-    #E8 cd   CALL rel32  Call near, relative, displacement relative to next instruction
-    #FF /2   CALL r/m16  Call near, absolute indirect, address given in r/m16
-    #FF /2   CALL r/m32  Call near, absolute indirect, address given in r/m32
-    #9A cd   CALL ptr16:16   Call far, absolute, address given in operand
-    #9A cp   CALL ptr16:32   Call far, absolute, address given in operand
-    #FF /3   CALL m16:16 Call far, absolute indirect, address given in m16:16
-    #FF /3   CALL m16:32 Call far, absolute indirect, address given in m16:32
-
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="call_e8_%x" % pid), name="call_e8_%x" % pid, start_opcode=0xE8, end_opcode=0xE8)
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="call_ff_%x" % pid), name="call_ff_%x" % pid, start_opcode=0xFF, end_opcode=0xFF)
-    cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="call_9a_%x" % pid), name="call_9a_%x" % pid, start_opcode=0x9A, end_opcode=0x9A)
-
-    cm.add_trigger("call_e8_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-    cm.set_trigger_var("call_e8_%x" % pid, "pgd", pgd)
-    cm.set_trigger_var("call_e8_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
-
-    cm.add_trigger("call_ff_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-    cm.set_trigger_var("call_ff_%x" % pid, "pgd", pgd)
-    cm.set_trigger_var("call_ff_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
-
-    cm.add_trigger("call_9a_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-    cm.set_trigger_var("call_9a_%x" % pid, "pgd", pgd)
-    cm.set_trigger_var("call_9a_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
-
-    #C3 RET NP Valid Valid Near return to calling procedure.
-    #CB RET NP Valid Valid Far return to calling procedure.
-    #C2 iw RET imm16 I Valid Valid Near return to calling procedure and pop imm16 bytes from stack.
-    #CA iw RET imm16 I Valid Valid Far return to calling procedure and pop imm16 bytes from stack.
-
-    if APITRACER_ENABLE_RET:
-        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="ret_c3_%x" % pid), name="ret_c3_%x" % pid, start_opcode=0xC3, end_opcode=0xC3)
-        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="ret_cb_%x" % pid), name="ret_cb_%x" % pid, start_opcode=0xCB, end_opcode=0xCB)
-        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="ret_c2_%x" % pid), name="ret_c2_%x" % pid, start_opcode=0xC2, end_opcode=0xC2)
-        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="ret_ca_%x" % pid), name="ret_ca_%x" % pid, start_opcode=0xCA, end_opcode=0xCA)
-
-        cm.add_trigger("ret_c3_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-        cm.set_trigger_var("ret_c3_%x" % pid, "pgd", pgd)
-        cm.set_trigger_var("ret_c3_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
-
-        cm.add_trigger("ret_cb_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-        cm.set_trigger_var("ret_cb_%x" % pid, "pgd", pgd)
-        cm.set_trigger_var("ret_cb_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
-
-        cm.add_trigger("ret_c2_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-        cm.set_trigger_var("ret_c2_%x" % pid, "pgd", pgd)
-        cm.set_trigger_var("ret_c2_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
-
-        cm.add_trigger("ret_ca_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-        cm.set_trigger_var("ret_ca_%x" % pid, "pgd", pgd)
-        cm.set_trigger_var("ret_ca_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
-
-
-    #EB cb JMP rel8       Jump short, RIP = RIP + 8-bit displacement sign extended to 64-bits
-    #E9 cw JMP rel16      Jump near, relative, displacement relative to next instruction. Not supported in 64-bit mode.
-    #E9 cd JMP rel32      Jump near, relative, RIP = RIP + 32-bit displacement sign extended to 64-bits
-    #FF /4 JMP r/m16      Jump near, absolute indirect, address = zeroextended r/m16. Not supported in 64-bit mode.
-    #FF /4 JMP r/m32      Jump near, absolute indirect, address given in r/m32. Not supported in 64-bit mode.
-    #FF /4 JMP r/m64      Jump near, absolute indirect, RIP = 64-Bit offset from register or memory
-    #EA cd JMP ptr16:16   Jump far, absolute, address given in operand
-    #EA cp JMP ptr16:32   Jump far, absolute, address given in operand
-    #FF /5 JMP m16:16     Jump far, absolute indirect, address given in m16:16
-    #FF /5 JMP m16:32     Jump far, absolute indirect, address given in m16:32.
-    #FF /5 JMP m16:64     Jump far, absolute indirect, address given in m16:64
-
-    if APITRACER_ENABLE_JMP:
-        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="jmp_e9_%x" % pid), name="jmp_e9_%x" % pid, start_opcode=0xE9, end_opcode=0xE9)
-        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="jmp_ea_%x" % pid), name="jmp_ea_%x" % pid, start_opcode=0xEA, end_opcode=0xEA)
-        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="jmp_eb_%x" % pid), name="jmp_eb_%x" % pid, start_opcode=0xEB, end_opcode=0xEB)
-
-        cm.add_trigger("jmp_e9_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-        cm.set_trigger_var("jmp_e9_%x" % pid, "pgd", pgd)
-        cm.set_trigger_var("jmp_e9_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
-
-        cm.add_trigger("jmp_ea_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-        cm.set_trigger_var("jmp_ea_%x" % pid, "pgd", pgd)
-        cm.set_trigger_var("jmp_ea_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
-
-        cm.add_trigger("jmp_eb_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
-        cm.set_trigger_var("jmp_eb_%x" % pid, "pgd", pgd)
-        cm.set_trigger_var("jmp_eb_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+    # Register all the hooks at once, so that the translated code is only invalidated once
+    cm.begin_update()
+    try:
+        #E8 cw   CALL rel16  Call near, relative, displacement relative to next instruction
+        #E8 cd   CALL rel32  Call near, relative, displacement relative to next instruction
+        #FF /2   CALL r/m16  Call near, absolute indirect, address given in r/m16
+        #FF /2   CALL r/m32  Call near, absolute indirect, address given in r/m32
+        #9A cd   CALL ptr16:16   Call far, absolute, address given in operand
+        #9A cp   CALL ptr16:32   Call far, absolute, address given in operand
+        #FF /3   CALL m16:16 Call far, absolute indirect, address given in m16:16
+        #FF /3   CALL m16:32 Call far, absolute indirect, address given in m16:32
+
+        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="call_e8_%x" % pid), name="call_e8_%x" % pid, start_opcode=0xE8, end_opcode=0xE8)
+        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="call_ff_%x" % pid), name="call_ff_%x" % pid, start_opcode=0xFF, end_opcode=0xFF)
+        cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="call_9a_%x" % pid), name="call_9a_%x" % pid, start_opcode=0x9A, end_opcode=0x9A)
+
+        cm.add_trigger("call_e8_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+        cm.set_trigger_var("call_e8_%x" % pid, "pgd", pgd)
+        cm.set_trigger_var("call_e8_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+
+        cm.add_trigger("call_ff_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+        cm.set_trigger_var("call_ff_%x" % pid, "pgd", pgd)
+        cm.set_trigger_var("call_ff_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+
+        cm.add_trigger("call_9a_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+        cm.set_trigger_var("call_9a_%x" % pid, "pgd", pgd)
+        cm.set_trigger_var("call_9a_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+
+        #C3 RET NP Valid Valid Near return to calling procedure.
+        #CB RET NP Valid Valid Far return to calling procedure.
+        #C2 iw RET imm16 I Valid Valid Near return to calling procedure and pop imm16 bytes from stack.
+        #CA iw RET imm16 I Valid Valid Far return to calling procedure and pop imm16 bytes from stack.
+
+        if APITRACER_ENABLE_RET:
+            cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="ret_c3_%x" % pid), name="ret_c3_%x" % pid, start_opcode=0xC3, end_opcode=0xC3)
+            cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="ret_cb_%x" % pid), name="ret_cb_%x" % pid, start_opcode=0xCB, end_opcode=0xCB)
+            cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="ret_c2_%x" % pid), name="ret_c2_%x" % pid, start_opcode=0xC2, end_opcode=0xC2)
+            cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="ret_ca_%x" % pid), name="ret_ca_%x" % pid, start_opcode=0xCA, end_opcode=0xCA)
+
+            cm.add_trigger("ret_c3_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+            cm.set_trigger_var("ret_c3_%x" % pid, "pgd", pgd)
+            cm.set_trigger_var("ret_c3_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+
+            cm.add_trigger("ret_cb_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+            cm.set_trigger_var("ret_cb_%x" % pid, "pgd", pgd)
+            cm.set_trigger_var("ret_cb_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+
+            cm.add_trigger("ret_c2_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+            cm.set_trigger_var("ret_c2_%x" % pid, "pgd", pgd)
+            cm.set_trigger_var("ret_c2_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+
+            cm.add_trigger("ret_ca_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+            cm.set_trigger_var("ret_ca_%x" % pid, "pgd", pgd)
+            cm.set_trigger_var("ret_ca_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+
+
+        #EB cb JMP rel8       Jump short, RIP = RIP + 8-bit displacement sign extended to 64-bits
+        #E9 cw JMP rel16      Jump near, relative, displacement relative to next instruction. Not supported in 64-bit mode.
+        #E9 cd JMP rel32      Jump near, relative, RIP = RIP + 32-bit displacement sign extended to 64-bits
+        #FF /4 JMP r/m16      Jump near, absolute indirect, address = zeroextended r/m16. Not supported in 64-bit mode.
+        #FF /4 JMP r/m32      Jump near, absolute indirect, address given in r/m32. Not supported in 64-bit mode.
+        #FF /4 JMP r/m64      Jump near, absolute indirect, RIP = 64-Bit offset from register or memory
+        #EA cd JMP ptr16:16   Jump far, absolute, address given in operand
+        #EA cp JMP ptr16:32   Jump far, absolute, address given in operand
+        #FF /5 JMP m16:16     Jump far, absolute indirect, address given in m16:16
+        #FF /5 JMP m16:32     Jump far, absolute indirect, address given in m16:32.
+        #FF /5 JMP m16:64     Jump far, absolute indirect, address given in m16:64
+
+        if APITRACER_ENABLE_JMP:
+            cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="jmp_e9_%x" % pid), name="jmp_e9_%x" % pid, start_opcode=0xE9, end_opcode=0xE9)
+            cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="jmp_ea_%x" % pid), name="jmp_ea_%x" % pid, start_opcode=0xEA, end_opcode=0xEA)
+            cm.add_callback(CallbackManager.OPCODE_RANGE_CB, functools.partial(cb_func, cb_name="jmp_eb_%x" % pid), name="jmp_eb_%x" % pid, start_opcode=0xEB, end_opcode=0xEB)
+
+            cm.add_trigger("jmp_e9_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+            cm.set_trigger_var("jmp_e9_%x" % pid, "pgd", pgd)
+            cm.set_trigger_var("jmp_e9_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+
+            cm.add_trigger("jmp_ea_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+            cm.set_trigger_var("jmp_ea_%x" % pid, "pgd", pgd)
+            cm.set_trigger_var("jmp_ea_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+
+            cm.add_trigger("jmp_eb_%x" % pid, "mw_monitor2/trigger_jmp_call_ret_tracer.so")
+            cm.set_trigger_var("jmp_eb_%x" % pid, "pgd", pgd)
+            cm.set_trigger_var("jmp_eb_%x" % pid, "enable_ff_jmp", 1 if APITRACER_ENABLE_JMP else 0)
+    finally:
+        # Never leave the update open, or every later registration stays queued
+        cm.commit_update()
 
     # Start monitoring process
     api.start_monitoring_process(pgd)
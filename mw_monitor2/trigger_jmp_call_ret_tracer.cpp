@@ -74,87 +74,32 @@ extern "C"{
 #else
 #error TARGET_LONG_SIZE undefined
 #endif
-        uint8_t buffer[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-
-        uint8_t opcodes[] = {0xff, 0xe8, 0x9a, 0xc3, 0xcb, 0xc2, 0xca, 0xe9, 0xea, 0xeb};
-
         pyrebox_target_ulong cur_pgd = get_pgd(params.opcode_range_params.cpu);
 
-        pyrebox_target_ulong insn_size = params.opcode_range_params.insn_size;
-        if (insn_size > 15){
-            insn_size = 15;
-        }
-        
         // Only user-space -> user-space transitions
         if (cur_pgd == target_pgd && params.opcode_range_params.cur_pc < system_space_limit && params.opcode_range_params.next_pc < system_space_limit){
-            // Double check the instruction that produced the callback
-            // Read insn_size bytes from cur_pc
-            if (qemu_virtual_memory_rw_with_pgd(cur_pgd, params.opcode_range_params.cur_pc, (uint8_t*) buffer, insn_size, 0) == 0){
-                // Skip the prefixes and find the opcode
-                int found = -1;
-                for (unsigned int i = 0; (i < insn_size) && found == -1; ++i){
-                    for (unsigned int j = 0; j < sizeof(opcodes) && found == -1; ++j){
-                        if (buffer[i] == opcodes[j]){
-                            found = i;
-                        }
+            // The instruction that produced the callback is classified at
+            // translation time (see qemu_glue_callbacks_insn_info.h), so there
+            // is no need to read it back from memory. The ff instruction is
+            // classified according to the reg field of its mod/rm byte, used
+            // as opcode extension: 010 and 011 for CALL, 100 and 101 for JMP.
+            // In order to understand the reference count, etc, read trigger_getset_var_example.cpp
+            uint8_t opcode = params.opcode_range_params.opcode & 0xFF;
+            switch (params.opcode_range_params.insn_class){
+                case INSN_CLASS_CALL:
+                case INSN_CLASS_CALL | INSN_CLASS_INDIRECT:
+                case INSN_CLASS_RET:
+                case INSN_CLASS_JMP:
+                    set_opcode_var(handle, opcode);
+                    return 1;
+                case INSN_CLASS_JMP | INSN_CLASS_INDIRECT:
+                    if (enable_ff_jmp > 0){
+                        set_opcode_var(handle, opcode);
+                        return 1;
                     }
-                }
-                if(found != -1){
-                    if (buffer[found] == 0xff){
-                        if (found <= (int)(insn_size - 2)){
-                            // reg is the opcode extension of the mod/rm byte
-                            // mod/rm byte:  00   111  000  == 0x38
-                            //               mod  reg  r/m
-                            // the reg parameter is used as opcode extension
-                            // for the ff instruction:
-                            //
-                            // 010 and 011 for CALL instructions
-                            // 100 and 101 for JMP instructions
-                            uint8_t reg = buffer[found+1] & 0x38;
-                            if (reg == 0x10 || reg == 0x18){
-                                //buffer[found] 
-                                // CALL
-                                set_opcode_var(handle, buffer[found]);
-                                return 1;
-                            } else if ((reg == 0x20 || reg == 0x28) && enable_ff_jmp > 0) {
-                                //buffer[found]
-                                // JMP
-                                set_opcode_var(handle, buffer[found]);
-                                return 1;
-                            } else {
-                                return 0;
-                            }
-                        } else {
-                            // if (found <= (insn_size - 2){
-                            return 0;
-                        }
-                    }
-                    else{
-                        // if (buffer[found] == 0xff){
-                        // In order to understand the reference count, etc, read trigger_getset_var_example.cpp
-                        if (buffer[found] == 0xe8 || buffer[found] == 0x9a){
-                            // CALL
-                            set_opcode_var(handle, buffer[found]);
-                            return 1;
-                        } else if (buffer[found] == 0xc3 || buffer[found] == 0xcb || buffer[found] == 0xca || buffer[found] == 0xc2){
-                            // RET
-                            set_opcode_var(handle, buffer[found]);
-                            return 1;
-                        } else if (buffer[found] == 0xe9 || buffer[found] == 0xea || buffer[found] == 0xeb){
-                            // JMP
-                            set_opcode_var(handle, buffer[found]);
-                            return 1;
-                        } else {
-                            return 0;
-                        }
-                    }
-                } else {
-                    // if(found != -1){
                     return 0;
-                }
-            } else {
-                //if (qemu_virtual_memory_rw_with_pgd(cur_pgd, params.opcode_range_params.cur_pc, (uint8_t*) buffer, insn_size, 0) == 0){)
-                return 0;
+                default:
+                    return 0;
             }
         } else {
             // if (cur_pgd == *target_pgd && params.opcode_range_params.cur_pc < system_space_limit && params.opcode_range_params.next_pc < system_space_limit){
@@ -0,0 +1,82 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+//Example native plugin. Counts the basic blocks executed by the monitored
+//processes, and reports the delivery rate every REPORT_INTERVAL blocks.
+//The equivalent python plugin is pyrebox_test/test_14_native_throughput.py
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <list>
+#include <string>
+#include <Python.h>
+extern "C"{
+    #include "qemu_glue.h"
+    #include "utils.h"
+}
+#include "callbacks.h"
+#include "native_plugins.h"
+
+#define REPORT_INTERVAL 1000000
+
+typedef struct block_counter {
+    uint64_t blocks;
+    double start;
+} block_counter_t;
+
+static block_counter_t counter;
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000.0);
+}
+
+static void block_begin(callback_handle_t handle, callback_params_t params, void* user_data){
+    block_counter_t* c = (block_counter_t*) user_data;
+    if (c->blocks == 0){
+        c->start = now();
+    }
+    c->blocks++;
+    if ((c->blocks % REPORT_INTERVAL) == 0){
+        double elapsed = now() - c->start;
+        utils_print("[*] native_block_counter: %llu blocks in %.3f s (%.0f blocks/s)\n",
+                    (unsigned long long) c->blocks, elapsed, (double) c->blocks / elapsed);
+    }
+}
+
+extern "C"{
+    int pyrebox_plugin_init(module_handle_t plugin_handle, unsigned int abi_version){
+        if (abi_version != NATIVE_PLUGIN_ABI_VERSION){
+            return 0;
+        }
+        counter.blocks = 0;
+        counter.start = 0.0;
+        return (add_native_callback(BLOCK_BEGIN_CB, block_begin, &counter) != 0);
+    }
+    void pyrebox_plugin_fini(module_handle_t plugin_handle){
+        utils_print("[*] native_block_counter: %llu blocks\n", (unsigned long long) counter.blocks);
+    }
+}
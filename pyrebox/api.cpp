@@ -43,10 +43,15 @@ extern "C" {
     #include "qemu_glue_sleuthkit.h"
     #include "qemu_glue_ui.h"
     #include "qemu_glue_gdbstub.h"
+    #include "qemu_glue_callbacks_flush.h"
+    #include "python_symbols.h"
 }
 
 #include "callbacks.h"
+#include "callback_events.h"
+#include "async_callbacks.h"
 #include "process_mgr.h"
+#include "native_plugins.h"
 #include "utils.h"
 #include "api.h"
 #include "vmi.h"
@@ -55,9 +60,22 @@ using namespace std;
 
 vector<QEMU_GLUE_TSK_PATH_INFO*> guest_path_handles;
 
+//Observe-only callbacks run after their event was delivered, so they
+//cannot change the callbacks from the asynchronous callback worker
+static int check_not_async_worker(){
+    if (is_async_callback_worker()){
+        PyErr_SetString(PyExc_RuntimeError, "[!] Callbacks cannot be changed from an observe-only callback");
+        return 0;
+    }
+    return 1;
+}
+
 extern "C" {
 
 PyObject* register_callback(PyObject *dummy, PyObject *args){
+    if (!check_not_async_worker()){
+        return 0;
+    }
     PyObject *result = 0;
     PyObject *py_callback;
     unsigned int callback_type = 0xFFFFFFFF;
@@ -94,21 +112,16 @@ PyObject* register_callback(PyObject *dummy, PyObject *args){
             //First parameter(address) is the start_opcode
             //Second parameter(pgd) is the end_opcode
             
-            //Translate extended opcodes to what QEMU understands in the translation switch (see target/i386/translate.c
-            //: "reswitch")
-            if ((first_param & 0xFF00) == 0x0F00){
-                first_param = 0x0100 | (0x00FF & first_param);
-            } else {
-                first_param &= 0xFFFF;
-            }
-            if ((second_param & 0xFF00) == 0x0F00){
-                second_param = 0x0100 | (0x00FF & second_param);
-            } else {
-                second_param &= 0xFFFF;
-            }
+            first_param = normalize_opcode(first_param);
+            second_param = normalize_opcode(second_param);
 
             hdl = add_callback_at(casted_callback_type,module_handle,py_callback,first_param,second_param);
         }
+        else if (casted_callback_type == BRANCH_CB)
+        {
+            //First parameter(address) is the mask of branch kinds (all of them by default)
+            hdl = add_callback_at(casted_callback_type,module_handle,py_callback,first_param,0);
+        }
         //Rewrite callback type appropriately
         else if (casted_callback_type == BLOCK_BEGIN_CB || casted_callback_type == INSN_BEGIN_CB){
             if (first_param == (pyrebox_target_ulong) INV_ADDR && second_param == (pyrebox_target_ulong) INV_PGD){
@@ -139,7 +152,50 @@ PyObject* register_callback(PyObject *dummy, PyObject *args){
     return result;
 }
 
+PyObject* register_watch_callback(PyObject *dummy, PyObject *args){
+    if (!check_not_async_worker()){
+        return 0;
+    }
+    PyObject *py_callback;
+    unsigned int callback_type = 0xFFFFFFFF;
+    module_handle_t module_handle;
+    memory_watch_t watch;
+
+    //Parameters: module handle, callback type, callback function, start, end, pgd, physical
+    int parse_tuple_result = 0;
+#if TARGET_LONG_SIZE == 4
+    parse_tuple_result = PyArg_ParseTuple(args, "IIOIIIi", &module_handle, &callback_type, &py_callback, &watch.start, &watch.end, &watch.pgd, &watch.physical);
+#elif TARGET_LONG_SIZE == 8
+    parse_tuple_result = PyArg_ParseTuple(args, "IIOKKKi", &module_handle, &callback_type, &py_callback, &watch.start, &watch.end, &watch.pgd, &watch.physical);
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+    if (!parse_tuple_result){
+        PyErr_SetString(PyExc_TypeError, "[!] Could not parse parameters");
+        return 0;
+    }
+    if (!PyCallable_Check(py_callback)) {
+        PyErr_SetString(PyExc_TypeError, "[!] Parameter must be callable");
+        return 0;
+    }
+    if (callback_type != MEM_READ_CB && callback_type != MEM_WRITE_CB)
+    {
+        PyErr_SetString(PyExc_TypeError, "[!] Invalid callback type, only memory read / write callbacks can watch memory");
+        return 0;
+    }
+    if (watch.end <= watch.start)
+    {
+        PyErr_SetString(PyExc_ValueError, "[!] Empty memory watch range");
+        return 0;
+    }
+    callback_handle_t hdl = add_watch_callback((callback_type_t) callback_type, module_handle, py_callback, watch);
+    return Py_BuildValue("I",hdl);
+}
+
 PyObject* unregister_callback(PyObject *dummy, PyObject *args){
+    if (!check_not_async_worker()){
+        return 0;
+    }
     PyObject *result = 0;
     callback_handle_t hdl; 
     if (PyArg_ParseTuple(args, "I", &hdl)){
@@ -150,6 +206,30 @@ PyObject* unregister_callback(PyObject *dummy, PyObject *args){
     return result;
 }
 
+PyObject* py_begin_callback_update(PyObject *dummy, PyObject *args){
+    if (!check_not_async_worker()){
+        return 0;
+    }
+    begin_callback_update();
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject* py_commit_callback_update(PyObject *dummy, PyObject *args){
+    if (!check_not_async_worker()){
+        return 0;
+    }
+    //Apply the removes requested so far too, so that they
+    //are part of the same invalidation pass. From a callback,
+    //the delivery applies them once it finishes
+    if (!is_callback_delivery_in_progress()){
+        commit_deferred_callback_removes();
+    }
+    commit_callback_update();
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 //Read physical memory
 PyObject* r_pa(PyObject *dummy, PyObject *args){
     PyObject *result = 0;
@@ -234,6 +314,201 @@ PyObject* r_va(PyObject *dummy, PyObject *args)
     return result;
 }
 
+//Read virtual memory of any length into a writable buffer (bytearray,
+//memoryview...). Returns the number of pages that could not be read,
+//and a bitmap with one bit per page touched
+PyObject* r_va_into(PyObject *dummy, PyObject *args)
+{
+    PyObject *result = 0;
+    pyrebox_target_ulong addr;
+    pyrebox_target_ulong pgd;
+    Py_buffer view;
+#if TARGET_LONG_SIZE == 4
+    if (PyArg_ParseTuple(args, "IIw*",&pgd, &addr, &view)){
+#elif TARGET_LONG_SIZE == 8
+    if (PyArg_ParseTuple(args, "KKw*",&pgd, &addr, &view)){
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+        pyrebox_target_ulong len = (pyrebox_target_ulong) view.len;
+        //The range must fit in the address space, and its page count in the bitmap
+        if ((uint64_t) view.len != (uint64_t) len || (len > 0 && addr + (len - 1) < addr)){
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_ValueError, "The buffer does not fit in the address space");
+            return 0;
+        }
+        //4KB pages, the granularity of the page walk
+        pyrebox_target_ulong first_page = addr & ~((pyrebox_target_ulong)0xFFF);
+        pyrebox_target_ulong last_page = (addr + (len > 0 ? len - 1 : 0)) & ~((pyrebox_target_ulong)0xFFF);
+        uint64_t pages = (len > 0) ? ((uint64_t)(last_page - first_page) / 0x1000 + 1) : 0;
+        if (pages > (uint64_t) ((unsigned int) -1) - 7){
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_ValueError, "Too many pages to read in a single call");
+            return 0;
+        }
+        unsigned int nb_pages = (unsigned int) pages;
+        //Allocate the bitmap directly in the returned string
+        PyObject* bitmap_str = PyString_FromStringAndSize(NULL, (nb_pages + 7) / 8);
+        if (bitmap_str){
+            uint8_t* bitmap = (uint8_t*) PyString_AS_STRING(bitmap_str);
+            memset(bitmap, 0, (nb_pages + 7) / 8);
+            unsigned int failed = qemu_virtual_memory_read_pages(pgd, addr, (uint8_t*) view.buf, len, bitmap);
+            result = Py_BuildValue("(IN)", failed, bitmap_str);
+        }
+        PyBuffer_Release(&view);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect function parameters: pgd,addr,buffer");
+    }
+    return result;
+}
+
+//Read a list of (addr, length) ranges of virtual memory in a single call.
+//Returns a bitmap with one bit per range, set if the range could be read,
+//and the contents of all the ranges packed one after another
+PyObject* r_va_many(PyObject *dummy, PyObject *args)
+{
+    PyObject *result = 0;
+    pyrebox_target_ulong pgd;
+    PyObject* ranges;
+#if TARGET_LONG_SIZE == 4
+    if (PyArg_ParseTuple(args, "IO",&pgd, &ranges) && PySequence_Check(ranges)){
+#elif TARGET_LONG_SIZE == 8
+    if (PyArg_ParseTuple(args, "KO",&pgd, &ranges) && PySequence_Check(ranges)){
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+        Py_ssize_t count = PySequence_Size(ranges);
+        if (count < 0 || (size_t) count >= ((size_t) -1) / sizeof(pyrebox_target_ulong) - 1){
+            PyErr_SetString(PyExc_ValueError, "Incorrect list of ranges");
+            return 0;
+        }
+        pyrebox_target_ulong* addrs = (pyrebox_target_ulong*) malloc((count + 1) * sizeof(pyrebox_target_ulong));
+        pyrebox_target_ulong* lens = (pyrebox_target_ulong*) malloc((count + 1) * sizeof(pyrebox_target_ulong));
+        Py_ssize_t total = 0;
+        if (addrs == 0 || lens == 0){
+            free(addrs);
+            free(lens);
+            PyErr_SetString(PyExc_ValueError, "Could not allocate buffer to read memory");
+            return 0;
+        }
+        for (Py_ssize_t i = 0; i < count; ++i){
+            PyObject* range = PySequence_GetItem(ranges, i);
+            Py_ssize_t len = 0;
+            int ok = (range != 0);
+#if TARGET_LONG_SIZE == 4
+            ok = ok && PyArg_ParseTuple(range, "In", &addrs[i], &len);
+#elif TARGET_LONG_SIZE == 8
+            ok = ok && PyArg_ParseTuple(range, "Kn", &addrs[i], &len);
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+            Py_XDECREF(range);
+            if (!ok){
+                free(addrs);
+                free(lens);
+                PyErr_SetString(PyExc_ValueError, "Incorrect range, it must be a tuple (addr, length)");
+                return 0;
+            }
+            //Lengths are parsed signed so that negative values are rejected instead of wrapping around
+            if (len < 0 || len > PY_SSIZE_T_MAX - total || (uint64_t) len > (uint64_t) ((pyrebox_target_ulong) -1)){
+                free(addrs);
+                free(lens);
+                PyErr_SetString(PyExc_ValueError, "Incorrect size, lengths must be positive and their total must fit in memory");
+                return 0;
+            }
+            lens[i] = (pyrebox_target_ulong) len;
+            total += len;
+        }
+        PyObject* bitmap_str = PyString_FromStringAndSize(NULL, (count + 7) / 8);
+        PyObject* data_str = PyString_FromStringAndSize(NULL, total);
+        if (bitmap_str && data_str){
+            uint8_t* bitmap = (uint8_t*) PyString_AS_STRING(bitmap_str);
+            memset(bitmap, 0, (count + 7) / 8);
+            qemu_virtual_memory_read_many(pgd, addrs, lens, (unsigned int) count, (uint8_t*) PyString_AS_STRING(data_str), bitmap);
+            result = Py_BuildValue("(NN)", bitmap_str, data_str);
+        } else {
+            Py_XDECREF(bitmap_str);
+            Py_XDECREF(data_str);
+        }
+        free(addrs);
+        free(lens);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect function parameters: pgd,ranges");
+    }
+    return result;
+}
+
+//Walk a linked list in a single call. Returns the list of node addresses
+//and node_size bytes of each node packed one after another
+PyObject* r_va_list(PyObject *dummy, PyObject *args)
+{
+    PyObject *result = 0;
+    pyrebox_target_ulong pgd;
+    pyrebox_target_ulong head;
+    pyrebox_target_ulong link_offset;
+    pyrebox_target_ulong node_size;
+    unsigned int ptr_size;
+    unsigned int max_nodes;
+#if TARGET_LONG_SIZE == 4
+    if (PyArg_ParseTuple(args, "IIIIII",&pgd, &head, &link_offset, &ptr_size, &node_size, &max_nodes)){
+#elif TARGET_LONG_SIZE == 8
+    if (PyArg_ParseTuple(args, "KKKIKI",&pgd, &head, &link_offset, &ptr_size, &node_size, &max_nodes)){
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+        if (ptr_size != 4 && ptr_size != 8){
+            PyErr_SetString(PyExc_ValueError, "Incorrect pointer size, it must be 4 or 8");
+            return 0;
+        }
+        //Compute the sizes in size_t, rejecting anything that overflows them
+        if ((uint64_t) node_size > (uint64_t) PY_SSIZE_T_MAX ||
+            (max_nodes != 0 && (size_t) node_size > ((size_t) PY_SSIZE_T_MAX - 1) / max_nodes) ||
+            (size_t) max_nodes >= ((size_t) -1) / sizeof(pyrebox_target_ulong)){
+            PyErr_SetString(PyExc_ValueError, "Incorrect size, node_size * max_nodes is too large");
+            return 0;
+        }
+        size_t buffer_size = (size_t) node_size * max_nodes;
+        pyrebox_target_ulong* nodes = (pyrebox_target_ulong*) malloc(((size_t) max_nodes + 1) * sizeof(pyrebox_target_ulong));
+        uint8_t* buffer = (uint8_t*) malloc(buffer_size + 1);
+        if (nodes && buffer){
+            unsigned int count = qemu_virtual_memory_walk_list(pgd, head, link_offset, ptr_size, node_size, max_nodes, nodes, buffer);
+            PyObject* node_list = PyList_New(count);
+            if (node_list){
+                for (unsigned int i = 0; i < count; ++i){
+#if TARGET_LONG_SIZE == 4
+                    PyList_SET_ITEM(node_list, i, Py_BuildValue("I", nodes[i]));
+#elif TARGET_LONG_SIZE == 8
+                    PyList_SET_ITEM(node_list, i, Py_BuildValue("K", nodes[i]));
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+                }
+                PyObject* data_str = PyString_FromStringAndSize((const char*) buffer, (Py_ssize_t) ((size_t) node_size * count));
+                if (data_str){
+                    result = Py_BuildValue("(NN)", node_list, data_str);
+                } else {
+                    Py_DECREF(node_list);
+                }
+            }
+        }
+        else
+        {
+            PyErr_SetString(PyExc_ValueError, "Could not allocate buffer to read memory");
+        }
+        free(nodes);
+        free(buffer);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect function parameters: pgd,head,link_offset,ptr_size,node_size,max_nodes");
+    }
+    return result;
+}
+
 //Write physical memory
 PyObject* w_pa(PyObject *dummy, PyObject *args)
 {
@@ -533,6 +808,32 @@ PyObject* py_get_num_cpus(PyObject *dummy, PyObject *args){
     return result;
 }
 
+PyObject* py_get_tb_flush_stats(PyObject *dummy, PyObject *args){
+    PyObject *result = 0;
+    result = Py_BuildValue("{s:K,s:K,s:K}",
+                           "full_flushes", (unsigned long long) tb_flush_stats.full_flushes,
+                           "targeted_invalidations", (unsigned long long) tb_flush_stats.targeted_invalidations,
+                           "flushes_avoided", (unsigned long long) tb_flush_stats.flushes_avoided);
+    return result;
+}
+
+PyObject* py_get_page_walk_cache_stats(PyObject *dummy, PyObject *args){
+    PyObject *result = 0;
+    page_walk_cache_stats_t stats;
+    page_walk_cache_get_stats(&stats);
+    result = Py_BuildValue("{s:K,s:K,s:K}",
+                           "hits", (unsigned long long) stats.hits,
+                           "misses", (unsigned long long) stats.misses,
+                           "invalidations", (unsigned long long) stats.invalidations);
+    return result;
+}
+
+PyObject* py_get_python_import_count(PyObject *dummy, PyObject *args){
+    PyObject *result = 0;
+    result = Py_BuildValue("K", python_symbols_get_import_count());
+    return result;
+}
+
 PyObject* is_kernel_running(PyObject *dummy, PyObject *args){
     int cpu_index;
     if (PyArg_ParseTuple(args, "i", &cpu_index)){
@@ -635,6 +936,132 @@ PyObject* py_remove_trigger(PyObject *dummy, PyObject *args){
     }
 }
 
+PyObject* py_set_callback_prefilter(PyObject *dummy, PyObject *args){
+    unsigned int handle;
+    prefilter_conditions_t conditions;
+#if TARGET_LONG_SIZE == 4
+    if (PyArg_ParseTuple(args, "IIIII", &handle, &conditions.flags, &conditions.pgd, &conditions.lo, &conditions.hi)){
+#elif TARGET_LONG_SIZE == 8
+    if (PyArg_ParseTuple(args, "IIKKK", &handle, &conditions.flags, &conditions.pgd, &conditions.lo, &conditions.hi)){
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+        if (set_callback_prefilter(handle, conditions)){
+            Py_INCREF(Py_True);
+            return Py_True;
+        }
+        Py_INCREF(Py_False);
+        return Py_False;
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect parameters passed to set_callback_prefilter");
+        return 0;
+    }
+}
+
+PyObject* py_set_callback_batch(PyObject *dummy, PyObject *args){
+    unsigned int handle;
+    unsigned int size;
+    if (PyArg_ParseTuple(args, "II", &handle, &size)){
+        if (set_callback_batch(handle, size)){
+            Py_INCREF(Py_True);
+            return Py_True;
+        }
+        Py_INCREF(Py_False);
+        return Py_False;
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect parameters passed to set_callback_batch");
+        return 0;
+    }
+}
+
+PyObject* py_flush_callback_batches(PyObject *dummy, PyObject *args){
+    if (!check_not_async_worker()){
+        return 0;
+    }
+    flush_callback_batches();
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject* py_set_callback_async(PyObject *dummy, PyObject *args){
+    unsigned int handle;
+    int mode;
+    if (PyArg_ParseTuple(args, "Ii", &handle, &mode)){
+        if (set_callback_async(handle, mode)){
+            Py_INCREF(Py_True);
+            return Py_True;
+        }
+        Py_INCREF(Py_False);
+        return Py_False;
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect parameters passed to set_callback_async");
+        return 0;
+    }
+}
+
+PyObject* py_get_async_callback_stats(PyObject *dummy, PyObject *args){
+    async_callback_stats_t stats;
+    get_async_callback_stats(&stats);
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K}",
+                         "queued", (unsigned long long) stats.queued,
+                         "delivered", (unsigned long long) stats.delivered,
+                         "dropped", (unsigned long long) stats.dropped,
+                         "blocked", (unsigned long long) stats.blocked,
+                         "discarded", (unsigned long long) stats.discarded);
+}
+
+PyObject* py_get_callback_record_fields(PyObject *dummy, PyObject *args){
+    unsigned int type;
+    if (PyArg_ParseTuple(args, "I", &type) && type < LAST_CB){
+        return get_callback_record_fields((callback_type_t) type);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect parameters passed to get_callback_record_fields");
+        return 0;
+    }
+}
+
+PyObject* py_load_native_plugin(PyObject *dummy, PyObject *args){
+    char* path;
+    int length;
+    if (PyArg_ParseTuple(args, "s#",&path,&length)){
+        module_handle_t plugin_handle = load_native_plugin(path);
+        if (plugin_handle == 0){
+            PyErr_SetString(PyExc_ValueError, "Could not load native plugin");
+            return 0;
+        }
+        return Py_BuildValue("I",plugin_handle);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect parameters passed to load_native_plugin");
+        return 0;
+    }
+}
+PyObject* py_unload_native_plugin(PyObject *dummy, PyObject *args){
+    module_handle_t plugin_handle;
+    if (PyArg_ParseTuple(args, "I",&plugin_handle)){
+        if (!unload_native_plugin(plugin_handle)){
+            PyErr_SetString(PyExc_ValueError, "The native plugin specified is not loaded");
+            return 0;
+        }
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect parameters passed to unload_native_plugin");
+        return 0;
+    }
+}
+
 PyObject* set_trigger_uint32(PyObject *dummy, PyObject *args){
     int handle;
     char* str;
@@ -928,6 +1355,8 @@ PyObject* py_import_module(PyObject *dummy, PyObject *args){
         PyObject* ret = PyObject_CallObject(py_import,py_args_tuple);
         Py_XDECREF(ret);
         Py_DECREF(py_args_tuple);
+        //Resolve the python entry points that were not available yet
+        python_symbols_resolve_all();
         Py_INCREF(Py_None);
         return Py_None;
     }
@@ -982,6 +1411,9 @@ PyObject* py_reload_module(PyObject *dummy, PyObject *args){
         Py_XDECREF(ret);
         Py_DECREF(py_args_tuple);
         commit_deferred_callback_removes();
+        //The reload may have replaced the cached python entry points
+        python_symbols_invalidate();
+        python_symbols_resolve_all();
         Py_INCREF(Py_None);
         return Py_None;
     }
@@ -1192,6 +1624,32 @@ PyObject* py_x86_get_pte(PyObject *dummy, PyObject *args){
      }
 }
 
+//Walk the page tables of a range of addresses in a single call. Returns a
+//string with 4 native uint64 (va, pa, flags, page size) per mapped page
+PyObject* py_x86_walk_page_range(PyObject *dummy, PyObject *args){
+    PyObject *result = 0;
+    pyrebox_target_ulong pgd;
+    pyrebox_target_ulong start;
+    pyrebox_target_ulong end;
+#if TARGET_LONG_SIZE == 4
+    if (PyArg_ParseTuple(args, "III",&pgd, &start, &end)){
+#elif TARGET_LONG_SIZE == 8
+    if (PyArg_ParseTuple(args, "KKK",&pgd, &start, &end)){
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+        unsigned int count = 0;
+        x86_page_mapping_t* mappings = x86_walk_page_range(pgd, start, end, &count);
+        result = PyString_FromStringAndSize((const char*) mappings, (Py_ssize_t) count * sizeof(x86_page_mapping_t));
+        free(mappings);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_ValueError, "Incorrect function parameters: pgd,start,end");
+    }
+    return result;
+}
+
 PyObject* py_x86_is_pae(PyObject *dummy, PyObject *args){
    int is_pae = x86_is_pae();
    if (is_pae){
@@ -1308,8 +1766,14 @@ PyObject* py_gdb_signal_breakpoint(PyObject *dummy, PyObject *args){
 PyMethodDef api_methods[] = {
       {"register_callback", register_callback, METH_VARARGS, "register_callback"}, 
       {"unregister_callback", unregister_callback, METH_VARARGS, "unregister_callback"},
+      {"register_watch_callback", register_watch_callback, METH_VARARGS, "register_watch_callback"},
+      {"begin_callback_update", py_begin_callback_update, METH_VARARGS, "begin_callback_update"},
+      {"commit_callback_update", py_commit_callback_update, METH_VARARGS, "commit_callback_update"},
       {"r_pa",r_pa, METH_VARARGS, "r_pa"},
       {"r_va",r_va, METH_VARARGS, "r_va"},
+      {"r_va_into",r_va_into, METH_VARARGS, "r_va_into"},
+      {"r_va_many",r_va_many, METH_VARARGS, "r_va_many"},
+      {"r_va_list",r_va_list, METH_VARARGS, "r_va_list"},
       {"r_cpu",r_cpu, METH_VARARGS, "r_cpu"},
       {"w_pa",w_pa, METH_VARARGS, "w_pa"},
       {"w_va",w_va, METH_VARARGS, "w_va"},
@@ -1326,7 +1790,15 @@ PyMethodDef api_methods[] = {
       {"save_vm",save_vm, METH_VARARGS, "save_vm"},
       {"load_vm",load_vm, METH_VARARGS, "load_vm"},
       {"add_trigger",py_add_trigger, METH_VARARGS, "add_trigger"},
+      {"load_native_plugin",py_load_native_plugin, METH_VARARGS, "load_native_plugin"},
+      {"unload_native_plugin",py_unload_native_plugin, METH_VARARGS, "unload_native_plugin"},
       {"remove_trigger",py_remove_trigger, METH_VARARGS, "remove_trigger"},
+      {"set_callback_prefilter",py_set_callback_prefilter, METH_VARARGS, "set_callback_prefilter"},
+      {"set_callback_batch",py_set_callback_batch, METH_VARARGS, "set_callback_batch"},
+      {"flush_callback_batches",py_flush_callback_batches, METH_VARARGS, "flush_callback_batches"},
+      {"get_callback_record_fields",py_get_callback_record_fields, METH_VARARGS, "get_callback_record_fields"},
+      {"set_callback_async",py_set_callback_async, METH_VARARGS, "set_callback_async"},
+      {"get_async_callback_stats",py_get_async_callback_stats, METH_VARARGS, "get_async_callback_stats"},
       {"set_trigger_uint32",set_trigger_uint32, METH_VARARGS, "set_trigger_uint32"},
       {"set_trigger_uint64",set_trigger_uint64, METH_VARARGS, "set_trigger_uint64"},
       {"set_trigger_str",set_trigger_str, METH_VARARGS, "set_trigger_str"},
@@ -1337,6 +1809,9 @@ PyMethodDef api_methods[] = {
       {"vol_write_memory",py_vol_write_memory, METH_VARARGS, "vol_write_memory"},
       {"get_process_list",get_process_list, METH_VARARGS, "get_process_list"},
       {"get_num_cpus",py_get_num_cpus, METH_VARARGS, "get_num_cpus"},
+      {"get_tb_flush_stats",py_get_tb_flush_stats, METH_VARARGS, "get_tb_flush_stats"},
+      {"get_page_walk_cache_stats",py_get_page_walk_cache_stats, METH_VARARGS, "get_page_walk_cache_stats"},
+      {"get_python_import_count",py_get_python_import_count, METH_VARARGS, "get_python_import_count"},
       {"plugin_print_internal",py_print_plugin, METH_VARARGS, "plugin_print_internal"},
       {"get_os_bits",py_get_os_bits,METH_VARARGS,"get_os_bits"},
       {"import_module",py_import_module,METH_VARARGS,"import_module"},
@@ -1349,6 +1824,7 @@ PyMethodDef api_methods[] = {
       {"close_guest_path", py_close_guest_path, METH_VARARGS, "close_guest_path"},
       {"x86_get_pte", py_x86_get_pte, METH_VARARGS, "x86_get_pte"},
       {"x86_is_pae", py_x86_is_pae, METH_VARARGS, "x86_is_pae"},
+      {"x86_walk_page_range", py_x86_walk_page_range, METH_VARARGS, "x86_walk_page_range"},
       {"mouse_move", py_mouse_move, METH_VARARGS, "mouse_move"},
       {"mouse_button", py_mouse_button, METH_VARARGS, "mouse_button"},
       {"send_key", py_send_key, METH_VARARGS, "send_key"},
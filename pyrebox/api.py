@@ -33,8 +33,36 @@ from cpus import X64CPU
 from api_internal import bp_func
 from api_internal import register_callback
 from api_internal import unregister_callback
+from api_internal import register_watch_callback
+from api_internal import begin_callback_update
+from api_internal import commit_callback_update
 from api_internal import add_trigger
 from api_internal import remove_trigger
+from api_internal import set_callback_prefilter
+from api_internal import PREFILTER_PGD
+from api_internal import PREFILTER_RANGE
+from api_internal import PREFILTER_USER_ONLY
+from api_internal import set_callback_batch
+from api_internal import flush_callback_batches
+from api_internal import get_callback_record_fields
+from api_internal import set_callback_async
+from api_internal import ASYNC_CALLBACK_BLOCK
+from api_internal import ASYNC_CALLBACK_DROP
+from api_internal import INSN_CLASS_NONE
+from api_internal import INSN_CLASS_CALL
+from api_internal import INSN_CLASS_JMP
+from api_internal import INSN_CLASS_JCC
+from api_internal import INSN_CLASS_RET
+from api_internal import INSN_CLASS_MASK
+from api_internal import INSN_CLASS_INDIRECT
+from api_internal import INSN_NO_MODRM_REG
+from api_internal import BRANCH_KIND_CALL
+from api_internal import BRANCH_KIND_CALL_INDIRECT
+from api_internal import BRANCH_KIND_RET
+from api_internal import BRANCH_KIND_JMP
+from api_internal import BRANCH_KIND_JMP_INDIRECT
+from api_internal import BRANCH_KIND_FAR
+from api_internal import BRANCH_KIND_ALL
 from api_internal import set_trigger_uint32
 from api_internal import set_trigger_uint64
 from api_internal import set_trigger_str
@@ -68,6 +96,62 @@ def get_num_cpus():
     return c_api.get_num_cpus()
 
 
+def get_tb_flush_stats():
+    """ Returns the translation cache invalidation counters
+
+        :return: A dictionary with the keys full_flushes (full flushes of the translation
+                 cache performed), targeted_invalidations (invalidations of the code translated
+                 for a single address) and flushes_avoided (callback changes that did not require
+                 a full flush)
+        :rtype: dict
+    """
+    import c_api
+    return c_api.get_tb_flush_stats()
+
+
+def get_page_walk_cache_stats():
+    """ Returns the counters of the translation cache used to access the memory of
+        address spaces that no CPU is running
+
+        The cache is only used for reads, and a cached translation is only served
+        after checking that none of the paging structure entries read to translate
+        it has changed.
+
+        :return: A dictionary with the keys hits (translations served from the cache),
+                 misses (translations that required walking the page tables) and
+                 invalidations (times the cache was dropped on a guest TLB flush)
+        :rtype: dict
+    """
+    import c_api
+    return c_api.get_page_walk_cache_stats()
+
+
+def get_async_callback_stats():
+    """ Returns the counters of the observe-only callbacks delivered asynchronously
+
+        :return: A dictionary with the keys queued (events queued for the worker thread), delivered
+                 (events delivered to the callbacks), dropped (events lost because the queue was full),
+                 blocked (events that found the queue full, so the guest waited while the oldest events were delivered)
+                 and discarded (events whose callback was removed before they were delivered)
+        :rtype: dict
+    """
+    import c_api
+    return c_api.get_async_callback_stats()
+
+
+def get_python_import_count():
+    """ Returns the number of python module imports performed by the C/C++ core after
+        initialization, to resolve the python functions it calls (VMI, GDB stub, CPU
+        state conversion). These functions are resolved in advance and cached, so this
+        counter should stay at 0.
+
+        :return: The number of imports
+        :rtype: int
+    """
+    import c_api
+    return c_api.get_python_import_count()
+
+
 def r_pa(addr, length):
     """ Read physical address
 
@@ -108,40 +192,168 @@ def r_va(pgd, addr, length, use_filesystem=False):
         :param use_filesystem: Optional. Default: False. If set to True, PyREBox will use The Sleuthkit to inspect the
                                file system and obtain this data from the file backing the memory page: The referenced 
                                file if it is memory mapped, or the pagefile.sys in case it has been paged out.
+                               Otherwise, the pages that cannot be read are zero filled.
         :type use_filesystem: bool
 
-        :return: The read content
+        :return: The read content, always length bytes long
         :rtype: str
     """
     import c_api
     from vmi import read_paged_out_memory
-    # If this function call fails, it will raise an exception.
-    # Given that the exception is self explanatory, we just let it propagate
-    # upwards
+    buf = bytearray(length)
+    # Pages that cannot be read are zero filled, so the offsets of the
+    # content are kept
+    failed, bitmap = c_api.r_va_into(pgd, addr, buf)
+    if failed == 0 or not use_filesystem:
+        return str(buf)
+    # Some page could not be read
     offset = addr
-    ret_buffer = ""
+    page_index = 0
     while offset < (addr + length):
-        # Read page by page, until the next page's boundary. In this way,
-        # we make sure we never read memory from more than one page, 
-        # dealing individually with paged-out memory
-        boundary = offset + 0x1000 
+        # Deal individually with each page, so that paged-out memory
+        # can be recovered from the file system
+        boundary = offset + 0x1000
         boundary -= (offset & 0xFFF)
-        read_length = boundary - offset 
+        read_length = boundary - offset
         if (offset + read_length) > (addr + length):
             read_length = (addr + length) - offset
-        try:
-            ret_buffer += c_api.r_va(pgd, offset, read_length)
-        except RuntimeError as e:
+        if not page_read(bitmap, page_index):
             # The memory is likely paged out, so we cannot read it
-            if use_filesystem:
-                new_buf = read_paged_out_memory(pgd, offset, read_length)
-                if new_buf is not None:
-                    ret_buffer += new_buf
-                else:
-                    raise e
-            # Traverse the VAD tree to find corresponding VAD
+            new_buf = read_paged_out_memory(pgd, offset, read_length)
+            if new_buf is None or len(new_buf) != read_length:
+                raise RuntimeError("Could not read memory")
+            buf[offset - addr:offset - addr + read_length] = new_buf
         offset += read_length
-    return ret_buffer
+        page_index += 1
+    return str(buf)
+
+
+def r_va_into(pgd, addr, buf):
+    """Read virtual memory into a writable buffer, without size limit
+
+        The whole page walk is performed natively, and the data is written
+        directly into the buffer. Pages that cannot be read (e.g., paged out)
+        are zero filled.
+
+        :param pgd: The PGD (address space) to read from
+        :type pgd: int
+
+        :param addr: The address to read
+        :type addr: int
+
+        :param buf: The buffer to fill. Its length determines the length to read
+        :type buf: bytearray | memoryview
+
+        :return: The number of pages that could not be read, and a bitmap with
+                 one bit per page touched by the range, set if the page could
+                 be read. Use page_read() to query it.
+        :rtype: tuple
+    """
+    import c_api
+    return c_api.r_va_into(pgd, addr, buf)
+
+
+def r_va_many(pgd, ranges):
+    """Read several ranges of virtual memory in a single call
+
+        :param pgd: The PGD (address space) to read from
+        :type pgd: int
+
+        :param ranges: The ranges to read
+        :type ranges: list of (addr, length) tuples
+
+        :return: The content of each range, or None if it could not be read
+        :rtype: list
+    """
+    import c_api
+    bitmap, data = c_api.r_va_many(pgd, ranges)
+    result = []
+    offset = 0
+    for i, (addr, length) in enumerate(ranges):
+        if page_read(bitmap, i):
+            result.append(data[offset:offset + length])
+        else:
+            result.append(None)
+        offset += length
+    return result
+
+
+def r_va_list(pgd, head, link_offset, node_size, max_nodes, ptr_size=None):
+    """Walk a circular linked list (e.g., a LIST_ENTRY) in a single call
+
+        The first pointer of each link (Flink) is followed from the list head
+        until the list goes back to the head, max_nodes nodes are read, or
+        some memory cannot be read.
+
+        :param pgd: The PGD (address space) to read from
+        :type pgd: int
+
+        :param head: The address of the list head (e.g., PsActiveProcessHead)
+        :type head: int
+
+        :param link_offset: The offset of the link inside each node (e.g., ActiveProcessLinks in _EPROCESS)
+        :type link_offset: int
+
+        :param node_size: The number of bytes to read from the start of each node
+        :type node_size: int
+
+        :param max_nodes: The maximum number of nodes to read
+        :type max_nodes: int
+
+        :param ptr_size: Optional. The size of the pointers, 4 or 8. By default, that of the O.S. being emulated
+        :type ptr_size: int
+
+        :return: A list of (node address, node content) tuples
+        :rtype: list
+    """
+    import c_api
+    if ptr_size is None:
+        ptr_size = c_api.get_os_bits() // 8
+    nodes, data = c_api.r_va_list(pgd, head, link_offset, ptr_size, node_size, max_nodes)
+    return [(node, data[i * node_size:(i + 1) * node_size]) for i, node in enumerate(nodes)]
+
+
+def get_page_mappings(pgd, start=0, end=0):
+    """Enumerate the pages mapped in an address space, walking its page tables once
+
+        Absent entries of the upper levels skip the whole range they would map,
+        and large pages (2 MB, 4 MB, 1 GB) are returned as a single mapping that
+        starts at the beginning of the page.
+
+        :param pgd: The PGD (address space) to walk
+        :type pgd: int
+
+        :param start: Optional. The first address of the range. Default: 0
+        :type start: int
+
+        :param end: Optional. The address where the range ends (excluded). Default: 0, the end of the address space
+        :type end: int
+
+        :return: A list of (virtual address, physical address, flags, page size) tuples. The flags are the
+                 low 12 bits of the entry that maps the page (present, writable, user...) and the NX bit (bit 63),
+                 where writable and user are only set if every level of the hierarchy allows it
+        :rtype: list
+    """
+    import c_api
+    import struct
+    data = c_api.x86_walk_page_range(pgd, start, end)
+    values = struct.unpack("=%dQ" % (len(data) // 8), data)
+    return [values[i:i + 4] for i in range(0, len(values), 4)]
+
+
+def page_read(bitmap, page_index):
+    """Check a page in a bitmap returned by r_va_into (or a range in one returned by c_api.r_va_many)
+
+        :param bitmap: The bitmap returned by r_va_into
+        :type bitmap: str
+
+        :param page_index: The index of the page, starting at the page of the first address read
+        :type page_index: int
+
+        :return: True if the page could be read
+        :rtype: bool
+    """
+    return (ord(bitmap[page_index // 8]) >> (page_index % 8)) & 1 == 1
 
 
 def r_cpu(cpu_index=0):
@@ -743,6 +955,57 @@ def get_loaded_modules():
     import c_api
     return c_api.get_loaded_modules()
 
+def load_native_plugin(plugin_path):
+    """ Load a native (C/C++) plugin.
+
+        Native plugins register their callbacks with add_native_callback (see callbacks.h) from their
+        pyrebox_plugin_init function, and receive the events directly in native code, without
+        going through python. If the plugin is not compiled or the binary is outdated, it will
+        force a compilation of the plugin before loading it.
+
+        :param plugin_path: The path to the plugin source, relative to the pyrebox root (e.g.: native_plugins/native_block_counter)
+        :type plugin_path: str
+
+        :return: The handle of the loaded plugin, that can be used to unload it
+        :rtype: int
+    """
+    from utils import ConfigurationManager as conf_m
+    import subprocess
+    import os
+    import c_api
+
+    # Remove ".so" from the path, if present
+    if plugin_path[-3:] == ".so":
+        plugin_path = plugin_path[:-3]
+    # Check if we have the plugin compiled for the correct architecture
+    plugin_path = "%s-%s.so" % (plugin_path, conf_m.platform)
+    p = subprocess.Popen(
+        ["make " + plugin_path],
+        shell=True,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        cwd=conf_m.pyre_root)
+    p.wait()
+
+    if os.path.isfile(plugin_path):
+        return c_api.load_native_plugin(plugin_path)
+    elif os.path.isfile(os.path.join(conf_m.pyre_root, plugin_path)):
+        return c_api.load_native_plugin(os.path.join(conf_m.pyre_root, plugin_path))
+    else:
+        raise ValueError("Could not correctly compile native plugin %s - cwd: %s\n" % (plugin_path, conf_m.pyre_root))
+
+def unload_native_plugin(plugin_handle):
+    """ Unload a native plugin, removing all its callbacks.
+
+        :param plugin_handle: The handle returned by load_native_plugin
+        :type plugin_handle: int
+
+        :return: None
+        :rtype: None
+    """
+    import c_api
+    return c_api.unload_native_plugin(plugin_handle)
+
 def mouse_move(dx = 0, dy = 0, dz = 0):
     """ Move the mouse cursor. 0 means no movement.
 
@@ -791,8 +1054,10 @@ def screenshot(filename):
 
 # ================================================== CLASSES  =============
 # These wrappers are helpers for the callback manager
-# that deal with the 2 possible callback parameter conventions
-def function_wrapper_old(f, callback_type, *args, **kwargs):
+# that deal with the 2 possible callback parameter conventions.
+# Callbacks delivered from C receive a single CallbackEvent object,
+# while the module load/remove callbacks receive keyword arguments.
+def function_wrapper_old(f, callback_type, params):
     global DISABLE_DEPRECATION_WARNINGS
     try:
         if not DISABLE_DEPRECATION_WARNINGS:
@@ -804,37 +1069,39 @@ def function_wrapper_old(f, callback_type, *args, **kwargs):
             DISABLE_DEPRECATION_WARNINGS = True
         # We need to treat each callback separately
         if callback_type == CallbackManager.BLOCK_BEGIN_CB:
-            f(kwargs["cpu_index"], kwargs["cpu"], kwargs["tb"])
+            f(params["cpu_index"], params["cpu"], params["tb"])
         elif callback_type == CallbackManager.BLOCK_END_CB:
-            f(kwargs["cpu_index"], kwargs["cpu"], kwargs["tb"], kwargs["cur_pc"], kwargs["next_pc"])
+            f(params["cpu_index"], params["cpu"], params["tb"], params["cur_pc"], params["next_pc"])
         elif callback_type == CallbackManager.INSN_BEGIN_CB:
-            f(kwargs["cpu_index"], kwargs["cpu"])
+            f(params["cpu_index"], params["cpu"])
         elif callback_type == CallbackManager.INSN_END_CB:
-            f(kwargs["cpu_index"], kwargs["cpu"])
+            f(params["cpu_index"], params["cpu"])
         elif callback_type == CallbackManager.MEM_READ_CB:
-            f(kwargs["cpu_index"], kwargs["vaddr"], kwargs["size"], kwargs["haddr"])
+            f(params["cpu_index"], params["vaddr"], params["size"], params["haddr"])
         elif callback_type == CallbackManager.MEM_WRITE_CB:
-            f(kwargs["cpu_index"], kwargs["vaddr"], kwargs["size"], kwargs["haddr"], kwargs["data"])
+            f(params["cpu_index"], params["vaddr"], params["size"], params["haddr"], params["data"])
         elif callback_type == CallbackManager.KEYSTROKE_CB:
-            f(kwargs["keycode"])
+            f(params["keycode"])
         elif callback_type == CallbackManager.NIC_REC_CB:
-            f(kwargs["buf"], kwargs["size"], kwargs["cur_pos"], kwargs["start"], kwargs["stop"])
+            f(params["buf"], params["size"], params["cur_pos"], params["start"], params["stop"])
         elif callback_type == CallbackManager.NIC_SEND_CB:
-            f(kwargs["addr"], kwargs["size"], kwargs["buf"])
+            f(params["addr"], params["size"], params["buf"])
         elif callback_type == CallbackManager.OPCODE_RANGE_CB:
-            f(kwargs["cpu_index"], kwargs["cpu"], kwargs["cur_pc"], kwargs["next_pc"])
+            f(params["cpu_index"], params["cpu"], params["cur_pc"], params["next_pc"])
         elif callback_type == CallbackManager.TLB_EXEC_CB:
-            f(kwargs["cpu"], kwargs["vaddr"])
+            f(params["cpu"], params["vaddr"])
         elif callback_type == CallbackManager.CREATEPROC_CB:
-            f(kwargs["pid"], kwargs["pgd"], kwargs["name"])
+            f(params["pid"], params["pgd"], params["name"])
         elif callback_type == CallbackManager.REMOVEPROC_CB:
-            f(kwargs["pid"], kwargs["pgd"], kwargs["name"])
+            f(params["pid"], params["pgd"], params["name"])
         elif callback_type == CallbackManager.CONTEXTCHANGE_CB:
-             f(kwargs["old_pgd"], kwargs["new_pgd"])
+             f(params["old_pgd"], params["new_pgd"])
+        elif callback_type == CallbackManager.BRANCH_CB:
+             f(params["cpu_index"], params["cpu"], params["source"], params["target"], params["return_addr"], params["kind"])
         elif callback_type == CallbackManager.LOADMODULE_CB:
-             f(kwargs["pid"], kwargs["pgd"], kwargs["base"], kwargs["size"], kwargs["name"], kwargs["fullname"])
+             f(params["pid"], params["pgd"], params["base"], params["size"], params["name"], params["fullname"])
         elif callback_type == CallbackManager.REMOVEMODULE_CB:
-             f(kwargs["pid"], kwargs["pgd"], kwargs["base"], kwargs["size"], kwargs["name"], kwargs["fullname"])
+             f(params["pid"], params["pgd"], params["base"], params["size"], params["name"], params["fullname"])
         else:
             raise Exception("Unsupported callback type!")
     except Exception as e:
@@ -844,11 +1111,11 @@ def function_wrapper_old(f, callback_type, *args, **kwargs):
         return
 
 def wrap_old(f, callback_type):
-    return lambda *args, **kwargs: function_wrapper_old(f, callback_type, *args, **kwargs)
+    return lambda params=None, **kwargs: function_wrapper_old(f, callback_type, kwargs if params is None else params)
 
-def function_wrapper_new(f, *args, **kwargs):
+def function_wrapper_new(f, params):
     try:
-        f(kwargs)
+        f(params)
     except Exception as e:
         from utils import pp_error
         import traceback
@@ -858,10 +1125,60 @@ def function_wrapper_new(f, *args, **kwargs):
         return
 
 def wrap_new(f, callback_type):
-    return lambda *args, **kwargs: function_wrapper_new(f, *args, **kwargs)
+    return lambda params=None, **kwargs: function_wrapper_new(f, kwargs if params is None else params)
+
+def function_wrapper_batch(f, fields, data):
+    try:
+        f(CallbackBatch(fields, data))
+    except Exception as e:
+        from utils import pp_error
+        import traceback
+        traceback.print_exc()
+        pp_error("\nException occurred when calling callback function %s - %s" % (repr(f), str(e)))
+    finally:
+        return
+
+def wrap_batch(f, callback_type):
+    fields = get_callback_record_fields(callback_type)
+    return lambda data: function_wrapper_batch(f, fields, data)
 
 # ================================================== CLASSES ==============
 
+class CallbackBatch(object):
+    '''
+        Events delivered together to a callback added with a batch_size (see CallbackManager.add_callback).
+
+        Each event is a record of unsigned 64 bit integers, one per field (see the fields attribute),
+        in native byte order. The raw records are available in the data attribute (a str, that supports
+        the buffer protocol), so they can be processed without creating a python object per event.
+    '''
+    def __init__(self, fields, data):
+        import struct
+        self.fields = fields
+        self.data = data
+        self.__record = struct.Struct("=%dQ" % len(fields))
+
+    def __len__(self):
+        return len(self.data) / self.__record.size
+
+    def __iter__(self):
+        ''' Yields a tuple of values per record '''
+        for offset in xrange(0, len(self.data), self.__record.size):
+            yield self.__record.unpack_from(self.data, offset)
+
+    def column(self, name):
+        ''' Returns the tuple of values of a field, one per record
+
+            :param name: The field name
+            :type name: str
+
+            :return: The values of the field
+            :rtype: tuple
+        '''
+        import struct
+        values = struct.unpack("=%dQ" % (len(self.data) / 8), self.data)
+        return values[self.fields.index(name)::len(self.fields)]
+
 class CallbackManager:
     '''
         Class that abstracts callback management,optionally associating names to callbacks, and registering the list of
@@ -883,8 +1200,10 @@ class CallbackManager:
     CREATEPROC_CB = 13
     REMOVEPROC_CB = 14
     CONTEXTCHANGE_CB = 15
-    LOADMODULE_CB = 16
-    REMOVEMODULE_CB = 17
+    BRANCH_CB = 16
+    # Module callbacks are handled in python, after the types known by the core
+    LOADMODULE_CB = 17
+    REMOVEMODULE_CB = 18
 
     def __init__(self, module_hdl, new_style = False):
         """ Constructor of the class
@@ -906,6 +1225,10 @@ class CallbackManager:
 
         self.new_style = new_style 
 
+        # Triggers already compiled during the current update
+        self.update_depth = 0
+        self.compiled_triggers = set()
+
     def get_module_handle(self):
         """ Returns the module handle associated to this callback manager
             
@@ -941,7 +1264,11 @@ class CallbackManager:
             pgd=None,
             start_opcode=None,
             end_opcode=None,
-            new_style=None):
+            branch_kinds=None,
+            new_style=None,
+            batch_size=None,
+            observe_only=False,
+            drop_when_full=False):
         """ Add a callback to the module, given a name, so that we can refer to it later.
 
             If the name is repeated, it will provide back a new name based on the one passed as argument,
@@ -965,12 +1292,36 @@ class CallbackManager:
                         to INSN_BEGIN_CB, BLOCK_BEGIN_CB
             :type pgd: int
 
+            :param branch_kinds: Optional. Mask of the BRANCH_KIND_* values that a BRANCH_CB callback is triggered
+                                 for. Far transfers are only delivered if BRANCH_KIND_FAR is included too. Only
+                                 the kinds requested by some callback are instrumented. By default, all of them.
+            :type branch_kinds: int
+
             :param new_style: Optional. Enables the new-style callback parameter format. New-style callback functions accept
                               a single parameter (dictionary), with a key (str) per parameter, and a value (value of
                               the parameter), instead of positional arguments. This parameter overrides the class-wide
                               new_style parameter in the CallbackManager __init__ function.
             :type new_style: bool
 
+            :param batch_size: Optional. Deliver the events in batches of up to batch_size records, instead of calling
+                               the function once per event. The function receives a single CallbackBatch
+                               parameter, when the batch is full, on context changes, when the callback is removed,
+                               or when flush_batches() is called. The cpu is recorded as its pc, and the tb as
+                               its start address. Not supported for module, NIC, and process creation / removal
+                               callbacks.
+            :type batch_size: int
+
+            :param observe_only: Optional. Deliver the events from a worker thread, while the guest keeps running.
+                                 The function receives a dictionary with the same fields as the batch records
+                                 (see batch_size). It must not modify the guest state, and cannot add or remove
+                                 callbacks. Not supported together with batch_size.
+            :type observe_only: bool
+
+            :param drop_when_full: Optional. For observe_only callbacks, drop the events when the queue of the
+                                   worker thread is full, instead of making the guest wait. See
+                                   get_async_callback_stats().
+            :type drop_when_full: bool
+
             :return: The actual inserted callback name. If the callback name indicated already existed,
                      this name will be updated to make it unique. This name can be used as a handle to the callback
             :rtype: str
@@ -1023,10 +1374,133 @@ class CallbackManager:
         # together to call register_callback
         first_param = start_opcode if addr is None else addr
         second_param = end_opcode if pgd is None else pgd
+        if callback_type == CallbackManager.BRANCH_CB:
+            first_param = BRANCH_KIND_ALL if branch_kinds is None else branch_kinds
+        if batch_size is not None or observe_only:
+            if get_callback_record_fields(callback_type) is None:
+                raise ValueError("[!] CallbackManager: Batches and observe-only delivery not supported for callback type %d\n" % (callback_type))
+            wrap = wrap_batch if batch_size is not None else wrap_new
         self.callbacks[name] = register_callback(
             self.module_hdl, callback_type, wrap(func, callback_type), first_param, second_param)
+        if batch_size is not None and not set_callback_batch(self.callbacks[name], batch_size):
+            self.rm_callback(name)
+            raise ValueError("[!] CallbackManager: Could not set batch size %d for callback %s\n" % (batch_size, name))
+        if observe_only and not set_callback_async(self.callbacks[name],
+                                                   ASYNC_CALLBACK_DROP if drop_when_full else ASYNC_CALLBACK_BLOCK):
+            self.rm_callback(name)
+            raise ValueError("[!] CallbackManager: Could not enable observe-only delivery for callback %s\n" % (name))
         return name
 
+    def add_watch_callback(
+            self,
+            callback_type,
+            func,
+            address_range,
+            name=None,
+            pgd=None,
+            physical=False,
+            new_style=None):
+        """ Add a memory read or write callback that is only triggered for the accesses to a range of memory.
+
+            Unlike a MEM_READ_CB or MEM_WRITE_CB callback filtered with a trigger, a watch does not instrument
+            every memory access: only the accesses to the pages that contain the range leave the fast path
+            of the emulator, so watching a few kilobytes has no cost for the rest of memory. The callback
+            receives the same parameters as a regular memory callback, and it is triggered for every
+            access that overlaps the range.
+
+            :param callback_type: MEM_READ_CB or MEM_WRITE_CB
+            :type callback_type: int
+
+            :param func: The callback function (python function)
+            :type func: function
+
+            :param address_range: The (start, end) addresses of the range to watch, end not included
+            :type address_range: tuple
+
+            :param name: The name of the callback
+            :type name: str
+
+            :param pgd: Optional. The PGD of the process whose virtual addresses are watched. By default,
+                        the range is watched in every process.
+            :type pgd: int
+
+            :param physical: Optional. If True, the range contains physical addresses (as reported in
+                             the haddr parameter of the callback) instead of virtual addresses.
+            :type physical: bool
+
+            :param new_style: Optional. Enables the new-style callback parameter format. See add_callback.
+            :type new_style: bool
+
+            :return: The actual inserted callback name. See add_callback.
+            :rtype: str
+        """
+        import random
+        import string
+        import time
+
+        if callback_type != CallbackManager.MEM_READ_CB and callback_type != CallbackManager.MEM_WRITE_CB:
+            raise ValueError("[!] CallbackManager: Only MEM_READ_CB and MEM_WRITE_CB callbacks can watch memory\n")
+        start, end = address_range
+        if end <= start:
+            raise ValueError("[!] CallbackManager: Empty memory watch range %x - %x\n" % (start, end))
+
+        # If not specified, apply the class default
+        if new_style is None:
+            new_style = self.new_style
+        if new_style is True:
+            wrap = wrap_new
+        else:
+            wrap = wrap_old
+
+        if name is None:
+            random.seed(time.time())
+            name = "".join(random.choice(string.lowercase) for i in range(16))
+        name = self.generate_callback_name(name)
+
+        if pgd is None:
+            pgd = -1
+        self.callbacks[name] = register_watch_callback(
+            self.module_hdl, callback_type, wrap(func, callback_type), start, end, pgd, physical)
+        return name
+
+    def begin_update(self):
+        """ Start a batched update.
+
+            Callbacks added or removed until the matching commit_update() call are applied
+            together, with a single invalidation of the translated code, instead of one per
+            callback. Callbacks added during the update are not triggered until it is committed,
+            but their names can already be used to attach triggers and set trigger variables.
+            Updates can be nested.
+
+            :return: None
+            :rtype: None
+        """
+        self.update_depth += 1
+        begin_callback_update()
+
+    def commit_update(self):
+        """ Apply the changes performed since the matching begin_update() call.
+
+            :return: None
+            :rtype: None
+        """
+        if self.update_depth == 0:
+            raise ValueError("[!] CallbackManager: commit_update() called without begin_update()\n")
+        self.update_depth -= 1
+        if self.update_depth == 0:
+            self.compiled_triggers.clear()
+        commit_callback_update()
+
+    def flush_batches(self):
+        """ Deliver the records pending in the batches of the callbacks added with a batch_size.
+            Since the batches are shared by every script, the callbacks of other modules are
+            flushed as well.
+
+            :return: None
+            :rtype: None
+        """
+        flush_callback_batches()
+
     def rm_callback(self, name):
         """ Remove a callback given its name. Associated triggers will get unloaded too.
 
@@ -1095,13 +1569,17 @@ class CallbackManager:
             trigger_path = trigger_path[:-3]
         # Check if we have the plugin compiled for the correct architecture
         trigger_path = "%s-%s.so" % (trigger_path, conf_m.platform)
-        p = subprocess.Popen(
-            ["make " + trigger_path],
-            shell=True,
-            stdout=subprocess.PIPE,
-            stderr=subprocess.PIPE,
-            cwd=conf_m.pyre_root)
-        p.wait()
+        # Within an update, check it only once
+        if trigger_path not in self.compiled_triggers:
+            p = subprocess.Popen(
+                ["make " + trigger_path],
+                shell=True,
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+                cwd=conf_m.pyre_root)
+            p.wait()
+            if self.update_depth > 0:
+                self.compiled_triggers.add(trigger_path)
 
         if os.path.isfile(trigger_path):
             # Trigger compiled correctly
@@ -1129,6 +1607,53 @@ class CallbackManager:
             return
         remove_trigger(self.callbacks[name])
 
+    def set_prefilter(self, name, pgd=None, address_range=None, user_only=False):
+        ''' Declare simple conditions on the events a callback wants to receive.
+
+            The conditions of all the callbacks of a type are merged and checked by the
+            translated code itself, so that the events that no callback accepts never
+            leave the generated code. This is much cheaper than discarding them in a
+            trigger or in the python callback. Supported for block begin, block end,
+            instruction begin, instruction end and memory read / write callbacks
+            that are not address specific.
+
+            :param name: The callback name
+            :type name: str
+
+            :param pgd: Only deliver the events of the process with this PGD
+            :type pgd: int
+
+            :param address_range: Only deliver the events for addresses in [start, end): the pc for
+                                  block and instruction begin callbacks, the pc of the last instruction
+                                  for block end callbacks, and the accessed address for memory callbacks.
+                                  Not supported for instruction end callbacks.
+            :type address_range: tuple
+
+            :param user_only: Only deliver the events generated in user mode
+            :type user_only: bool
+
+            :return: None
+            :rtype: None
+        '''
+        if name not in self.callbacks:
+            raise ValueError(
+                "[!] CallbackManager: A callback with name %s does not exist, or it is a module callback (non-prefilter compatible)\n" %
+                (name))
+        flags = 0
+        lo = 0
+        hi = 0
+        if pgd is None:
+            pgd = 0
+        else:
+            flags |= PREFILTER_PGD
+        if address_range is not None:
+            flags |= PREFILTER_RANGE
+            lo, hi = address_range
+        if user_only:
+            flags |= PREFILTER_USER_ONLY
+        if not set_callback_prefilter(self.callbacks[name], flags, pgd, lo, hi):
+            raise ValueError("[!] CallbackManager: Prefilter not supported for callback %s\n" % (name))
+
     def set_trigger_var(self, name, var_name, val):
         '''
         Add a trigger variable with name var_name and value val, to the callback with the given name
@@ -1429,56 +1954,24 @@ class BP:
                     BP.__cm.set_trigger_var(
                         self.__bp_repr, "end", self.addr + self.size)
                     BP.__cm.set_trigger_var(self.__bp_repr, "pgd", self.pgd)
-            elif self.typ == self.MEM_READ:
-                if not is_monitored_process(self.pgd):
-                    start_monitoring_process(self.pgd)
-                if self.pgd not in BP.__active_bps:
-                    BP.__active_bps[self.pgd] = 1
-                else:
-                    BP.__active_bps[self.pgd] += 1
-                self.__bp_repr = BP.__cm.add_callback(
-                    CallbackManager.MEM_READ_CB, self.func, name=self.__bp_repr,
-                    new_style = self.__new_style)
-                BP.__cm.add_trigger(
-                    self.__bp_repr, "triggers/trigger_bpr_memrange.so")
-                BP.__cm.set_trigger_var(self.__bp_repr, "begin", self.addr)
-                BP.__cm.set_trigger_var(
-                    self.__bp_repr, "end", self.addr + self.size)
-                BP.__cm.set_trigger_var(self.__bp_repr, "pgd", self.pgd)
-            elif self.typ == self.MEM_WRITE:
-                if not is_monitored_process(self.pgd):
-                    start_monitoring_process(self.pgd)
-                if self.pgd not in BP.__active_bps:
-                    BP.__active_bps[self.pgd] = 1
-                else:
-                    BP.__active_bps[self.pgd] += 1
-                self.__bp_repr = BP.__cm.add_callback(
-                    CallbackManager.MEM_WRITE_CB, self.func, name=self.__bp_repr,
-                    new_style = self.__new_style)
-                BP.__cm.add_trigger(
-                    self.__bp_repr, "triggers/trigger_bpw_memrange.so")
-                BP.__cm.set_trigger_var(self.__bp_repr, "begin", self.addr)
-                BP.__cm.set_trigger_var(
-                    self.__bp_repr, "end", self.addr + self.size)
-                BP.__cm.set_trigger_var(self.__bp_repr, "pgd", self.pgd)
-            elif self.typ == self.MEM_READ_PHYS:
-                self.__bp_repr = BP.__cm.add_callback(
-                    CallbackManager.MEM_READ_CB, self.func, name=self.__bp_repr,
+            elif self.typ == self.MEM_READ or self.typ == self.MEM_WRITE:
+                # Memory breakpoints watch the pages of the range, instead
+                # of instrumenting every memory access
+                self.__bp_repr = BP.__cm.add_watch_callback(
+                    CallbackManager.MEM_READ_CB if self.typ == self.MEM_READ else CallbackManager.MEM_WRITE_CB,
+                    self.func,
+                    (self.addr, self.addr + self.size),
+                    name=self.__bp_repr,
+                    pgd=self.pgd,
                     new_style = self.__new_style)
-                BP.__cm.add_trigger(
-                    self.__bp_repr, "triggers/trigger_bprh_memrange.so")
-                BP.__cm.set_trigger_var(self.__bp_repr, "begin", self.addr)
-                BP.__cm.set_trigger_var(
-                    self.__bp_repr, "end", self.addr + self.size)
-            elif self.typ == self.MEM_WRITE_PHYS:
-                self.__bp_repr = BP.__cm.add_callback(
-                    CallbackManager.MEM_WRITE_CB, self.func, name=self.__bp_repr,
+            elif self.typ == self.MEM_READ_PHYS or self.typ == self.MEM_WRITE_PHYS:
+                self.__bp_repr = BP.__cm.add_watch_callback(
+                    CallbackManager.MEM_READ_CB if self.typ == self.MEM_READ_PHYS else CallbackManager.MEM_WRITE_CB,
+                    self.func,
+                    (self.addr, self.addr + self.size),
+                    name=self.__bp_repr,
+                    physical=True,
                     new_style = self.__new_style)
-                BP.__cm.add_trigger(
-                    self.__bp_repr, "triggers/trigger_bpwh_memrange.so")
-                BP.__cm.set_trigger_var(self.__bp_repr, "begin", self.addr)
-                BP.__cm.set_trigger_var(
-                    self.__bp_repr, "end", self.addr + self.size)
 
     def disable(self):
         """ Disable a breakpoint
@@ -1491,7 +1984,7 @@ class BP:
             self.en = False
             # Trigger is deleted automagically
             BP.__cm.rm_callback(self.__bp_repr)
-            if self.typ < BP.MEM_READ_PHYS and self.pgd in BP.__active_bps:
+            if self.typ == BP.EXECUTION and self.pgd in BP.__active_bps:
                 BP.__active_bps[self.pgd] -= 1
                 if BP.__active_bps[self.pgd] == 0:
                     stop_monitoring_process(self.pgd)
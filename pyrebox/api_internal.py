@@ -393,6 +393,49 @@ def register_callback(
             second_param)
 
 
+def register_watch_callback(
+        module_hdl,
+        callback_type,
+        py_callback,
+        start,
+        end,
+        pgd,
+        physical):
+    """Register a memory read / write callback restricted to a range of memory. For a richer interface,
+       use the CallbackManager class.
+
+        Only the accesses to the watched pages leave the fast path of the emulator, so the rest of
+        memory accesses are not slowed down.
+
+        :param module_hdl: The module handle provided to the script as parameter to the initialize_callbacks function.
+                           Use 0 if it doesn't apply.
+        :type module_hdl: int
+
+        :param callback_type: MEM_READ_CB or MEM_WRITE_CB
+        :type callback_type: int
+
+        :param py_callback: Callback function.
+        :type py_callback: function
+
+        :param start: First address of the range.
+        :type start: int
+
+        :param end: End of the range, not included.
+        :type end: int
+
+        :param pgd: PGD of the process for virtual addresses, or -1 for any process.
+        :type pgd: int
+
+        :param physical: True if the range contains physical addresses (as reported in the haddr parameter).
+        :type physical: bool
+
+        :return: Callback handle for the registered callback, that can be used to unregister it.
+        :rtype: int
+    """
+    import c_api
+    return c_api.register_watch_callback(module_hdl, callback_type, py_callback, start, end, pgd, 1 if physical else 0)
+
+
 def unregister_callback(callback_handle):
     """Unregister a callback. For a richer interface, use the CallbackManager class.
 
@@ -407,6 +450,32 @@ def unregister_callback(callback_handle):
     return c_api.unregister_callback(callback_handle)
 
 
+def begin_callback_update():
+    """Start a batched callback update. For a richer interface, use the CallbackManager class.
+
+    Callbacks registered or unregistered until the matching commit_callback_update()
+    call are applied together, with a single invalidation of the translated code.
+    Updates can be nested.
+
+    :return: None
+    :rtype: None
+    """
+    import c_api
+
+    return c_api.begin_callback_update()
+
+
+def commit_callback_update():
+    """Apply the changes performed since the matching begin_callback_update() call.
+
+    :return: None
+    :rtype: None
+    """
+    import c_api
+
+    return c_api.commit_callback_update()
+
+
 def add_trigger(handle, path):
     """ Add (attach) a trigger to a given callback.
 
@@ -454,6 +523,129 @@ def remove_trigger(handle):
     return c_api.remove_trigger(handle)
 
 
+# Prefilter condition flags (see callbacks.h)
+PREFILTER_PGD = 0x1
+PREFILTER_RANGE = 0x2
+PREFILTER_USER_ONLY = 0x4
+
+
+def set_callback_prefilter(handle, flags, pgd, lo, hi):
+    """ Declare the prefilter conditions of a callback. For a richer interface, use the CallbackManager class.
+
+        The conditions of every callback of a type are merged into a prefilter that the translated code
+        evaluates before leaving the generated code, so that events that no callback accepts are
+        discarded without calling any helper.
+
+        :param handle: Handle of the callback.
+        :type handle: int
+
+        :param flags: Combination of PREFILTER_PGD, PREFILTER_RANGE and PREFILTER_USER_ONLY.
+        :type flags: int
+
+        :param pgd: PGD of the process (PREFILTER_PGD).
+        :type pgd: int
+
+        :param lo: First address of the range (PREFILTER_RANGE).
+        :type lo: int
+
+        :param hi: End of the range, not included (PREFILTER_RANGE).
+        :type hi: int
+
+        :return: True if the conditions were accepted
+        :rtype: bool
+    """
+    import c_api
+    return c_api.set_callback_prefilter(handle, flags, pgd, lo, hi)
+
+
+def set_callback_batch(handle, size):
+    """ Deliver the events of a callback in batches of records. For a richer interface, use the CallbackManager class.
+
+        The callback function receives a single string with the records of up to size events,
+        as consecutive arrays of unsigned 64 bit integers (see get_callback_record_fields).
+
+        :param handle: Handle of the callback.
+        :type handle: int
+
+        :param size: Maximum number of records in a batch.
+        :type size: int
+
+        :return: True if batches are supported for the callback
+        :rtype: bool
+    """
+    import c_api
+    return c_api.set_callback_batch(handle, size)
+
+
+def flush_callback_batches():
+    """ Deliver the records pending in the batches of every callback.
+
+        :return: None
+        :rtype: None
+    """
+    import c_api
+    c_api.flush_callback_batches()
+
+
+# Asynchronous delivery modes (see async_callbacks.h)
+ASYNC_CALLBACK_BLOCK = 1
+ASYNC_CALLBACK_DROP = 2
+
+
+# Instruction classes of the insn_class parameter of the opcode range
+# callbacks (see qemu_glue_callbacks_insn_info.h)
+INSN_CLASS_NONE = 0
+INSN_CLASS_CALL = 1
+INSN_CLASS_JMP = 2
+INSN_CLASS_JCC = 3
+INSN_CLASS_RET = 4
+INSN_CLASS_MASK = 0x7
+INSN_CLASS_INDIRECT = 0x8
+INSN_NO_MODRM_REG = 0xFF
+
+
+# Kinds of the branch callbacks (see qemu_glue_callbacks_insn_info.h). Far
+# transfers carry BRANCH_KIND_FAR together with their kind.
+BRANCH_KIND_CALL = 0x1
+BRANCH_KIND_CALL_INDIRECT = 0x2
+BRANCH_KIND_RET = 0x4
+BRANCH_KIND_JMP = 0x8
+BRANCH_KIND_JMP_INDIRECT = 0x10
+BRANCH_KIND_FAR = 0x20
+BRANCH_KIND_ALL = 0x3F
+
+
+def set_callback_async(handle, mode):
+    """ Deliver the events of a callback from a worker thread, without stopping the guest.
+        For a richer interface, use the CallbackManager class.
+
+        :param handle: Handle of the callback.
+        :type handle: int
+
+        :param mode: ASYNC_CALLBACK_BLOCK to make the guest wait (while the oldest events are delivered) when the event queue is full,
+                     or ASYNC_CALLBACK_DROP to drop the events instead.
+        :type mode: int
+
+        :return: True if asynchronous delivery is supported for the callback
+        :rtype: bool
+    """
+    import c_api
+    return c_api.set_callback_async(handle, mode)
+
+
+def get_callback_record_fields(callback_type):
+    """ Returns the names of the fields of the batch records of a callback type.
+
+        :param callback_type: The callback type
+        :type callback_type: int
+
+        :return: The tuple of field names, or None if the callback type does not support batches
+        :rtype: tuple
+    """
+    import c_api
+    return c_api.get_callback_record_fields(callback_type)
+
+
 def set_trigger_uint32(handle, name, val):
     """ Create or update an uint32_t variable that can be read from a trigger.
 
@@ -0,0 +1,307 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#include <Python.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <vector>
+
+extern "C" {
+#include "qemu_glue.h"
+#include "utils.h"
+#include "pyrebox.h"
+}
+#include "callbacks.h"
+#include "callback_events.h"
+#include "async_callbacks.h"
+
+//Maximum number of events delivered each time the worker takes the python mutex
+#define ASYNC_DRAIN_MAX 256
+
+struct async_callback_target {
+    PyObject* function;
+    //One reference for the callback, and one for each queued event
+    std::atomic<unsigned int> references;
+    //Written and read holding the python mutex
+    bool removed;
+};
+
+typedef struct async_callback_event {
+    async_callback_target_t* target;
+    callback_type_t type;
+    uint64_t record[CALLBACK_RECORD_MAX_FIELDS];
+} async_callback_event_t;
+
+//Bounded multiple producer, single consumer queue. Each slot carries a sequence
+//number that tells whether it is free for the producer of a position, or ready
+//for the consumer, so the producers only contend on the tail index and never
+//wait for each other.
+template <typename T, size_t N>
+class BoundedMPSCQueue
+{
+    static_assert((N & (N - 1)) == 0, "The queue size must be a power of 2");
+
+    public:
+        BoundedMPSCQueue() : head(0), tail(0) {
+            for (size_t i = 0; i < N; ++i){
+                this->slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        };
+        //Returns false if the queue is full
+        bool push(const T& value){
+            size_t pos = this->tail.load(std::memory_order_relaxed);
+            for (;;){
+                Slot* slot = &(this->slots[pos & (N - 1)]);
+                intptr_t diff = (intptr_t) slot->sequence.load(std::memory_order_acquire) - (intptr_t) pos;
+                if (diff == 0){
+                    if (this->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                        slot->value = value;
+                        slot->sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0){
+                    return false;
+                } else {
+                    pos = this->tail.load(std::memory_order_relaxed);
+                }
+            }
+        };
+        //Consumer side, returns false if the queue is empty. The consumers must
+        //be serialized by the caller.
+        bool pop(T* value){
+            size_t pos = this->head.load(std::memory_order_relaxed);
+            Slot* slot = &(this->slots[pos & (N - 1)]);
+            if (slot->sequence.load(std::memory_order_acquire) != pos + 1){
+                return false;
+            }
+            *value = slot->value;
+            slot->sequence.store(pos + N, std::memory_order_release);
+            this->head.store(pos + 1, std::memory_order_relaxed);
+            return true;
+        };
+        bool is_empty(){
+            size_t pos = this->head.load(std::memory_order_relaxed);
+            return (this->slots[pos & (N - 1)].sequence.load(std::memory_order_acquire) != pos + 1);
+        };
+
+    private:
+        struct Slot {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+        Slot slots[N];
+        std::atomic<size_t> head;
+        std::atomic<size_t> tail;
+};
+
+typedef BoundedMPSCQueue<async_callback_event_t, ASYNC_QUEUE_SIZE> AsyncCallbackQueue;
+
+static AsyncCallbackQueue* async_queue = 0;
+static pthread_t async_worker;
+static bool async_worker_running = false;
+static std::atomic<bool> async_worker_stop(false);
+//Set while the worker waits for events, so that the producers only signal it when needed
+static std::atomic<bool> async_worker_sleeping(false);
+static pthread_mutex_t async_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_wait_cond = PTHREAD_COND_INITIALIZER;
+//Set while an asynchronous callback runs, in the worker or in a vCPU thread
+static thread_local bool async_delivering = false;
+
+static std::atomic<uint64_t> async_queued(0);
+static std::atomic<uint64_t> async_delivered(0);
+static std::atomic<uint64_t> async_dropped(0);
+static std::atomic<uint64_t> async_blocked(0);
+static std::atomic<uint64_t> async_discarded(0);
+
+static void wake_async_worker(){
+    pthread_mutex_lock(&async_wait_mutex);
+    pthread_cond_signal(&async_wait_cond);
+    pthread_mutex_unlock(&async_wait_mutex);
+}
+
+static void release_target_reference(async_callback_target_t* target){
+    if (target->references.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        delete target;
+    }
+}
+
+//Called holding the python mutex
+static bool deliver_async_event(const async_callback_event_t& event){
+    async_callback_target_t* target = event.target;
+    bool delivered = !target->removed;
+    if (delivered){
+        async_delivering = true;
+        PyObject* params = get_callback_record_dict(event.type, event.record);
+        if (params == 0){
+            PyErr_Print();
+        } else {
+            PyObject* ret = PyObject_CallFunctionObjArgs(target->function, params, NULL);
+            if (ret == 0){
+                PyErr_Print();
+            }
+            Py_XDECREF(ret);
+            Py_DECREF(params);
+        }
+        async_delivering = false;
+    }
+    release_target_reference(target);
+    return delivered;
+}
+
+//Deliver at most max queued events. The queue is only consumed holding the
+//python mutex, so the worker and the vCPU threads never pop at the same time.
+static void drain_async_events(int max){
+    async_callback_event_t event;
+    for (int i = 0; i < max && async_queue->pop(&event); ++i){
+        if (deliver_async_event(event)){
+            async_delivered.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            async_discarded.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+static void wait_for_async_events(){
+    pthread_mutex_lock(&async_wait_mutex);
+    async_worker_sleeping.store(true);
+    //Pairs with the fence in queue_async_callback_event: either the producer
+    //sees the flag, or we see the event
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (async_queue->is_empty() && !async_worker_stop.load()){
+        pthread_cond_wait(&async_wait_cond, &async_wait_mutex);
+    }
+    async_worker_sleeping.store(false);
+    pthread_mutex_unlock(&async_wait_mutex);
+}
+
+static void* async_callback_worker(void* unused){
+    while (!async_worker_stop.load()){
+        wait_for_async_events();
+        //Release the python mutex from time to time, so that the
+        //synchronous callbacks of the vCPU thread are not delayed
+        pthread_mutex_lock(&pyrebox_mutex);
+        drain_async_events(ASYNC_DRAIN_MAX);
+        utils_flush_output();
+        pthread_mutex_unlock(&pyrebox_mutex);
+    }
+    return 0;
+}
+
+extern "C" {
+
+int start_async_callbacks(){
+    if (async_worker_running){
+        return 1;
+    }
+    if (async_queue == 0){
+        async_queue = new AsyncCallbackQueue();
+    }
+    async_worker_stop.store(false);
+    if (pthread_create(&async_worker, 0, async_callback_worker, 0) != 0){
+        utils_print_error("[!] Could not start the asynchronous callback worker\n");
+        return 0;
+    }
+    async_worker_running = true;
+    return 1;
+}
+
+void stop_async_callbacks(){
+    if (!async_worker_running){
+        return;
+    }
+    async_worker_stop.store(true);
+    wake_async_worker();
+    pthread_join(async_worker, 0);
+    async_worker_running = false;
+    //The events still queued are lost
+    async_callback_event_t event;
+    while (async_queue->pop(&event)){
+        release_target_reference(event.target);
+    }
+    delete async_queue;
+    async_queue = 0;
+}
+
+async_callback_target_t* create_async_callback_target(PyObject* function){
+    async_callback_target_t* target = new async_callback_target_t;
+    target->function = function;
+    target->references.store(1);
+    target->removed = false;
+    return target;
+}
+
+void release_async_callback_target(async_callback_target_t* target){
+    //The queued events are discarded by the worker
+    target->removed = true;
+    release_target_reference(target);
+}
+
+void queue_async_callback_event(async_callback_target_t* target, callback_type_t type, int mode, callback_params_t* params){
+    if (async_queue == 0){
+        return;
+    }
+    async_callback_event_t event;
+    event.target = target;
+    event.type = type;
+    encode_callback_record(type, params, event.record);
+    //Called holding the python mutex, so the callback (that holds a reference)
+    //cannot be released meanwhile
+    target->references.fetch_add(1, std::memory_order_relaxed);
+    if (!async_queue->push(event)){
+        bool queued = false;
+        if (mode == ASYNC_CALLBACK_BLOCK){
+            //Back-pressure: the worker cannot drain the queue while this thread holds
+            //the python mutex, so never wait for it. Deliver the oldest events from
+            //this thread instead, which keeps them in order.
+            async_blocked.fetch_add(1, std::memory_order_relaxed);
+            drain_async_events(ASYNC_DRAIN_MAX);
+            queued = async_queue->push(event);
+        }
+        if (!queued){
+            async_dropped.fetch_add(1, std::memory_order_relaxed);
+            release_target_reference(target);
+            return;
+        }
+    }
+    async_queued.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (async_worker_sleeping.load(std::memory_order_relaxed)){
+        wake_async_worker();
+    }
+}
+
+int is_async_callback_worker(){
+    return (async_delivering || (async_worker_running && pthread_equal(pthread_self(), async_worker)));
+}
+
+void get_async_callback_stats(async_callback_stats_t* stats){
+    stats->queued = async_queued.load(std::memory_order_relaxed);
+    stats->delivered = async_delivered.load(std::memory_order_relaxed);
+    stats->dropped = async_dropped.load(std::memory_order_relaxed);
+    stats->blocked = async_blocked.load(std::memory_order_relaxed);
+    stats->discarded = async_discarded.load(std::memory_order_relaxed);
+}
+
+}
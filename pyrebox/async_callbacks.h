@@ -0,0 +1,82 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#ifndef ASYNC_CALLBACKS_H
+#define ASYNC_CALLBACKS_H
+
+//Asynchronous delivery of observe-only python callbacks. The vCPU thread encodes
+//the event as a record (see callback_events.h) and pushes it to a bounded queue,
+//consumed by a worker thread that calls the python functions holding the python
+//mutex. The guest keeps running while the callbacks execute, so they must not
+//modify the guest state, and cannot add or remove callbacks.
+//
+//The events carry the target they must be delivered to, resolved when they are
+//queued, so the worker never looks up the callback tables.
+
+//Behaviour when the queue is full: make room by delivering the oldest events from
+//the vCPU thread (the guest waits meanwhile), or drop the event right away.
+#define ASYNC_CALLBACK_BLOCK 1
+#define ASYNC_CALLBACK_DROP  2
+
+#define ASYNC_QUEUE_SIZE 16384
+
+typedef struct async_callback_stats {
+    //Events pushed to the queue
+    uint64_t queued;
+    //Events delivered to the python functions
+    uint64_t delivered;
+    //Events lost because the queue was full
+    uint64_t dropped;
+    //Events that found the queue full, and made the vCPU thread deliver the oldest ones
+    uint64_t blocked;
+    //Events whose callback was removed before they were delivered
+    uint64_t discarded;
+} async_callback_stats_t;
+
+//Python function of an asynchronous callback, shared by the callback and the
+//events queued for it. It is reference counted, so it outlives the callback
+//while there are events in the queue.
+typedef struct async_callback_target async_callback_target_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif//__cplusplus
+
+//Start the worker thread, if it is not running. Returns 0 on error.
+int start_async_callbacks(void);
+void stop_async_callbacks(void);
+//Both must be called holding the python mutex. The function is borrowed from
+//the callback, that must release the target before releasing its function.
+async_callback_target_t* create_async_callback_target(PyObject* function);
+void release_async_callback_target(async_callback_target_t* target);
+//Called holding the python mutex
+void queue_async_callback_event(async_callback_target_t* target, callback_type_t type, int mode, callback_params_t* params);
+//Returns 1 if called from the worker thread, or from an asynchronous callback
+int is_async_callback_worker(void);
+void get_async_callback_stats(async_callback_stats_t* stats);
+
+#ifdef __cplusplus
+};
+#endif//__cplusplus
+
+#endif //ASYNC_CALLBACKS_H
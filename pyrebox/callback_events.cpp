@@ -0,0 +1,688 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#include <Python.h>
+#include <stddef.h>
+#include <string.h>
+#include <list>
+#include <vector>
+
+extern "C" {
+#include "qemu_glue.h"
+#include "utils.h"
+}
+#include "callbacks.h"
+#include "callback_events.h"
+
+#define CALLBACK_EVENT_MAX_FIELDS CALLBACK_RECORD_MAX_FIELDS
+
+typedef enum callback_event_field_kind {
+    FIELD_INT = 0,
+    FIELD_UINT,
+    FIELD_UINT8,
+    FIELD_UINT16,
+    FIELD_TARGET_ULONG,
+    FIELD_UINT64,
+    FIELD_HADDR,
+    //The following kinds point to data that is only valid during the delivery,
+    //and are kept in the objects array of the event once they are built
+    FIELD_CPU,
+    FIELD_TB,
+    FIELD_STRING,
+    FIELD_BUFFER,
+} callback_event_field_kind_t;
+
+typedef struct callback_event_field {
+    PyObject* name;
+    callback_event_field_kind_t kind;
+    size_t offset;
+    //For FIELD_BUFFER, offset of the uint64_t size of the buffer
+    size_t size_offset;
+} callback_event_field_t;
+
+typedef struct callback_event_layout {
+    int nfields;
+    callback_event_field_t fields[CALLBACK_EVENT_MAX_FIELDS];
+} callback_event_layout_t;
+
+typedef struct CallbackEvent {
+    PyObject_HEAD
+    callback_type_t type;
+    callback_params_t params;
+    PyObject* objects[CALLBACK_EVENT_MAX_FIELDS];
+    //Values assigned by the callbacks, created on the first assignment
+    PyObject* overlay;
+} CallbackEvent;
+
+static callback_event_layout_t callback_event_layouts[LAST_CB];
+//Field names of the batch records of each type, 0 if the type cannot be recorded
+static PyObject* callback_record_fields[LAST_CB];
+//Released events that were not referenced any more, ready to be reused
+static CallbackEvent* callback_event_free[LAST_CB];
+
+static PyObject* callback_event_build_field(CallbackEvent* self, int index){
+    callback_event_field_t* field = &(callback_event_layouts[self->type].fields[index]);
+    char* base = ((char*) &(self->params)) + field->offset;
+    PyObject* value = 0;
+    switch(field->kind){
+        case FIELD_INT:
+            return PyInt_FromLong(*((int*) base));
+        case FIELD_UINT:
+            return Py_BuildValue("I", *((unsigned int*) base));
+        case FIELD_UINT8:
+            return PyInt_FromLong(*((uint8_t*) base));
+        case FIELD_UINT16:
+            return PyInt_FromLong(*((uint16_t*) base));
+        case FIELD_TARGET_ULONG:
+#if TARGET_LONG_SIZE == 4
+            return Py_BuildValue("I", *((pyrebox_target_ulong*) base));
+#elif TARGET_LONG_SIZE == 8
+            return Py_BuildValue("K", *((pyrebox_target_ulong*) base));
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+        case FIELD_UINT64:
+            return Py_BuildValue("K", (unsigned long long) *((uint64_t*) base));
+        case FIELD_HADDR:
+            return Py_BuildValue("K", (unsigned long long) *((uintptr_t*) base));
+        default:
+            break;
+    }
+    if (self->objects[index] == 0){
+        switch(field->kind){
+            case FIELD_CPU:
+                value = get_cpu_state_proxy(*((qemu_cpu_opaque_t*) base));
+                break;
+            case FIELD_TB:
+                value = get_tb(*((qemu_tb_opaque_t*) base));
+                break;
+            case FIELD_STRING:
+                if (*((char**) base) == 0){
+                    Py_INCREF(Py_None);
+                    value = Py_None;
+                } else {
+                    value = PyString_FromString(*((char**) base));
+                }
+                break;
+            case FIELD_BUFFER:
+                value = PyString_FromStringAndSize(*((char**) base),
+                                                   *((uint64_t*) (((char*) &(self->params)) + field->size_offset)));
+                break;
+            default:
+                assert(0);
+                break;
+        }
+        if (value == 0){
+            return 0;
+        }
+        self->objects[index] = value;
+    }
+    Py_INCREF(self->objects[index]);
+    return self->objects[index];
+}
+
+static int callback_event_find_field(CallbackEvent* self, PyObject* key){
+    callback_event_layout_t* layout = &(callback_event_layouts[self->type]);
+    //Keys are usually interned string literals
+    for (int i = 0; i < layout->nfields; ++i){
+        if (layout->fields[i].name == key){
+            return i;
+        }
+    }
+    if (!PyString_Check(key)){
+        return -1;
+    }
+    for (int i = 0; i < layout->nfields; ++i){
+        if (strcmp(PyString_AS_STRING(layout->fields[i].name), PyString_AS_STRING(key)) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+//Returns a new reference to the value of key, the assigned one if any. Returns 0
+//without an exception set if the key does not exist.
+static PyObject* callback_event_lookup(CallbackEvent* self, PyObject* key){
+    if (self->overlay != 0){
+        PyObject* value = PyDict_GetItem(self->overlay, key);
+        if (value != 0){
+            Py_INCREF(value);
+            return value;
+        }
+    }
+    int index = callback_event_find_field(self, key);
+    if (index < 0){
+        return 0;
+    }
+    return callback_event_build_field(self, index);
+}
+
+static PyObject* callback_event_copy(PyObject* self, PyObject* unused);
+
+static PyObject* callback_event_subscript(PyObject* self, PyObject* key){
+    PyObject* value = callback_event_lookup((CallbackEvent*) self, key);
+    if (value == 0 && !PyErr_Occurred()){
+        PyErr_SetObject(PyExc_KeyError, key);
+    }
+    return value;
+}
+
+//Assignments are kept in the overlay, the parameters of the event are not modified
+static int callback_event_ass_subscript(PyObject* self, PyObject* key, PyObject* value){
+    CallbackEvent* event = (CallbackEvent*) self;
+    if (value == 0){
+        if (event->overlay != 0 && PyDict_GetItem(event->overlay, key) != 0){
+            return PyDict_DelItem(event->overlay, key);
+        }
+        if (callback_event_find_field(event, key) >= 0){
+            PyErr_SetString(PyExc_TypeError, "The parameters of a callback cannot be deleted");
+        } else {
+            PyErr_SetObject(PyExc_KeyError, key);
+        }
+        return -1;
+    }
+    if (event->overlay == 0){
+        event->overlay = PyDict_New();
+        if (event->overlay == 0){
+            return -1;
+        }
+    }
+    return PyDict_SetItem(event->overlay, key, value);
+}
+
+static Py_ssize_t callback_event_length(PyObject* self){
+    CallbackEvent* event = (CallbackEvent*) self;
+    Py_ssize_t length = callback_event_layouts[event->type].nfields;
+    if (event->overlay != 0){
+        PyObject* key;
+        PyObject* value;
+        Py_ssize_t pos = 0;
+        while (PyDict_Next(event->overlay, &pos, &key, &value)){
+            if (callback_event_find_field(event, key) < 0){
+                length++;
+            }
+        }
+    }
+    return length;
+}
+
+static int callback_event_contains(PyObject* self, PyObject* key){
+    CallbackEvent* event = (CallbackEvent*) self;
+    if (event->overlay != 0 && PyDict_GetItem(event->overlay, key) != 0){
+        return 1;
+    }
+    return callback_event_find_field(event, key) >= 0;
+}
+
+static PyObject* callback_event_getattro(PyObject* self, PyObject* name){
+    PyObject* value = callback_event_lookup((CallbackEvent*) self, name);
+    if (value != 0 || PyErr_Occurred()){
+        return value;
+    }
+    return PyObject_GenericGetAttr(self, name);
+}
+
+static int callback_event_setattro(PyObject* self, PyObject* name, PyObject* value){
+    return callback_event_ass_subscript(self, name, value);
+}
+
+//With assigned values, the list methods are built from a copy of the event
+static PyObject* callback_event_overlay_list(PyObject* self, PyObject* (*list)(PyObject*)){
+    PyObject* dict = callback_event_copy(self, 0);
+    if (dict == 0){
+        return 0;
+    }
+    PyObject* result = list(dict);
+    Py_DECREF(dict);
+    return result;
+}
+
+static PyObject* callback_event_keys(PyObject* self, PyObject* unused){
+    if (((CallbackEvent*) self)->overlay != 0){
+        return callback_event_overlay_list(self, PyDict_Keys);
+    }
+    callback_event_layout_t* layout = &(callback_event_layouts[((CallbackEvent*) self)->type]);
+    PyObject* keys = PyList_New(layout->nfields);
+    if (keys == 0){
+        return 0;
+    }
+    for (int i = 0; i < layout->nfields; ++i){
+        Py_INCREF(layout->fields[i].name);
+        PyList_SET_ITEM(keys, i, layout->fields[i].name);
+    }
+    return keys;
+}
+
+static PyObject* callback_event_values(PyObject* self, PyObject* unused){
+    if (((CallbackEvent*) self)->overlay != 0){
+        return callback_event_overlay_list(self, PyDict_Values);
+    }
+    int nfields = callback_event_layouts[((CallbackEvent*) self)->type].nfields;
+    PyObject* values = PyList_New(nfields);
+    if (values == 0){
+        return 0;
+    }
+    for (int i = 0; i < nfields; ++i){
+        PyObject* value = callback_event_build_field((CallbackEvent*) self, i);
+        if (value == 0){
+            Py_DECREF(values);
+            return 0;
+        }
+        PyList_SET_ITEM(values, i, value);
+    }
+    return values;
+}
+
+static PyObject* callback_event_items(PyObject* self, PyObject* unused){
+    if (((CallbackEvent*) self)->overlay != 0){
+        return callback_event_overlay_list(self, PyDict_Items);
+    }
+    callback_event_layout_t* layout = &(callback_event_layouts[((CallbackEvent*) self)->type]);
+    PyObject* items = PyList_New(layout->nfields);
+    if (items == 0){
+        return 0;
+    }
+    for (int i = 0; i < layout->nfields; ++i){
+        PyObject* value = callback_event_build_field((CallbackEvent*) self, i);
+        PyObject* item = (value == 0) ? 0 : PyTuple_Pack(2, layout->fields[i].name, value);
+        Py_XDECREF(value);
+        if (item == 0){
+            Py_DECREF(items);
+            return 0;
+        }
+        PyList_SET_ITEM(items, i, item);
+    }
+    return items;
+}
+
+static PyObject* callback_event_copy(PyObject* self, PyObject* unused){
+    callback_event_layout_t* layout = &(callback_event_layouts[((CallbackEvent*) self)->type]);
+    PyObject* dict = PyDict_New();
+    if (dict == 0){
+        return 0;
+    }
+    for (int i = 0; i < layout->nfields; ++i){
+        PyObject* value = callback_event_build_field((CallbackEvent*) self, i);
+        if (value == 0 || PyDict_SetItem(dict, layout->fields[i].name, value) != 0){
+            Py_XDECREF(value);
+            Py_DECREF(dict);
+            return 0;
+        }
+        Py_DECREF(value);
+    }
+    if (((CallbackEvent*) self)->overlay != 0 && PyDict_Update(dict, ((CallbackEvent*) self)->overlay) != 0){
+        Py_DECREF(dict);
+        return 0;
+    }
+    return dict;
+}
+
+static PyObject* callback_event_get(PyObject* self, PyObject* args){
+    PyObject* key;
+    PyObject* default_value = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O", &key, &default_value)){
+        return 0;
+    }
+    PyObject* value = callback_event_lookup((CallbackEvent*) self, key);
+    if (value == 0 && !PyErr_Occurred()){
+        Py_INCREF(default_value);
+        return default_value;
+    }
+    return value;
+}
+
+static PyObject* callback_event_has_key(PyObject* self, PyObject* key){
+    return PyBool_FromLong(callback_event_contains(self, key));
+}
+
+static PyObject* callback_event_iter(PyObject* self){
+    PyObject* keys = callback_event_keys(self, 0);
+    if (keys == 0){
+        return 0;
+    }
+    PyObject* iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iter;
+}
+
+static PyObject* callback_event_repr(PyObject* self){
+    PyObject* dict = callback_event_copy(self, 0);
+    if (dict == 0){
+        return 0;
+    }
+    PyObject* result = PyObject_Repr(dict);
+    Py_DECREF(dict);
+    return result;
+}
+
+static void callback_event_dealloc(PyObject* self){
+    for (int i = 0; i < CALLBACK_EVENT_MAX_FIELDS; ++i){
+        Py_XDECREF(((CallbackEvent*) self)->objects[i]);
+    }
+    Py_XDECREF(((CallbackEvent*) self)->overlay);
+    PyObject_Del(self);
+}
+
+static PyMappingMethods callback_event_as_mapping = {
+    callback_event_length,      //mp_length
+    callback_event_subscript,   //mp_subscript
+    callback_event_ass_subscript, //mp_ass_subscript
+};
+
+static PySequenceMethods callback_event_as_sequence = {
+    0, 0, 0, 0, 0, 0, 0,        //sq_length ... sq_ass_slice
+    callback_event_contains,    //sq_contains
+    0, 0,                       //sq_inplace_concat, sq_inplace_repeat
+};
+
+static PyMethodDef callback_event_methods[] = {
+    {"keys", callback_event_keys, METH_NOARGS, "Returns the list of parameter names"},
+    {"values", callback_event_values, METH_NOARGS, "Returns the list of parameter values"},
+    {"items", callback_event_items, METH_NOARGS, "Returns the list of (name, value) pairs"},
+    {"copy", callback_event_copy, METH_NOARGS, "Returns a dictionary with the parameters"},
+    {"get", callback_event_get, METH_VARARGS, "Returns a parameter, or a default value if it does not exist"},
+    {"has_key", callback_event_has_key, METH_O, "Returns True if the parameter exists"},
+    {NULL}
+};
+
+static PyTypeObject callback_event_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "c_api.CallbackEvent",              //tp_name
+    sizeof(CallbackEvent),              //tp_basicsize
+};
+
+static void add_field(callback_type_t type, const char* name, callback_event_field_kind_t kind,
+                      size_t offset, size_t size_offset = 0){
+    callback_event_layout_t* layout = &(callback_event_layouts[type]);
+    assert(layout->nfields < CALLBACK_EVENT_MAX_FIELDS);
+    callback_event_field_t* field = &(layout->fields[layout->nfields++]);
+    field->name = PyString_InternFromString(name);
+    field->kind = kind;
+    field->offset = offset;
+    field->size_offset = size_offset;
+}
+
+#define PARAM_OFFSET(member) offsetof(callback_params_t, member)
+
+extern "C" {
+
+int init_callback_event_type(PyObject* module){
+    callback_event_type.tp_dealloc = callback_event_dealloc;
+    callback_event_type.tp_repr = callback_event_repr;
+    callback_event_type.tp_as_sequence = &callback_event_as_sequence;
+    callback_event_type.tp_as_mapping = &callback_event_as_mapping;
+    callback_event_type.tp_getattro = callback_event_getattro;
+    callback_event_type.tp_setattro = callback_event_setattro;
+    callback_event_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    callback_event_type.tp_doc = "Parameters of a callback. Supports both params[\"name\"] and params.name, and assignments";
+    callback_event_type.tp_iter = callback_event_iter;
+    callback_event_type.tp_methods = callback_event_methods;
+    if (PyType_Ready(&callback_event_type) < 0){
+        return 1;
+    }
+    Py_INCREF(&callback_event_type);
+    PyModule_AddObject(module, "CallbackEvent", (PyObject*) &callback_event_type);
+
+    //Same names as the keyword arguments used before for each callback type
+    callback_type_t block_begin_types[] = {OP_BLOCK_BEGIN_CB, BLOCK_BEGIN_CB};
+    for (int i = 0; i < 2; ++i){
+        add_field(block_begin_types[i], "cpu_index", FIELD_INT, PARAM_OFFSET(block_begin_params.cpu_index));
+        add_field(block_begin_types[i], "cpu", FIELD_CPU, PARAM_OFFSET(block_begin_params.cpu));
+        add_field(block_begin_types[i], "tb", FIELD_TB, PARAM_OFFSET(block_begin_params.tb));
+    }
+    add_field(BLOCK_END_CB, "cpu_index", FIELD_INT, PARAM_OFFSET(block_end_params.cpu_index));
+    add_field(BLOCK_END_CB, "cpu", FIELD_CPU, PARAM_OFFSET(block_end_params.cpu));
+    add_field(BLOCK_END_CB, "tb", FIELD_TB, PARAM_OFFSET(block_end_params.tb));
+    add_field(BLOCK_END_CB, "cur_pc", FIELD_TARGET_ULONG, PARAM_OFFSET(block_end_params.cur_pc));
+    add_field(BLOCK_END_CB, "next_pc", FIELD_TARGET_ULONG, PARAM_OFFSET(block_end_params.next_pc));
+    callback_type_t insn_begin_types[] = {OP_INSN_BEGIN_CB, INSN_BEGIN_CB};
+    for (int i = 0; i < 2; ++i){
+        add_field(insn_begin_types[i], "cpu_index", FIELD_INT, PARAM_OFFSET(insn_begin_params.cpu_index));
+        add_field(insn_begin_types[i], "cpu", FIELD_CPU, PARAM_OFFSET(insn_begin_params.cpu));
+    }
+    add_field(INSN_END_CB, "cpu_index", FIELD_INT, PARAM_OFFSET(insn_end_params.cpu_index));
+    add_field(INSN_END_CB, "cpu", FIELD_CPU, PARAM_OFFSET(insn_end_params.cpu));
+    add_field(MEM_READ_CB, "cpu_index", FIELD_INT, PARAM_OFFSET(mem_read_params.cpu_index));
+    add_field(MEM_READ_CB, "vaddr", FIELD_TARGET_ULONG, PARAM_OFFSET(mem_read_params.vaddr));
+    add_field(MEM_READ_CB, "size", FIELD_TARGET_ULONG, PARAM_OFFSET(mem_read_params.size));
+    add_field(MEM_READ_CB, "haddr", FIELD_HADDR, PARAM_OFFSET(mem_read_params.haddr));
+    add_field(MEM_WRITE_CB, "cpu_index", FIELD_INT, PARAM_OFFSET(mem_write_params.cpu_index));
+    add_field(MEM_WRITE_CB, "vaddr", FIELD_TARGET_ULONG, PARAM_OFFSET(mem_write_params.vaddr));
+    add_field(MEM_WRITE_CB, "size", FIELD_TARGET_ULONG, PARAM_OFFSET(mem_write_params.size));
+    add_field(MEM_WRITE_CB, "haddr", FIELD_HADDR, PARAM_OFFSET(mem_write_params.haddr));
+    add_field(MEM_WRITE_CB, "data", FIELD_TARGET_ULONG, PARAM_OFFSET(mem_write_params.data));
+    add_field(KEYSTROKE_CB, "keycode", FIELD_UINT, PARAM_OFFSET(keystroke_params.keycode));
+    add_field(NIC_REC_CB, "buf", FIELD_BUFFER, PARAM_OFFSET(nic_rec_params.buf), PARAM_OFFSET(nic_rec_params.size));
+    add_field(NIC_REC_CB, "size", FIELD_UINT64, PARAM_OFFSET(nic_rec_params.size));
+    add_field(NIC_REC_CB, "cur_pos", FIELD_UINT64, PARAM_OFFSET(nic_rec_params.cur_pos));
+    add_field(NIC_REC_CB, "start", FIELD_UINT64, PARAM_OFFSET(nic_rec_params.start));
+    add_field(NIC_REC_CB, "stop", FIELD_UINT64, PARAM_OFFSET(nic_rec_params.stop));
+    add_field(NIC_SEND_CB, "addr", FIELD_UINT64, PARAM_OFFSET(nic_send_params.address));
+    add_field(NIC_SEND_CB, "size", FIELD_UINT64, PARAM_OFFSET(nic_send_params.size));
+    add_field(NIC_SEND_CB, "buf", FIELD_BUFFER, PARAM_OFFSET(nic_send_params.buf), PARAM_OFFSET(nic_send_params.size));
+    add_field(OPCODE_RANGE_CB, "cpu_index", FIELD_INT, PARAM_OFFSET(opcode_range_params.cpu_index));
+    add_field(OPCODE_RANGE_CB, "cpu", FIELD_CPU, PARAM_OFFSET(opcode_range_params.cpu));
+    add_field(OPCODE_RANGE_CB, "cur_pc", FIELD_TARGET_ULONG, PARAM_OFFSET(opcode_range_params.cur_pc));
+    add_field(OPCODE_RANGE_CB, "next_pc", FIELD_TARGET_ULONG, PARAM_OFFSET(opcode_range_params.next_pc));
+    add_field(OPCODE_RANGE_CB, "insn_size", FIELD_TARGET_ULONG, PARAM_OFFSET(opcode_range_params.insn_size));
+    add_field(OPCODE_RANGE_CB, "opcode", FIELD_UINT16, PARAM_OFFSET(opcode_range_params.opcode));
+    add_field(OPCODE_RANGE_CB, "prefix_len", FIELD_UINT8, PARAM_OFFSET(opcode_range_params.prefix_len));
+    add_field(OPCODE_RANGE_CB, "modrm_reg", FIELD_UINT8, PARAM_OFFSET(opcode_range_params.modrm_reg));
+    add_field(OPCODE_RANGE_CB, "insn_class", FIELD_UINT8, PARAM_OFFSET(opcode_range_params.insn_class));
+    add_field(TLB_EXEC_CB, "cpu", FIELD_CPU, PARAM_OFFSET(tlb_exec_params.cpu));
+    add_field(TLB_EXEC_CB, "vaddr", FIELD_TARGET_ULONG, PARAM_OFFSET(tlb_exec_params.vaddr));
+    add_field(CREATEPROC_CB, "pid", FIELD_TARGET_ULONG, PARAM_OFFSET(vmi_create_proc_params.pid));
+    add_field(CREATEPROC_CB, "pgd", FIELD_TARGET_ULONG, PARAM_OFFSET(vmi_create_proc_params.pgd));
+    add_field(CREATEPROC_CB, "name", FIELD_STRING, PARAM_OFFSET(vmi_create_proc_params.name));
+    add_field(REMOVEPROC_CB, "pid", FIELD_TARGET_ULONG, PARAM_OFFSET(vmi_remove_proc_params.pid));
+    add_field(REMOVEPROC_CB, "pgd", FIELD_TARGET_ULONG, PARAM_OFFSET(vmi_remove_proc_params.pgd));
+    add_field(REMOVEPROC_CB, "name", FIELD_STRING, PARAM_OFFSET(vmi_remove_proc_params.name));
+    add_field(CONTEXTCHANGE_CB, "cpu_index", FIELD_INT, PARAM_OFFSET(vmi_context_change_params.cpu_index));
+    add_field(CONTEXTCHANGE_CB, "old_pgd", FIELD_TARGET_ULONG, PARAM_OFFSET(vmi_context_change_params.old_pgd));
+    add_field(CONTEXTCHANGE_CB, "new_pgd", FIELD_TARGET_ULONG, PARAM_OFFSET(vmi_context_change_params.new_pgd));
+    add_field(BRANCH_CB, "cpu_index", FIELD_INT, PARAM_OFFSET(branch_params.cpu_index));
+    add_field(BRANCH_CB, "cpu", FIELD_CPU, PARAM_OFFSET(branch_params.cpu));
+    add_field(BRANCH_CB, "source", FIELD_TARGET_ULONG, PARAM_OFFSET(branch_params.source));
+    add_field(BRANCH_CB, "target", FIELD_TARGET_ULONG, PARAM_OFFSET(branch_params.target));
+    add_field(BRANCH_CB, "return_addr", FIELD_TARGET_ULONG, PARAM_OFFSET(branch_params.return_addr));
+    add_field(BRANCH_CB, "kind", FIELD_UINT, PARAM_OFFSET(branch_params.kind));
+
+    for (int type = 0; type < LAST_CB; ++type){
+        callback_event_layout_t* layout = &(callback_event_layouts[type]);
+        if (layout->nfields == 0){
+            continue;
+        }
+        PyObject* names = PyTuple_New(layout->nfields);
+        if (names == 0){
+            return 1;
+        }
+        for (int i = 0; i < layout->nfields; ++i){
+            PyObject* name = layout->fields[i].name;
+            if (layout->fields[i].kind == FIELD_CPU){
+                name = PyString_InternFromString("pc");
+            } else if (layout->fields[i].kind == FIELD_TB){
+                name = PyString_InternFromString("tb_pc");
+            } else if (layout->fields[i].kind == FIELD_STRING || layout->fields[i].kind == FIELD_BUFFER){
+                Py_DECREF(names);
+                names = 0;
+                break;
+            } else {
+                Py_INCREF(name);
+            }
+            PyTuple_SET_ITEM(names, i, name);
+        }
+        callback_record_fields[type] = names;
+    }
+    return 0;
+}
+
+int get_callback_record_size(callback_type_t type){
+    if (type >= LAST_CB || callback_record_fields[type] == 0){
+        return 0;
+    }
+    return callback_event_layouts[type].nfields;
+}
+
+void encode_callback_record(callback_type_t type, callback_params_t* params, uint64_t* record){
+    callback_event_layout_t* layout = &(callback_event_layouts[type]);
+    for (int i = 0; i < layout->nfields; ++i){
+        char* base = ((char*) params) + layout->fields[i].offset;
+        switch(layout->fields[i].kind){
+            case FIELD_INT:
+                record[i] = (uint64_t) *((int*) base);
+                break;
+            case FIELD_UINT:
+                record[i] = *((unsigned int*) base);
+                break;
+            case FIELD_UINT8:
+                record[i] = *((uint8_t*) base);
+                break;
+            case FIELD_UINT16:
+                record[i] = *((uint16_t*) base);
+                break;
+            case FIELD_TARGET_ULONG:
+                record[i] = *((pyrebox_target_ulong*) base);
+                break;
+            case FIELD_UINT64:
+                record[i] = *((uint64_t*) base);
+                break;
+            case FIELD_HADDR:
+                record[i] = *((uintptr_t*) base);
+                break;
+            case FIELD_CPU:
+                record[i] = get_cpu_addr(*((qemu_cpu_opaque_t*) base));
+                break;
+            case FIELD_TB:
+                record[i] = get_tb_addr(*((qemu_tb_opaque_t*) base));
+                break;
+            default:
+                assert(0);
+                break;
+        }
+    }
+}
+
+PyObject* get_callback_record_dict(callback_type_t type, const uint64_t* record){
+    PyObject* names = callback_record_fields[type];
+    PyObject* dict = PyDict_New();
+    if (dict == 0){
+        return 0;
+    }
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(names); ++i){
+        PyObject* value = Py_BuildValue("K", (unsigned long long) record[i]);
+        if (value == 0 || PyDict_SetItem(dict, PyTuple_GET_ITEM(names, i), value) != 0){
+            Py_XDECREF(value);
+            Py_DECREF(dict);
+            return 0;
+        }
+        Py_DECREF(value);
+    }
+    return dict;
+}
+
+PyObject* get_callback_record_fields(callback_type_t type){
+    if (type >= LAST_CB || callback_record_fields[type] == 0){
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    Py_INCREF(callback_record_fields[type]);
+    return callback_record_fields[type];
+}
+
+PyObject* get_callback_event(callback_type_t type, callback_params_t* params){
+    assert(type < LAST_CB && callback_event_layouts[type].nfields > 0);
+    CallbackEvent* event = callback_event_free[type];
+    if (event != 0){
+        callback_event_free[type] = 0;
+    } else {
+        event = PyObject_New(CallbackEvent, &callback_event_type);
+        if (event == 0){
+            return 0;
+        }
+        memset(event->objects, 0, sizeof(event->objects));
+        event->overlay = 0;
+        event->type = type;
+    }
+    event->params = *params;
+    return (PyObject*) event;
+}
+
+PyObject* next_callback_event(PyObject* py_event){
+    CallbackEvent* event = (CallbackEvent*) py_event;
+    if (Py_REFCNT(py_event) > 1){
+        //Kept by the previous callback: it is detached, and the next one gets its own
+        callback_type_t type = event->type;
+        callback_params_t params = event->params;
+        release_callback_event(py_event);
+        return get_callback_event(type, &params);
+    }
+    Py_CLEAR(event->overlay);
+    return py_event;
+}
+
+void release_callback_event(PyObject* py_event){
+    if (py_event == 0){
+        return;
+    }
+    CallbackEvent* event = (CallbackEvent*) py_event;
+    callback_event_layout_t* layout = &(callback_event_layouts[event->type]);
+    if (Py_REFCNT(py_event) > 1){
+        //Still referenced (e.g., stored by a callback). Build the values that point to
+        //data that is only valid during the delivery, and keep the CPU state as it is now.
+        for (int i = 0; i < layout->nfields; ++i){
+            if (layout->fields[i].kind < FIELD_CPU){
+                continue;
+            }
+            PyObject* value = callback_event_build_field(event, i);
+            if (value == 0){
+                PyErr_Print();
+                continue;
+            }
+            if (layout->fields[i].kind == FIELD_CPU){
+                //Holds two references (value and objects[i]), so it is frozen
+                release_cpu_state_proxy(value);
+            } else {
+                Py_DECREF(value);
+            }
+        }
+        Py_DECREF(py_event);
+        return;
+    }
+    for (int i = 0; i < layout->nfields; ++i){
+        PyObject* value = event->objects[i];
+        event->objects[i] = 0;
+        if (layout->fields[i].kind == FIELD_CPU){
+            release_cpu_state_proxy(value);
+        } else {
+            Py_XDECREF(value);
+        }
+    }
+    Py_CLEAR(event->overlay);
+    if (callback_event_free[event->type] == 0){
+        callback_event_free[event->type] = event;
+    } else {
+        Py_DECREF(py_event);
+    }
+}
+
+}
@@ -0,0 +1,68 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#ifndef CALLBACK_EVENTS_H
+#define CALLBACK_EVENTS_H
+
+//Parameter objects passed to the python callbacks. Instead of a dictionary per
+//event, the callbacks receive a c_api.CallbackEvent object that keeps a copy of
+//the callback_params_t and boxes each value when it is accessed. It supports the
+//mapping interface (params["vaddr"], keys(), items(), in...) and attribute access
+//(params.vaddr). Values assigned by a callback are kept in a dictionary created on
+//the first assignment, and hide the parameters with the same name. The event objects
+//are reused between deliveries of the same callback type, unless a callback kept a
+//reference to them.
+
+#ifdef __cplusplus
+extern "C" {
+#endif//__cplusplus
+
+//Returns the event object for a delivery. It must be released with
+//release_callback_event (instead of decrefed) once the callbacks have returned.
+PyObject* get_callback_event(callback_type_t type, callback_params_t* params);
+void release_callback_event(PyObject* event);
+//Returns the event for the next callback of the same delivery, so that each one
+//receives the parameters as they were delivered: the values assigned by the
+//previous callback are dropped, and if it kept a reference to the event, that
+//one is detached and a new one is returned (0 on error).
+PyObject* next_callback_event(PyObject* event);
+int init_callback_event_type(PyObject* module);
+
+#define CALLBACK_RECORD_MAX_FIELDS 9
+
+//Records of the callbacks delivered in batches: one uint64_t per parameter, in the
+//same order as the event fields. The cpu is recorded as its pc and the tb as its
+//start address (fields "pc" and "tb_pc"). The types whose parameters point to
+//strings or buffers cannot be recorded, and get_callback_record_size returns 0.
+int get_callback_record_size(callback_type_t type);
+void encode_callback_record(callback_type_t type, callback_params_t* params, uint64_t* record);
+//Returns a new reference to the tuple of field names of the records of a type
+PyObject* get_callback_record_fields(callback_type_t type);
+//Returns a new dictionary with the values of a record, for the asynchronous callbacks
+PyObject* get_callback_record_dict(callback_type_t type, const uint64_t* record);
+
+#ifdef __cplusplus
+};
+#endif//__cplusplus
+
+#endif //CALLBACK_EVENTS_H
@@ -0,0 +1,178 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox
+   Author: Xabier Ugarte-Pedrero
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+
+-------------------------------------------------------------------------------*/
+
+#ifndef CALLBACK_TABLE_H
+#define CALLBACK_TABLE_H
+
+//C++ only header. Containers used by the CallbackManager to index
+//callbacks so that lookups on the hot paths (translation time and
+//callback delivery) never allocate memory.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <utility>
+
+//64 bit finalizer (murmur3 fmix64). Spreads the bits of guest addresses,
+//that are usually aligned and share their upper bits.
+static inline uint64_t callback_table_mix(uint64_t x){
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+//Open addressing hash table with linear probing and tombstones.
+//The capacity is always a power of 2, and the table is grown
+//when the load (including tombstones) exceeds 1/2.
+//
+//find() never allocates. Pointers returned by find() or insert()
+//are invalidated by any subsequent insert() or erase().
+template <typename K, typename V, typename H, typename E>
+class OpenAddressingTable
+{
+    public:
+        OpenAddressingTable() : slots(), used(0), tombstones(0) {};
+
+        V* find(const K& key) {
+            size_t i = this->find_index(key);
+            if (i == NOT_FOUND){
+                return 0;
+            }
+            return &(this->slots[i].value);
+        };
+
+        //Returns the value associated to key, inserting a default
+        //constructed one if the key was not present.
+        V& insert(const K& key) {
+            V* existing = this->find(key);
+            if (existing != 0){
+                return *existing;
+            }
+            if ((this->used + this->tombstones + 1) * 2 > this->slots.size()){
+                this->rehash(this->used + 1);
+            }
+            size_t mask = this->slots.size() - 1;
+            size_t i = ((size_t)this->hasher(key)) & mask;
+            while (this->slots[i].state == SLOT_USED){
+                i = (i + 1) & mask;
+            }
+            if (this->slots[i].state == SLOT_TOMBSTONE){
+                this->tombstones--;
+            }
+            this->slots[i].state = SLOT_USED;
+            this->slots[i].key = key;
+            this->slots[i].value = V();
+            this->used++;
+            return this->slots[i].value;
+        };
+
+        bool erase(const K& key) {
+            size_t i = this->find_index(key);
+            if (i == NOT_FOUND){
+                return false;
+            }
+            this->slots[i].state = SLOT_TOMBSTONE;
+            this->slots[i].value = V();
+            this->used--;
+            this->tombstones++;
+            return true;
+        };
+
+        void clear() {
+            this->slots.clear();
+            this->used = 0;
+            this->tombstones = 0;
+        };
+
+        size_t size() const { return this->used; };
+
+        //Iterate over every (key, value) pair. The table must
+        //not be modified from within f.
+        template <typename F>
+        void for_each(F f) {
+            for (size_t i = 0; i < this->slots.size(); ++i){
+                if (this->slots[i].state == SLOT_USED){
+                    f(this->slots[i].key, this->slots[i].value);
+                }
+            }
+        };
+
+    private:
+        enum { SLOT_EMPTY = 0, SLOT_USED, SLOT_TOMBSTONE };
+        struct Slot {
+            int state;
+            K key;
+            V value;
+            Slot() : state(SLOT_EMPTY), key(), value() {};
+        };
+
+        static const size_t NOT_FOUND = (size_t)-1;
+
+        size_t find_index(const K& key) {
+            if (this->used == 0){
+                return NOT_FOUND;
+            }
+            size_t mask = this->slots.size() - 1;
+            size_t i = ((size_t)this->hasher(key)) & mask;
+            while (this->slots[i].state != SLOT_EMPTY){
+                if (this->slots[i].state == SLOT_USED && this->equals(this->slots[i].key, key)){
+                    return i;
+                }
+                i = (i + 1) & mask;
+            }
+            return NOT_FOUND;
+        };
+
+        void rehash(size_t min_elements) {
+            size_t new_capacity = 16;
+            while (new_capacity < min_elements * 4){
+                new_capacity <<= 1;
+            }
+            std::vector<Slot> old_slots(new_capacity);
+            old_slots.swap(this->slots);
+            size_t mask = new_capacity - 1;
+            for (size_t j = 0; j < old_slots.size(); ++j){
+                if (old_slots[j].state == SLOT_USED){
+                    size_t i = ((size_t)this->hasher(old_slots[j].key)) & mask;
+                    while (this->slots[i].state == SLOT_USED){
+                        i = (i + 1) & mask;
+                    }
+                    this->slots[i].state = SLOT_USED;
+                    this->slots[i].key = old_slots[j].key;
+                    std::swap(this->slots[i].value, old_slots[j].value);
+                }
+            }
+            this->tombstones = 0;
+        };
+
+        std::vector<Slot> slots;
+        size_t used;
+        size_t tombstones;
+        H hasher;
+        E equals;
+};
+
+#endif //CALLBACK_TABLE_H
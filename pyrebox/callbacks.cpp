@@ -22,8 +22,11 @@
 -------------------------------------------------------------------------------*/
 
 #include <Python.h>
+#include <inttypes.h>
 #include <list>
 #include <set>
+#include <vector>
+#include <algorithm>
 #include <dlfcn.h>
 #include <pthread.h>
 
@@ -32,10 +35,14 @@ extern "C" {
 #include "pyrebox.h"
 #include "utils.h"
 #include "qemu_glue_callbacks_flush.h"
-#include "pyrebox.h"
+#include "qemu_glue_callbacks_prefilter.h"
+#include "qemu_glue_callbacks_watch.h"
 }
 #include "process_mgr.h"
 #include "callbacks.h"
+#include "native_plugins.h"
+#include "callback_events.h"
+#include "async_callbacks.h"
 #include "vmi.h"
 
 using namespace std;
@@ -45,30 +52,49 @@ extern "C" {
 //Handle counter. Starts at 1. 0 is the invalid handle
 callback_handle_t callback_handle_counter = 1;
 
-//Array of internal callbacks
-internal_callbacks_t internal_callbacks[MAX_INTERNAL_CALLBACKS];
-internal_callback_handle_t current_internal_callback_handle = 0;
-
 //CallbackManager class initialization 
 
 //Reference to callback manager
 CallbackManager* cb_manager = 0;
 
+//Values of trigger variables released meanwhile (see retire_trigger_var)
+static vector<void*> retired_trigger_vars;
+static pthread_mutex_t retired_trigger_vars_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void retire_trigger_var(void* val){
+    if (val == 0){
+        return;
+    }
+    pthread_mutex_lock(&retired_trigger_vars_mutex);
+    retired_trigger_vars.push_back(val);
+    pthread_mutex_unlock(&retired_trigger_vars_mutex);
+}
+
+static void free_retired_trigger_vars(void){
+    vector<void*> retired;
+    pthread_mutex_lock(&retired_trigger_vars_mutex);
+    retired.swap(retired_trigger_vars);
+    pthread_mutex_unlock(&retired_trigger_vars_mutex);
+    for (vector<void*>::iterator it = retired.begin(); it != retired.end(); ++it){
+        free(*it);
+    }
+}
+
 void InitCallbacks(){
     cb_manager = new CallbackManager();
-    for (int i = 0; i < MAX_INTERNAL_CALLBACKS; ++i){
-        internal_callbacks[i] = {.pgd = 0,
-                                 .pc = 0,
-                                 .callback_function = 0};
-    }
 }
 
 void FinalizeCallbacks(){
+    //The worker may still be delivering events
+    stop_async_callbacks();
+    //Native plugins may still hold callbacks
+    unload_all_native_plugins();
     if (cb_manager != 0)
     {
         delete cb_manager;
         cb_manager = 0;
     }
+    free_retired_trigger_vars();
 }
 
 //----------------------------------------------------------------------------------------------
@@ -123,6 +149,75 @@ void commit_deferred_callback_removes(){
     }
     return;
 }
+void remove_module_callbacks(module_handle_t module_handle){
+    if (cb_manager != 0) {
+        cb_manager->remove_module_callbacks(module_handle);
+    }
+    return;
+}
+void remove_module_callbacks_deferred(module_handle_t module_handle){
+    if (cb_manager != 0) {
+        cb_manager->remove_module_callbacks_deferred(module_handle);
+    }
+    return;
+}
+void begin_callback_update(){
+    if (cb_manager != 0) {
+        cb_manager->begin_update();
+    }
+    return;
+}
+void commit_callback_update(){
+    if (cb_manager != 0) {
+        cb_manager->commit_update();
+    }
+    return;
+}
+int is_callback_delivery_in_progress(){
+    if (cb_manager != 0) {
+        return cb_manager->is_delivering() ? 1 : 0;
+    }
+    return 0;
+}
+
+int set_callback_prefilter(callback_handle_t handle, prefilter_conditions_t conditions){
+    if (cb_manager != 0) {
+        return cb_manager->set_prefilter(handle, conditions);
+    }
+    return 0;
+}
+void update_callback_prefilters(){
+    if (cb_manager != 0) {
+        cb_manager->update_prefilters();
+    }
+    return;
+}
+int set_callback_batch(callback_handle_t handle, unsigned int size){
+    if (cb_manager != 0) {
+        return cb_manager->set_batch(handle, size);
+    }
+    return 0;
+}
+
+void flush_callback_batches(){
+    if (cb_manager != 0) {
+        cb_manager->flush_batches();
+    }
+}
+
+int set_callback_async(callback_handle_t handle, int mode){
+    if (cb_manager != 0) {
+        return cb_manager->set_async(handle, mode);
+    }
+    return 0;
+}
+
+int is_prefilter_applicable(callback_type_t callback_type, pyrebox_target_ulong address){
+    if (cb_manager != 0) {
+        return cb_manager->is_prefilter_applicable(callback_type, address);
+    }
+    return 0;
+}
 
 callback_handle_t add_callback_at(callback_type_t type, module_handle_t module_handle, PyObject* callback_function, pyrebox_target_ulong address, pyrebox_target_ulong pgd){
     if (cb_manager != 0) {
@@ -141,19 +236,96 @@ callback_handle_t add_callback(callback_type_t type, module_handle_t module_hand
     }
 }
 
+callback_handle_t add_watch_callback(callback_type_t type, module_handle_t module_handle, PyObject* callback_function, memory_watch_t watch){
+    if (cb_manager != 0) {
+        return cb_manager->add_watch_callback(type,module_handle,callback_function,0,0,watch);
+    }
+    else{
+        return 0;
+    }
+}
+
+void dispatch_records_flushed(void){
+    if (cb_manager != 0) {
+        cb_manager->reset_dispatch_records();
+    }
+}
+
+int get_page_watch_flags(uint64_t vaddr_page, uint64_t ram_page){
+    if (cb_manager != 0) {
+        return cb_manager->get_page_watch_flags((pyrebox_target_ulong) vaddr_page, (pyrebox_target_ulong) ram_page);
+    }
+    return 0;
+}
+
+//Native plugin whose code is running (initialization or callback delivery)
+static module_handle_t native_module_context = 0;
+
+module_handle_t set_native_module_context(module_handle_t module_handle){
+    module_handle_t previous = native_module_context;
+    native_module_context = module_handle;
+    return previous;
+}
+
+callback_handle_t add_native_callback(callback_type_t type, native_callback_t callback_function, void* user_data){
+    if (cb_manager != 0) {
+        return cb_manager->add_native_callback(type,native_module_context,callback_function,user_data,0,0);
+    }
+    else{
+        return 0;
+    }
+}
+
+callback_handle_t add_native_callback_at(callback_type_t type, native_callback_t callback_function, void* user_data, pyrebox_target_ulong address, pyrebox_target_ulong pgd){
+    if (cb_manager == 0) {
+        return 0;
+    }
+    //Same conventions as register_callback in the python API
+    if (type == BLOCK_BEGIN_CB){
+        type = OP_BLOCK_BEGIN_CB;
+    } else if (type == INSN_BEGIN_CB){
+        type = OP_INSN_BEGIN_CB;
+    } else if (type == OPCODE_RANGE_CB){
+        address = normalize_opcode(address);
+        pgd = normalize_opcode(pgd);
+    }
+    return cb_manager->add_native_callback(type,native_module_context,callback_function,user_data,address,pgd);
+}
+
+callback_handle_t add_native_watch_callback(callback_type_t type, native_callback_t callback_function, void* user_data, memory_watch_t watch){
+    if (cb_manager != 0) {
+        return cb_manager->add_watch_callback(type,native_module_context,0,callback_function,user_data,watch);
+    }
+    else{
+        return 0;
+    }
+}
+
+pyrebox_target_ulong normalize_opcode(pyrebox_target_ulong opcode){
+    //Translate extended opcodes to what QEMU understands in the translation switch (see target/i386/translate.c
+    //: "reswitch")
+    if ((opcode & 0xFF00) == 0x0F00){
+        return 0x0100 | (0x00FF & opcode);
+    }
+    return opcode & 0xFFFF;
+}
+
 //----------------------------------------------------------------------------------
 // Internal callback management functions
 //----------------------------------------------------------------------------------
 
 internal_callback_handle_t add_internal_callback(pyrebox_target_ulong pgd, pyrebox_target_ulong pc, callback_t callback_function){
-    //We already reached the maximum number of internal callbacks
-    if (current_internal_callback_handle < MAX_INTERNAL_CALLBACKS){
-        internal_callbacks[current_internal_callback_handle++] = {.pgd = pgd,
-                                                                .pc = pc,
-                                                                .callback_function = callback_function};
-        return (current_internal_callback_handle-1);
+    if (cb_manager != 0 && callback_function != 0) {
+        return cb_manager->add_internal_callback(pgd, pc, callback_function);
+    }
+    utils_print_error("[!] Could not add internal callback at %" PRIx64 "\n", (uint64_t) pc);
+    return INV_INTERNAL_CALLBACK;
+}
+
+void remove_internal_callback(internal_callback_handle_t callback_handle){
+    if (cb_manager != 0) {
+        cb_manager->remove_internal_callback(callback_handle);
     }
-    return (internal_callback_handle_t) -1;
 }
 
 //----------------------------------------------------------------------------------
@@ -239,6 +411,14 @@ void opcode_range_callback(callback_params_t params)
    }
 }
 
+void branch_callback(callback_params_t params)
+{
+   if (cb_manager != 0)
+   {
+    cb_manager->deliver_callback(BRANCH_CB,params);
+   }
+}
+
 void tlb_exec_callback(callback_params_t params)
 {
    qemu_cpu_opaque_t cpu_opaque = params.tlb_exec_params.cpu;
@@ -281,6 +461,13 @@ void context_change_callback(callback_params_t params)
     //Deliver callback
     if (cb_manager != 0)
     {
+        //The records of the batched callbacks do not span context changes
+        if (cb_manager->has_batches()){
+            pthread_mutex_lock(&pyrebox_mutex);
+            cb_manager->flush_batches();
+            cb_manager->commit_deferred_callback_removes();
+            pthread_mutex_unlock(&pyrebox_mutex);
+        }
         cb_manager->deliver_callback(CONTEXTCHANGE_CB, params);
     }
 }
@@ -291,6 +478,10 @@ int is_callback_needed(callback_type_t callback_type, pyrebox_target_ulong addre
     return (cb_manager->is_callback_needed(callback_type,address));
 }
 
+int get_dispatch_record(callback_type_t callback_type, pyrebox_target_ulong address){
+    return (cb_manager->get_dispatch_record(callback_type,address));
+}
+
 }; // extern "C" 
 
 
@@ -299,37 +490,19 @@ callback_handle_t CallbackManager::add_callback(callback_type_t type, module_han
 }
 
 void CallbackManager::set_trigger_var(callback_handle_t callback_handle,const char* var,void*val){
-    multiset<Callback*,CompareCallbackP>::iterator it;
-    int i;
-    int found = 0;
-    for (i = 0; found == 0 && i<LAST_CB;i++)
-    {
-        for (it = this->callbacks[i].begin();it!=this->callbacks[i].end();++it)
-        {
-            if ((*it)->get_handle() == callback_handle)
-            {
-                found = 1;
-                break;
-            }
-        }
-        if (found == 1){
-            //Break to avoid incrementing i
-            break;
-        }
-    }
-    if (found == 0)
+    Callback* cb = this->find_callback(callback_handle);
+    if (cb == 0)
     {
         utils_print_error("[!] Could not set trigger var on unregistered callback handle %x\n",callback_handle);
         return;
     }
-    //iterator points to the callback.
     //We first fetch the set_var method from the plugin.
-    if ((*it)->get_dll_handle() == 0)
+    if (cb->get_dll_handle() == 0)
     {
         utils_print_error("[!] Cannot update variable on unloaded trigger\n");
         return;
     }
-    set_var_t func = (set_var_t)dlsym((*it)->get_dll_handle(),"set_var");
+    set_var_t func = (set_var_t)dlsym(cb->get_dll_handle(),"set_var");
     if (func == 0)
     {
         utils_print_error("[!] Could not fetch set_var function from plugin\n");
@@ -339,37 +512,19 @@ void CallbackManager::set_trigger_var(callback_handle_t callback_handle,const ch
     func(callback_handle,var,val);
 }
 void* CallbackManager::get_trigger_var(callback_handle_t callback_handle,const char* var){
-    multiset<Callback*,CompareCallbackP>::iterator it;
-    int i;
-    int found = 0;
-    for (i = 0; found == 0 && i<LAST_CB;i++)
-    {
-        for (it = this->callbacks[i].begin();it!=this->callbacks[i].end();++it)
-        {
-            if ((*it)->get_handle() == callback_handle)
-            {
-                found = 1;
-                break;
-            }
-        }
-        if (found == 1){
-            //Break to avoid incrementing i
-            break;
-        }
-    }
-    if (found == 0)
+    Callback* cb = this->find_callback(callback_handle);
+    if (cb == 0)
     {
         utils_print_error("[!] Could not get trigger on unregistered callback handle %x\n",callback_handle);
         return 0;
     }
-    //iterator points to the callback.
     //We first fetch the set_var method from the plugin.
-    if ((*it)->get_dll_handle() == 0)
+    if (cb->get_dll_handle() == 0)
     {
         utils_print_error("[!] Cannot update variable on unloaded trigger\n");
         return 0;
     }
-    get_var_t func = (get_var_t)dlsym((*it)->get_dll_handle(),"get_var");
+    get_var_t func = (get_var_t)dlsym(cb->get_dll_handle(),"get_var");
     if (func == 0)
     {
         utils_print_error("[!] Could not fetch get_var function from plugin\n");
@@ -380,37 +535,19 @@ void* CallbackManager::get_trigger_var(callback_handle_t callback_handle,const c
 }
 
 void* CallbackManager::call_trigger_function(callback_handle_t callback_handle, const char* function_name){
-    multiset<Callback*,CompareCallbackP>::iterator it;
-    int i;
-    int found = 0;
-    for (i = 0; found == 0 && i<LAST_CB;i++)
-    {
-        for (it = this->callbacks[i].begin();it!=this->callbacks[i].end();++it)
-        {
-            if ((*it)->get_handle() == callback_handle)
-            {
-                found = 1;
-                break;
-            }
-        }
-        if (found == 1){
-            //Break to avoid incrementing i
-            break;
-        }
-    }
-    if (found == 0)
+    Callback* cb = this->find_callback(callback_handle);
+    if (cb == 0)
     {
         utils_print_error("[!] Could not get trigger on unregistered callback handle %x\n",callback_handle);
         return 0;
     }
-    //iterator points to the callback.
     //We first fetch the set_var method from the plugin.
-    if ((*it)->get_dll_handle() == 0)
+    if (cb->get_dll_handle() == 0)
     {
         utils_print_error("[!] Cannot call function on unloaded trigger\n");
         return 0;
     }
-    call_function_t func = (call_function_t)dlsym((*it)->get_dll_handle(),"call_function");
+    call_function_t func = (call_function_t)dlsym(cb->get_dll_handle(),"call_function");
     if (func == 0)
     {
         utils_print_error("[!] Could not fetch call_function function from plugin\n");
@@ -422,33 +559,15 @@ void* CallbackManager::call_trigger_function(callback_handle_t callback_handle,
 
 void CallbackManager::add_trigger(callback_handle_t callback_handle,char* trigger_path){
     //Locate callback entry
-    multiset<Callback*,CompareCallbackP>::iterator it;
-    int i;
-    int found = 0;
-    for (i = 0; found == 0 && i<LAST_CB;i++)
-    {
-        for (it = this->callbacks[i].begin();it!=this->callbacks[i].end();++it)
-        {
-            if ((*it)->get_handle() == callback_handle)
-            {
-                found = 1;
-                break;
-            }
-        }
-        if (found == 1){
-            //Break to avoid incrementing i
-            break;
-        }
-    }
-    if (found == 0)
+    Callback* cb = this->find_callback(callback_handle);
+    if (cb == 0)
     {
         utils_print_error("[!] Could not set trigger on unregistered callback handle %x\n",callback_handle);
         return;
     }
-    //iterator (it) points to the callback structure
-    if((*it)->get_trigger() != (trigger_t)0)
+    if(cb->has_trigger())
     {
-        utils_print_debug("[!] Removing existing trigger %llx on callback...\n",(*it)->get_trigger());
+        utils_print_debug("[!] Removing existing trigger on callback...\n");
         this->remove_trigger(callback_handle);
     }
     //Load dll
@@ -460,73 +579,86 @@ void CallbackManager::add_trigger(callback_handle_t callback_handle,char* trigge
         return;
     }
     trigger_get_type_t get_func_type = (trigger_get_type_t) dlsym(dll_handle,"get_type");
-    if (get_func_type != 0 && get_func_type() == i)
+    if (get_func_type != 0 && get_func_type() == (int)cb->get_callback_type())
     {
+        //ABI v2 triggers receive their variables, resolved at load time
+        void* func_v2 = dlsym(dll_handle,"trigger_v2");
+        if (func_v2)
+        {
+            trigger_get_var_names_t get_var_names = (trigger_get_var_names_t) dlsym(dll_handle,"get_var_names");
+            create_trigger_context_t create_context = (create_trigger_context_t) dlsym(dll_handle,"create_trigger_context");
+            if (!create_context)
+            {
+                utils_print_error("[!] Could not find function create_trigger_context in %s\n",trigger_path);
+                dlclose(dll_handle);
+                return;
+            }
+            trigger_context_t* context = create_context(callback_handle, (get_var_names != 0) ? get_var_names() : 0);
+            //Update trigger
+            cb->set_dll_handle(dll_handle);
+            cb->set_trigger_v2((trigger_v2_t)func_v2, context);
+            this->mark_prefilter_dirty(cb->get_callback_type());
+            this->refresh_prefilters();
+            return;
+        }
         //Load symbol
         void* func = dlsym(dll_handle,"trigger");
         if (!func)
         {
             utils_print_error("[!] Could not find function trigger in %s\n",trigger_path);
+            dlclose(dll_handle);
             return;
         }
         //Update trigger
-        (*it)->set_trigger((trigger_t)func);
-        (*it)->set_dll_handle(dll_handle);
+        cb->set_trigger((trigger_t)func);
+        cb->set_dll_handle(dll_handle);
+        this->mark_prefilter_dirty(cb->get_callback_type());
+        this->refresh_prefilters();
     }
     else{
         utils_print_error("[!] The trigger cannot be used for this callback type %s\n",trigger_path);
+        dlclose(dll_handle);
     }
 }
 void CallbackManager::remove_trigger(callback_handle_t callback_handle){
     //Locate callback entry
-    multiset<Callback*,CompareCallbackP>::iterator it;
-    int i;
-    int found = 0;
-    for (i = 0; found == 0 && i<LAST_CB;i++)
-    {
-        for (it = this->callbacks[i].begin();it!=this->callbacks[i].end();++it)
-        {
-            if ((*it)->get_handle() == callback_handle)
-            {
-                found = 1;
-                break;
-            }
-        }
-        if (found == 1){
-            //Break to avoid incrementing i
-            break;
-        }
-    }
-    if (found == 0)
+    Callback* cb = this->find_callback(callback_handle);
+    if (cb == 0)
     {
         utils_print_error("[!] Could not set trigger on unregistered callback handle %x\n",callback_handle);
         return;
     }
-    //iterator (it) points to the callback structure
-    if((*it)->get_trigger() == (trigger_t)0 || (*it)->get_dll_handle() == (void*)0)
+    this->unload_trigger(cb);
+}
+
+void CallbackManager::unload_trigger(Callback* cb){
+    if(!cb->has_trigger() || cb->get_dll_handle() == (void*)0)
     {
         utils_print_error("[!] Cannot remove non existent trigger\n");
         return;
     }
     //Load symbol
-    trigger_clean_t clean = (trigger_clean_t)dlsym((*it)->get_dll_handle(),"clean");
+    trigger_clean_t clean = (trigger_clean_t)dlsym(cb->get_dll_handle(),"clean");
     if (!clean)
     {
         utils_print_error("[!] Could not find function clean\n");
         return;
     }
     //First, remove reference to trigger
-    (*it)->set_trigger((trigger_t)0);
+    cb->set_trigger((trigger_t)0);
+    cb->set_trigger_v2((trigger_v2_t)0, (trigger_context_t*)0);
+    this->mark_prefilter_dirty(cb->get_callback_type());
+    this->refresh_prefilters();
     //Second, call the clean function
-    clean((*it)->get_handle());
+    clean(cb->get_handle());
     //Third, unload dll
-    if(dlclose((*it)->get_dll_handle()))
+    if(dlclose(cb->get_dll_handle()))
     {
         utils_print_error("[!] Error while decrementing reference count for library\n");
         return;
     }
     utils_print_debug("[*] Successfully removed trigger\n");
-    (*it)->set_dll_handle(0);
+    cb->set_dll_handle(0);
 }
 
 callback_handle_t CallbackManager::add_callback(callback_type_t type, module_handle_t module_handle, PyObject* callback_function, pyrebox_target_ulong address, pyrebox_target_ulong pgd) {
@@ -535,14 +667,52 @@ callback_handle_t CallbackManager::add_callback(callback_type_t type, module_han
         return 0;
     }
     //Now, create the callback and insert it
+    Callback* cb = this->create_callback(type, address, pgd);
+    cb->set_callback_function(callback_function);
+    Py_XINCREF(callback_function);
+    return this->register_callback(cb, type, module_handle);
+}
+
+callback_handle_t CallbackManager::add_native_callback(callback_type_t type, module_handle_t module_handle, native_callback_t callback_function, void* user_data, pyrebox_target_ulong address, pyrebox_target_ulong pgd) {
+    if (callback_function == 0 || type >= LAST_CB){
+        return 0;
+    }
+    Callback* cb = this->create_callback(type, address, pgd);
+    cb->set_native_function(callback_function);
+    cb->set_user_data(user_data);
+    return this->register_callback(cb, type, module_handle);
+}
+
+callback_handle_t CallbackManager::add_watch_callback(callback_type_t type, module_handle_t module_handle, PyObject* callback_function, native_callback_t native_function, void* user_data, memory_watch_t watch) {
+    if (type != MEM_READ_CB && type != MEM_WRITE_CB){
+        utils_print_error("[!] Memory watches are only supported for memory read / write callbacks\n");
+        return 0;
+    }
+    if (watch.end <= watch.start){
+        utils_print_error("[!] Empty memory watch range\n");
+        return 0;
+    }
+    if (native_function == 0 && !PyCallable_Check(callback_function)){
+        return 0;
+    }
+    WatchCallback* cb = new WatchCallback();
+    cb->set_watch(watch);
+    if (native_function != 0){
+        cb->set_native_function(native_function);
+        cb->set_user_data(user_data);
+    } else {
+        cb->set_callback_function(callback_function);
+        Py_XINCREF(callback_function);
+    }
+    return this->register_callback(cb, type, module_handle);
+}
+
+//Allocate the callback object for a given type
+Callback* CallbackManager::create_callback(callback_type_t type, pyrebox_target_ulong address, pyrebox_target_ulong pgd){
     Callback* cb;
     switch(type)
     {
         case OP_BLOCK_BEGIN_CB:
-            //Unless we are isntrumenting all block begins, flush TB 
-            if (callbacks[BLOCK_BEGIN_CB].size() == 0){
-                pyrebox_flush_tb();
-            }
             cb = (Callback*) new OptimizedBlockBeginCallback();
             memory_address_t addr_block;
             addr_block.address = address;
@@ -550,10 +720,6 @@ callback_handle_t CallbackManager::add_callback(callback_type_t type, module_han
             ((OptimizedBlockBeginCallback*)cb)->set_target_address(addr_block);
             break;
         case OP_INSN_BEGIN_CB:
-            //Unless we are isntrumenting all insn begins, flush TB 
-            if (callbacks[INSN_BEGIN_CB].size() == 0){
-                pyrebox_flush_tb();
-            }
             cb = (Callback*) new OptimizedInsBeginCallback(); 
             memory_address_t addr;
             addr.address = address;
@@ -561,486 +727,1081 @@ callback_handle_t CallbackManager::add_callback(callback_type_t type, module_han
             ((OptimizedInsBeginCallback*)cb)->set_target_address(addr);
             break;
         case OPCODE_RANGE_CB:
-            //Always flush tb when new opcode range callback is inserted
-            pyrebox_flush_tb();
             cb = (Callback*) new OptimizedOpcodeRangeCallback();
             opcode_range_t opcode_range;
             opcode_range.start_opcode = address & 0xFFFF;
             opcode_range.end_opcode = pgd & 0xFFFF;
             ((OptimizedOpcodeRangeCallback*)cb)->set_opcode_range(opcode_range);
             break;
+        case BRANCH_CB:
+            //The address carries the mask of branch kinds, 0 for all of them
+            cb = (Callback*) new BranchCallback();
+            if ((address & BRANCH_KIND_ALL) != 0){
+                ((BranchCallback*)cb)->set_branch_kinds(address & BRANCH_KIND_ALL);
+            }
+            break;
         case BLOCK_BEGIN_CB:
         case BLOCK_END_CB:
         case INSN_BEGIN_CB:
         case INSN_END_CB:
         case MEM_READ_CB:
         case MEM_WRITE_CB:
-            //Flush TB unless there were already callbacks for that type
-            if (callbacks[type].size() == 0){
-                pyrebox_flush_tb();
-            }
             cb = new Callback();
             break;
         default:
             cb = new Callback();
             break;
     }
+    return cb;
+}
 
+//Assign a handle to a new callback, and insert it in the callback tables
+callback_handle_t CallbackManager::register_callback(Callback* cb, callback_type_t type, module_handle_t module_handle){
     cb->set_trigger((trigger_t)0);
     cb->set_dll_handle(0);
 
     cb->set_callback_type(type);
     cb->set_module_handle(module_handle);
-    cb->set_callback_function(callback_function);
     cb->set_handle(callback_handle_counter++);
 
-    //Insert callback in list
-    Py_XINCREF(callback_function);
-
-    callbacks[type].insert(cb);
+    this->callbacks_by_handle.insert(cb->get_handle()) = cb;
+    //Insert callback in its table, unless we are in the middle of an update
+    if (this->update_depth > 0){
+        this->pending_adds.push_back(cb);
+    } else {
+        this->attach_callback(cb);
+        this->refresh_prefilters();
+    }
     //Return callback.
     return cb->get_handle();
 }
 
 void CallbackManager::deliver_callback(callback_type_t type, callback_params_t params){
-
     if (type == OP_INSN_BEGIN_CB || type == INSN_BEGIN_CB){
         memory_address_t addr;
         addr.address = get_cpu_addr(params.insn_begin_params.cpu);
         addr.pgd = get_pgd(params.insn_begin_params.cpu);
         //Deliver inmediately the internal callbacks 
-        for (int i = 0; i < MAX_INTERNAL_CALLBACKS && internal_callbacks[i].callback_function != 0; ++i){
-            if (internal_callbacks[i].pc == addr.address && (internal_callbacks[i].pgd == 0 || internal_callbacks[i].pgd == addr.pgd)){
-                internal_callbacks[i].callback_function(params);
-            }
-        }
+        this->internal_callbacks.deliver(addr.address, addr.pgd, params);
     }
-    //Lock the python mutex
+    //The callback tables, the triggers and the callbacks themselves are changed by
+    //the python code and by the native callbacks of every vCPU, so the filtering
+    //phase runs with the python mutex held too. The output is only flushed if a
+    //python callback runs.
     pthread_mutex_lock(&pyrebox_mutex);
-    fflush(stdout);
-    fflush(stderr);
-
-    //For each type of callback, trigger the python callback with its corresponding arguments 
-    list<Callback*> callbacks_needed;
-
+    this->delivery_depth++;
+    //First phase: native filtering. Triggers and the monitored process checks
+    //decide which callbacks must run. Deliveries do not nest (the mutex is held
+    //until they finish), so a single scratch list per thread is enough.
+    static thread_local vector<Callback*> callbacks_needed;
+    callbacks_needed.clear();
     //For delivering callbacks, we must do it as efficiently as possible.
     //We have 4 cases: Optimized insn begin, optimized block begin, opcode ranges, and regular callbacks (all get called)
     //Optimized and general versions are joined together
     if (type == OP_BLOCK_BEGIN_CB || type == BLOCK_BEGIN_CB){
-  
         pyrebox_target_ulong pgd = get_pgd(params.block_begin_params.cpu);
-
+        pyrebox_target_ulong pc = get_tb_addr(params.block_begin_params.tb);
         // Check if process is monitored if there is no trigger
-        for (multiset<Callback*,CompareCallbackP>::iterator it = this->callbacks[BLOCK_BEGIN_CB].begin(); it != this->callbacks[BLOCK_BEGIN_CB].end(); ++it){
-            if (((*it)->get_trigger() == 0 && is_monitored_process(pgd)) || ((*it)->get_trigger() != 0 && (*it)->get_trigger()((*it)->get_handle(),params))){
-                callbacks_needed.push_back((*it));
+        for (CallbackList::iterator it = this->callbacks[BLOCK_BEGIN_CB].begin(); it != this->callbacks[BLOCK_BEGIN_CB].end(); ++it){
+            if (!(*it)->matches_prefilter(pgd, pc, params.block_begin_params.cpu)){
+                continue;
             }
-        }
-
-        //Search only blocks starting at that address
-        OptimizedBlockBeginCallback *cb = new OptimizedBlockBeginCallback();
-        memory_address_t addr;
-        addr.address = get_tb_addr(params.block_begin_params.tb);
-        addr.pgd = pgd; 
-        cb->set_target_address(addr);
-        multiset<Callback*,CompareCallbackP>::iterator it = this->callbacks[OP_BLOCK_BEGIN_CB].lower_bound((Callback*)cb);
-        delete cb;
-        while (it != this->callbacks[OP_BLOCK_BEGIN_CB].end() && addr.address == ((OptimizedBlockBeginCallback*)(*it))->get_target_address().address && addr.pgd == ((OptimizedBlockBeginCallback*)(*it))->get_target_address().pgd){
-            if ((*it)->get_trigger() == 0 || (*it)->get_trigger()((*it)->get_handle(),params)){
+            if ((!(*it)->has_trigger() && is_monitored_process(pgd)) || ((*it)->has_trigger() && (*it)->call_trigger(params))){
                 callbacks_needed.push_back((*it));
             }
-            ++it;
         }
+        //Search only blocks starting at that address
+        this->collect_address_callbacks(callbacks_needed, OP_BLOCK_BEGIN_CB, params.block_begin_params.dispatch_record, pc, pgd, params);
     }
     //Optimized and general versions are joined together
     else if (type == OP_INSN_BEGIN_CB || type == INSN_BEGIN_CB){
-
         memory_address_t addr;
         addr.address = get_cpu_addr(params.insn_begin_params.cpu);
         addr.pgd = get_pgd(params.insn_begin_params.cpu);
-
-
         // Defer the python callbacks
         // Check if process is monitored if there is no trigger
-        for (multiset<Callback*,CompareCallbackP>::iterator it = this->callbacks[INSN_BEGIN_CB].begin(); it != this->callbacks[INSN_BEGIN_CB].end(); ++it){
-            if (((*it)->get_trigger() == 0 && is_monitored_process(addr.pgd)) || ((*it)->get_trigger() != 0 && (*it)->get_trigger()((*it)->get_handle(),params))){
-                callbacks_needed.push_back((*it));
+        for (CallbackList::iterator it = this->callbacks[INSN_BEGIN_CB].begin(); it != this->callbacks[INSN_BEGIN_CB].end(); ++it){
+            if (!(*it)->matches_prefilter(addr.pgd, addr.address, params.insn_begin_params.cpu)){
+                continue;
             }
-        }
-
-        OptimizedInsBeginCallback *cb = new OptimizedInsBeginCallback();
-        cb->set_target_address(addr);
-        multiset<Callback*,CompareCallbackP>::iterator it = this->callbacks[OP_INSN_BEGIN_CB].lower_bound((Callback*)cb);
-        delete cb;
-
-        while (it != this->callbacks[OP_INSN_BEGIN_CB].end() && addr.address == ((OptimizedInsBeginCallback*)(*it))->get_target_address().address && addr.pgd == ((OptimizedInsBeginCallback*)(*it))->get_target_address().pgd){
-            if ((*it)->get_trigger() == 0 || (*it)->get_trigger()((*it)->get_handle(),params)){
+            if ((!(*it)->has_trigger() && is_monitored_process(addr.pgd)) || ((*it)->has_trigger() && (*it)->call_trigger(params))){
                 callbacks_needed.push_back((*it));
             }
-            ++it;
         }
+        this->collect_address_callbacks(callbacks_needed, OP_INSN_BEGIN_CB, params.insn_begin_params.dispatch_record, addr.address, addr.pgd, params);
     }
     else if (type == OPCODE_RANGE_CB){
         uint16_t opcode = params.opcode_range_params.opcode;
         pyrebox_target_ulong pgd = get_pgd(params.opcode_range_params.cpu);
-        OptimizedOpcodeRangeCallback *cb = new OptimizedOpcodeRangeCallback();
-        opcode_range_t opcoderange;
-        opcoderange.start_opcode = opcode;
-        opcoderange.end_opcode = opcode;
-        cb->set_opcode_range(opcoderange);
-        //With this, we can get the overlapping opcode_range blocks
-        multiset<Callback*,CompareCallbackP>::iterator it = this->callbacks[type].lower_bound((Callback*)cb);
-        delete cb;
-        while (it != this->callbacks[type].end()) {
-            if (((OptimizedOpcodeRangeCallback*)(*it))->get_opcode_range().start_opcode <= opcode){
-                if (((*it)->get_trigger() == 0 && is_monitored_process(pgd)) || ((*it)->get_trigger() != 0 && (*it)->get_trigger()((*it)->get_handle(),params))){
+        //Get the opcode_range callbacks that cover the opcode
+        std::shared_ptr<OpcodeRangeIndex> ranges = this->get_opcode_ranges();
+        vector<Callback*>* cbs = ranges ? ranges->find(opcode) : 0;
+        if (cbs != 0){
+            for (vector<Callback*>::iterator it = cbs->begin(); it != cbs->end(); ++it){
+                if ((!(*it)->has_trigger() && is_monitored_process(pgd)) || ((*it)->has_trigger() && (*it)->call_trigger(params))){
                     callbacks_needed.push_back((*it));
                 }
             }
-            ++it;
+        }
+    }
+    else if (type == BRANCH_CB){
+        pyrebox_target_ulong pgd = get_pgd(params.branch_params.cpu);
+        for (CallbackList::iterator it = this->callbacks[BRANCH_CB].begin(); it != this->callbacks[BRANCH_CB].end(); ++it){
+            if (!((BranchCallback*)(*it))->accepts(params.branch_params.kind)){
+                continue;
+            }
+            if ((!(*it)->has_trigger() && is_monitored_process(pgd)) || ((*it)->has_trigger() && (*it)->call_trigger(params))){
+                callbacks_needed.push_back((*it));
+            }
         }
     }
     else if (type == BLOCK_END_CB || type == INSN_END_CB || type == MEM_READ_CB || type == MEM_WRITE_CB){
-        // Get the PGD        
+        // Get the PGD, and the address the prefilters apply to
         pyrebox_target_ulong pgd = 0;
+        pyrebox_target_ulong address = 0;
+        qemu_cpu_opaque_t cpu = 0;
         if (type == BLOCK_END_CB){
-            pgd = get_pgd(params.block_end_params.cpu);
+            cpu = params.block_end_params.cpu;
+            address = params.block_end_params.cur_pc;
         } else if (type == INSN_END_CB) {
-            pgd = get_pgd(params.insn_end_params.cpu);
+            cpu = params.insn_end_params.cpu;
         } else if (type == MEM_READ_CB){
-            pgd = get_pgd(params.mem_read_params.cpu);
+            cpu = params.mem_read_params.cpu;
+            address = params.mem_read_params.vaddr;
         } else if (type == MEM_WRITE_CB){
-            pgd = get_pgd(params.mem_write_params.cpu);
+            cpu = params.mem_write_params.cpu;
+            address = params.mem_write_params.vaddr;
         }
+        pgd = get_pgd(cpu);
         // Check if the process in monitored or not, only if there is no trigger
-        for (multiset<Callback*,CompareCallbackP>::iterator it = this->callbacks[type].begin(); it != this->callbacks[type].end(); ++it){
-            if (((*it)->get_trigger() == 0 && is_monitored_process(pgd)) || ((*it)->get_trigger() != 0 && (*it)->get_trigger()((*it)->get_handle(),params))){
+        for (CallbackList::iterator it = this->callbacks[type].begin(); it != this->callbacks[type].end(); ++it){
+            //Wide memory watches, not restricted to the monitored processes
+            if ((*it)->is_watch()){
+                if (this->watch_applies((WatchCallback*)(*it), type, pgd, cpu, params)){
+                    callbacks_needed.push_back((*it));
+                }
+                continue;
+            }
+            if (!(*it)->matches_prefilter(pgd, address, cpu)){
+                continue;
+            }
+            if ((!(*it)->has_trigger() && is_monitored_process(pgd)) || ((*it)->has_trigger() && (*it)->call_trigger(params))){
                 callbacks_needed.push_back((*it));
             }
         }
+        if (type == MEM_READ_CB || type == MEM_WRITE_CB){
+            this->collect_watch_callbacks(callbacks_needed, type, pgd, cpu, params);
+        }
     }
     else {
         // The rest of the cases don't need the process to be monitored (VMI & system wide callbacks)
         // Check if the process in monitored or not
         //Here, just check the triggers. 
-        for (multiset<Callback*,CompareCallbackP>::iterator it = this->callbacks[type].begin(); it != this->callbacks[type].end(); ++it){
-            if ((*it)->get_trigger() == 0 || (*it)->get_trigger()((*it)->get_handle(),params)){
+        for (CallbackList::iterator it = this->callbacks[type].begin(); it != this->callbacks[type].end(); ++it){
+            if (!(*it)->has_trigger() || (*it)->call_trigger(params)){
                 callbacks_needed.push_back((*it));
             }
         }
     }
-
-    if (callbacks_needed.size() == 0)
+    //Native callbacks are delivered right away. The python ones are kept
+    //in callbacks_needed, in the same order.
+    //Batched python callbacks just append a record, and are only called
+    //when their batch is full. The asynchronous ones are queued for the worker.
+    size_t python_callbacks = 0;
+    bool full_batches = false;
+    for (size_t i = 0; i < callbacks_needed.size(); ++i){
+        Callback* cb = callbacks_needed[i];
+        if (cb->get_native_function() != 0){
+            module_handle_t previous_module = set_native_module_context(cb->get_module_handle());
+            cb->get_native_function()(cb->get_handle(), params, cb->get_user_data());
+            set_native_module_context(previous_module);
+        } else if (cb->get_async_mode() != 0){
+            queue_async_callback_event(cb->get_async_target(), cb->get_callback_type(), cb->get_async_mode(), &params);
+        } else if (cb->get_batch() != 0){
+            uint64_t* record = cb->get_batch()->next_record();
+            if (record == 0){
+                //Full batches are flushed before the delivery that filled them
+                //finishes, but never write past the end of the records
+                this->flush_batch(cb);
+                record = cb->get_batch()->next_record();
+            }
+            encode_callback_record(cb->get_callback_type(), &params, record);
+            full_batches |= cb->get_batch()->is_full();
+        } else {
+            callbacks_needed[python_callbacks++] = cb;
+        }
+    }
+    if (python_callbacks < callbacks_needed.size()){
+        callbacks_needed.resize(python_callbacks);
+        //Removals requested by the native callbacks. Otherwise, they are
+        //committed after the python callbacks.
+        if (python_callbacks == 0 && !full_batches && !this->callback_remove_list.empty()){
+            this->commit_deferred_callback_removes();
+        }
+    }
+    if (callbacks_needed.size() == 0 && !full_batches)
     {
-        //Unlock the python mutex
-        fflush(stdout);
-        fflush(stderr);
+        //Apply the update committed by the native callbacks, if any
+        this->end_delivery();
+        this->close_unloaded_modules();
         pthread_mutex_unlock(&pyrebox_mutex);
         return; 
     }
+    //Second phase: python callbacks
+    utils_flush_output();
 
-
-    //We pass the arguments as keyword arguments, so arg should be an empty tuple
-    PyObject* arg = Py_BuildValue("()");
-    PyObject* kwarg = 0; 
-    switch(type)
-    {
-       case OP_BLOCK_BEGIN_CB:
-            kwarg =  Py_BuildValue("{s:i,s:N,s:N}", "cpu_index",
-                                                  params.block_begin_params.cpu_index,
-                                                  "cpu", 
-                                                  get_cpu_state(params.block_begin_params.cpu),
-                                                  "tb",
-                                                  get_tb(params.block_begin_params.tb));
-            break;
-       case OP_INSN_BEGIN_CB:
-            kwarg =  Py_BuildValue("{s:i,s:N}", "cpu_index",
-                                              params.insn_begin_params.cpu_index,
-                                              "cpu",
-                                              get_cpu_state(params.insn_begin_params.cpu));
-            break;
-       case BLOCK_BEGIN_CB:
-            kwarg =  Py_BuildValue("{s:i,s:N,s:N}", "cpu_index",
-                                                  params.block_begin_params.cpu_index,
-                                                  "cpu", 
-                                                  get_cpu_state(params.block_begin_params.cpu),
-                                                  "tb",
-                                                  get_tb(params.block_begin_params.tb));
-            break;
-       case BLOCK_END_CB:
-#if TARGET_LONG_SIZE == 4
-            kwarg =  Py_BuildValue("{s:i,s:N,s:N,s:I,s:I}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s:i,s:N,s:N,s:K,s:K}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                      "cpu_index",
-                                      params.block_end_params.cpu_index,
-                                      "cpu",
-                                      get_cpu_state(params.block_end_params.cpu),
-                                      "tb",
-                                      get_tb(params.block_end_params.tb),
-                                      "cur_pc",
-                                      params.block_end_params.cur_pc,
-                                      "next_pc",
-                                      params.block_end_params.next_pc);
-            break;
-       case INSN_BEGIN_CB:
-            kwarg =  Py_BuildValue("{s:i,s:N}", "cpu_index",
-                                              params.insn_begin_params.cpu_index,
-                                              "cpu",
-                                              get_cpu_state(params.insn_begin_params.cpu));
-            break;
-       case INSN_END_CB:
-            kwarg =  Py_BuildValue("{s:i,s:N}", "cpu_index",
-                                              params.insn_end_params.cpu_index,
-                                              "cpu",
-                                              get_cpu_state(params.insn_end_params.cpu));
-            break;
-       case MEM_READ_CB:
-#if TARGET_LONG_SIZE == 4
-            kwarg =  Py_BuildValue("{s:i,s:I,s:I,s:K}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s:i,s:K,s:K,s:K}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                           "cpu_index",
-                                           params.mem_read_params.cpu_index,
-                                           "vaddr",
-                                           params.mem_read_params.vaddr,
-                                           "size",
-                                           params.mem_read_params.size,
-                                           "haddr",
-                                           params.mem_read_params.haddr);
-            break;
-       case MEM_WRITE_CB:
-#if TARGET_LONG_SIZE == 4
-            kwarg =  Py_BuildValue("{s:i,s:I,s:I,s:K,s:I}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s:i,s:K,s:K,s:K,s:K}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                           "cpu_index",
-                                           params.mem_write_params.cpu_index,
-                                           "vaddr",
-                                           params.mem_write_params.vaddr,
-                                           "size",
-                                           params.mem_write_params.size,
-                                           "haddr",
-                                           params.mem_write_params.haddr,
-                                           "data",
-                                           params.mem_write_params.data);
-            break;
-       case KEYSTROKE_CB:
-            kwarg =  Py_BuildValue("{s:I}", "keycode", params.keystroke_params.keycode);
-            break;
-       case NIC_REC_CB:
-            //Size is duplicated, first for the size of the string, second one for the size parameter
-#if TARGET_LONG_SIZE == 4
-            //Since this is target independent, we use always 64 bits
-            kwarg =  Py_BuildValue("{s:s#,s:K,s:K,s:K,s:K}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s:s#,s:K,s:K,s:K,s:K}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                           "buf",
-                                           params.nic_rec_params.buf,
-                                           params.nic_rec_params.size,
-                                           "size",
-                                           params.nic_rec_params.size,
-                                           "cur_pos",
-                                           params.nic_rec_params.cur_pos,
-                                           "start",
-                                           params.nic_rec_params.start,
-                                           "stop",
-                                           params.nic_rec_params.stop);
-            break;
-       case NIC_SEND_CB:
-#if TARGET_LONG_SIZE == 4
-            //Since this is target independent, we use always 64 bits
-            kwarg =  Py_BuildValue("{s:K,s:K,s:s#}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s:K,s:K,s:s#}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                           "addr",
-                                           params.nic_send_params.address,
-                                           "size",
-                                           params.nic_send_params.size,
-                                           "buf",
-                                           params.nic_send_params.buf,
-                                           params.nic_send_params.size);
-            break;
-       case OPCODE_RANGE_CB:
-#if TARGET_LONG_SIZE == 4
-            kwarg =  Py_BuildValue("{s:i,s:N,s:I,s:I,s:I}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s:i,s:N,s:K,s:K,s:K}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                      "cpu_index",
-                                      params.opcode_range_params.cpu_index,
-                                      "cpu",
-                                      get_cpu_state(params.opcode_range_params.cpu),
-                                      "cur_pc",
-                                      params.opcode_range_params.cur_pc,
-                                      "next_pc",
-                                      params.opcode_range_params.next_pc,
-                                      "insn_size",
-                                      params.opcode_range_params.insn_size);
-            break;
-       case TLB_EXEC_CB:
-#if TARGET_LONG_SIZE == 4
-            kwarg =  Py_BuildValue("{s: N, s: I}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s: N, s: K}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                      "cpu",
-                                      get_cpu_state(params.tlb_exec_params.cpu),
-                                      "vaddr",
-                                      params.tlb_exec_params.vaddr);
-            break;
-       case CREATEPROC_CB:
-#if TARGET_LONG_SIZE == 4
-            kwarg =  Py_BuildValue("{s:I,s:I,s:s}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s:K,s:K,s:s}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                        "pid",
-                                        params.vmi_create_proc_params.pid,
-                                        "pgd",
-                                        params.vmi_create_proc_params.pgd,
-                                        "name",
-                                        params.vmi_create_proc_params.name);
-
-            break;
-       case REMOVEPROC_CB:
-#if TARGET_LONG_SIZE == 4
-            kwarg =  Py_BuildValue("{s:I,s:I,s:s}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s:K,s:K,s:s}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                        "pid",
-                                        params.vmi_create_proc_params.pid,
-                                        "pgd",
-                                        params.vmi_create_proc_params.pgd,
-                                        "name",
-                                        params.vmi_create_proc_params.name);
-            break;
-       case CONTEXTCHANGE_CB:
-#if TARGET_LONG_SIZE == 4
-            kwarg =  Py_BuildValue("{s:I,s:I}",
-#elif TARGET_LONG_SIZE == 8
-            kwarg =  Py_BuildValue("{s:K,s:K}",
-#else
-#error TARGET_LONG_SIZE undefined
-#endif
-                                        "old_pgd",
-                                        params.vmi_context_change_params.old_pgd,
-                                        "new_pgd",
-                                        params.vmi_context_change_params.new_pgd);
-            break;
-       default:
-            //Reaching this path means some case is
-            //not implemented. Code it lazy ass!
-            assert(0);
-            break;
+    if (full_batches){
+        for (size_t i = 0; i < this->batched_callbacks.size(); ++i){
+            if (this->batched_callbacks[i]->get_batch()->is_full()){
+                this->flush_batch(this->batched_callbacks[i]);
+            }
+        }
     }
 
-    for (list<Callback*>::iterator it = callbacks_needed.begin(); it != callbacks_needed.end(); ++it)
-    {
-        PyObject* ret = PyObject_Call((*it)->get_callback_function(), arg, kwarg);
-        Py_XDECREF(ret);
-    }
-    //Once all callbacks have been triggered, just decref the arguments
-    Py_XDECREF(arg);
-    Py_XDECREF(kwarg);
-    //Remove the installed callbacks whose removal was deferred until all callbacks have been dispatched
-    this->commit_deferred_callback_removes();
-    fflush(stdout);
-    fflush(stderr);
-    pthread_mutex_unlock(&pyrebox_mutex);
+    //The parameters are passed as a single CallbackEvent object, that builds
+    //each value when it is accessed
+    PyObject* event = (callbacks_needed.size() > 0) ? get_callback_event(type, &params) : 0;
+    if (event == 0){
+        if (callbacks_needed.size() > 0){
+            PyErr_Print();
+        }
+    } else {
+        for (vector<Callback*>::iterator it = callbacks_needed.begin(); it != callbacks_needed.end(); ++it)
+        {
+            if (it != callbacks_needed.begin()){
+                event = next_callback_event(event);
+                if (event == 0){
+                    PyErr_Print();
+                    break;
+                }
+            }
+            PyObject* ret = PyObject_CallFunctionObjArgs((*it)->get_callback_function(), event, NULL);
+            Py_XDECREF(ret);
+        }
+        //Once all callbacks have been triggered, release the parameters
+        release_callback_event(event);
+    }
+    //Remove the installed callbacks whose removal was deferred until all callbacks have been dispatched
+    this->commit_deferred_callback_removes();
+    this->end_delivery();
+    this->close_unloaded_modules();
+    utils_flush_output();
+    pthread_mutex_unlock(&pyrebox_mutex);
+}
+
+//Finish a delivery, applying the update committed by its callbacks, if any.
+//Called with the python mutex held
+void CallbackManager::end_delivery(){
+    if (--this->delivery_depth == 0 && this->commit_deferred){
+        this->commit_deferred = false;
+        this->commit_update();
+    }
+}
+
+bool CallbackManager::are_removes_committed(){
+    return (this->delivery_depth == 0 && this->update_depth == 0 && this->callback_remove_list.empty());
+}
+
+//The code of the native plugins unloaded meanwhile, and the trigger variables
+//released meanwhile, can be freed once no callback or trigger can be using them.
+//Called at the end of a delivery, holding the python mutex: native callbacks and
+//triggers only run from deliveries, and those hold the mutex until they finish,
+//so once the delivery of this thread is over and the removes are committed, no
+//thread can be running them.
+void CallbackManager::close_unloaded_modules(){
+    if (this->are_removes_committed()){
+        free_retired_trigger_vars();
+        close_unloaded_native_plugins();
+    }
+}
+
+//Add to callbacks_needed the address specific callbacks (OP_BLOCK_BEGIN_CB or OP_INSN_BEGIN_CB)
+//for an event. If the translated code carries a dispatch record for the address, the callbacks
+//are taken from it, otherwise they are searched in the callback table.
+void CallbackManager::collect_address_callbacks(vector<Callback*>& callbacks_needed, callback_type_t type, int record_index, pyrebox_target_ulong address, pyrebox_target_ulong pgd, callback_params_t params){
+    DispatchRecordArena& records = (type == OP_BLOCK_BEGIN_CB) ? this->block_begin_records : this->insn_begin_records;
+    AddressCallbackTable& table = (type == OP_BLOCK_BEGIN_CB) ? this->op_block_begin_callbacks : this->op_insn_begin_callbacks;
+    DispatchRecord* record = records.get_record(record_index);
+    if (record != 0 && record->address == address){
+        //Resolve the record again if the callbacks changed since it was last used
+        if (!records.is_valid(record)){
+            vector<TargetedCallback>* entries = table.find_address(address);
+            if (entries != 0){
+                record->callbacks = *entries;
+            }
+            else{
+                record->callbacks.clear();
+            }
+            records.validate(record);
+        }
+        for (vector<TargetedCallback>::iterator it = record->callbacks.begin(); it != record->callbacks.end(); ++it){
+            if (it->pgd == pgd && (!it->cb->has_trigger() || it->cb->call_trigger(params))){
+                callbacks_needed.push_back(it->cb);
+            }
+        }
+        return;
+    }
+    vector<Callback*>* cbs = table.find(address, pgd);
+    if (cbs != 0){
+        for (vector<Callback*>::iterator it = cbs->begin(); it != cbs->end(); ++it){
+            if (!(*it)->has_trigger() || (*it)->call_trigger(params)){
+                callbacks_needed.push_back((*it));
+            }
+        }
+    }
+}
+
+//Add to callbacks_needed the memory watches that cover a memory access. The watches
+//are not restricted to the monitored processes.
+void CallbackManager::collect_watch_callbacks(vector<Callback*>& callbacks_needed, callback_type_t type, pyrebox_target_ulong pgd, qemu_cpu_opaque_t cpu, callback_params_t params){
+    std::shared_ptr<WatchPageSnapshot> pages = std::atomic_load(&this->watch_pages);
+    if (!pages){
+        return;
+    }
+    pyrebox_target_ulong vaddr = (type == MEM_READ_CB) ? params.mem_read_params.vaddr : params.mem_write_params.vaddr;
+    pyrebox_target_ulong haddr = (pyrebox_target_ulong) ((type == MEM_READ_CB) ? params.mem_read_params.haddr : params.mem_write_params.haddr);
+    for (int physical = 0; physical < 2; ++physical){
+        pyrebox_target_ulong address = physical ? haddr : vaddr;
+        vector<Callback*>* cbs = pages->find(type, address & WATCH_PAGE_MASK, physical);
+        if (cbs == 0){
+            continue;
+        }
+        for (vector<Callback*>::iterator it = cbs->begin(); it != cbs->end(); ++it){
+            if (this->watch_applies((WatchCallback*)(*it), type, pgd, cpu, params)){
+                callbacks_needed.push_back(*it);
+            }
+        }
+    }
+}
+
+//Returns true if a memory access must be delivered to a watch
+bool CallbackManager::watch_applies(WatchCallback* cb, callback_type_t type, pyrebox_target_ulong pgd, qemu_cpu_opaque_t cpu, callback_params_t& params){
+    pyrebox_target_ulong vaddr;
+    pyrebox_target_ulong haddr;
+    pyrebox_target_ulong size;
+    if (type == MEM_READ_CB){
+        vaddr = params.mem_read_params.vaddr;
+        haddr = (pyrebox_target_ulong) params.mem_read_params.haddr;
+        size = params.mem_read_params.size;
+    } else {
+        vaddr = params.mem_write_params.vaddr;
+        haddr = (pyrebox_target_ulong) params.mem_write_params.haddr;
+        size = params.mem_write_params.size;
+    }
+    memory_watch_t watch = cb->get_watch();
+    if (!cb->covers(watch.physical ? haddr : vaddr, size)){
+        return false;
+    }
+    if (!watch.physical && watch.pgd != (pyrebox_target_ulong) INV_PGD && watch.pgd != pgd){
+        return false;
+    }
+    if (!cb->matches_prefilter(pgd, vaddr, cpu)){
+        return false;
+    }
+    return (!cb->has_trigger() || cb->call_trigger(params));
+}
+
+bool WatchCallback::is_wide(){
+    uint64_t pages = (((uint64_t) this->watch.end - 1) >> WATCH_PAGE_BITS) - ((uint64_t) this->watch.start >> WATCH_PAGE_BITS) + 1;
+    return (pages > WATCH_MAX_PAGES);
 }
 
 void CallbackManager::clean_callbacks(){
     //For whatever action that may be needed here.
+    this->refresh_prefilters();
 }
 
-CallbackManager::CallbackManager(){}
+thread_local unsigned int CallbackManager::delivery_depth = 0;
+
+CallbackManager::CallbackManager() : opcode_ranges_dirty(false), branch_kinds(0), update_depth(0), commit_deferred(false), pending_flush(false), prefilters_dirty(0) {}
+
 CallbackManager::~CallbackManager(){
     this->remove_all_callbacks();
 }
 
+size_t CallbackManager::count_callbacks(callback_type_t type){
+    switch(type){
+        case OP_BLOCK_BEGIN_CB:
+            return this->op_block_begin_callbacks.size();
+        case OP_INSN_BEGIN_CB:
+            return this->op_insn_begin_callbacks.size();
+        default:
+            return this->callbacks[type].size();
+    }
+}
+
+Callback* CallbackManager::find_callback(callback_handle_t handle){
+    Callback** cb = this->callbacks_by_handle.find(handle);
+    if (cb == 0){
+        return 0;
+    }
+    return (*cb);
+}
+
+//Insert a callback (already present in the handle index) in its table
+void CallbackManager::attach_callback(Callback* cb){
+    switch(cb->get_callback_type())
+    {
+        case OP_BLOCK_BEGIN_CB:
+            this->op_block_begin_callbacks.insert(((OptimizedBlockBeginCallback*)cb)->get_target_address(), cb);
+            this->block_begin_records.invalidate(((OptimizedBlockBeginCallback*)cb)->get_target_address().address);
+            break;
+        case OP_INSN_BEGIN_CB:
+            this->op_insn_begin_callbacks.insert(((OptimizedInsBeginCallback*)cb)->get_target_address(), cb);
+            this->insn_begin_records.invalidate(((OptimizedInsBeginCallback*)cb)->get_target_address().address);
+            break;
+        default:
+            if (cb->is_watch() && !((WatchCallback*)cb)->is_wide()){
+                this->update_watched_pages((WatchCallback*)cb, true);
+                break;
+            }
+            this->callbacks[cb->get_callback_type()].push_back(cb);
+            this->mark_prefilter_dirty(cb->get_callback_type());
+            if (cb->get_callback_type() == OPCODE_RANGE_CB){
+                this->opcode_ranges_dirty = true;
+                this->publish_opcode_ranges();
+            } else if (cb->get_callback_type() == BRANCH_CB){
+                this->branch_kinds |= ((BranchCallback*)cb)->get_branch_kinds();
+            }
+            break;
+    }
+    //Make sure the translated code calls the new callback
+    this->invalidate_translated_code(cb, true);
+}
+
+//If the callback was added during the current update and not attached yet,
+//forget it and return true
+bool CallbackManager::take_pending_add(Callback* cb){
+    vector<Callback*>::iterator it = std::find(this->pending_adds.begin(), this->pending_adds.end(), cb);
+    if (it == this->pending_adds.end()){
+        return false;
+    }
+    this->pending_adds.erase(it);
+    return true;
+}
+
+//Remove the callback from its table and from the handle index, without freeing it
+void CallbackManager::detach_callback(Callback* cb){
+    switch(cb->get_callback_type()){
+        case OP_BLOCK_BEGIN_CB:
+            this->op_block_begin_callbacks.erase(((OptimizedBlockBeginCallback*)cb)->get_target_address(), cb);
+            this->block_begin_records.invalidate(((OptimizedBlockBeginCallback*)cb)->get_target_address().address);
+            break;
+        case OP_INSN_BEGIN_CB:
+            this->op_insn_begin_callbacks.erase(((OptimizedInsBeginCallback*)cb)->get_target_address(), cb);
+            this->insn_begin_records.invalidate(((OptimizedInsBeginCallback*)cb)->get_target_address().address);
+            break;
+        default:
+            if (cb->is_watch() && !((WatchCallback*)cb)->is_wide()){
+                this->update_watched_pages((WatchCallback*)cb, false);
+                break;
+            }
+            this->callbacks[cb->get_callback_type()].erase(cb);
+            this->mark_prefilter_dirty(cb->get_callback_type());
+            if (cb->get_callback_type() == OPCODE_RANGE_CB){
+                this->opcode_ranges_dirty = true;
+                this->publish_opcode_ranges();
+            } else if (cb->get_callback_type() == BRANCH_CB){
+                this->branch_kinds = this->get_branch_kinds(0);
+            }
+            break;
+    }
+    this->callbacks_by_handle.erase(cb->get_handle());
+}
+
+//Release the resources held by a callback already detached from its table
+void CallbackManager::destroy_callback(Callback* cb){
+    //Deliver the records still pending
+    if (cb->get_batch() != 0){
+        this->flush_batch(cb);
+        this->batched_callbacks.erase(std::find(this->batched_callbacks.begin(), this->batched_callbacks.end(), cb));
+        delete cb->get_batch();
+    }
+    //The events still queued for it are discarded
+    if (cb->get_async_target() != 0){
+        release_async_callback_target(cb->get_async_target());
+    }
+    //Decrement reference count for the callback function
+    Py_XDECREF(cb->get_callback_function());
+    //Remove trigger (will decrement reference count for loaded library
+    if (cb->has_trigger()){
+        this->unload_trigger(cb);
+    }
+    //Free memory for the Callback*
+    delete cb;
+}
+
+//Build the index of the opcode ranges again after they change. Called holding
+//the python mutex. During an update, it is only built once, on commit.
+void CallbackManager::publish_opcode_ranges(){
+    if (!this->opcode_ranges_dirty || this->update_depth > 0){
+        return;
+    }
+    std::shared_ptr<OpcodeRangeIndex> ranges;
+    if (this->callbacks[OPCODE_RANGE_CB].size() > 0){
+        ranges = std::make_shared<OpcodeRangeIndex>(this->callbacks[OPCODE_RANGE_CB]);
+    }
+    std::atomic_store(&this->opcode_ranges, ranges);
+    this->opcode_ranges_dirty = false;
+}
+
+//Called from the translation of the vCPU threads, without the python mutex
+std::shared_ptr<OpcodeRangeIndex> CallbackManager::get_opcode_ranges(){
+    return std::atomic_load(&this->opcode_ranges);
+}
+
+//Returns true if every opcode in range is covered by the opcode range callbacks
+//registered, other than excluded
+bool CallbackManager::opcode_range_covered(opcode_range_t range, Callback* excluded){
+    uint32_t next = range.start_opcode;
+    bool progress = true;
+    while (next <= range.end_opcode && progress){
+        progress = false;
+        for (CallbackList::iterator it = this->callbacks[OPCODE_RANGE_CB].begin(); it != this->callbacks[OPCODE_RANGE_CB].end(); ++it){
+            if (*it == excluded){
+                continue;
+            }
+            opcode_range_t other = ((OptimizedOpcodeRangeCallback*)(*it))->get_opcode_range();
+            if (other.start_opcode <= next && next <= other.end_opcode){
+                next = (uint32_t)other.end_opcode + 1;
+                progress = true;
+            }
+        }
+    }
+    return (next > range.end_opcode);
+}
+
+//Returns the union of the kinds selected by the branch callbacks registered,
+//other than excluded
+unsigned int CallbackManager::get_branch_kinds(Callback* excluded){
+    unsigned int kinds = 0;
+    for (CallbackList::iterator it = this->callbacks[BRANCH_CB].begin(); it != this->callbacks[BRANCH_CB].end(); ++it){
+        if (*it != excluded){
+            kinds |= ((BranchCallback*)(*it))->get_branch_kinds();
+        }
+    }
+    return kinds;
+}
+
+//Invalidate the translated code affected by a callback that has just been
+//added to (or detached from) its table. Address specific callbacks only
+//invalidate the code at their address, the rest of types flush the whole
+//translation cache, and only when the instrumentation actually changes.
+void CallbackManager::invalidate_translated_code(Callback* cb, bool added){
+    callback_type_t type = cb->get_callback_type();
+    AddressCallbackTable* table = 0;
+    memory_address_t target;
+    switch(type){
+        case OP_BLOCK_BEGIN_CB:
+        case OP_INSN_BEGIN_CB:
+            if (type == OP_BLOCK_BEGIN_CB){
+                table = &(this->op_block_begin_callbacks);
+                target = ((OptimizedBlockBeginCallback*)cb)->get_target_address();
+            } else {
+                table = &(this->op_insn_begin_callbacks);
+                target = ((OptimizedInsBeginCallback*)cb)->get_target_address();
+            }
+            if (this->callbacks[(type == OP_BLOCK_BEGIN_CB) ? BLOCK_BEGIN_CB : INSN_BEGIN_CB].size() > 0){
+                //We are instrumenting every block / instruction already
+                tb_flush_stats.flushes_avoided++;
+            } else if (added ? (table->find_address(target.address)->size() > 1) : table->has_address(target.address)){
+                //Other callbacks keep the address instrumented. Its dispatch
+                //record has been invalidated, so the translated code can stay.
+                tb_flush_stats.flushes_avoided++;
+            } else {
+                this->request_invalidation(target.pgd, target.address);
+            }
+            break;
+        case OPCODE_RANGE_CB:
+            if (this->opcode_range_covered(((OptimizedOpcodeRangeCallback*)cb)->get_opcode_range(), cb)){
+                tb_flush_stats.flushes_avoided++;
+            } else {
+                this->request_flush();
+            }
+            break;
+        case BRANCH_CB:
+            //Only the kinds are instrumented, so the code stays valid if the
+            //rest of branch callbacks select the same kinds
+            if ((((BranchCallback*)cb)->get_branch_kinds() & ~this->get_branch_kinds(cb)) == 0){
+                tb_flush_stats.flushes_avoided++;
+            } else {
+                this->request_flush();
+            }
+            break;
+        case BLOCK_BEGIN_CB:
+        case BLOCK_END_CB:
+        case INSN_BEGIN_CB:
+        case INSN_END_CB:
+        case MEM_READ_CB:
+        case MEM_WRITE_CB:
+            //Watches only change the TLB entries of their pages (see update_watched_pages)
+            if (cb->is_watch() && !((WatchCallback*)cb)->is_wide()){
+                break;
+            }
+            //Flush TB only for the first callback added, or the last one removed
+            if (this->callbacks[type].size() == (added ? 1 : 0)){
+                this->request_flush();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+//Beyond this number of pages, the whole TLBs are flushed
+#define WATCH_MAX_PAGE_FLUSHES 64
+
+//Insert (or remove) a watch in the pages it covers, and drop the TLB entries
+//of the pages that become watched (or unwatched), so that they are filled
+//again with (or without) TLB_WATCH.
+void CallbackManager::update_watched_pages(WatchCallback* cb, bool added){
+    WatchPageTable& table = (cb->get_callback_type() == MEM_READ_CB) ? this->read_watches : this->write_watches;
+    memory_watch_t watch = cb->get_watch();
+    bool physical = (watch.physical != 0);
+    pyrebox_target_ulong last = (watch.end - 1) & WATCH_PAGE_MASK;
+    vector<pyrebox_target_ulong> changed;
+    for (pyrebox_target_ulong page = watch.start & WATCH_PAGE_MASK; ; page += ((pyrebox_target_ulong) 1 << WATCH_PAGE_BITS)){
+        if (added ? table.insert(page, physical, cb) : table.erase(page, physical, cb)){
+            changed.push_back(page);
+        }
+        if (page == last){
+            break;
+        }
+    }
+    if (changed.size() == 0){
+        return;
+    }
+    //The new snapshot must be visible before the TLB entries are filled again
+    this->publish_watch_pages();
+    watched_pages_count = this->read_watches.pages() + this->write_watches.pages();
+    //A ram address can be mapped at any virtual address
+    if (physical || changed.size() > WATCH_MAX_PAGE_FLUSHES){
+        pyrebox_flush_tlb();
+    } else {
+        for (vector<pyrebox_target_ulong>::iterator it = changed.begin(); it != changed.end(); ++it){
+            pyrebox_flush_tlb_page(*it);
+        }
+    }
+}
+
+//Rebuild the snapshot of the watched pages. Called holding the python mutex
+void CallbackManager::publish_watch_pages(){
+    std::shared_ptr<WatchPageSnapshot> pages;
+    if (this->read_watches.pages() > 0 || this->write_watches.pages() > 0){
+        pages = std::make_shared<WatchPageSnapshot>();
+        this->read_watches.for_each_page([&pages](pyrebox_target_ulong page, bool physical, vector<Callback*>& cbs) {
+            pages->add(MEM_READ_CB, page, physical, WATCH_READ, cbs);
+        });
+        this->write_watches.for_each_page([&pages](pyrebox_target_ulong page, bool physical, vector<Callback*>& cbs) {
+            pages->add(MEM_WRITE_CB, page, physical, WATCH_WRITE, cbs);
+        });
+    }
+    std::atomic_store(&this->watch_pages, pages);
+}
+
+//Called from the TLB fills of the vCPU threads, without the python mutex
+int CallbackManager::get_page_watch_flags(pyrebox_target_ulong vaddr_page, pyrebox_target_ulong ram_page){
+    std::shared_ptr<WatchPageSnapshot> pages = std::atomic_load(&this->watch_pages);
+    if (!pages){
+        return 0;
+    }
+    return (pages->get_flags(vaddr_page, false) | pages->get_flags(ram_page, true));
+}
+
+void CallbackManager::request_flush(){
+    if (this->update_depth > 0){
+        if (this->pending_flush){
+            tb_flush_stats.flushes_avoided++;
+        }
+        this->pending_flush = true;
+    } else {
+        pyrebox_flush_tb();
+    }
+}
+
+void CallbackManager::request_invalidation(pyrebox_target_ulong pgd, pyrebox_target_ulong address){
+    if (this->update_depth > 0){
+        memory_address_t target;
+        target.address = address;
+        target.pgd = pgd;
+        this->pending_invalidations.push_back(target);
+    } else {
+        pyrebox_invalidate_tb(pgd, address);
+    }
+}
+
+//Start a batched update. Updates can be nested, and only the
+//outermost commit_update applies the changes.
+void CallbackManager::begin_update(){
+    this->update_depth++;
+}
+
+//Apply the callbacks added and removed since begin_update, with a single
+//invalidation pass over the translated code
+void CallbackManager::commit_update(){
+    if (this->update_depth == 0){
+        utils_print_error("[!] Cannot commit a callback update that was not started\n");
+        return;
+    }
+    if (--this->update_depth > 0){
+        return;
+    }
+    if (this->delivery_depth > 0){
+        //Committed from a callback. Keep the update open until the delivery finishes
+        this->update_depth++;
+        this->commit_deferred = true;
+        return;
+    }
+    //Keep collecting invalidations while the changes are applied
+    this->update_depth++;
+    vector<Callback*> adds;
+    adds.swap(this->pending_adds);
+    for (vector<Callback*>::iterator it = adds.begin(); it != adds.end(); ++it){
+        this->attach_callback(*it);
+    }
+    vector<callback_handle_t> removes;
+    removes.swap(this->pending_removes);
+    for (vector<callback_handle_t>::iterator it = removes.begin(); it != removes.end(); ++it){
+        Callback* cb = this->find_callback(*it);
+        if (cb != 0){
+            this->detach_callback(cb);
+            this->invalidate_translated_code(cb, false);
+            this->destroy_callback(cb);
+        }
+    }
+    this->update_depth--;
+    this->publish_opcode_ranges();
+
+    //Single invalidation pass
+    if (this->pending_flush){
+        tb_flush_stats.flushes_avoided += this->pending_invalidations.size();
+        pyrebox_flush_tb();
+    } else {
+        std::sort(this->pending_invalidations.begin(), this->pending_invalidations.end(), MemoryAddressLess());
+        vector<memory_address_t>::iterator last = std::unique(this->pending_invalidations.begin(), this->pending_invalidations.end(), MemoryAddressEqual());
+        tb_flush_stats.flushes_avoided += (this->pending_invalidations.end() - last);
+        for (vector<memory_address_t>::iterator it = this->pending_invalidations.begin(); it != last; ++it){
+            pyrebox_invalidate_tb(it->pgd, it->address);
+        }
+    }
+    this->pending_invalidations.clear();
+    this->pending_flush = false;
+    this->clean_callbacks();
+}
+
+//Prefilter evaluated by the generated code for a callback type, -1 if none
+static int get_prefilter_kind(callback_type_t type){
+    switch(type){
+        case BLOCK_BEGIN_CB:
+            return PREFILTER_BLOCK_BEGIN;
+        case INSN_BEGIN_CB:
+            return PREFILTER_INSN_BEGIN;
+        case BLOCK_END_CB:
+            return PREFILTER_BLOCK_END;
+        case INSN_END_CB:
+            return PREFILTER_INSN_END;
+        case MEM_READ_CB:
+            return PREFILTER_MEM_READ;
+        case MEM_WRITE_CB:
+            return PREFILTER_MEM_WRITE;
+        default:
+            return -1;
+    }
+}
+
+int CallbackManager::set_prefilter(callback_handle_t handle, prefilter_conditions_t conditions){
+    Callback* cb = this->find_callback(handle);
+    if (cb == 0){
+        utils_print_error("[!] Could not set prefilter on unregistered callback handle %x\n", handle);
+        return 0;
+    }
+    if (get_prefilter_kind(cb->get_callback_type()) < 0){
+        utils_print_error("[!] Prefilters are not supported for this callback type\n");
+        return 0;
+    }
+    if (conditions.flags & ~(PREFILTER_PGD | PREFILTER_RANGE | PREFILTER_USER_ONLY)){
+        utils_print_error("[!] Unknown prefilter flags %x\n", conditions.flags);
+        return 0;
+    }
+    if (conditions.flags & PREFILTER_RANGE){
+        if (cb->get_callback_type() == INSN_END_CB){
+            utils_print_error("[!] Address ranges are not supported for insn end callbacks\n");
+            return 0;
+        }
+        if (conditions.hi <= conditions.lo){
+            utils_print_error("[!] Empty prefilter range\n");
+            return 0;
+        }
+    }
+    cb->set_prefilter(conditions);
+    this->mark_prefilter_dirty(cb->get_callback_type());
+    this->refresh_prefilters();
+    return 1;
+}
+
+int CallbackManager::set_batch(callback_handle_t handle, unsigned int size){
+    Callback* cb = this->find_callback(handle);
+    if (cb == 0){
+        utils_print_error("[!] Could not set batch size on unregistered callback handle %x\n", handle);
+        return 0;
+    }
+    if (cb->get_native_function() != 0 || cb->get_batch() != 0 || cb->get_async_mode() != 0){
+        utils_print_error("[!] Batches are only supported for synchronous python callbacks, and can only be enabled once\n");
+        return 0;
+    }
+    int record_size = get_callback_record_size(cb->get_callback_type());
+    if (record_size == 0){
+        utils_print_error("[!] Batches are not supported for this callback type\n");
+        return 0;
+    }
+    if (size == 0){
+        utils_print_error("[!] Empty batch size\n");
+        return 0;
+    }
+    cb->set_batch(new CallbackBatch(size, record_size));
+    this->batched_callbacks.push_back(cb);
+    return 1;
+}
+
+//Call the python function of a batched callback with its pending records. The
+//records are copied into a string, so the callback can keep it.
+void CallbackManager::flush_batch(Callback* cb){
+    CallbackBatch* batch = cb->get_batch();
+    if (batch->is_empty()){
+        return;
+    }
+    PyObject* data = PyString_FromStringAndSize(batch->data(), batch->data_size());
+    batch->clear();
+    if (data == 0){
+        PyErr_Print();
+        return;
+    }
+    PyObject* ret = PyObject_CallFunctionObjArgs(cb->get_callback_function(), data, NULL);
+    if (ret == 0){
+        PyErr_Print();
+    }
+    Py_XDECREF(ret);
+    Py_DECREF(data);
+}
+
+//Deliver every pending record. The callbacks can add more batched callbacks meanwhile.
+void CallbackManager::flush_batches(){
+    for (size_t i = 0; i < this->batched_callbacks.size(); ++i){
+        this->flush_batch(this->batched_callbacks[i]);
+    }
+}
+
+internal_callback_handle_t CallbackManager::add_internal_callback(pyrebox_target_ulong pgd, pyrebox_target_ulong pc, callback_t callback_function){
+    bool hooked = this->internal_callbacks.has_address(pc);
+    internal_callback_handle_t handle = this->internal_callbacks.insert(pgd, pc, callback_function);
+    //The code at pc may have been translated without the insn begin helper, or with
+    //the insn begin prefilter, that skips the helper unless a callback accepts pc.
+    //Only the address specific callbacks disable the prefilter at their address.
+    if (!hooked && !this->op_insn_begin_callbacks.has_address(pc)){
+        this->request_invalidation(pgd, pc);
+    } else {
+        tb_flush_stats.flushes_avoided++;
+    }
+    return handle;
+}
+
+void CallbackManager::remove_internal_callback(internal_callback_handle_t handle){
+    pyrebox_target_ulong pc;
+    if (!this->internal_callbacks.erase(handle, &pc)){
+        utils_print_error("[!] Could not remove unregistered internal callback handle %x\n", handle);
+        return;
+    }
+    //The code translated for pc may keep calling the insn begin helper, that
+    //will not find the callback any more. Not worth invalidating it.
+    tb_flush_stats.flushes_avoided++;
+}
+
+int CallbackManager::set_async(callback_handle_t handle, int mode){
+    Callback* cb = this->find_callback(handle);
+    if (cb == 0){
+        utils_print_error("[!] Could not set asynchronous delivery on unregistered callback handle %x\n", handle);
+        return 0;
+    }
+    if (cb->get_native_function() != 0 || cb->get_batch() != 0){
+        utils_print_error("[!] Asynchronous delivery is only supported for python callbacks without batches\n");
+        return 0;
+    }
+    if (get_callback_record_size(cb->get_callback_type()) == 0){
+        utils_print_error("[!] Asynchronous delivery is not supported for this callback type\n");
+        return 0;
+    }
+    if (mode != ASYNC_CALLBACK_BLOCK && mode != ASYNC_CALLBACK_DROP){
+        utils_print_error("[!] Unknown asynchronous delivery mode %d\n", mode);
+        return 0;
+    }
+    if (!start_async_callbacks()){
+        return 0;
+    }
+    //The target is set before the mode, that the vCPU threads check first
+    if (cb->get_async_target() == 0){
+        cb->set_async_target(create_async_callback_target(cb->get_callback_function()));
+    }
+    cb->set_async_mode(mode);
+    return 1;
+}
+
+//The prefilters include the monitored processes for the callbacks without a trigger
+void CallbackManager::update_prefilters(){
+    this->prefilters_dirty = ~0u;
+    this->refresh_prefilters();
+}
+
+int CallbackManager::is_prefilter_applicable(callback_type_t callback_type, pyrebox_target_ulong address){
+    switch(callback_type){
+        case OP_BLOCK_BEGIN_CB:
+        case BLOCK_BEGIN_CB:
+            return !this->op_block_begin_callbacks.has_address(address);
+        case OP_INSN_BEGIN_CB:
+        case INSN_BEGIN_CB:
+            return !(this->internal_callbacks.has_address(address) || this->op_insn_begin_callbacks.has_address(address));
+        default:
+            return (get_prefilter_kind(callback_type) >= 0);
+    }
+}
+
+void CallbackManager::mark_prefilter_dirty(callback_type_t type){
+    if (get_prefilter_kind(type) >= 0){
+        this->prefilters_dirty |= (1u << type);
+    }
+}
+
+//Merge the conditions of the callbacks of every dirty type into the prefilter
+//read by the generated code. The merged prefilter must accept every event
+//that could be delivered to some callback: it is inactive if a callback has a
+//trigger but no conditions, and it accepts the monitored processes if a
+//callback has no trigger and no pgd condition.
+void CallbackManager::refresh_prefilters(){
+    if (this->prefilters_dirty == 0 || this->update_depth > 0){
+        return;
+    }
+    pyrebox_target_ulong monitored[CALLBACK_PREFILTER_MAX_PGDS];
+    int nb_monitored = get_monitored_processes(monitored, CALLBACK_PREFILTER_MAX_PGDS);
+    for (int type = 0; type < LAST_CB; ++type){
+        int kind = get_prefilter_kind((callback_type_t)type);
+        if (kind < 0 || !(this->prefilters_dirty & (1u << type))){
+            continue;
+        }
+        callback_prefilter_t merged;
+        merged.active = (this->callbacks[type].size() > 0);
+        merged.user_only = 1;
+        merged.first = (pyrebox_target_ulong)-1;
+        merged.last = 0;
+        merged.any_pgd = 0;
+        vector<pyrebox_target_ulong> pgds;
+        bool monitored_pgds = false;
+        for (CallbackList::iterator it = this->callbacks[type].begin(); it != this->callbacks[type].end(); ++it){
+            prefilter_conditions_t conditions = (*it)->get_prefilter();
+            if ((*it)->is_watch()){
+                //Wide memory watches: the accesses to their range, from any process
+                memory_watch_t watch = ((WatchCallback*)(*it))->get_watch();
+                if (!(conditions.flags & PREFILTER_USER_ONLY)){
+                    merged.user_only = 0;
+                }
+                if (watch.physical){
+                    merged.first = 0;
+                    merged.last = (pyrebox_target_ulong)-1;
+                } else {
+                    merged.first = std::min(merged.first, watch.start);
+                    //[start, end) to inclusive bounds
+                    merged.last = std::max(merged.last, (pyrebox_target_ulong)(watch.end - 1));
+                }
+                if (!watch.physical && watch.pgd != (pyrebox_target_ulong) INV_PGD){
+                    pgds.push_back(watch.pgd);
+                } else {
+                    merged.any_pgd = 1;
+                }
+                continue;
+            }
+            if (conditions.flags == 0 && (*it)->has_trigger()){
+                //The trigger decides for every event
+                merged.active = 0;
+                break;
+            }
+            if (!(conditions.flags & PREFILTER_USER_ONLY)){
+                merged.user_only = 0;
+            }
+            if (conditions.flags & PREFILTER_RANGE){
+                merged.first = std::min(merged.first, conditions.lo);
+                //[lo, hi) to inclusive bounds. hi > lo, checked by set_callback_prefilter
+                merged.last = std::max(merged.last, (pyrebox_target_ulong)(conditions.hi - 1));
+            } else {
+                merged.first = 0;
+                merged.last = (pyrebox_target_ulong)-1;
+            }
+            if (conditions.flags & PREFILTER_PGD){
+                pgds.push_back(conditions.pgd);
+            } else if (!(*it)->has_trigger()){
+                //Only delivered for the monitored processes
+                monitored_pgds = true;
+            } else {
+                merged.any_pgd = 1;
+            }
+        }
+        if (monitored_pgds){
+            if (nb_monitored > CALLBACK_PREFILTER_MAX_PGDS){
+                merged.any_pgd = 1;
+            } else {
+                pgds.insert(pgds.end(), monitored, monitored + nb_monitored);
+            }
+        }
+        std::sort(pgds.begin(), pgds.end());
+        pgds.erase(std::unique(pgds.begin(), pgds.end()), pgds.end());
+        if (pgds.size() > CALLBACK_PREFILTER_MAX_PGDS){
+            merged.any_pgd = 1;
+        }
+        for (size_t i = 0; i < CALLBACK_PREFILTER_MAX_PGDS; ++i){
+            merged.pgds[i] = (i < pgds.size()) ? pgds[i] : (pyrebox_target_ulong)INV_PGD;
+        }
+        //Disable the prefilter while it is updated, so that the generated
+        //code never applies a partially updated one
+        callback_prefilter_t* target = &callback_prefilters[kind];
+        target->active = 0;
+        __sync_synchronize();
+        target->user_only = merged.user_only;
+        target->first = merged.first;
+        target->last = merged.last;
+        target->any_pgd = merged.any_pgd;
+        for (int i = 0; i < CALLBACK_PREFILTER_MAX_PGDS; ++i){
+            target->pgds[i] = merged.pgds[i];
+        }
+        __sync_synchronize();
+        target->active = merged.active;
+    }
+    this->prefilters_dirty = 0;
+}
+
 void CallbackManager::remove_callback_deferred(callback_handle_t handle){
     this->callback_remove_list.push_front(handle);
 }
 
 void CallbackManager::commit_deferred_callback_removes(){
-    for (std::list<callback_handle_t>::iterator it = this->callback_remove_list.begin(); it != this->callback_remove_list.end(); ++it){
+    //Removing a batched callback delivers its last records, which can request more removals
+    std::list<callback_handle_t> removes;
+    removes.swap(this->callback_remove_list);
+    for (std::list<callback_handle_t>::iterator it = removes.begin(); it != removes.end(); ++it){
         this->remove_callback(*it);
     }
-    this->callback_remove_list.clear();
 }
 
 void CallbackManager::remove_callback(callback_handle_t handle){
-    for (int i = OP_BLOCK_BEGIN_CB; i < LAST_CB;i++){
-        std::multiset<Callback*,CompareCallbackP>::iterator it = this->callbacks[i].begin();
-        while (it != this->callbacks[i].end())
-        {
-           if ((*it)->get_handle() == handle)
-           {
-               //Decrement reference count for the callback function
-               Py_XDECREF((*it)->get_callback_function());
-               //Remove trigger (will decrement reference count for loaded library
-               if ((*it)->get_trigger() != (trigger_t)0){
-                   this->remove_trigger((*it)->get_handle());
-               }
-               //Free memory for the Callback*
-               if (*it != 0){
-                   delete (*it);
-               }
-               it = this->callbacks[i].erase(it);
-               switch(i){
-                   case OP_BLOCK_BEGIN_CB:
-                        //Flush TB unless we are instrumenting all
-                        if (this->callbacks[BLOCK_BEGIN_CB].size() == 0){
-                            pyrebox_flush_tb();
-                        }
-                        break;
-                   case OP_INSN_BEGIN_CB:
-                        //Flush TB unless we are instrumenting all
-                        if (this->callbacks[INSN_BEGIN_CB].size() == 0){
-                            pyrebox_flush_tb();
-                        }
-                        break;
-                   case OPCODE_RANGE_CB:
-                        //Always flush TB
-                        pyrebox_flush_tb();
-                        break;
-                   default:
-                        //For the rest of the cases, flush if the list now contains 0 callbacks
-                        if (this->callbacks[i].size() == 0){
-                            pyrebox_flush_tb();
-                        }
-                        break;
-               }
-           }
-           else
-           {
-               ++it;
-           }
+    Callback* cb = this->find_callback(handle);
+    if (cb != 0){
+        if (this->take_pending_add(cb)){
+            //Never attached, just forget it
+            this->callbacks_by_handle.erase(handle);
+            this->destroy_callback(cb);
+        } else if (this->update_depth > 0){
+            //Keep delivering it until the update is committed
+            this->pending_removes.push_back(handle);
+        } else {
+            this->detach_callback(cb);
+            this->invalidate_translated_code(cb, false);
+            this->destroy_callback(cb);
         }
     }
     //Finally, call to callbacks for last actions
@@ -1048,59 +1809,76 @@ void CallbackManager::remove_callback(callback_handle_t handle){
 }
 
 void CallbackManager::remove_all_callbacks(){
-    std::multiset<Callback*,CompareCallbackP>::iterator it;
+    vector<Callback*> removed;
+    removed.reserve(this->callbacks_by_handle.size());
+    this->callbacks_by_handle.for_each([&removed](const callback_handle_t&, Callback* cb) {
+        removed.push_back(cb);
+    });
     for (int i = OP_BLOCK_BEGIN_CB; i < LAST_CB;i++){
-        it = this->callbacks[i].begin();
-        while (it != this->callbacks[i].end()){
-           //Decrement reference count for the callback function
-           Py_XDECREF((*it)->get_callback_function());
-           if ((*it)->get_trigger() != (trigger_t)0){
-               this->remove_trigger((*it)->get_handle());
-           }
-           //Free memory for the Callback*
-           if (*it != 0){
-               delete (*it);
-           }
-           it = this->callbacks[i].erase(it);
-        }
+        this->callbacks[i].clear();
+    }
+    this->op_block_begin_callbacks.clear();
+    this->op_insn_begin_callbacks.clear();
+    this->opcode_ranges_dirty = true;
+    this->publish_opcode_ranges();
+    this->branch_kinds = 0;
+    if (this->read_watches.pages() > 0 || this->write_watches.pages() > 0){
+        this->read_watches.clear();
+        this->write_watches.clear();
+        this->publish_watch_pages();
+        watched_pages_count = 0;
+        pyrebox_flush_tlb();
+    }
+    this->block_begin_records.invalidate_all();
+    this->insn_begin_records.invalidate_all();
+    this->callbacks_by_handle.clear();
+    this->pending_adds.clear();
+    this->pending_removes.clear();
+    this->pending_invalidations.clear();
+    this->prefilters_dirty = ~0u;
+    for (vector<Callback*>::iterator it = removed.begin(); it != removed.end(); ++it){
+        this->destroy_callback(*it);
     }
     //Finally, call to callbacks for last actions
     this->clean_callbacks();
     //Flush TB after such a step
-    pyrebox_flush_tb();
+    this->request_flush();
+}
+
+//Safe to call from a callback: the callbacks are removed when the delivery finishes
+void CallbackManager::remove_module_callbacks_deferred(module_handle_t handle){
+    vector<callback_handle_t> removed;
+    this->callbacks_by_handle.for_each([&removed, handle](const callback_handle_t&, Callback* cb) {
+        if (cb->get_module_handle() == handle){
+            removed.push_back(cb->get_handle());
+        }
+    });
+    for (vector<callback_handle_t>::iterator it = removed.begin(); it != removed.end(); ++it){
+        this->remove_callback_deferred(*it);
+    }
 }
 
 void CallbackManager::remove_module_callbacks(module_handle_t handle){
-    std::multiset<Callback*,CompareCallbackP>::iterator it;
-    for (int i = OP_BLOCK_BEGIN_CB; i < LAST_CB;i++){
-        it = this->callbacks[i].begin();
-        while (it != this->callbacks[i].end()){
-           if ((*it)->get_module_handle() == handle){
-               //Decrement reference count for the callback function
-               Py_XDECREF((*it)->get_callback_function());
-               if ((*it)->get_trigger() != (trigger_t)0){
-                   this->remove_trigger((*it)->get_handle());
-               }
-               //Free memory for the Callback*
-               if (*it != 0){
-                   delete (*it);
-               }
-               it = this->callbacks[i].erase(it);
-           }
-           else {
-               ++i;
-           }
+    vector<Callback*> removed;
+    this->callbacks_by_handle.for_each([&removed, handle](const callback_handle_t&, Callback* cb) {
+        if (cb->get_module_handle() == handle){
+            removed.push_back(cb);
         }
+    });
+    for (vector<Callback*>::iterator it = removed.begin(); it != removed.end(); ++it){
+        if (this->take_pending_add(*it)){
+            this->callbacks_by_handle.erase((*it)->get_handle());
+        } else {
+            this->detach_callback(*it);
+            this->invalidate_translated_code(*it, false);
+        }
+        this->destroy_callback(*it);
     }
     //Finally, call to callbacks for last actions
     this->clean_callbacks();
-    //Flush TB after such a step
-    pyrebox_flush_tb();
 }
 
 int CallbackManager::is_callback_needed(callback_type_t callback_type, pyrebox_target_ulong address){
-    std::multiset<Callback*,CompareCallbackP>::iterator it;
-    Callback* cb;
     switch(callback_type){
         //Unified block begin callback. Only BLOCK_BEGIN_CB should be queried, anyway
         case OP_BLOCK_BEGIN_CB:
@@ -1110,67 +1888,45 @@ int CallbackManager::is_callback_needed(callback_type_t callback_type, pyrebox_t
                 return 1;
             }
             //Second, check if we have the optimized version
-            cb = new OptimizedBlockBeginCallback();
-            memory_address_t addr_block;
-            addr_block.address = address;
-            addr_block.pgd = 0;
-            ((OptimizedBlockBeginCallback*)cb)->set_target_address(addr_block);
-            it = this->callbacks[OP_BLOCK_BEGIN_CB].lower_bound((Callback*)cb);
-            delete cb;
             // Only check the address, regardless of the PGD. PGD will be checked on callback delivery
-            if (it != this->callbacks[OP_BLOCK_BEGIN_CB].end() && address == ((OptimizedBlockBeginCallback*)(*it))->get_target_address().address){
+            if (this->op_block_begin_callbacks.has_address(address)){
                 return 1;
             }
             break;
         //Unified insn begin callback. Only INSN_BEGIN_CB should be queried, anyway
         case OP_INSN_BEGIN_CB:
         case INSN_BEGIN_CB:
-            //First, do a fast check over our internal callbacks
-            for (int i = 0; i < MAX_INTERNAL_CALLBACKS && internal_callbacks[i].callback_function != 0; ++i){
-                if (internal_callbacks[i].pc == address){
-                    return 1;
-                }
+            //First, check our internal callbacks
+            if (this->internal_callbacks.has_address(address)){
+                return 1;
             }
             //First, check if we have callbacks for the generic version 
             if (this->callbacks[INSN_BEGIN_CB].size() > 0){
                 return 1;
             }
- 
             //Second, check if we have the optimized version
-            cb = (Callback*) new OptimizedInsBeginCallback();
-            memory_address_t addr;
-            addr.address = address;
-            addr.pgd = 0;
-            ((OptimizedInsBeginCallback*)cb)->set_target_address(addr);
-            it = this->callbacks[OP_INSN_BEGIN_CB].lower_bound((Callback*)cb);
-            delete cb;
             // Only check the address, regardless of the PGD. PGD will be checked on callback delivery
-            if (it != this->callbacks[OP_INSN_BEGIN_CB].end() && address == ((OptimizedInsBeginCallback*)(*it))->get_target_address().address){
+            if (this->op_insn_begin_callbacks.has_address(address)){
                 return 1;
             }
             break;
         case OPCODE_RANGE_CB:
-            // Consider only the number of callbacks, because the pgd will be checked at
+            // Consider only the opcode, because the pgd will be checked at
             // callback delivery
-            if (this->callbacks[OPCODE_RANGE_CB].size() > 0){
-                cb = (Callback*) new OptimizedOpcodeRangeCallback();
-                opcode_range_t opcoderange;
-                opcoderange.start_opcode = (uint16_t)(address & 0xFFFF);
-                opcoderange.end_opcode = (uint16_t)(address & 0xFFFF);
-                ((OptimizedOpcodeRangeCallback*)cb)->set_opcode_range(opcoderange);
-                //With this, we can get the overlapping opcode_range blocks
-                it = this->callbacks[OPCODE_RANGE_CB].lower_bound((Callback*)cb);
-                delete cb;
-                while (it != this->callbacks[OPCODE_RANGE_CB].end()) {
-                    if (((OptimizedOpcodeRangeCallback*)(*it))->get_opcode_range().start_opcode <= (uint16_t)(address & 0xFFFF)){
-                        return 1;
-                    }
-                    else{
-                        ++it;
-                    }
+            {
+                std::shared_ptr<OpcodeRangeIndex> ranges = this->get_opcode_ranges();
+                if (ranges && ranges->test((uint16_t)(address & 0xFFFF))){
+                    return 1;
                 }
             }
             break;
+        case BRANCH_CB:
+            //The address is the kind of the branch. Consider only the kinds
+            //selected, because the pgd will be checked at callback delivery
+            if (address != 0 && (address & ~((pyrebox_target_ulong)this->branch_kinds)) == 0){
+                return 1;
+            }
+            break;
         case TLB_EXEC_CB:
         case KEYSTROKE_CB:
         case NIC_REC_CB:
@@ -1185,8 +1941,37 @@ int CallbackManager::is_callback_needed(callback_type_t callback_type, pyrebox_t
         default:
             // Consider only the number of callbacks, because the pgd will be checked at
             // callback delivery
-            return (this->callbacks[callback_type].size() > 0);
+            return (this->count_callbacks(callback_type) > 0);
             break;
     }
     return 0;
 }
+
+//Returns the index of the dispatch record for the address specific callbacks at
+//an address, to be embedded in the translated code, or -1 if there are none.
+int CallbackManager::get_dispatch_record(callback_type_t callback_type, pyrebox_target_ulong address){
+    switch(callback_type){
+        case OP_BLOCK_BEGIN_CB:
+        case BLOCK_BEGIN_CB:
+            if (this->op_block_begin_callbacks.has_address(address)){
+                return this->block_begin_records.get_record_index(address);
+            }
+            break;
+        case OP_INSN_BEGIN_CB:
+        case INSN_BEGIN_CB:
+            if (this->op_insn_begin_callbacks.has_address(address)){
+                return this->insn_begin_records.get_record_index(address);
+            }
+            break;
+        default:
+            break;
+    }
+    return -1;
+}
+
+//Called when the translation cache is flushed, with every vCPU stopped: the
+//indices embedded in the translated code are gone, and so are their records
+void CallbackManager::reset_dispatch_records(){
+    this->block_begin_records.reset();
+    this->insn_begin_records.reset();
+}
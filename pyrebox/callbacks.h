@@ -24,11 +24,11 @@
 #ifndef CALLBACKS_H
 #define CALLBACKS_H
 
+#include "qemu_glue_callbacks_insn_info.h"
+
 #define INV_ADDR -1
 #define INV_PGD -1
 
-#define MAX_INTERNAL_CALLBACKS 16
-
 #ifdef __cplusplus
 extern "C" {
 #endif//__cplusplus
@@ -54,6 +54,7 @@ typedef enum {
         CREATEPROC_CB,
         REMOVEPROC_CB,
         CONTEXTCHANGE_CB,
+        BRANCH_CB,
         LAST_CB, //Last position, not used
 } callback_type_t;
 
@@ -65,6 +66,8 @@ typedef struct block_begin_params {
     int cpu_index;
     qemu_cpu_opaque_t cpu;
     qemu_tb_opaque_t tb;   
+    //Dispatch record resolved at translation time, -1 if none
+    int dispatch_record;
 } block_begin_params_t;
 
 typedef struct block_end_params {
@@ -78,6 +81,8 @@ typedef struct block_end_params {
 typedef struct insn_begin_params {
     int cpu_index;
     qemu_cpu_opaque_t cpu;
+    //Dispatch record resolved at translation time, -1 if none
+    int dispatch_record;
 } insn_begin_params_t;
 
 typedef struct insn_end_params {
@@ -127,8 +132,23 @@ typedef struct opcode_range_params {
     pyrebox_target_ulong next_pc;
     uint16_t opcode;
     pyrebox_target_ulong insn_size;
+    //Decoder state, see qemu_glue_callbacks_insn_info.h
+    uint8_t prefix_len;
+    uint8_t modrm_reg;
+    uint8_t insn_class;
 } opcode_range_params_t;
 
+typedef struct branch_params {
+    int cpu_index;
+    qemu_cpu_opaque_t cpu;
+    pyrebox_target_ulong source;
+    pyrebox_target_ulong target;
+    //Address of the instruction after the call, 0 for the rest of kinds
+    pyrebox_target_ulong return_addr;
+    //BRANCH_KIND_* (see qemu_glue_callbacks_insn_info.h)
+    uint32_t kind;
+} branch_params_t;
+
 typedef struct tlb_exec_params {
     qemu_cpu_opaque_t cpu;
     pyrebox_target_ulong vaddr;
@@ -147,6 +167,7 @@ typedef struct vmi_remove_proc_params {
 } vmi_remove_proc_params_t;
 
 typedef struct vmi_context_change_params {
+    int cpu_index;
     pyrebox_target_ulong old_pgd;
     pyrebox_target_ulong new_pgd;
 } vmi_context_change_params_t;
@@ -168,6 +189,7 @@ typedef struct callback_params {
         vmi_create_proc_params_t vmi_create_proc_params;
         vmi_remove_proc_params_t vmi_remove_proc_params;
         vmi_context_change_params_t vmi_context_change_params;
+        branch_params_t branch_params;
    };
 } callback_params_t;
 
@@ -189,6 +211,7 @@ void tlb_exec_callback(callback_params_t params);
 void create_proc_callback(callback_params_t params);
 void remove_proc_callback(callback_params_t params);
 void context_change_callback(callback_params_t params);
+void branch_callback(callback_params_t params);
 
 //Triggers
 typedef int (*trigger_t)(callback_handle_t,callback_params_t);
@@ -198,6 +221,48 @@ typedef void* (*get_var_t)(callback_handle_t,const char*);
 typedef void (*set_var_t)(callback_handle_t,const char*,void*);
 typedef void* (*call_function_t)(callback_handle_t, const char*);
 
+//Trigger ABI v2: the trigger variables are bound to slots of a
+//trigger_context_t (see trigger_helpers.h) when the trigger is loaded
+typedef struct trigger_context trigger_context_t;
+typedef int (*trigger_v2_t)(trigger_context_t*,callback_params_t);
+typedef const char* const* (*trigger_get_var_names_t)(void);
+typedef trigger_context_t* (*create_trigger_context_t)(callback_handle_t,const char* const*);
+
+//Native callbacks. Delivered right after the trigger / monitored process checks,
+//without building any python object.
+typedef void (*native_callback_t)(callback_handle_t handle, callback_params_t params, void* user_data);
+
+//Prefilters. A callback can declare simple conditions on the events it wants
+//to receive. The conditions of all the callbacks of a type are merged into
+//the prefilter evaluated by the generated code before calling the helper
+//(see qemu_glue_callbacks_prefilter.h), so that events no callback accepts
+//never leave the translated code. The address range applies to the pc for
+//block begin / block end / insn begin callbacks, and to the accessed address
+//for memory callbacks. Insn end callbacks do not support address ranges.
+#define PREFILTER_PGD       0x1
+#define PREFILTER_RANGE     0x2
+#define PREFILTER_USER_ONLY 0x4
+
+typedef struct prefilter_conditions {
+    unsigned int flags;
+    pyrebox_target_ulong pgd;
+    //[lo, hi): hi is not included. Merged into the inclusive
+    //[first, last] range of callback_prefilter_t
+    pyrebox_target_ulong lo;
+    pyrebox_target_ulong hi;
+} prefilter_conditions_t;
+
+//Memory watch: range of addresses covered by a memory read / write callback
+typedef struct memory_watch {
+    //[start, end)
+    pyrebox_target_ulong start;
+    pyrebox_target_ulong end;
+    //Address space of the virtual addresses, INV_PGD for any
+    pyrebox_target_ulong pgd;
+    //Non zero: the range contains ram addresses (haddr) instead of virtual addresses
+    int physical;
+} memory_watch_t;
+
 typedef struct memory_address{
     pyrebox_target_ulong address;
     pyrebox_target_ulong pgd;
@@ -216,32 +281,75 @@ extern callback_handle_t callback_handle_counter;
 callback_handle_t add_callback_at(callback_type_t type, module_handle_t module_handle, PyObject* callback_function, pyrebox_target_ulong address, pyrebox_target_ulong pgd);
 callback_handle_t add_callback(callback_type_t type, module_handle_t module_handle, PyObject* callback_function);
 int is_callback_needed(callback_type_t callback_type, pyrebox_target_ulong address);
+int get_dispatch_record(callback_type_t callback_type, pyrebox_target_ulong address);
 void remove_callback(callback_handle_t handle);
 void remove_callback_deferred(callback_handle_t handle);
 void commit_deferred_callback_removes(void);
+void remove_module_callbacks(module_handle_t module_handle);
+//Defer the removal of every callback of a module, like remove_callback_deferred
+void remove_module_callbacks_deferred(module_handle_t module_handle);
+//Batched updates
+void begin_callback_update(void);
+void commit_callback_update(void);
+int is_callback_delivery_in_progress(void);
+//Native callbacks. Address specific callbacks (and opcode ranges) are registered with
+//add_native_callback_at, using the same (address, pgd) / (start, end) convention as
+//the python API. The callbacks are bound to the native plugin being initialized or
+//delivered when they are added, and removed when it is unloaded. From a native callback,
+//use remove_callback_deferred to remove callbacks.
+callback_handle_t add_native_callback(callback_type_t type, native_callback_t callback_function, void* user_data);
+callback_handle_t add_native_callback_at(callback_type_t type, native_callback_t callback_function, void* user_data, pyrebox_target_ulong address, pyrebox_target_ulong pgd);
+module_handle_t set_native_module_context(module_handle_t module_handle);
+//Translate opcodes to the encoding used in the translation switch (0x0Fxx -> 0x01xx)
+pyrebox_target_ulong normalize_opcode(pyrebox_target_ulong opcode);
+//Prefilters. Returns 0 if the conditions are not supported for the callback type
+int set_callback_prefilter(callback_handle_t handle, prefilter_conditions_t conditions);
+//Recompute the prefilters that depend on the set of monitored processes
+void update_callback_prefilters(void);
+//Returns 1 if the generated code can apply the prefilter of the type at the address,
+//that is, if there are no address specific or internal callbacks for it
+int is_prefilter_applicable(callback_type_t callback_type, pyrebox_target_ulong address);
+//Batch delivery. The events of a python callback are encoded as fixed-layout records
+//(see get_callback_record_fields) and delivered together, as a single string of
+//size records, when the batch fills up, on context changes, when the callback is
+//removed, or when flush_callback_batches is called. Returns 0 if the callback type
+//does not support batches.
+int set_callback_batch(callback_handle_t handle, unsigned int size);
+void flush_callback_batches(void);
+//Asynchronous delivery (see async_callbacks.h). The python callback is called
+//from a worker thread with a dictionary of the record fields. mode is one of
+//ASYNC_CALLBACK_BLOCK or ASYNC_CALLBACK_DROP. Returns 0 if the callback type
+//does not support it.
+int set_callback_async(callback_handle_t handle, int mode);
+//Memory watches. Memory read / write callbacks delivered only for the accesses that
+//overlap the watched range. Only the pages in the range leave the fast path of the
+//softmmu (see qemu_glue_callbacks_watch.h), so the rest of memory accesses are not
+//instrumented at all.
+callback_handle_t add_watch_callback(callback_type_t type, module_handle_t module_handle, PyObject* callback_function, memory_watch_t watch);
+callback_handle_t add_native_watch_callback(callback_type_t type, native_callback_t callback_function, void* user_data, memory_watch_t watch);
 //For triggers
 void add_trigger(callback_handle_t callback_handle, char* trigger_path);
 void remove_trigger(callback_handle_t callback_handle);
 void set_trigger_var(callback_handle_t callback_handle, const char* var, void* val);
 void* get_trigger_var(callback_handle_t callback_handle, const char* var);
 void* call_trigger_function(callback_handle_t callback_handle, const char* function_name);
+//Release the value of a trigger variable that was replaced or deleted. A trigger
+//running on another vCPU may still be reading it, so it is freed once no
+//delivery can be running triggers
+void retire_trigger_var(void* val);
 void InitCallbacks(void);
 void FinalizeCallbacks(void);
 
 typedef unsigned int internal_callback_handle_t;
 
-//Internal callbacks, we can place up to a MAX number of internal callbacks
-//that are delivered as OptimizedInsn callbacks, for VMI related actions.
-typedef struct internal_callback{
-    pyrebox_target_ulong pgd;
-    pyrebox_target_ulong pc;
-    callback_t callback_function; 
-} internal_callbacks_t;
+#define INV_INTERNAL_CALLBACK ((internal_callback_handle_t) -1)
 
+//Internal callbacks. Native hooks for VMI related actions, delivered at the
+//beginning of the instruction at pc (for any process if pgd is 0), before
+//any other callback. Returns INV_INTERNAL_CALLBACK on error.
 internal_callback_handle_t add_internal_callback(pyrebox_target_ulong pgd, pyrebox_target_ulong pc, callback_t callback_function);
-// We do not implement an internal callback removal, since these callbacks are supposed to be static for VMI related
-// actions, so there is no need to handle callback removal.
-//void remove_internal_callback(internal_callback_handle_t callback_handle);
+//Can be called from an internal callback, including the one being removed
+void remove_internal_callback(internal_callback_handle_t callback_handle);
 
 #ifdef __cplusplus
 };
@@ -249,6 +357,43 @@ internal_callback_handle_t add_internal_callback(pyrebox_target_ulong pgd, pyreb
 
 #ifdef __cplusplus
 
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "callback_table.h"
+
+//Records of a batched python callback, one array of uint64_t values per event.
+//Appended and flushed with the python mutex held.
+class CallbackBatch
+{
+    public:
+        CallbackBatch(size_t capacity, size_t record_size) : records(capacity * record_size), capacity(capacity), record_size(record_size), count(0) {};
+        //Returns 0 if the batch is full
+        uint64_t* next_record() {
+            if (this->count >= this->capacity){
+                return 0;
+            }
+            return &(this->records[(this->count++) * this->record_size]);
+        };
+        bool is_full() { return (this->count >= this->capacity); };
+        bool is_empty() { return (this->count == 0); };
+        const char* data() { return (const char*) this->records.data(); };
+        size_t data_size() { return this->count * this->record_size * sizeof(uint64_t); };
+        void clear() { this->count = 0; };
+
+    private:
+        std::vector<uint64_t> records;
+        size_t capacity;
+        size_t record_size;
+        size_t count;
+};
+
+//Defined in async_callbacks.cpp
+struct async_callback_target;
+
 class Callback
 {
     public:
@@ -261,26 +406,58 @@ class Callback
         PyObject* get_callback_function() { return this->callback_function; };
         callback_handle_t get_handle() { return this->handle; };
         trigger_t get_trigger() { return this->trigger; };
+        bool has_trigger() { return (this->trigger != 0 || this->trigger_v2 != 0); };
+        //Returns 1 if the event should be delivered
+        int call_trigger(callback_params_t params) {
+            if (this->trigger_v2 != 0){
+                return this->trigger_v2(this->trigger_context, params);
+            }
+            return this->trigger(this->handle, params);
+        };
         void* get_dll_handle() { return this->dll_handle; };
+        native_callback_t get_native_function() { return this->native_function; };
+        void* get_user_data() { return this->user_data; };
+        size_t get_slot() { return this->slot; };
+        prefilter_conditions_t get_prefilter() { return this->prefilter; };
+        virtual bool is_watch() { return false; };
+        //The generated code applies the merged prefilter of the type, so the
+        //conditions of each callback are checked again on delivery
+        bool matches_prefilter(pyrebox_target_ulong pgd, pyrebox_target_ulong address, qemu_cpu_opaque_t cpu) {
+            if (this->prefilter.flags == 0){
+                return true;
+            }
+            if ((this->prefilter.flags & PREFILTER_PGD) && pgd != this->prefilter.pgd){
+                return false;
+            }
+            if ((this->prefilter.flags & PREFILTER_RANGE) && (address < this->prefilter.lo || address >= this->prefilter.hi)){
+                return false;
+            }
+            if ((this->prefilter.flags & PREFILTER_USER_ONLY) && !get_qemu_cpu_user_mode(cpu)){
+                return false;
+            }
+            return true;
+        };
         //Public setters
         void set_callback_type(callback_type_t callback_type) { this->callback_type = callback_type; };
         void set_module_handle(module_handle_t module_handle) { this->module_handle = module_handle; };
         void set_callback_function(PyObject* callback_function) { this->callback_function = callback_function; };
         void set_handle(callback_handle_t handle) { this->handle = handle; };
         void set_trigger(trigger_t trigger) { this->trigger = trigger; };
-        void set_dll_handle(void* dll_handle) { this->dll_handle = dll_handle; };
-        //Comparison operators, for STL collections
-        virtual bool compare_less(Callback* rhs){
-            return this->handle < rhs->handle;
-        }
-        bool operator< (Callback &rhs) {
-            //Calls to the virtual compare_less function, because comparison
-            //operator cannot be polymorphic even if they are virtual. They
-            //cannot be polymorphic because they have different interfaces (the
-            //type of the parameter passed by referece is different in derived
-            //classes).
-            return this->compare_less((Callback*)(&rhs));
+        void set_trigger_v2(trigger_v2_t trigger_v2, trigger_context_t* trigger_context) {
+            this->trigger_context = trigger_context;
+            this->trigger_v2 = trigger_v2;
         };
+        void set_dll_handle(void* dll_handle) { this->dll_handle = dll_handle; };
+        void set_native_function(native_callback_t native_function) { this->native_function = native_function; };
+        void set_user_data(void* user_data) { this->user_data = user_data; };
+        void set_slot(size_t slot) { this->slot = slot; };
+        void set_prefilter(prefilter_conditions_t prefilter) { this->prefilter = prefilter; };
+        CallbackBatch* get_batch() { return this->batch; };
+        void set_batch(CallbackBatch* batch) { this->batch = batch; };
+        int get_async_mode() { return this->async_mode; };
+        void set_async_mode(int async_mode) { this->async_mode = async_mode; };
+        struct async_callback_target* get_async_target() { return this->async_target; };
+        void set_async_target(struct async_callback_target* async_target) { this->async_target = async_target; };
 
     protected:
         callback_type_t callback_type = (callback_type_t) 0;
@@ -289,7 +466,21 @@ class Callback
         callback_handle_t handle = (callback_handle_t)0; // our own handle
         //Trigger
         trigger_t trigger = (trigger_t)0;
+        trigger_v2_t trigger_v2 = (trigger_v2_t)0;
+        trigger_context_t* trigger_context = (trigger_context_t*)0;
         void* dll_handle = (void*)0;
+        //Native consumer, used instead of callback_function when set
+        native_callback_t native_function = (native_callback_t)0;
+        void* user_data = (void*)0;
+        //Position in the CallbackList that holds the callback
+        size_t slot = (size_t)0;
+        //Conditions declared with set_callback_prefilter
+        prefilter_conditions_t prefilter = {0,0,0,0};
+        //Pending records, for python callbacks delivered in batches
+        CallbackBatch* batch = (CallbackBatch*)0;
+        //Observe-only python callbacks delivered by the worker thread
+        int async_mode = 0;
+        struct async_callback_target* async_target = (struct async_callback_target*)0;
 };
 
 class OptimizedInsBeginCallback : public Callback
@@ -299,13 +490,6 @@ class OptimizedInsBeginCallback : public Callback
         memory_address_t get_target_address(){return this->target_address;};
         void set_target_address(memory_address_t target_address){this->target_address = target_address;};
 
-        virtual bool compare_less(Callback* rhs) {
-            OptimizedInsBeginCallback* casted_rhs = dynamic_cast<OptimizedInsBeginCallback*>(rhs);
-            //Exit if it does not belong to the same class
-            assert(casted_rhs != 0);
-            return ((this->target_address.address < casted_rhs->target_address.address) || (this->target_address.address == casted_rhs->target_address.address && this->target_address.pgd < casted_rhs->target_address.pgd));
-        }
-
     protected:
         memory_address_t target_address = {0,0};
 };
@@ -319,13 +503,6 @@ class OptimizedBlockBeginCallback : public Callback
         memory_address_t get_target_address(){return this->target_address;};
         void set_target_address(memory_address_t target_address){this->target_address = target_address;};
 
-        virtual bool compare_less(Callback* rhs) {
-            OptimizedBlockBeginCallback* casted_rhs = dynamic_cast<OptimizedBlockBeginCallback*>(rhs);
-            //Exit if it does not belong to the same class
-            assert(casted_rhs != 0);
-            return ((this->target_address.address < casted_rhs->target_address.address) || (this->target_address.address == casted_rhs->target_address.address && this->target_address.pgd < casted_rhs->target_address.pgd));
-        }
-
     protected:
         memory_address_t target_address = {0,0};
 };
@@ -337,26 +514,596 @@ class OptimizedOpcodeRangeCallback : public Callback
 
         void set_opcode_range(opcode_range_t opcode_range) { this->opcode_range = opcode_range; };
         opcode_range_t get_opcode_range() { return this->opcode_range; };
-        virtual bool compare_less(Callback* rhs) {
-            OptimizedOpcodeRangeCallback* casted_rhs = dynamic_cast<OptimizedOpcodeRangeCallback*>(rhs);
-            //Exit if it does not belong to the same class
-            assert(casted_rhs != 0);
-            return (this->opcode_range.end_opcode < casted_rhs->opcode_range.end_opcode);
-        }
-        
+
     protected:
         opcode_range_t opcode_range = {0,0};
 };
 
+class BranchCallback : public Callback
+{
+    public:
+        BranchCallback(): Callback() {};
+
+        void set_branch_kinds(unsigned int kinds) { this->kinds = kinds; };
+        unsigned int get_branch_kinds() { return this->kinds; };
+        //A branch is delivered if every bit of its kind is selected
+        bool accepts(uint32_t kind) { return (kind & ~this->kinds) == 0; };
+
+    protected:
+        unsigned int kinds = BRANCH_KIND_ALL;
+};
+
+class WatchCallback : public Callback
+{
+    public:
+        WatchCallback(): Callback() {};
+        bool is_watch() { return true; };
+        memory_watch_t get_watch() { return this->watch; };
+        void set_watch(memory_watch_t watch) { this->watch = watch; };
+        //Returns true if an access of size bytes at address overlaps the watched range
+        bool covers(pyrebox_target_ulong address, pyrebox_target_ulong size) {
+            return (address < this->watch.end && address + size > this->watch.start);
+        };
+        //Watches that span more than WATCH_MAX_PAGES pages are not inserted in
+        //the watched pages, they are delivered from the MEM_READ_CB / MEM_WRITE_CB
+        //instrumentation of every access instead
+        bool is_wide();
+
+    protected:
+        memory_watch_t watch = {0,0,0,0};
+};
+
+/** Hash and equality functors for the callback tables **/
+struct MemoryAddressHash {
+    uint64_t operator()(const memory_address_t& key) const
+    {
+        return callback_table_mix((uint64_t)key.address ^ ((uint64_t)key.pgd * 0x9e3779b97f4a7c15ULL));
+    }
+};
+
+struct MemoryAddressEqual {
+    bool operator()(const memory_address_t& lhs, const memory_address_t& rhs) const
+    {
+        return (lhs.address == rhs.address && lhs.pgd == rhs.pgd);
+    }
+};
+
+struct MemoryAddressLess {
+    bool operator()(const memory_address_t& lhs, const memory_address_t& rhs) const
+    {
+        return (lhs.address < rhs.address || (lhs.address == rhs.address && lhs.pgd < rhs.pgd));
+    }
+};
+
+struct TargetAddressHash {
+    uint64_t operator()(const pyrebox_target_ulong& key) const
+    {
+        return callback_table_mix((uint64_t)key);
+    }
+};
 
-/** Comparison for multiset of Callback* **/
-struct CompareCallbackP {
-    bool operator()(Callback* lhs, Callback* rhs)
+struct TargetAddressEqual {
+    bool operator()(const pyrebox_target_ulong& lhs, const pyrebox_target_ulong& rhs) const
     {
-        return lhs->compare_less(rhs);
+        return (lhs == rhs);
     }
 };
 
+struct CallbackHandleHash {
+    uint64_t operator()(const callback_handle_t& key) const
+    {
+        return callback_table_mix((uint64_t)key);
+    }
+};
+
+struct CallbackHandleEqual {
+    bool operator()(const callback_handle_t& lhs, const callback_handle_t& rhs) const
+    {
+        return (lhs == rhs);
+    }
+};
+
+//Internal callbacks (add_internal_callback), indexed by address, so that both the
+//delivery and the checks at translation time are a single hash lookup. The VMI
+//adds and removes them from the vCPU threads, without the python mutex, so the
+//table has its own lock. It is not held while the callbacks run.
+class InternalCallbackTable
+{
+    public:
+        InternalCallbackTable() : next_handle(0), count(0) {
+            pthread_mutex_init(&(this->lock), 0);
+        };
+        ~InternalCallbackTable() {
+            pthread_mutex_destroy(&(this->lock));
+        };
+
+        internal_callback_handle_t insert(pyrebox_target_ulong pgd, pyrebox_target_ulong pc, callback_t callback_function) {
+            pthread_mutex_lock(&(this->lock));
+            internal_callback_handle_t handle = this->next_handle++;
+            Entry entry;
+            entry.handle = handle;
+            entry.pgd = pgd;
+            entry.callback_function = callback_function;
+            this->by_address.insert(pc).push_back(entry);
+            this->by_handle.insert(handle) = pc;
+            this->count.store(this->by_handle.size(), std::memory_order_relaxed);
+            pthread_mutex_unlock(&(this->lock));
+            return handle;
+        };
+        //Returns false if the handle is unknown. Otherwise, pc is set to the
+        //address of the callback.
+        bool erase(internal_callback_handle_t handle, pyrebox_target_ulong* pc) {
+            pthread_mutex_lock(&(this->lock));
+            pyrebox_target_ulong* address = this->by_handle.find(handle);
+            if (address == 0){
+                pthread_mutex_unlock(&(this->lock));
+                return false;
+            }
+            *pc = *address;
+            this->by_handle.erase(handle);
+            std::vector<Entry>* entries = this->by_address.find(*pc);
+            for (std::vector<Entry>::iterator it = entries->begin(); it != entries->end(); ++it){
+                if (it->handle == handle){
+                    entries->erase(it);
+                    break;
+                }
+            }
+            if (entries->size() == 0){
+                this->by_address.erase(*pc);
+            }
+            this->count.store(this->by_handle.size(), std::memory_order_relaxed);
+            pthread_mutex_unlock(&(this->lock));
+            return true;
+        };
+        bool has_address(pyrebox_target_ulong pc) {
+            if (this->count.load(std::memory_order_relaxed) == 0){
+                return false;
+            }
+            pthread_mutex_lock(&(this->lock));
+            bool found = (this->by_address.find(pc) != 0);
+            pthread_mutex_unlock(&(this->lock));
+            return found;
+        };
+        void deliver(pyrebox_target_ulong pc, pyrebox_target_ulong pgd, callback_params_t params) {
+            if (this->count.load(std::memory_order_relaxed) == 0){
+                return;
+            }
+            //The callbacks can add and remove callbacks, so they are called on a copy
+            std::vector<Entry> matching;
+            pthread_mutex_lock(&(this->lock));
+            std::vector<Entry>* entries = this->by_address.find(pc);
+            if (entries != 0){
+                for (std::vector<Entry>::iterator it = entries->begin(); it != entries->end(); ++it){
+                    if (it->pgd == 0 || it->pgd == pgd){
+                        matching.push_back(*it);
+                    }
+                }
+            }
+            pthread_mutex_unlock(&(this->lock));
+            for (size_t i = 0; i < matching.size(); ++i){
+                //Skip the ones removed by the previous callbacks
+                if (i > 0 && !this->has_handle(matching[i].handle)){
+                    continue;
+                }
+                matching[i].callback_function(params);
+            }
+        };
+
+    private:
+        struct Entry {
+            internal_callback_handle_t handle;
+            pyrebox_target_ulong pgd;
+            callback_t callback_function;
+        };
+        bool has_handle(internal_callback_handle_t handle) {
+            pthread_mutex_lock(&(this->lock));
+            bool found = (this->by_handle.find(handle) != 0);
+            pthread_mutex_unlock(&(this->lock));
+            return found;
+        };
+
+        OpenAddressingTable<pyrebox_target_ulong, std::vector<Entry>, TargetAddressHash, TargetAddressEqual> by_address;
+        OpenAddressingTable<internal_callback_handle_t, pyrebox_target_ulong, CallbackHandleHash, CallbackHandleEqual> by_handle;
+        internal_callback_handle_t next_handle;
+        pthread_mutex_t lock;
+        //Number of callbacks, read without the lock for the common case of an empty table
+        std::atomic<size_t> count;
+};
+
+//Callbacks of a catch-all type, in handle order. A removed callback leaves
+//a hole (0) that is skipped by the iterator, and holes are compacted once
+//they outnumber the live callbacks, so that removal takes amortized constant
+//time.
+class CallbackList
+{
+    public:
+        //Forward iterator that skips the holes
+        class iterator
+        {
+            public:
+                iterator(std::vector<Callback*>::iterator it, std::vector<Callback*>::iterator last) : it(it), last(last) { this->skip_holes(); };
+                Callback*& operator*() { return *(this->it); };
+                iterator& operator++() { ++(this->it); this->skip_holes(); return *this; };
+                bool operator==(const iterator& rhs) const { return this->it == rhs.it; };
+                bool operator!=(const iterator& rhs) const { return this->it != rhs.it; };
+            private:
+                void skip_holes() {
+                    while (this->it != this->last && *(this->it) == 0){
+                        ++(this->it);
+                    }
+                };
+                std::vector<Callback*>::iterator it;
+                std::vector<Callback*>::iterator last;
+        };
+
+        CallbackList() : live(0) {};
+
+        iterator begin() { return iterator(this->entries.begin(), this->entries.end()); };
+        iterator end() { return iterator(this->entries.end(), this->entries.end()); };
+        size_t size() { return this->live; };
+        void push_back(Callback* cb) {
+            cb->set_slot(this->entries.size());
+            this->entries.push_back(cb);
+            this->live++;
+        };
+        bool erase(Callback* cb) {
+            size_t slot = cb->get_slot();
+            if (slot >= this->entries.size() || this->entries[slot] != cb){
+                return false;
+            }
+            this->entries[slot] = 0;
+            this->live--;
+            if (this->live * 2 < this->entries.size()){
+                this->compact();
+            }
+            return true;
+        };
+        void clear() {
+            this->entries.clear();
+            this->live = 0;
+        };
+
+    private:
+        void compact() {
+            size_t j = 0;
+            for (size_t i = 0; i < this->entries.size(); ++i){
+                if (this->entries[i] != 0){
+                    this->entries[i]->set_slot(j);
+                    this->entries[j++] = this->entries[i];
+                }
+            }
+            this->entries.resize(j);
+        };
+
+        std::vector<Callback*> entries;
+        size_t live;
+};
+
+//Index of the opcode range callbacks. A bitmap of the 65536 (normalized)
+//opcodes covered by any range answers the checks at translation time with a
+//single bit test, and the opcode space is split at the range boundaries into
+//segments that hold the callbacks covering them (in handle order), for the
+//delivery. The index is read by the translation of every vCPU, so it is never
+//modified once built: the callback manager builds a new one whenever the
+//ranges change.
+class OpcodeRangeIndex
+{
+    public:
+        OpcodeRangeIndex(CallbackList& callbacks) {
+            memset(this->bitmap, 0, sizeof(this->bitmap));
+            std::vector<uint32_t> bounds;
+            for (CallbackList::iterator it = callbacks.begin(); it != callbacks.end(); ++it){
+                opcode_range_t range = ((OptimizedOpcodeRangeCallback*)(*it))->get_opcode_range();
+                for (uint32_t opcode = range.start_opcode; opcode <= range.end_opcode; ++opcode){
+                    this->bitmap[opcode >> 6] |= ((uint64_t) 1 << (opcode & 63));
+                }
+                bounds.push_back(range.start_opcode);
+                bounds.push_back((uint32_t) range.end_opcode + 1);
+            }
+            std::sort(bounds.begin(), bounds.end());
+            bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+            for (size_t i = 0; i + 1 < bounds.size(); ++i){
+                this->starts.push_back(bounds[i]);
+                this->segments.push_back(std::vector<Callback*>());
+                for (CallbackList::iterator it = callbacks.begin(); it != callbacks.end(); ++it){
+                    opcode_range_t range = ((OptimizedOpcodeRangeCallback*)(*it))->get_opcode_range();
+                    if (range.start_opcode <= bounds[i] && bounds[i] <= range.end_opcode){
+                        this->segments.back().push_back(*it);
+                    }
+                }
+            }
+        };
+        bool test(uint16_t opcode) {
+            return ((this->bitmap[opcode >> 6] >> (opcode & 63)) & 1) != 0;
+        };
+        //Callbacks whose range covers the opcode, 0 if none
+        std::vector<Callback*>* find(uint16_t opcode) {
+            if (!this->test(opcode)){
+                return 0;
+            }
+            std::vector<uint32_t>::iterator it = std::upper_bound(this->starts.begin(), this->starts.end(), (uint32_t) opcode);
+            return &(this->segments[(it - this->starts.begin()) - 1]);
+        };
+
+    private:
+        uint64_t bitmap[65536 / 64];
+        //Segment i covers [starts[i], starts[i + 1])
+        std::vector<uint32_t> starts;
+        std::vector<std::vector<Callback*> > segments;
+};
+
+//Callback attached to an address, together with the pgd it applies to
+struct TargetedCallback {
+    pyrebox_target_ulong pgd;
+    Callback* cb;
+};
+
+//Callbacks attached to a given (address, pgd) pair. Callbacks for the same
+//pair are kept in insertion order. A second table keeps the callbacks per
+//address regardless of the pgd, because at translation time we only know
+//the address.
+class AddressCallbackTable
+{
+    public:
+        AddressCallbackTable() : count(0) {};
+
+        std::vector<Callback*>* find(pyrebox_target_ulong address, pyrebox_target_ulong pgd) {
+            memory_address_t key;
+            key.address = address;
+            key.pgd = pgd;
+            return this->by_target.find(key);
+        };
+        std::vector<TargetedCallback>* find_address(pyrebox_target_ulong address) {
+            return this->by_address.find(address);
+        };
+        bool has_address(pyrebox_target_ulong address) {
+            return (this->by_address.find(address) != 0);
+        };
+        void insert(memory_address_t target_address, Callback* cb) {
+            TargetedCallback entry;
+            entry.pgd = target_address.pgd;
+            entry.cb = cb;
+            this->by_target.insert(target_address).push_back(cb);
+            this->by_address.insert(target_address.address).push_back(entry);
+            this->count++;
+        };
+        bool erase(memory_address_t target_address, Callback* cb) {
+            std::vector<Callback*>* cbs = this->by_target.find(target_address);
+            if (cbs == 0){
+                return false;
+            }
+            std::vector<Callback*>::iterator it = std::find(cbs->begin(), cbs->end(), cb);
+            if (it == cbs->end()){
+                return false;
+            }
+            cbs->erase(it);
+            if (cbs->size() == 0){
+                this->by_target.erase(target_address);
+            }
+            std::vector<TargetedCallback>* entries = this->by_address.find(target_address.address);
+            if (entries != 0){
+                for (std::vector<TargetedCallback>::iterator e = entries->begin(); e != entries->end(); ++e){
+                    if (e->cb == cb){
+                        entries->erase(e);
+                        break;
+                    }
+                }
+                if (entries->size() == 0){
+                    this->by_address.erase(target_address.address);
+                }
+            }
+            this->count--;
+            return true;
+        };
+        void clear() {
+            this->by_target.clear();
+            this->by_address.clear();
+            this->count = 0;
+        };
+        size_t size() { return this->count; };
+
+    private:
+        OpenAddressingTable<memory_address_t, std::vector<Callback*>, MemoryAddressHash, MemoryAddressEqual> by_target;
+        OpenAddressingTable<pyrebox_target_ulong, std::vector<TargetedCallback>, TargetAddressHash, TargetAddressEqual> by_address;
+        size_t count;
+};
+
+//Watch callbacks of a memory access type, indexed by the pages they cover.
+//Virtual and physical (ram address) pages are kept in separate tables.
+class WatchPageTable
+{
+    public:
+        WatchPageTable() {};
+
+        std::vector<Callback*>* find(pyrebox_target_ulong page, bool physical) {
+            return this->get_table(physical).find(page);
+        };
+        //Returns true if the page was not watched before
+        bool insert(pyrebox_target_ulong page, bool physical, Callback* cb) {
+            std::vector<Callback*>& cbs = this->get_table(physical).insert(page);
+            cbs.push_back(cb);
+            return (cbs.size() == 1);
+        };
+        //Returns true if the page is not watched anymore
+        bool erase(pyrebox_target_ulong page, bool physical, Callback* cb) {
+            std::vector<Callback*>* cbs = this->get_table(physical).find(page);
+            if (cbs == 0){
+                return false;
+            }
+            std::vector<Callback*>::iterator it = std::find(cbs->begin(), cbs->end(), cb);
+            if (it == cbs->end()){
+                return false;
+            }
+            cbs->erase(it);
+            if (cbs->size() == 0){
+                this->get_table(physical).erase(page);
+                return true;
+            }
+            return false;
+        };
+        void clear() {
+            this->virtual_pages.clear();
+            this->physical_pages.clear();
+        };
+        size_t pages() { return this->virtual_pages.size() + this->physical_pages.size(); };
+        //Iterate over the watched pages, f(page, physical, callbacks)
+        template <typename F>
+        void for_each_page(F f) {
+            this->virtual_pages.for_each([&f](const pyrebox_target_ulong& page, std::vector<Callback*>& cbs) { f(page, false, cbs); });
+            this->physical_pages.for_each([&f](const pyrebox_target_ulong& page, std::vector<Callback*>& cbs) { f(page, true, cbs); });
+        };
+
+    private:
+        typedef OpenAddressingTable<pyrebox_target_ulong, std::vector<Callback*>, TargetAddressHash, TargetAddressEqual> PageTable;
+        PageTable& get_table(bool physical) { return physical ? this->physical_pages : this->virtual_pages; };
+
+        PageTable virtual_pages;
+        PageTable physical_pages;
+};
+
+//Snapshot of the watched pages: their WATCH_READ / WATCH_WRITE flags, looked up
+//by the TLB fills, and the watches that cover them, looked up by the memory
+//access deliveries. Both run on the vCPU threads. A snapshot is never modified
+//once published: the callback manager builds a new one whenever the watched
+//pages change.
+class WatchPageSnapshot
+{
+    public:
+        WatchPageSnapshot() {};
+        void add(callback_type_t type, pyrebox_target_ulong page, bool physical, int flags, std::vector<Callback*>& cbs) {
+            this->get_flag_table(physical).insert(page) |= flags;
+            this->get_callback_table(type, physical).insert(page) = cbs;
+        };
+        int get_flags(pyrebox_target_ulong page, bool physical) {
+            int* flags = this->get_flag_table(physical).find(page);
+            return (flags != 0) ? *flags : 0;
+        };
+        //Watches of a memory access type that cover the page, 0 if none
+        std::vector<Callback*>* find(callback_type_t type, pyrebox_target_ulong page, bool physical) {
+            return this->get_callback_table(type, physical).find(page);
+        };
+
+    private:
+        typedef OpenAddressingTable<pyrebox_target_ulong, int, TargetAddressHash, TargetAddressEqual> FlagTable;
+        typedef OpenAddressingTable<pyrebox_target_ulong, std::vector<Callback*>, TargetAddressHash, TargetAddressEqual> CallbackTable;
+        FlagTable& get_flag_table(bool physical) { return physical ? this->physical_flags : this->virtual_flags; };
+        CallbackTable& get_callback_table(callback_type_t type, bool physical) {
+            if (type == MEM_READ_CB){
+                return physical ? this->physical_reads : this->virtual_reads;
+            }
+            return physical ? this->physical_writes : this->virtual_writes;
+        };
+
+        FlagTable virtual_flags;
+        FlagTable physical_flags;
+        CallbackTable virtual_reads;
+        CallbackTable physical_reads;
+        CallbackTable virtual_writes;
+        CallbackTable physical_writes;
+};
+
+//Dispatch record: the address-specific callbacks for a given address,
+//resolved at translation time. The index of the record is passed as an
+//argument to the block/insn begin helpers, so that the callbacks can be
+//delivered without searching the callback tables again.
+struct DispatchRecord {
+    pyrebox_target_ulong address;
+    //The record is valid only if it matches the generation of the arena
+    unsigned int generation;
+    std::vector<TargetedCallback> callbacks;
+};
+
+#define DISPATCH_RECORD_CHUNK_BITS 10
+#define DISPATCH_RECORD_CHUNK_SIZE (1 << DISPATCH_RECORD_CHUNK_BITS)
+#define DISPATCH_RECORD_MAX_CHUNKS 4096
+
+//Records are allocated once per address, in chunks that are never moved,
+//so a record stays at the same place while translated code carries its
+//index. Records are created by the translation of the vCPU threads, under
+//the lock of the arena, and read by the deliveries, under the python mutex:
+//a record is only visible to get_record once it is complete. Records become
+//stale when the callbacks for their address change, and are resolved again
+//on their next use. They are all freed by reset, when the translated code
+//is flushed.
+class DispatchRecordArena
+{
+    public:
+        DispatchRecordArena() : count(0), generation(1) {
+            pthread_mutex_init(&this->lock, 0);
+            memset(this->chunks, 0, sizeof(this->chunks));
+        };
+        ~DispatchRecordArena() {
+            this->reset();
+            pthread_mutex_destroy(&this->lock);
+        };
+
+        //Returns the index of the record for the address, creating it if
+        //needed, or -1 if the arena is full
+        int get_record_index(pyrebox_target_ulong address) {
+            pthread_mutex_lock(&this->lock);
+            int* index = this->by_address.find(address);
+            if (index != 0){
+                int found = *index;
+                pthread_mutex_unlock(&this->lock);
+                return found;
+            }
+            size_t next = this->count.load(std::memory_order_relaxed);
+            size_t chunk = next >> DISPATCH_RECORD_CHUNK_BITS;
+            if (chunk >= DISPATCH_RECORD_MAX_CHUNKS){
+                pthread_mutex_unlock(&this->lock);
+                return -1;
+            }
+            if (this->chunks[chunk] == 0){
+                this->chunks[chunk] = new DispatchRecord[DISPATCH_RECORD_CHUNK_SIZE];
+            }
+            DispatchRecord& record = this->chunks[chunk][next & (DISPATCH_RECORD_CHUNK_SIZE - 1)];
+            record.address = address;
+            record.generation = 0;
+            record.callbacks.clear();
+            this->by_address.insert(address) = (int) next;
+            this->count.store(next + 1, std::memory_order_release);
+            pthread_mutex_unlock(&this->lock);
+            return (int) next;
+        };
+        DispatchRecord* get_record(int index) {
+            if (index < 0 || (size_t)index >= this->count.load(std::memory_order_acquire)){
+                return 0;
+            }
+            return &(this->chunks[index >> DISPATCH_RECORD_CHUNK_BITS][index & (DISPATCH_RECORD_CHUNK_SIZE - 1)]);
+        };
+        bool is_valid(DispatchRecord* record) { return (record->generation == this->generation); };
+        void validate(DispatchRecord* record) { record->generation = this->generation; };
+        void invalidate(pyrebox_target_ulong address) {
+            pthread_mutex_lock(&this->lock);
+            int* index = this->by_address.find(address);
+            if (index != 0){
+                this->get_record(*index)->generation = 0;
+            }
+            pthread_mutex_unlock(&this->lock);
+        };
+        void invalidate_all() { this->generation++; };
+        //Free every record. Only called when no translated code can carry
+        //an index (the translation cache is being flushed, with the vCPUs
+        //stopped), so no delivery can be using them
+        void reset() {
+            pthread_mutex_lock(&this->lock);
+            this->count.store(0, std::memory_order_release);
+            for (size_t i = 0; i < DISPATCH_RECORD_MAX_CHUNKS && this->chunks[i] != 0; ++i){
+                delete[] this->chunks[i];
+                this->chunks[i] = 0;
+            }
+            this->by_address.clear();
+            pthread_mutex_unlock(&this->lock);
+        };
+
+    private:
+        pthread_mutex_t lock;
+        DispatchRecord* chunks[DISPATCH_RECORD_MAX_CHUNKS];
+        std::atomic<size_t> count;
+        OpenAddressingTable<pyrebox_target_ulong, int, TargetAddressHash, TargetAddressEqual> by_address;
+        unsigned int generation;
+};
+
 
 class CallbackManager
 {
@@ -365,24 +1112,111 @@ class CallbackManager
             ~CallbackManager();
             callback_handle_t add_callback(callback_type_t type, module_handle_t module_handle, PyObject* callback_function, pyrebox_target_ulong address);
             callback_handle_t add_callback(callback_type_t type, module_handle_t module_handle, PyObject* callback_function, pyrebox_target_ulong address,pyrebox_target_ulong pgd);
+            callback_handle_t add_native_callback(callback_type_t type, module_handle_t module_handle, native_callback_t callback_function, void* user_data, pyrebox_target_ulong address, pyrebox_target_ulong pgd);
+            callback_handle_t add_watch_callback(callback_type_t type, module_handle_t module_handle, PyObject* callback_function, native_callback_t native_function, void* user_data, memory_watch_t watch);
             void deliver_callback(callback_type_t type,callback_params_t params);
             void remove_callback(callback_handle_t handle);
             void remove_callback_deferred(callback_handle_t handle);
             void commit_deferred_callback_removes();
             void remove_all_callbacks();
             void remove_module_callbacks(module_handle_t handle);
+            void remove_module_callbacks_deferred(module_handle_t handle);
+            bool are_removes_committed();
             void add_trigger(callback_handle_t callback_handle,char* trigger_path);
             void remove_trigger(callback_handle_t callback_handle);
             void set_trigger_var(callback_handle_t callback_handle,const char* var,void* val);
             void* get_trigger_var(callback_handle_t callback_handle,const char* var);
             void* call_trigger_function(callback_handle_t callback_handle, const char* function_name);
             int is_callback_needed(callback_type_t callback_type, pyrebox_target_ulong address);
+            int get_dispatch_record(callback_type_t callback_type, pyrebox_target_ulong address);
+            void reset_dispatch_records();
+            void begin_update();
+            void commit_update();
+            bool is_delivering() { return this->delivery_depth > 0; };
+            int set_prefilter(callback_handle_t handle, prefilter_conditions_t conditions);
+            void update_prefilters();
+            int is_prefilter_applicable(callback_type_t callback_type, pyrebox_target_ulong address);
+            int get_page_watch_flags(pyrebox_target_ulong vaddr_page, pyrebox_target_ulong ram_page);
+            int set_batch(callback_handle_t handle, unsigned int size);
+            void flush_batches();
+            bool has_batches() { return !this->batched_callbacks.empty(); };
+            internal_callback_handle_t add_internal_callback(pyrebox_target_ulong pgd, pyrebox_target_ulong pc, callback_t callback_function);
+            void remove_internal_callback(internal_callback_handle_t handle);
+            int set_async(callback_handle_t handle, int mode);
         protected:
         private:
-            //Array of lists, used to hold the pyrebox callbacks
-            std::multiset<Callback*,CompareCallbackP> callbacks[LAST_CB];
+            //Array of lists, used to hold the pyrebox callbacks for the
+            //catch-all types (in handle order). OP_BLOCK_BEGIN_CB and
+            //OP_INSN_BEGIN_CB are held in hash tables keyed by (address, pgd).
+            CallbackList callbacks[LAST_CB];
+            AddressCallbackTable op_block_begin_callbacks;
+            AddressCallbackTable op_insn_begin_callbacks;
+            //Native hooks of the VMI, delivered before the rest of insn begin callbacks
+            InternalCallbackTable internal_callbacks;
+            //Opcodes covered by the OPCODE_RANGE_CB callbacks, accessed with
+            //std::atomic_load / std::atomic_store. Null if there are none.
+            std::shared_ptr<OpcodeRangeIndex> opcode_ranges;
+            bool opcode_ranges_dirty;
+            void publish_opcode_ranges();
+            //Union of the kinds selected by the BRANCH_CB callbacks
+            unsigned int branch_kinds;
+            //Every registered callback, indexed by handle
+            OpenAddressingTable<callback_handle_t, Callback*, CallbackHandleHash, CallbackHandleEqual> callbacks_by_handle;
+            //Dispatch records for OP_BLOCK_BEGIN_CB and OP_INSN_BEGIN_CB
+            DispatchRecordArena block_begin_records;
+            DispatchRecordArena insn_begin_records;
+            //Memory watches (MEM_READ_CB and MEM_WRITE_CB callbacks restricted to a range)
+            WatchPageTable read_watches;
+            WatchPageTable write_watches;
+            //Snapshot of the watched pages for get_page_watch_flags and the
+            //memory access deliveries, accessed with std::atomic_load /
+            //std::atomic_store. Null if there are no watches.
+            std::shared_ptr<WatchPageSnapshot> watch_pages;
+            void publish_watch_pages();
             std::list<callback_handle_t> callback_remove_list;
+            //Batched updates (begin_update / commit_update). Callbacks added
+            //during an update are not delivered until it is committed, and the
+            //translated code is only invalidated once, on commit.
+            unsigned int update_depth;
+            //Nesting of deliver_callback in the current thread. An update committed
+            //by a callback while its delivery is in progress is applied when the
+            //delivery finishes, as the callbacks being delivered must stay alive
+            //until then. Updates committed from other threads are not affected.
+            static thread_local unsigned int delivery_depth;
+            bool commit_deferred;
+            void end_delivery();
+            void close_unloaded_modules();
+            std::vector<Callback*> pending_adds;
+            std::vector<callback_handle_t> pending_removes;
+            std::vector<memory_address_t> pending_invalidations;
+            bool pending_flush;
+            //Callback types whose prefilter must be recomputed (bit mask)
+            unsigned int prefilters_dirty;
+            //Batched python callbacks, flushed on context changes
+            std::vector<Callback*> batched_callbacks;
+            size_t count_callbacks(callback_type_t type);
+            void collect_address_callbacks(std::vector<Callback*>& callbacks_needed, callback_type_t type, int record_index, pyrebox_target_ulong address, pyrebox_target_ulong pgd, callback_params_t params);
+            void collect_watch_callbacks(std::vector<Callback*>& callbacks_needed, callback_type_t type, pyrebox_target_ulong pgd, qemu_cpu_opaque_t cpu, callback_params_t params);
+            bool watch_applies(WatchCallback* cb, callback_type_t type, pyrebox_target_ulong pgd, qemu_cpu_opaque_t cpu, callback_params_t& params);
+            void update_watched_pages(WatchCallback* cb, bool added);
+            Callback* find_callback(callback_handle_t handle);
+            void detach_callback(Callback* cb);
+            void destroy_callback(Callback* cb);
+            Callback* create_callback(callback_type_t type, pyrebox_target_ulong address, pyrebox_target_ulong pgd);
+            callback_handle_t register_callback(Callback* cb, callback_type_t type, module_handle_t module_handle);
+            void attach_callback(Callback* cb);
+            bool take_pending_add(Callback* cb);
+            void request_flush();
+            void request_invalidation(pyrebox_target_ulong pgd, pyrebox_target_ulong address);
+            bool opcode_range_covered(opcode_range_t range, Callback* excluded);
+            unsigned int get_branch_kinds(Callback* excluded);
+            void invalidate_translated_code(Callback* cb, bool added);
+            void unload_trigger(Callback* cb);
+            void mark_prefilter_dirty(callback_type_t type);
+            void refresh_prefilters();
             void clean_callbacks();
+            void flush_batch(Callback* cb);
+            std::shared_ptr<OpcodeRangeIndex> get_opcode_ranges();
 };
 #endif //__cplusplus
 
@@ -67,7 +67,20 @@ gdb_map_x86_64_softmmu = {0: ("RAX", "Rax", 8, RT_REGULAR),
                         22: ("FS", "SegFs", 4, RT_SEGMENT),
                         23: ("GS" "SegGs", 4, RT_SEGMENT)}
 
-class X86CPU:
+class CPUStateMeta(type):
+    '''
+    Metaclass for X86CPU and X64CPU. The callbacks receive a
+    c_api.CPUStateProxy, that reads the registers on demand, instead of
+    a X86CPU/X64CPU object. This makes isinstance() checks accept it too.
+    '''
+    def __instancecheck__(cls, instance):
+        if getattr(type(instance), "cpu_class", None) == cls.__name__:
+            return True
+        return type.__instancecheck__(cls, instance)
+
+
+class X86CPU(object):
+    __metaclass__ = CPUStateMeta
     reg_nums = {"EAX": 0,
                 "ECX": 1,
                 "EDX": 2,
@@ -239,7 +252,8 @@ class X86CPU:
         return result
 
 
-class X64CPU:
+class X64CPU(object):
+    __metaclass__ = CPUStateMeta
     reg_nums = {"RAX": 0,
                 "RCX": 1,
                 "RDX": 2,
@@ -31,6 +31,7 @@ extern "C"{
 #include "qemu_glue.h"
 #include "utils.h"
 #include "pyrebox.h"
+#include "python_symbols.h"
 }
 #include "vmi.h"
 #include "linux_vmi.h"
@@ -86,29 +87,20 @@ void linux_init_address_space(){
 
    utils_print_debug("[*] Initializing volatility address space...\n");
    if (init_task_offset != 0){
-       PyObject* py_module_name = PyString_FromString("linux_vmi");
-       PyObject* py_vmi_module = PyImport_Import(py_module_name);
-       Py_DECREF(py_module_name);
-       if(py_vmi_module != NULL){
-           PyObject* py_linux_init_address_space = PyObject_GetAttrString(py_vmi_module,"linux_init_address_space");
-           if (py_linux_init_address_space){
-               if (PyCallable_Check(py_linux_init_address_space)){
-                    PyObject* ret = PyObject_CallObject(py_linux_init_address_space,NULL);
-                    if (ret){
-                        if (ret == Py_True){
-                            utils_print_debug("[*] Volatility address space initialized!\n");
-                        } else{
-                            utils_print_error("[!] Could not initialize address space!");
-                        }
-                        Py_DECREF(ret);
-                    }
-                    else{
-                        utils_print_error("[!] Could not initialize address space!");
-                    }
-               }
-               Py_XDECREF(py_linux_init_address_space);
-           }
-           Py_DECREF(py_vmi_module);
+       PyObject* py_linux_init_address_space = python_symbol_get(PY_SYM_LINUX_INIT_ADDRESS_SPACE);
+       if (py_linux_init_address_space){
+            PyObject* ret = PyObject_CallObject(py_linux_init_address_space,NULL);
+            if (ret){
+                if (ret == Py_True){
+                    utils_print_debug("[*] Volatility address space initialized!\n");
+                } else{
+                    utils_print_error("[!] Could not initialize address space!");
+                }
+                Py_DECREF(ret);
+            }
+            else{
+                utils_print_error("[!] Could not initialize address space!");
+            }
        }
    }
 
@@ -129,102 +121,83 @@ void linux_vmi_init(os_index_t os_index){
    utils_print_debug("[*] Setting up Linux Profile...\n");
 
    //Update the OS family in the Python VMI module
-   PyObject* py_module_name = PyString_FromString("vmi");
-   PyObject* py_vmi_module = PyImport_Import(py_module_name);
-   Py_DECREF(py_module_name);
-
-   if(py_vmi_module != NULL){
-       PyObject* py_setosfamily = PyObject_GetAttrString(py_vmi_module,"set_os_family_linux");
-       if (py_setosfamily){
-           if (PyCallable_Check(py_setosfamily)){
-                PyObject* py_args = PyTuple_New(0);
-                PyObject* ret = PyObject_CallObject(py_setosfamily,py_args);
-                Py_DECREF(py_args);
-                if (ret){
-                    Py_DECREF(ret);
-                }
-           }
-           Py_XDECREF(py_setosfamily);
-       }
-       Py_DECREF(py_vmi_module);
+   PyObject* py_setosfamily = python_symbol_get(PY_SYM_SET_OS_FAMILY_LINUX);
+   if (py_setosfamily){
+        PyObject* py_args = PyTuple_New(0);
+        PyObject* ret = PyObject_CallObject(py_setosfamily,py_args);
+        Py_DECREF(py_args);
+        if (ret){
+            Py_DECREF(ret);
+        }
    }
 
    if (init_task_offset == 0){
-       PyObject* py_module_name = PyString_FromString("linux_vmi");
-       PyObject* py_vmi_module = PyImport_Import(py_module_name);
-       Py_DECREF(py_module_name);
-       if(py_vmi_module != NULL){
-           PyObject* py_linux_get_offsets = PyObject_GetAttrString(py_vmi_module,"linux_get_offsets");
-           if (py_linux_get_offsets){
-               if (PyCallable_Check(py_linux_get_offsets)){
-                    PyObject* ret = PyObject_CallObject(py_linux_get_offsets,NULL);
-                    //Parse return and get offsets
-                    if (ret){
-                        PyObject* py_init_task_offset = PyTuple_GetItem(ret,0);
-                        PyObject* py_comm_offset = PyTuple_GetItem(ret,1);
-                        PyObject* py_pid_offset = PyTuple_GetItem(ret,2);
-                        PyObject* py_tasks_offset = PyTuple_GetItem(ret,3);
-                        PyObject* py_mm_offset = PyTuple_GetItem(ret,4);
-                        PyObject* py_pgd_offset = PyTuple_GetItem(ret,5);
-                        PyObject* py_parent_offset = PyTuple_GetItem(ret,6);
-                        PyObject* py_exit_state_offset = PyTuple_GetItem(ret,7);
-                        PyObject* py_thread_stack_size = PyTuple_GetItem(ret,8);
-                        PyObject* py_proc_exec_connector_offset = PyTuple_GetItem(ret,9);
-                        PyObject* py_trim_init_extable_offset = PyTuple_GetItem(ret,10);
-                        PyObject* py_proc_exit_connector_offset = PyTuple_GetItem(ret,11);
-
-                        if (arch_bits[os_index] == 32){
-                            init_task_offset = PyLong_AsUnsignedLong(py_init_task_offset);
-                            pid_offset = PyLong_AsUnsignedLong(py_pid_offset);
-                            comm_offset = PyLong_AsUnsignedLong(py_comm_offset);
-                            tasks_offset = PyLong_AsUnsignedLong(py_tasks_offset);
-                            mm_offset = PyLong_AsUnsignedLong(py_mm_offset);
-                            pgd_offset = PyLong_AsUnsignedLong(py_pgd_offset);
-                            parent_offset = PyLong_AsUnsignedLong(py_parent_offset);
-                            exit_state_offset = PyLong_AsUnsignedLong(py_exit_state_offset);
-                            thread_stack_size = PyLong_AsUnsignedLong(py_thread_stack_size);
-
-                            proc_exec_connector_offset = PyLong_AsUnsignedLong(py_proc_exec_connector_offset);
-                            trim_init_extable_offset = PyLong_AsUnsignedLong(py_trim_init_extable_offset);
-                            proc_exit_connector_offset = PyLong_AsUnsignedLong(py_proc_exit_connector_offset);
-                        }
-                        else{
-                            init_task_offset = PyLong_AsUnsignedLongLong(py_init_task_offset);
-                            pid_offset = PyLong_AsUnsignedLongLong(py_pid_offset);
-                            comm_offset = PyLong_AsUnsignedLongLong(py_comm_offset);
-                            tasks_offset = PyLong_AsUnsignedLongLong(py_tasks_offset);
-                            mm_offset = PyLong_AsUnsignedLongLong(py_mm_offset);
-                            pgd_offset = PyLong_AsUnsignedLongLong(py_pgd_offset);
-                            parent_offset = PyLong_AsUnsignedLongLong(py_parent_offset);
-                            exit_state_offset = PyLong_AsUnsignedLongLong(py_exit_state_offset);
-                            thread_stack_size = PyLong_AsUnsignedLongLong(py_thread_stack_size);
-
-                            proc_exec_connector_offset = PyLong_AsUnsignedLongLong(py_proc_exec_connector_offset);
-                            trim_init_extable_offset = PyLong_AsUnsignedLongLong(py_trim_init_extable_offset);
-                            proc_exit_connector_offset = PyLong_AsUnsignedLongLong(py_proc_exit_connector_offset);
-                        }
-                        /*utils_print_debug("  [-] init_task offset: %016lx\n", init_task_offset);
-                        utils_print_debug("  [-] pid offset: %016lx\n", pid_offset);
-                        utils_print_debug("  [-] comm offset: %016lx\n", comm_offset);
-                        utils_print_debug("  [-] tasks offset: %016lx\n", tasks_offset);
-                        utils_print_debug("  [-] mm offset: %016lx\n", mm_offset);
-                        utils_print_debug("  [-] pgd offset: %016lx\n", pgd_offset);
-                        utils_print_debug("  [-] parent offset: %016lx\n", parent_offset);
-                        utils_print_debug("  [-] exit_state offset: %016lx\n", exit_state_offset);
-                        utils_print_debug("  [-] proc exec connector: %016lx\n", proc_exec_connector_offset);
-                        utils_print_debug("  [-] trim init extable: %016lx\n", trim_init_extable_offset);
-                        utils_print_debug("  [-] proc exit connector: %016lx\n", proc_exit_connector_offset);
-                        utils_print_debug("  [-] thread stack size: %016lx\n", thread_stack_size);*/
-
-                        Py_DECREF(ret);
-                    }
-                    else{
-                        utils_print_error("[!] Could not retrieve offsets for profile initialization");
-                    }
-               }
-               Py_XDECREF(py_linux_get_offsets);
-           }
-           Py_DECREF(py_vmi_module);
+       PyObject* py_linux_get_offsets = python_symbol_get(PY_SYM_LINUX_GET_OFFSETS);
+       if (py_linux_get_offsets){
+            PyObject* ret = PyObject_CallObject(py_linux_get_offsets,NULL);
+            //Parse return and get offsets
+            if (ret){
+                PyObject* py_init_task_offset = PyTuple_GetItem(ret,0);
+                PyObject* py_comm_offset = PyTuple_GetItem(ret,1);
+                PyObject* py_pid_offset = PyTuple_GetItem(ret,2);
+                PyObject* py_tasks_offset = PyTuple_GetItem(ret,3);
+                PyObject* py_mm_offset = PyTuple_GetItem(ret,4);
+                PyObject* py_pgd_offset = PyTuple_GetItem(ret,5);
+                PyObject* py_parent_offset = PyTuple_GetItem(ret,6);
+                PyObject* py_exit_state_offset = PyTuple_GetItem(ret,7);
+                PyObject* py_thread_stack_size = PyTuple_GetItem(ret,8);
+                PyObject* py_proc_exec_connector_offset = PyTuple_GetItem(ret,9);
+                PyObject* py_trim_init_extable_offset = PyTuple_GetItem(ret,10);
+                PyObject* py_proc_exit_connector_offset = PyTuple_GetItem(ret,11);
+
+                if (arch_bits[os_index] == 32){
+                    init_task_offset = PyLong_AsUnsignedLong(py_init_task_offset);
+                    pid_offset = PyLong_AsUnsignedLong(py_pid_offset);
+                    comm_offset = PyLong_AsUnsignedLong(py_comm_offset);
+                    tasks_offset = PyLong_AsUnsignedLong(py_tasks_offset);
+                    mm_offset = PyLong_AsUnsignedLong(py_mm_offset);
+                    pgd_offset = PyLong_AsUnsignedLong(py_pgd_offset);
+                    parent_offset = PyLong_AsUnsignedLong(py_parent_offset);
+                    exit_state_offset = PyLong_AsUnsignedLong(py_exit_state_offset);
+                    thread_stack_size = PyLong_AsUnsignedLong(py_thread_stack_size);
+
+                    proc_exec_connector_offset = PyLong_AsUnsignedLong(py_proc_exec_connector_offset);
+                    trim_init_extable_offset = PyLong_AsUnsignedLong(py_trim_init_extable_offset);
+                    proc_exit_connector_offset = PyLong_AsUnsignedLong(py_proc_exit_connector_offset);
+                }
+                else{
+                    init_task_offset = PyLong_AsUnsignedLongLong(py_init_task_offset);
+                    pid_offset = PyLong_AsUnsignedLongLong(py_pid_offset);
+                    comm_offset = PyLong_AsUnsignedLongLong(py_comm_offset);
+                    tasks_offset = PyLong_AsUnsignedLongLong(py_tasks_offset);
+                    mm_offset = PyLong_AsUnsignedLongLong(py_mm_offset);
+                    pgd_offset = PyLong_AsUnsignedLongLong(py_pgd_offset);
+                    parent_offset = PyLong_AsUnsignedLongLong(py_parent_offset);
+                    exit_state_offset = PyLong_AsUnsignedLongLong(py_exit_state_offset);
+                    thread_stack_size = PyLong_AsUnsignedLongLong(py_thread_stack_size);
+
+                    proc_exec_connector_offset = PyLong_AsUnsignedLongLong(py_proc_exec_connector_offset);
+                    trim_init_extable_offset = PyLong_AsUnsignedLongLong(py_trim_init_extable_offset);
+                    proc_exit_connector_offset = PyLong_AsUnsignedLongLong(py_proc_exit_connector_offset);
+                }
+                /*utils_print_debug("  [-] init_task offset: %016lx\n", init_task_offset);
+                utils_print_debug("  [-] pid offset: %016lx\n", pid_offset);
+                utils_print_debug("  [-] comm offset: %016lx\n", comm_offset);
+                utils_print_debug("  [-] tasks offset: %016lx\n", tasks_offset);
+                utils_print_debug("  [-] mm offset: %016lx\n", mm_offset);
+                utils_print_debug("  [-] pgd offset: %016lx\n", pgd_offset);
+                utils_print_debug("  [-] parent offset: %016lx\n", parent_offset);
+                utils_print_debug("  [-] exit_state offset: %016lx\n", exit_state_offset);
+                utils_print_debug("  [-] proc exec connector: %016lx\n", proc_exec_connector_offset);
+                utils_print_debug("  [-] trim init extable: %016lx\n", trim_init_extable_offset);
+                utils_print_debug("  [-] proc exit connector: %016lx\n", proc_exit_connector_offset);
+                utils_print_debug("  [-] thread stack size: %016lx\n", thread_stack_size);*/
+
+                Py_DECREF(ret);
+            }
+            else{
+                utils_print_error("[!] Could not retrieve offsets for profile initialization");
+            }
        }
    }
 
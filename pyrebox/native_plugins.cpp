@@ -0,0 +1,138 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#include <Python.h>
+#include <map>
+#include <list>
+#include <string>
+#include <dlfcn.h>
+#include <pthread.h>
+
+extern "C"{
+    #include "qemu_glue.h"
+    #include "utils.h"
+}
+#include "callbacks.h"
+#include "native_plugins.h"
+
+using namespace std;
+
+typedef struct native_plugin {
+    string path;
+    void* dll_handle;
+    native_plugin_fini_t fini;
+} native_plugin_t;
+
+static map<module_handle_t,native_plugin_t> native_plugins;
+static module_handle_t native_plugin_counter = NATIVE_PLUGIN_HANDLE_BASE;
+//Unloaded plugins whose callbacks may still be referenced by a delivery. Plugins
+//are unloaded from the python code, and closed by the vCPU threads.
+static list<native_plugin_t> unloaded_native_plugins;
+static pthread_mutex_t unloaded_native_plugins_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//Remove the callbacks of a plugin. The plugin is closed once they cannot be
+//delivered any more (see close_unloaded_native_plugins)
+static void release_native_plugin(module_handle_t plugin_handle, const native_plugin_t& plugin){
+    remove_module_callbacks_deferred(plugin_handle);
+    if (!is_callback_delivery_in_progress()){
+        commit_deferred_callback_removes();
+    }
+    pthread_mutex_lock(&unloaded_native_plugins_mutex);
+    unloaded_native_plugins.push_back(plugin);
+    pthread_mutex_unlock(&unloaded_native_plugins_mutex);
+}
+
+extern "C"{
+
+module_handle_t load_native_plugin(const char* path){
+    void* dll_handle = dlopen(path,RTLD_NOW|RTLD_LOCAL);
+    if (!dll_handle)
+    {
+        utils_print_error("[!] Error while loading %s\n",path);
+        utils_print_error("%s\n", dlerror());
+        return 0;
+    }
+    native_plugin_init_t init = (native_plugin_init_t) dlsym(dll_handle,"pyrebox_plugin_init");
+    if (init == 0)
+    {
+        utils_print_error("[!] Could not find function pyrebox_plugin_init in %s\n",path);
+        dlclose(dll_handle);
+        return 0;
+    }
+    module_handle_t plugin_handle = ++native_plugin_counter;
+    //The callbacks added during the initialization are bound to the plugin
+    module_handle_t previous_module = set_native_module_context(plugin_handle);
+    int initialized = init(plugin_handle, NATIVE_PLUGIN_ABI_VERSION);
+    set_native_module_context(previous_module);
+    native_plugin_t plugin;
+    plugin.path = path;
+    plugin.dll_handle = dll_handle;
+    plugin.fini = (native_plugin_fini_t) dlsym(dll_handle,"pyrebox_plugin_fini");
+    if (!initialized)
+    {
+        utils_print_error("[!] Could not initialize native plugin %s\n",path);
+        release_native_plugin(plugin_handle, plugin);
+        return 0;
+    }
+    native_plugins[plugin_handle] = plugin;
+    return plugin_handle;
+}
+
+int unload_native_plugin(module_handle_t plugin_handle){
+    map<module_handle_t,native_plugin_t>::iterator it = native_plugins.find(plugin_handle);
+    if (it == native_plugins.end()){
+        return 0;
+    }
+    if (it->second.fini != 0){
+        module_handle_t previous_module = set_native_module_context(plugin_handle);
+        it->second.fini(plugin_handle);
+        set_native_module_context(previous_module);
+    }
+    //No callback can point to the plugin code after it is closed
+    release_native_plugin(plugin_handle, it->second);
+    native_plugins.erase(it);
+    return 1;
+}
+
+void close_unloaded_native_plugins(void){
+    list<native_plugin_t> closed;
+    pthread_mutex_lock(&unloaded_native_plugins_mutex);
+    closed.swap(unloaded_native_plugins);
+    pthread_mutex_unlock(&unloaded_native_plugins_mutex);
+    for (list<native_plugin_t>::iterator it = closed.begin(); it != closed.end(); ++it){
+        if (dlclose(it->dll_handle))
+        {
+            utils_print_error("[!] Error while unloading native plugin %s\n",it->path.c_str());
+        }
+    }
+}
+
+//Called once the vCPUs are stopped
+void unload_all_native_plugins(void){
+    while (!native_plugins.empty()){
+        unload_native_plugin(native_plugins.begin()->first);
+    }
+    close_unloaded_native_plugins();
+}
+
+}
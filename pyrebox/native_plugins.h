@@ -0,0 +1,64 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#ifndef NATIVE_PLUGINS_H
+#define NATIVE_PLUGINS_H
+
+//Native plugins are shared objects that consume callbacks directly in C/C++,
+//registering them with add_native_callback / add_native_callback_at /
+//add_native_watch_callback (see callbacks.h).
+//A plugin must export:
+//
+//  int pyrebox_plugin_init(module_handle_t plugin_handle, unsigned int abi_version);
+//
+//returning 1 if it could be initialized, and may export:
+//
+//  void pyrebox_plugin_fini(module_handle_t plugin_handle);
+//
+//The callbacks registered by the plugin are removed after pyrebox_plugin_fini returns.
+//If the plugin is unloaded while a callback is being delivered, its callbacks are
+//removed when the delivery finishes, and the shared object is only closed then.
+
+#define NATIVE_PLUGIN_ABI_VERSION 1
+//Plugin handles are allocated above this value, so that they never
+//collide with the handles of the python modules
+#define NATIVE_PLUGIN_HANDLE_BASE 0x80000000
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+typedef int (*native_plugin_init_t)(module_handle_t plugin_handle, unsigned int abi_version);
+typedef void (*native_plugin_fini_t)(module_handle_t plugin_handle);
+
+module_handle_t load_native_plugin(const char* path);
+int unload_native_plugin(module_handle_t plugin_handle);
+void unload_all_native_plugins(void);
+//Close the shared objects of the plugins unloaded while their callbacks could
+//still be delivered. Called by the callback manager at the end of a delivery,
+//holding the python mutex, once no delivery can reference their callbacks.
+void close_unloaded_native_plugins(void);
+#ifdef __cplusplus
+};
+#endif
+
+#endif
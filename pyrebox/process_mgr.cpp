@@ -24,9 +24,11 @@
 #include <Python.h>
 #include <map>
 #include <string>
+#include <list>
 
 #include "qemu_glue.h"
 #include "process_mgr.h"
+#include "callbacks.h"
 extern "C"{
     #include "qemu_glue_callbacks_flush.h"
 }
@@ -44,8 +46,10 @@ int add_monitored_process(pyrebox_target_ulong pgd){
         return 1;
     } else {
         monitored_processes[pgd] = 1;
-        //Perform flush, because we will need to insert callbacks now
-        pyrebox_flush_tb();
+        //No need to flush, translated code does not depend on
+        //the set of monitored processes (the prefilters read it at run time)
+        tb_flush_stats.flushes_avoided++;
+        update_callback_prefilters();
         return 1;
     }
 }
@@ -58,8 +62,8 @@ int remove_monitored_process(pyrebox_target_ulong pgd,int force){
         }
         if (count == 0 || force){
             monitored_processes.erase(pgd);
-            //Perform flush, because we will not need to insert callbacks now
-            pyrebox_flush_tb();
+            tb_flush_stats.flushes_avoided++;
+            update_callback_prefilters();
         } else {
             monitored_processes[pgd] = count;
         }
@@ -77,10 +81,19 @@ int is_monitored_process(pyrebox_target_ulong pgd){
 
 void clear_monitored_processes(){
     monitored_processes.clear();
+    update_callback_prefilters();
 }
 
 int nb_monitored_processes(){
     return (monitored_processes.size());
 }
 
+int get_monitored_processes(pyrebox_target_ulong* pgds, int max){
+    int i = 0;
+    for (map<pyrebox_target_ulong,unsigned int>::iterator it = monitored_processes.begin(); it != monitored_processes.end() && i < max; ++it){
+        pgds[i++] = it->first;
+    }
+    return (monitored_processes.size());
+}
+
 };
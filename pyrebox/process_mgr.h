@@ -32,6 +32,8 @@ int remove_monitored_process(pyrebox_target_ulong pgd,int force);
 int is_monitored_process(pyrebox_target_ulong pgd);
 void clear_monitored_processes(void);
 int nb_monitored_processes(void);
+//Copies up to max pgds, returns the number of monitored processes
+int get_monitored_processes(pyrebox_target_ulong* pgds, int max);
 #ifdef __cplusplus
 };
 #endif
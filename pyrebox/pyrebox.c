@@ -45,9 +45,12 @@
 #include "process_mgr.h"
 #include "config.h"
 #include "callbacks.h"
+#include "callback_events.h"
 #include "pyrebox.h"
 #include "vmi.h"
 #include "qemu_glue_block.h"
+#include "qemu_glue_callbacks_context.h"
+#include "python_symbols.h"
 
 pthread_mutex_t pyrebox_mutex;
 
@@ -60,6 +63,18 @@ void pyrebox_init_blocks(void){
   pyrebox_blocks_init();
 }
 
+void pyrebox_init_cpus(void){
+  //Index the vCPUs by cpu_index
+  init_qemu_cpus();
+  //Before any vCPU runs: the context change checks read it without locking
+  init_context_change_tracking();
+}
+
+void pyrebox_unrealize_cpu(int cpu_index){
+  //The CPUState is about to be freed (CPU unplug)
+  clear_qemu_cpu(cpu_index);
+}
+
 int pyrebox_init(const char *pyrebox_conf_str){
 
   //Initialize mutex to call python code, which may sometime be thread unsafe
@@ -88,7 +103,15 @@ int pyrebox_init(const char *pyrebox_conf_str){
   PyList_Insert(sysPath, 0, path);
 
   //Register all the interface function for python
-  Py_InitModule("c_api", api_methods);
+  PyObject* c_api_module = Py_InitModule("c_api", api_methods);
+  if (init_cpu_state_proxy_type(c_api_module) != 0){
+      printf("Could not initialize the CPU state type\n");
+      return 1;
+  }
+  if (init_callback_event_type(c_api_module) != 0){
+      printf("Could not initialize the callback event type\n");
+      return 1;
+  }
   Py_InitModule("utils_print", utils_methods_print);
 
   unsigned int length = strlen(PYREBOX_PATH) + strlen("init.py") + 2;
@@ -161,6 +184,9 @@ int pyrebox_init(const char *pyrebox_conf_str){
   // We can decref the result
   Py_XDECREF(result);
 
+  //Resolve the python functions called from the C/C++ core
+  python_symbols_resolve_all();
+
   return 0;
 };
 
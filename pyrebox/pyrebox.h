@@ -29,5 +29,7 @@ extern pthread_mutex_t pyrebox_mutex;
 void clear_targets(void);
 int pyrebox_init(const char *pyrebox_conf_str);
 void pyrebox_init_blocks(void);
+void pyrebox_init_cpus(void);
+void pyrebox_unrealize_cpu(int cpu_index);
 int pyrebox_finalize(void);
 #endif
@@ -0,0 +1,112 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#include <Python.h>
+#include <stdio.h>
+
+#include "python_symbols.h"
+
+typedef struct python_symbol_entry {
+    const char* module;
+    const char* function;
+} python_symbol_entry_t;
+
+//Indexed by python_symbol_t
+static const python_symbol_entry_t python_symbol_entries[PY_SYM_LAST] = {
+    {"api_internal", "convert_x86_cpu"},          //PY_SYM_CONVERT_X86_CPU
+    {"api_internal", "convert_x64_cpu"},          //PY_SYM_CONVERT_X64_CPU
+    {"vmi", "update_modules"},                    //PY_SYM_UPDATE_MODULES
+    {"vmi", "set_os_family_win"},                 //PY_SYM_SET_OS_FAMILY_WIN
+    {"vmi", "set_os_family_linux"},               //PY_SYM_SET_OS_FAMILY_LINUX
+    {"windows_vmi", "windows_kdbgscan_fast"},     //PY_SYM_WINDOWS_KDBGSCAN_FAST
+    {"linux_vmi", "linux_init_address_space"},    //PY_SYM_LINUX_INIT_ADDRESS_SPACE
+    {"linux_vmi", "linux_get_offsets"},           //PY_SYM_LINUX_GET_OFFSETS
+    {"vmi", "get_threads"},                       //PY_SYM_GET_THREADS
+    {"vmi", "get_thread_description"},            //PY_SYM_GET_THREAD_DESCRIPTION
+    {"vmi", "get_thread_id"},                     //PY_SYM_GET_THREAD_ID
+    {"vmi", "get_running_thread_first_cpu"},      //PY_SYM_GET_RUNNING_THREAD_FIRST_CPU
+    {"vmi", "does_thread_exist"},                 //PY_SYM_DOES_THREAD_EXIST
+    {"vmi", "gdb_read_thread_register"},          //PY_SYM_GDB_READ_THREAD_REGISTER
+    {"vmi", "gdb_memory_rw_debug"},               //PY_SYM_GDB_MEMORY_RW_DEBUG
+    {"vmi", "gdb_set_cpu_pc"},                    //PY_SYM_GDB_SET_CPU_PC
+    {"vmi", "gdb_breakpoint_remove_all"},         //PY_SYM_GDB_BREAKPOINT_REMOVE_ALL
+    {"vmi", "gdb_breakpoint_insert"},             //PY_SYM_GDB_BREAKPOINT_INSERT
+    {"vmi", "gdb_breakpoint_remove"},             //PY_SYM_GDB_BREAKPOINT_REMOVE
+    {"vmi", "gdb_get_register_size"},             //PY_SYM_GDB_GET_REGISTER_SIZE
+    {"vmi", "gdb_write_thread_register"},         //PY_SYM_GDB_WRITE_THREAD_REGISTER
+};
+
+//Owned references to the resolved functions
+static PyObject* python_symbol_cache[PY_SYM_LAST];
+static int python_symbols_initialized = 0;
+static unsigned long long python_symbols_import_count = 0;
+
+static PyObject* python_symbol_resolve(python_symbol_t symbol){
+    PyObject* py_module = PyImport_ImportModule(python_symbol_entries[symbol].module);
+    if (py_module == NULL){
+        return NULL;
+    }
+    PyObject* py_function = PyObject_GetAttrString(py_module, python_symbol_entries[symbol].function);
+    Py_DECREF(py_module);
+    if (py_function == NULL){
+        return NULL;
+    }
+    if (!PyCallable_Check(py_function)){
+        PyErr_Format(PyExc_TypeError, "%s.%s is not callable",
+                     python_symbol_entries[symbol].module, python_symbol_entries[symbol].function);
+        Py_DECREF(py_function);
+        return NULL;
+    }
+    python_symbol_cache[symbol] = py_function;
+    return py_function;
+}
+
+PyObject* python_symbol_get(python_symbol_t symbol){
+    if (python_symbol_cache[symbol] != NULL){
+        return python_symbol_cache[symbol];
+    }
+    if (python_symbols_initialized){
+        python_symbols_import_count++;
+    }
+    return python_symbol_resolve(symbol);
+}
+
+void python_symbols_resolve_all(void){
+    for (int i = 0; i < PY_SYM_LAST; ++i){
+        if (python_symbol_cache[i] == NULL && python_symbol_resolve((python_symbol_t)i) == NULL){
+            //Not available yet (e.g., the module cannot be imported for this guest)
+            PyErr_Clear();
+        }
+    }
+    python_symbols_initialized = 1;
+}
+
+void python_symbols_invalidate(void){
+    for (int i = 0; i < PY_SYM_LAST; ++i){
+        Py_CLEAR(python_symbol_cache[i]);
+    }
+}
+
+unsigned long long python_symbols_get_import_count(void){
+    return python_symbols_import_count;
+}
@@ -0,0 +1,72 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#ifndef PYTHON_SYMBOLS_H
+#define PYTHON_SYMBOLS_H
+
+//Cache of the python functions called from the C/C++ core (VMI, GDB stub,
+//CPU state conversion). Each function is imported and looked up once, instead of
+//on every call. The python mutex must be held by the caller of these functions.
+
+typedef enum python_symbol {
+    PY_SYM_CONVERT_X86_CPU = 0,
+    PY_SYM_CONVERT_X64_CPU,
+    PY_SYM_UPDATE_MODULES,
+    PY_SYM_SET_OS_FAMILY_WIN,
+    PY_SYM_SET_OS_FAMILY_LINUX,
+    PY_SYM_WINDOWS_KDBGSCAN_FAST,
+    PY_SYM_LINUX_INIT_ADDRESS_SPACE,
+    PY_SYM_LINUX_GET_OFFSETS,
+    PY_SYM_GET_THREADS,
+    PY_SYM_GET_THREAD_DESCRIPTION,
+    PY_SYM_GET_THREAD_ID,
+    PY_SYM_GET_RUNNING_THREAD_FIRST_CPU,
+    PY_SYM_DOES_THREAD_EXIST,
+    PY_SYM_GDB_READ_THREAD_REGISTER,
+    PY_SYM_GDB_MEMORY_RW_DEBUG,
+    PY_SYM_GDB_SET_CPU_PC,
+    PY_SYM_GDB_BREAKPOINT_REMOVE_ALL,
+    PY_SYM_GDB_BREAKPOINT_INSERT,
+    PY_SYM_GDB_BREAKPOINT_REMOVE,
+    PY_SYM_GDB_GET_REGISTER_SIZE,
+    PY_SYM_GDB_WRITE_THREAD_REGISTER,
+    PY_SYM_LAST
+} python_symbol_t;
+
+//Returns a borrowed reference to the function, resolving it if it is not
+//cached yet. Returns NULL with the python error set if it cannot be resolved.
+PyObject* python_symbol_get(python_symbol_t symbol);
+
+//Resolve every symbol that is not cached yet. Called once pyrebox has been
+//initialized, and after loading scripts. Symbols that cannot be resolved
+//yet are left for python_symbol_get.
+void python_symbols_resolve_all(void);
+
+//Drop the cached functions (e.g., a module may have been reloaded)
+void python_symbols_invalidate(void);
+
+//Number of imports performed by python_symbol_get after initialization,
+//which should stay at 0 unless some symbol could not be resolved in advance
+unsigned long long python_symbols_get_import_count(void);
+
+#endif
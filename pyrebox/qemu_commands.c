@@ -42,6 +42,7 @@
 #include "qemu_commands.h"
 #include "pyrebox.h"
 #include "qemu_glue_gdbstub.h"
+#include "python_symbols.h"
 
 void import_module(Monitor* mon, const QDict* qdict)
 {
@@ -61,6 +62,8 @@ void import_module(Monitor* mon, const QDict* qdict)
     PyObject* ret = PyObject_CallObject(py_import,py_args_tuple);
     Py_XDECREF(ret);
     Py_DECREF(py_args_tuple);
+    //Resolve the python entry points that were not available yet
+    python_symbols_resolve_all();
   }
 
 }
@@ -106,6 +109,9 @@ void reload_module(Monitor* mon, const QDict* qdict)
     Py_XDECREF(ret);
     Py_DECREF(py_args_tuple);
     commit_deferred_callback_removes();
+    //The reload may have replaced the cached python entry points
+    python_symbols_invalidate();
+    python_symbols_resolve_all();
   }
 }
 
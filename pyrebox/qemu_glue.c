@@ -56,6 +56,8 @@
 #include "qemu_glue_callbacks_flush.h"
 #include "qemu_glue_callbacks.h"
 #include "qemu_glue_ui.h"
+#include "utils.h"
+#include "python_symbols.h"
 
 /**************************************************** DEFINITIONS ************************************************/
 
@@ -148,112 +150,342 @@ register_type_t register_type[RN_LAST] =
 
 /**************************************************** PYTHON FUNCTIONS ************************************************/
 
-PyObject* get_cpu_state(qemu_cpu_opaque_t cpu_opaque){
+//CPU state proxy. The callbacks receive a python object that keeps a pointer to
+//the QEMU CPU and reads each register when the attribute is accessed, instead of
+//converting the whole CPU state into a X86CPU/X64CPU object on every callback.
+//
+//Once the callbacks return, the proxy is released. If a callback kept a reference
+//to it, the register values are copied into the proxy at that point, so that it
+//keeps returning the values of the callback in which it was received.
 
-    // We must not lock the pyrebox_mutex (python mutex) because this function
-    // is always called in a point where the mutex has already been acquired.
+#if defined(TARGET_I386) && !defined(TARGET_X86_64)
+#define CPU_STATE_PROXY_CLASS "X86CPU"
+#define CPU_STATE_PROXY_PC RN_EIP
+#define CPU_STATE_PROXY_FLAGS RN_EFLAGS
+#elif defined(TARGET_X86_64)
+#define CPU_STATE_PROXY_CLASS "X64CPU"
+#define CPU_STATE_PROXY_PC RN_RIP
+#define CPU_STATE_PROXY_FLAGS RN_RFLAGS
+#elif defined(TARGET_AARCH64)
+#error "Architecture not supported yet"
+#elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
+#error "Architecture not supported yet"
+#endif
+
+#define CPU_STATE_PROXY_SEGMENTS (RN_IDT - RN_ES + 1)
+
+typedef struct cpu_state_frozen {
+    pyrebox_target_ulong regs[RN_LAST];
+    SegmentCache segs[CPU_STATE_PROXY_SEGMENTS];
+} cpu_state_frozen_t;
+
+typedef struct CPUStateProxy {
+    PyObject_HEAD
+    //Set while the callbacks are running
+    CPUState* cpu;
+    //Set once the proxy has been released, if it was still referenced
+    cpu_state_frozen_t* frozen;
+} CPUStateProxy;
+
+//A released proxy that was not referenced any more, ready to be reused
+static CPUStateProxy* cpu_state_proxy_free = 0;
+
+static pyrebox_target_ulong cpu_state_proxy_live_register(CPUState* cpu, int reg_num){
+    CPUX86State* env = &(X86_CPU(cpu)->env);
+    //The general purpose registers follow the order of QEMU (R_EAX ... R_EDI)
+    if (reg_num >= 0 && reg_num < CPU_STATE_PROXY_PC){
+        return env->regs[reg_num];
+    }
+#if defined(TARGET_X86_64)
+    if (reg_num >= RN_R8 && reg_num <= RN_R15){
+        return env->regs[8 + reg_num - RN_R8];
+    }
+#endif
+    if (reg_num >= RN_CR0 && reg_num <= RN_CR4){
+        return env->cr[reg_num - RN_CR0];
+    }
+    switch(reg_num){
+        case CPU_STATE_PROXY_PC:
+            return env->eip;
+        case CPU_STATE_PROXY_FLAGS:
+            return env->eflags;
+        case RN_CPU_INDEX:
+            return cpu->cpu_index;
+        default:
+            assert(0);
+            return 0;
+    }
+}
+
+static SegmentCache* cpu_state_proxy_live_segment(CPUState* cpu, int reg_num){
+    CPUX86State* env = &(X86_CPU(cpu)->env);
+    //The segment registers follow the order of QEMU (R_ES ... R_GS)
+    if (reg_num >= RN_ES && reg_num <= RN_GS){
+        return &(env->segs[reg_num - RN_ES]);
+    }
+    switch(reg_num){
+        case RN_LDT:
+            return &(env->ldt);
+        case RN_TR:
+            return &(env->tr);
+        case RN_GDT:
+            return &(env->gdt);
+        case RN_IDT:
+            return &(env->idt);
+        default:
+            assert(0);
+            return 0;
+    }
+}
+
+static PyObject* cpu_state_proxy_build_register(CPUStateProxy* self, int reg_num){
+    pyrebox_target_ulong value;
+    if (self->cpu != 0){
+        value = cpu_state_proxy_live_register(self->cpu, reg_num);
+    } else {
+        assert(self->frozen != 0);
+        value = self->frozen->regs[reg_num];
+    }
+    if (reg_num == RN_CPU_INDEX){
+        return Py_BuildValue("i", (int)value);
+    }
+#if TARGET_LONG_SIZE == 4
+    return Py_BuildValue("I", value);
+#elif TARGET_LONG_SIZE == 8
+    return Py_BuildValue("K", value);
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+}
+
+static SegmentCache* cpu_state_proxy_segment(CPUStateProxy* self, int reg_num){
+    if (self->cpu != 0){
+        return cpu_state_proxy_live_segment(self->cpu, reg_num);
+    }
+    assert(self->frozen != 0);
+    return &(self->frozen->segs[reg_num - RN_ES]);
+}
+
+static PyObject* cpu_state_proxy_get_register(PyObject* self, void* closure){
+    return cpu_state_proxy_build_register((CPUStateProxy*)self, (int)(intptr_t)closure);
+}
 
-    //N denotes object type. It passes an object untouched, and it doesnt increment its reference count like O, 
-    //so that the call to XDECREF of the whole tuple will already trigger the deallocation of all the values.
-    PyObject* result = 0;
+//Segments are exposed as dictionaries, like in X86CPU / X64CPU
+static PyObject* cpu_state_proxy_get_segment(PyObject* self, void* closure){
+    SegmentCache* seg = cpu_state_proxy_segment((CPUStateProxy*)self, (int)(intptr_t)closure);
+#if TARGET_LONG_SIZE == 4
+    return Py_BuildValue("{s:I,s:I,s:I,s:I}",
+#elif TARGET_LONG_SIZE == 8
+    return Py_BuildValue("{s:I,s:K,s:I,s:I}",
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
+                         "sel", seg->selector,
+                         "base", seg->base,
+                         "size", seg->limit,
+                         "flags", seg->flags);
+}
+
+#define CPU_STATE_PROXY_REGISTER(name, reg_num) \
+    {(char*)name, cpu_state_proxy_get_register, NULL, NULL, (void*)(intptr_t)reg_num}
+#define CPU_STATE_PROXY_SEGMENT(name, reg_num) \
+    {(char*)name, cpu_state_proxy_get_segment, NULL, NULL, (void*)(intptr_t)reg_num}
+
+static PyGetSetDef cpu_state_proxy_getset[] = {
 #if defined(TARGET_I386) && !defined(TARGET_X86_64)
-    CPUX86State* env = &(X86_CPU((CPUState*)cpu_opaque)->env);
-    PyObject* args = Py_BuildValue("((I,I,I,I,I,I,I,I, I,I, N,N,N,N,N,N,N,N,N,N, I,I,I,I,I,i))",
-                            env->regs[R_EAX],
-                            env->regs[R_ECX],
-                            env->regs[R_EDX],
-                            env->regs[R_EBX],
-                            env->regs[R_ESP],
-                            env->regs[R_EBP],
-                            env->regs[R_ESI],
-                            env->regs[R_EDI],
-                            env->eip, 
-                            env->eflags,
-                            Py_BuildValue("(I,I,I,I)", env->segs[R_ES].selector,env->segs[R_ES].base,env->segs[R_ES].limit,env->segs[R_ES].flags),
-                            Py_BuildValue("(I,I,I,I)", env->segs[R_CS].selector,env->segs[R_CS].base,env->segs[R_CS].limit,env->segs[R_CS].flags),
-                            Py_BuildValue("(I,I,I,I)", env->segs[R_SS].selector,env->segs[R_SS].base,env->segs[R_SS].limit,env->segs[R_SS].flags),
-                            Py_BuildValue("(I,I,I,I)", env->segs[R_DS].selector,env->segs[R_DS].base,env->segs[R_DS].limit,env->segs[R_DS].flags),
-                            Py_BuildValue("(I,I,I,I)", env->segs[R_FS].selector,env->segs[R_FS].base,env->segs[R_FS].limit,env->segs[R_FS].flags),
-                            Py_BuildValue("(I,I,I,I)", env->segs[R_GS].selector,env->segs[R_GS].base,env->segs[R_GS].limit,env->segs[R_GS].flags),
-                            Py_BuildValue("(I,I,I,I)", env->ldt.selector,env->ldt.base,env->ldt.limit,env->ldt.flags),
-                            Py_BuildValue("(I,I,I,I)", env->tr.selector,env->tr.base,env->tr.limit,env->tr.flags),
-                            Py_BuildValue("(I,I,I,I)", env->gdt.selector,env->gdt.base,env->gdt.limit,env->gdt.flags),
-                            Py_BuildValue("(I,I,I,I)", env->idt.selector,env->idt.base,env->idt.limit,env->idt.flags),
-                            env->cr[0],
-                            env->cr[1],
-                            env->cr[2],
-                            env->cr[3],
-                            env->cr[4],
-                            get_qemu_cpu_index_with_pgd(env->cr[3]));
-
-    PyObject* py_module_name = PyString_FromString("api_internal");
-    PyObject* py_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    if(py_module != NULL){
-        PyObject* py_convert_cpu= PyObject_GetAttrString(py_module,"convert_x86_cpu");
-        if (py_convert_cpu){
-            if (PyCallable_Check(py_convert_cpu)){
-                 result =  PyObject_CallObject(py_convert_cpu,args);
-                 Py_DECREF(args);
-            }
+    CPU_STATE_PROXY_REGISTER("EAX", RN_EAX),
+    CPU_STATE_PROXY_REGISTER("ECX", RN_ECX),
+    CPU_STATE_PROXY_REGISTER("EDX", RN_EDX),
+    CPU_STATE_PROXY_REGISTER("EBX", RN_EBX),
+    CPU_STATE_PROXY_REGISTER("ESP", RN_ESP),
+    CPU_STATE_PROXY_REGISTER("EBP", RN_EBP),
+    CPU_STATE_PROXY_REGISTER("ESI", RN_ESI),
+    CPU_STATE_PROXY_REGISTER("EDI", RN_EDI),
+    CPU_STATE_PROXY_REGISTER("EIP", RN_EIP),
+    CPU_STATE_PROXY_REGISTER("EFLAGS", RN_EFLAGS),
+#elif defined(TARGET_X86_64)
+    CPU_STATE_PROXY_REGISTER("RAX", RN_RAX),
+    CPU_STATE_PROXY_REGISTER("RCX", RN_RCX),
+    CPU_STATE_PROXY_REGISTER("RDX", RN_RDX),
+    CPU_STATE_PROXY_REGISTER("RBX", RN_RBX),
+    CPU_STATE_PROXY_REGISTER("RSP", RN_RSP),
+    CPU_STATE_PROXY_REGISTER("RBP", RN_RBP),
+    CPU_STATE_PROXY_REGISTER("RSI", RN_RSI),
+    CPU_STATE_PROXY_REGISTER("RDI", RN_RDI),
+    CPU_STATE_PROXY_REGISTER("RIP", RN_RIP),
+    CPU_STATE_PROXY_REGISTER("RFLAGS", RN_RFLAGS),
+    CPU_STATE_PROXY_REGISTER("R8", RN_R8),
+    CPU_STATE_PROXY_REGISTER("R9", RN_R9),
+    CPU_STATE_PROXY_REGISTER("R10", RN_R10),
+    CPU_STATE_PROXY_REGISTER("R11", RN_R11),
+    CPU_STATE_PROXY_REGISTER("R12", RN_R12),
+    CPU_STATE_PROXY_REGISTER("R13", RN_R13),
+    CPU_STATE_PROXY_REGISTER("R14", RN_R14),
+    CPU_STATE_PROXY_REGISTER("R15", RN_R15),
+#endif
+    CPU_STATE_PROXY_SEGMENT("ES", RN_ES),
+    CPU_STATE_PROXY_SEGMENT("CS", RN_CS),
+    CPU_STATE_PROXY_SEGMENT("SS", RN_SS),
+    CPU_STATE_PROXY_SEGMENT("DS", RN_DS),
+    CPU_STATE_PROXY_SEGMENT("FS", RN_FS),
+    CPU_STATE_PROXY_SEGMENT("GS", RN_GS),
+    CPU_STATE_PROXY_SEGMENT("LDT", RN_LDT),
+    CPU_STATE_PROXY_SEGMENT("TR", RN_TR),
+    CPU_STATE_PROXY_SEGMENT("GDT", RN_GDT),
+    CPU_STATE_PROXY_SEGMENT("IDT", RN_IDT),
+    CPU_STATE_PROXY_REGISTER("CR0", RN_CR0),
+    CPU_STATE_PROXY_REGISTER("CR1", RN_CR1),
+    CPU_STATE_PROXY_REGISTER("CR2", RN_CR2),
+    CPU_STATE_PROXY_REGISTER("CR3", RN_CR3),
+    CPU_STATE_PROXY_REGISTER("CR4", RN_CR4),
+    CPU_STATE_PROXY_REGISTER("CPU_INDEX", RN_CPU_INDEX),
+    CPU_STATE_PROXY_REGISTER("PC", CPU_STATE_PROXY_PC),
+    {NULL}
+};
+
+//Build a X86CPU / X64CPU object with the current values of the proxy
+static PyObject* cpu_state_proxy_snapshot(PyObject* self, PyObject* unused){
+#if defined(TARGET_I386) && !defined(TARGET_X86_64)
+    PyObject* converter = python_symbol_get(PY_SYM_CONVERT_X86_CPU);
+#elif defined(TARGET_X86_64)
+    PyObject* converter = python_symbol_get(PY_SYM_CONVERT_X64_CPU);
+#endif
+    if (converter == NULL){
+        return NULL;
+    }
+    //Same layout as the one expected by the X86CPU / X64CPU constructors
+    PyObject* regs = PyTuple_New(RN_LAST);
+    if (regs == NULL){
+        return NULL;
+    }
+    for (int i = 0; i < RN_LAST; ++i){
+        PyObject* item;
+        if (register_type[i] == RT_REGULAR){
+            item = cpu_state_proxy_build_register((CPUStateProxy*)self, i);
+        } else {
+            SegmentCache* seg = cpu_state_proxy_segment((CPUStateProxy*)self, i);
+#if TARGET_LONG_SIZE == 4
+            item = Py_BuildValue("(I,I,I,I)", seg->selector, seg->base, seg->limit, seg->flags);
+#elif TARGET_LONG_SIZE == 8
+            item = Py_BuildValue("(I,K,I,I)", seg->selector, seg->base, seg->limit, seg->flags);
+#else
+#error TARGET_LONG_SIZE undefined
+#endif
         }
+        if (item == NULL){
+            Py_DECREF(regs);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(regs, i, item);
     }
-#elif defined(TARGET_X86_64)
-    CPUX86State* env = &(X86_CPU((CPUState*)cpu_opaque)->env);
-    PyObject* args = Py_BuildValue("((K,K,K,K,K,K,K,K, K,K, N,N,N,N,N,N,N,N,N,N, K,K,K,K,K,i,K,K,K,K,K,K,K,K))",
-                            env->regs[R_EAX],
-                            env->regs[R_ECX],
-                            env->regs[R_EDX],
-                            env->regs[R_EBX],
-                            env->regs[R_ESP],
-                            env->regs[R_EBP],
-                            env->regs[R_ESI],
-                            env->regs[R_EDI],
-                            env->eip, 
-                            env->eflags,
-                            Py_BuildValue("(I,K,I,I)", env->segs[R_ES].selector,env->segs[R_ES].base,env->segs[R_ES].limit,env->segs[R_ES].flags),
-                            Py_BuildValue("(I,K,I,I)", env->segs[R_CS].selector,env->segs[R_CS].base,env->segs[R_CS].limit,env->segs[R_CS].flags),
-                            Py_BuildValue("(I,K,I,I)", env->segs[R_SS].selector,env->segs[R_SS].base,env->segs[R_SS].limit,env->segs[R_SS].flags),
-                            Py_BuildValue("(I,K,I,I)", env->segs[R_DS].selector,env->segs[R_DS].base,env->segs[R_DS].limit,env->segs[R_DS].flags),
-                            Py_BuildValue("(I,K,I,I)", env->segs[R_FS].selector,env->segs[R_FS].base,env->segs[R_FS].limit,env->segs[R_FS].flags),
-                            Py_BuildValue("(I,K,I,I)", env->segs[R_GS].selector,env->segs[R_GS].base,env->segs[R_GS].limit,env->segs[R_GS].flags),
-                            Py_BuildValue("(I,K,I,I)", env->ldt.selector,env->ldt.base,env->ldt.limit,env->ldt.flags),
-                            Py_BuildValue("(I,K,I,I)", env->tr.selector,env->tr.base,env->tr.limit,env->tr.flags),
-                            Py_BuildValue("(I,K,I,I)", env->gdt.selector,env->gdt.base,env->gdt.limit,env->gdt.flags),
-                            Py_BuildValue("(I,K,I,I)", env->idt.selector,env->idt.base,env->idt.limit,env->idt.flags),
-                            env->cr[0],
-                            env->cr[1],
-                            env->cr[2],
-                            env->cr[3],
-                            env->cr[4],
-                            get_qemu_cpu_index_with_pgd(env->cr[3]),
-                            env->regs[8],
-                            env->regs[9],
-                            env->regs[10],
-                            env->regs[11],
-                            env->regs[12],
-                            env->regs[13],
-                            env->regs[14],
-                            env->regs[15]);
-
-    PyObject* py_module_name = PyString_FromString("api_internal");
-    PyObject* py_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    if(py_module != NULL){
-        PyObject* py_convert_cpu= PyObject_GetAttrString(py_module,"convert_x64_cpu");
-        if (py_convert_cpu){
-            if (PyCallable_Check(py_convert_cpu)){
-                 result =  PyObject_CallObject(py_convert_cpu,args);
-                 Py_DECREF(args);
+    PyObject* result = PyObject_CallFunctionObjArgs(converter, regs, NULL);
+    Py_DECREF(regs);
+    return result;
+}
+
+static PyObject* cpu_state_proxy_str(PyObject* self){
+    PyObject* snapshot = cpu_state_proxy_snapshot(self, NULL);
+    if (snapshot == NULL){
+        return NULL;
+    }
+    PyObject* result = PyObject_Str(snapshot);
+    Py_DECREF(snapshot);
+    return result;
+}
+
+static void cpu_state_proxy_dealloc(PyObject* self){
+    if (((CPUStateProxy*)self)->frozen != 0){
+        free(((CPUStateProxy*)self)->frozen);
+    }
+    PyObject_Del(self);
+}
+
+static PyMethodDef cpu_state_proxy_methods[] = {
+    {"snapshot", cpu_state_proxy_snapshot, METH_NOARGS,
+     "Returns a " CPU_STATE_PROXY_CLASS " object with a copy of the register values"},
+    {NULL}
+};
+
+static PyTypeObject cpu_state_proxy_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "c_api.CPUStateProxy",
+    .tp_basicsize = sizeof(CPUStateProxy),
+    .tp_dealloc = cpu_state_proxy_dealloc,
+    .tp_str = cpu_state_proxy_str,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Registers of a CPU, read when accessed. Same fields as " CPU_STATE_PROXY_CLASS,
+    .tp_methods = cpu_state_proxy_methods,
+    .tp_getset = cpu_state_proxy_getset,
+};
+
+int init_cpu_state_proxy_type(PyObject* module){
+    if (PyType_Ready(&cpu_state_proxy_type) < 0){
+        return 1;
+    }
+    //Lets X86CPU / X64CPU accept the proxy in isinstance() checks (see cpus.py)
+    PyObject* cpu_class = PyString_FromString(CPU_STATE_PROXY_CLASS);
+    PyDict_SetItemString(cpu_state_proxy_type.tp_dict, "cpu_class", cpu_class);
+    Py_DECREF(cpu_class);
+    Py_INCREF(&cpu_state_proxy_type);
+    PyModule_AddObject(module, "CPUStateProxy", (PyObject*)&cpu_state_proxy_type);
+    return 0;
+}
+
+PyObject* get_cpu_state_proxy(qemu_cpu_opaque_t cpu_opaque){
+    CPUStateProxy* proxy = cpu_state_proxy_free;
+    if (proxy != 0){
+        cpu_state_proxy_free = 0;
+    } else {
+        proxy = PyObject_New(CPUStateProxy, &cpu_state_proxy_type);
+        if (proxy == NULL){
+            return NULL;
+        }
+        proxy->frozen = 0;
+    }
+    proxy->cpu = (CPUState*)cpu_opaque;
+    return (PyObject*)proxy;
+}
+
+void release_cpu_state_proxy(PyObject* py_proxy){
+    if (py_proxy == NULL){
+        return;
+    }
+    CPUStateProxy* proxy = (CPUStateProxy*)py_proxy;
+    if (Py_REFCNT(py_proxy) > 1){
+        //Still referenced (e.g., stored by a callback). Keep the current values
+        cpu_state_frozen_t* frozen = (cpu_state_frozen_t*)malloc(sizeof(cpu_state_frozen_t));
+        if (frozen == 0){
+            utils_print_error("[!] Could not allocate memory for the CPU state\n");
+        } else {
+            for (int i = 0; i < RN_LAST; ++i){
+                if (register_type[i] == RT_REGULAR){
+                    frozen->regs[i] = cpu_state_proxy_live_register(proxy->cpu, i);
+                } else {
+                    frozen->segs[i - RN_ES] = *cpu_state_proxy_live_segment(proxy->cpu, i);
+                }
             }
+            proxy->frozen = frozen;
+            proxy->cpu = 0;
         }
+        Py_DECREF(py_proxy);
+    } else if (cpu_state_proxy_free == 0){
+        proxy->cpu = 0;
+        cpu_state_proxy_free = proxy;
+    } else {
+        Py_DECREF(py_proxy);
     }
+}
 
-#elif defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#endif
+PyObject* get_cpu_state(qemu_cpu_opaque_t cpu_opaque){
+
+    // We must not lock the pyrebox_mutex (python mutex) because this function
+    // is always called in a point where the mutex has already been acquired.
+    PyObject* proxy = get_cpu_state_proxy(cpu_opaque);
+    if (proxy == NULL){
+        return NULL;
+    }
+    PyObject* result = cpu_state_proxy_snapshot(proxy, NULL);
+    release_cpu_state_proxy(proxy);
     return result;
 }
 
@@ -294,15 +526,9 @@ int qemu_virtual_memory_rw_with_pgd(pyrebox_target_ulong pgd, pyrebox_target_ulo
     if (running_cpu != NULL){
         result = qemu_virtual_memory_rw(running_cpu,addr,buf,len,is_write);
     }
-    else{//If it didnt work, we force the pgd 
-        CPUState* cpu = first_cpu;
-        assert(first_cpu != NULL);
+    else{//If it didnt work, walk the page tables of the pgd
 #if defined(TARGET_I386) || defined(TARGET_X86_64)
-        CPUX86State* env = &(X86_CPU(cpu)->env);
-        pyrebox_target_ulong old_pgd = env->cr[3];
-        env->cr[3] = pgd;
-        result = qemu_virtual_memory_rw((qemu_cpu_opaque_t)cpu,addr,buf,len,is_write);
-        env->cr[3] = old_pgd;
+        result = x86_memory_rw_with_pgd(pgd,addr,buf,len,is_write);
 #elif defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
 #elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
@@ -311,6 +537,125 @@ int qemu_virtual_memory_rw_with_pgd(pyrebox_target_ulong pgd, pyrebox_target_ulo
     }
     return result;
 }
+//Access to the memory of an address space in bulk reads. The cpu running
+//the pgd, if any, is resolved once per bulk read instead of once per access
+typedef struct pgd_access {
+    CPUState* cpu;
+    pyrebox_target_ulong pgd;
+} pgd_access_t;
+
+static void begin_pgd_access(pgd_access_t* access, pyrebox_target_ulong pgd){
+    access->cpu = (CPUState*) get_qemu_cpu_with_pgd(pgd);
+    access->pgd = pgd;
+}
+
+static int pgd_access_rw(pgd_access_t* access, pyrebox_target_ulong addr,
+                         uint8_t *buf, pyrebox_target_ulong len, int is_write){
+    if (access->cpu != NULL){
+        return cpu_memory_rw_debug(access->cpu, addr, buf, len, is_write);
+    }
+#if defined(TARGET_I386) || defined(TARGET_X86_64)
+    return x86_memory_rw_with_pgd(access->pgd, addr, buf, len, is_write);
+#elif defined(TARGET_AARCH64)
+#error "Architecture not supported yet"
+#elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
+#error "Architecture not supported yet"
+#endif
+}
+
+static void set_bitmap_bit(uint8_t* bitmap, unsigned int index, int value){
+    if (value){
+        bitmap[index / 8] |= (1 << (index % 8));
+    } else {
+        bitmap[index / 8] &= ~(1 << (index % 8));
+    }
+}
+
+//Read an arbitrarily long range of virtual memory page by page. Bit i of
+//page_bitmap (bit i % 8 of byte i / 8) is set if the i-th page touched by
+//the range could be read. Unreadable pages are zero filled in buf.
+//Returns the number of pages that could not be read.
+unsigned int qemu_virtual_memory_read_pages(pyrebox_target_ulong pgd, pyrebox_target_ulong addr,
+                        uint8_t *buf, pyrebox_target_ulong len, uint8_t *page_bitmap){
+    unsigned int failed = 0;
+    unsigned int page_index = 0;
+    pyrebox_target_ulong offset = 0;
+    pgd_access_t access;
+    begin_pgd_access(&access, pgd);
+    while (offset < len){
+        pyrebox_target_ulong chunk = TARGET_PAGE_SIZE - ((addr + offset) & ~TARGET_PAGE_MASK);
+        if (chunk > len - offset){
+            chunk = len - offset;
+        }
+        if (pgd_access_rw(&access, addr + offset, buf + offset, chunk, 0) == 0){
+            set_bitmap_bit(page_bitmap, page_index, 1);
+        } else {
+            set_bitmap_bit(page_bitmap, page_index, 0);
+            memset(buf + offset, 0, chunk);
+            ++failed;
+        }
+        offset += chunk;
+        ++page_index;
+    }
+    return failed;
+}
+
+//Read several ranges of virtual memory, packed one after another in buf.
+//Bit i of bitmap is set if the i-th range could be read entirely.
+//Ranges that cannot be read are zero filled.
+//Returns the number of ranges that could not be read.
+unsigned int qemu_virtual_memory_read_many(pyrebox_target_ulong pgd, const pyrebox_target_ulong* addrs,
+                        const pyrebox_target_ulong* lens, unsigned int count, uint8_t *buf, uint8_t *bitmap){
+    unsigned int failed = 0;
+    unsigned int i;
+    pgd_access_t access;
+    begin_pgd_access(&access, pgd);
+    for (i = 0; i < count; ++i){
+        if (pgd_access_rw(&access, addrs[i], buf, lens[i], 0) == 0){
+            set_bitmap_bit(bitmap, i, 1);
+        } else {
+            set_bitmap_bit(bitmap, i, 0);
+            memset(buf, 0, lens[i]);
+            ++failed;
+        }
+        buf += lens[i];
+    }
+    return failed;
+}
+
+//Follow a circular doubly linked list (e.g., a LIST_ENTRY with its Flink
+//as first pointer) starting at the list head. For every node, whose link
+//is at link_offset, its address is stored in nodes and node_size bytes
+//starting at that address are packed in buf. The walk stops when the list
+//goes back to the head, after max_nodes nodes, or when a read fails.
+//Returns the number of nodes read.
+unsigned int qemu_virtual_memory_walk_list(pyrebox_target_ulong pgd, pyrebox_target_ulong head,
+                        pyrebox_target_ulong link_offset, unsigned int ptr_size, pyrebox_target_ulong node_size,
+                        unsigned int max_nodes, pyrebox_target_ulong* nodes, uint8_t *buf){
+    unsigned int count = 0;
+    pyrebox_target_ulong link;
+    //The pointers are little endian and at most 8 bytes long
+    uint64_t raw = 0;
+    pgd_access_t access;
+    assert(ptr_size == 4 || ptr_size == 8);
+    begin_pgd_access(&access, pgd);
+    if (pgd_access_rw(&access, head, (uint8_t*) &raw, ptr_size, 0) == 0){
+        link = (pyrebox_target_ulong) le64_to_cpu(raw);
+        while (count < max_nodes && link != 0 && link != head){
+            nodes[count] = link - link_offset;
+            raw = 0;
+            if (pgd_access_rw(&access, nodes[count], buf, node_size, 0) != 0 ||
+                pgd_access_rw(&access, link, (uint8_t*) &raw, ptr_size, 0) != 0){
+                break;
+            }
+            buf += node_size;
+            ++count;
+            link = (pyrebox_target_ulong) le64_to_cpu(raw);
+        }
+    }
+    return count;
+}
+
 pyrebox_target_ulong qemu_virtual_to_physical_with_pgd(pyrebox_target_ulong pgd, pyrebox_target_ulong addr){
     qemu_cpu_opaque_t running_cpu = get_qemu_cpu_with_pgd(pgd);
     pyrebox_target_ulong page,phys_addr;
@@ -324,26 +669,57 @@ pyrebox_target_ulong qemu_virtual_to_physical_with_pgd(pyrebox_target_ulong pgd,
         phys_addr += (addr & ~TARGET_PAGE_MASK);
         return (pyrebox_target_ulong)phys_addr; 
     }
-    else{//If it didnt work, we force the cr[3]
-        CPUState* cpu = first_cpu;
-        assert(first_cpu != NULL);
+    else{//If it didnt work, walk the page tables of the pgd
 #if defined(TARGET_I386) || defined(TARGET_X86_64)
-        CPUX86State* env = &(X86_CPU(cpu)->env);
-        pyrebox_target_ulong old_pgd = env->cr[3];
-        env->cr[3] = pgd;
-        page = addr & TARGET_PAGE_MASK;
-        phys_addr = cpu_get_phys_page_attrs_debug(cpu, page, &attrs);
-        env->cr[3] = old_pgd;
+        uint64_t x86_phys_addr;
+        if (x86_translate_with_pgd(pgd, addr, &x86_phys_addr) != 0)
+          return -1;
+        return (pyrebox_target_ulong)x86_phys_addr;
 #elif defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
 #elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
 #endif
-        /* if no physical page mapped, return an error */
-        if (phys_addr == -1)
-          return -1;
-        phys_addr += (addr & ~TARGET_PAGE_MASK);
-        return (pyrebox_target_ulong)phys_addr; 
+    }
+}
+
+void pyrebox_invalidate_tb(pyrebox_target_ulong pgd, pyrebox_target_ulong addr){
+    //A full flush is already pending, nothing to do
+    if (is_tb_flush_pending()){
+        tb_flush_stats.flushes_avoided++;
+        return;
+    }
+    pyrebox_target_ulong phys_addr = (pyrebox_target_ulong) -1;
+    if (pgd != 0){
+        phys_addr = qemu_virtual_to_physical_with_pgd(pgd, addr);
+    }
+    if (phys_addr == (pyrebox_target_ulong) -1){
+        //The page is not mapped, but there could be code translated
+        //before it was paged out
+        pyrebox_flush_tb();
+        return;
+    }
+    //Same approach as breakpoint_invalidate (exec.c)
+    tb_invalidate_phys_addr(first_cpu->as, (hwaddr) phys_addr, MEMTXATTRS_UNSPECIFIED);
+    tb_flush_stats.targeted_invalidations++;
+    tb_flush_stats.flushes_avoided++;
+    //The callback could be for the translation block being executed,
+    //which would otherwise run until its end
+    pyrebox_cpu_loop_exit();
+}
+
+void pyrebox_flush_tlb_page(pyrebox_target_ulong vaddr){
+    CPUState* cpu;
+    //Runs asynchronously for the CPUs other than the current one
+    CPU_FOREACH(cpu) {
+        tlb_flush_page(cpu, (target_ulong) vaddr);
+    }
+}
+
+void pyrebox_flush_tlb(void){
+    CPUState* cpu;
+    CPU_FOREACH(cpu) {
+        tlb_flush(cpu);
     }
 }
 
@@ -773,6 +1149,12 @@ int get_qemu_cpu_protected_mode(qemu_cpu_opaque_t cpu_opaque){
     return (env->cr[0] & 0x1);
 };
 
+//Returns 1 if the cpu is running in user mode (CPL 3)
+int get_qemu_cpu_user_mode(qemu_cpu_opaque_t cpu_opaque){
+    CPUX86State* env = &(X86_CPU((CPUState*)cpu_opaque)->env);
+    return ((env->hflags & HF_CPL_MASK) == 3);
+};
+
 //Returns 0 if not running in kernel mode, 1 if running in kernel mode,
 //-1 if the cpu index is incorrect
 int qemu_is_kernel_running(int cpu_index){
@@ -806,15 +1188,37 @@ pyrebox_target_ulong get_cpu_addr(qemu_cpu_opaque_t cpu_opaque){
 
 }
 
+//CPUState of each vCPU, indexed by cpu_index. Built at machine init, filled
+//lazily for hotplugged CPUs and cleared when a CPU is unplugged
+static CPUState** qemu_cpus = NULL;
+
+void init_qemu_cpus(void){
+    CPUState* cpu;
+    qemu_cpus = g_new0(CPUState*, max_cpus);
+    CPU_FOREACH(cpu) {
+        if (cpu->cpu_index >= 0 && cpu->cpu_index < max_cpus){
+            qemu_cpus[cpu->cpu_index] = cpu;
+        }
+    }
+}
+
 qemu_cpu_opaque_t get_qemu_cpu(int cpu_index){
-    int ind = 0;
-    CPUState* next_cpu = first_cpu;
-    while (ind < cpu_index && next_cpu != NULL)
-    {
-        ++ind;
-        next_cpu = CPU_NEXT(next_cpu);
+    if (qemu_cpus == NULL || cpu_index < 0 || cpu_index >= max_cpus){
+        return (qemu_cpu_opaque_t) qemu_get_cpu(cpu_index);
+    }
+    CPUState* cpu = atomic_read(&qemu_cpus[cpu_index]);
+    if (cpu == NULL){
+        //Hotplugged after machine init
+        cpu = qemu_get_cpu(cpu_index);
+        atomic_set(&qemu_cpus[cpu_index], cpu);
+    }
+    return (qemu_cpu_opaque_t) cpu;
+}
+
+void clear_qemu_cpu(int cpu_index){
+    if (qemu_cpus != NULL && cpu_index >= 0 && cpu_index < max_cpus){
+        atomic_set(&qemu_cpus[cpu_index], NULL);
     }
-    return (qemu_cpu_opaque_t) next_cpu;
 }
 
 
@@ -861,16 +1265,10 @@ int get_qemu_cpu_index_with_pgd(pyrebox_target_ulong pgd){
 }
 
 pyrebox_target_ulong get_running_process(int cpu_index){
-    int ind = 0;
-    CPUState* next_cpu = first_cpu;
-    while (ind < cpu_index && next_cpu != NULL)
-    {
-        ++ind;
-        next_cpu = CPU_NEXT(next_cpu);
-    }
-    if (next_cpu != NULL){
+    CPUState* cpu = (CPUState*) get_qemu_cpu(cpu_index);
+    if (cpu != NULL){
 #if defined(TARGET_I386) || defined(TARGET_X86_64)
-        CPUX86State* env = &(X86_CPU(next_cpu)->env);
+        CPUX86State* env = &(X86_CPU(cpu)->env);
         return ((pyrebox_target_ulong)env->cr[3]);
 #elif defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
@@ -1040,7 +1438,35 @@ int x86_is_pae(void){
     return (env->cr[4] & CR4_PAE_MASK);
 }
 
-pyrebox_target_ulong x86_get_pte(pyrebox_target_ulong pgd, pyrebox_target_ulong addr)
+//Location and raw contents of every paging structure entry read by a walk,
+//from the top level down to the entry that maps the page, so that a cached
+//walk can be checked against the page tables
+#define PAGE_WALK_MAX_LEVELS 5
+
+typedef struct x86_page_walk_path {
+    int levels;
+    struct {
+        uint64_t addr;
+        uint64_t value;
+        int size;
+    } entries[PAGE_WALK_MAX_LEVELS];
+} x86_page_walk_path_t;
+
+static inline void x86_page_walk_record(x86_page_walk_path_t* path, uint64_t addr, uint64_t value, int size){
+    if (path != NULL) {
+        path->entries[path->levels].addr = addr;
+        path->entries[path->levels].value = value;
+        path->entries[path->levels].size = size;
+        path->levels++;
+    }
+}
+
+//Walk the page tables of pgd for addr. Returns the entry that maps the page
+//(or -1 if a paging structure is not present), and sets page_size to the
+//size of the page it maps. If path is not NULL, it is filled with every
+//entry read by the walk
+static pyrebox_target_ulong x86_walk_page_tables(pyrebox_target_ulong pgd, pyrebox_target_ulong addr,
+                                                 pyrebox_target_ulong* page_size, x86_page_walk_path_t* path)
 {
     // Just get first cpu, for CR0, CR4 registers
     X86CPU *cpu = X86_CPU(get_qemu_cpu(0));;
@@ -1050,6 +1476,9 @@ pyrebox_target_ulong x86_get_pte(pyrebox_target_ulong pgd, pyrebox_target_ulong
     int32_t a20_mask;
 
     a20_mask = x86_get_a20_mask(env);
+    if (path != NULL) {
+        path->levels = 0;
+    }
     if (!(env->cr[0] & CR0_PG_MASK)) {
         //Paging not yet enabled
         return (pyrebox_target_ulong)-1;
@@ -1074,6 +1503,7 @@ pyrebox_target_ulong x86_get_pte(pyrebox_target_ulong pgd, pyrebox_target_ulong
                 pml5e_addr = ((pgd & ~0xfff) +
                         (((addr >> 48) & 0x1ff) << 3)) & a20_mask;
                 pml5e = x86_ldq_phys(get_qemu_cpu(0), pml5e_addr);
+                x86_page_walk_record(path, pml5e_addr, pml5e, 8);
                 if (!(pml5e & PG_PRESENT_MASK)) {
                     return (pyrebox_target_ulong)-1;
                 }
@@ -1084,17 +1514,19 @@ pyrebox_target_ulong x86_get_pte(pyrebox_target_ulong pgd, pyrebox_target_ulong
             pml4e_addr = ((pml5e & PG_ADDRESS_MASK) +
                     (((addr >> 39) & 0x1ff) << 3)) & a20_mask;
             pml4e = x86_ldq_phys(get_qemu_cpu(0), pml4e_addr);
+            x86_page_walk_record(path, pml4e_addr, pml4e, 8);
             if (!(pml4e & PG_PRESENT_MASK)) {
                 return (pyrebox_target_ulong)-1;
             }
             pdpe_addr = ((pml4e & PG_ADDRESS_MASK) +
                          (((addr >> 30) & 0x1ff) << 3)) & a20_mask;
             pdpe = x86_ldq_phys(get_qemu_cpu(0), pdpe_addr);
+            x86_page_walk_record(path, pdpe_addr, pdpe, 8);
             if (!(pdpe & PG_PRESENT_MASK)) {
                 return (pyrebox_target_ulong)-1;
             }
             if (pdpe & PG_PSE_MASK) {
-                //page_size = 1024 * 1024 * 1024;
+                *page_size = 1024 * 1024 * 1024;
                 pte = pdpe;
                 return pte;
             }
@@ -1105,6 +1537,7 @@ pyrebox_target_ulong x86_get_pte(pyrebox_target_ulong pgd, pyrebox_target_ulong
             pdpe_addr = ((pgd & ~0x1f) + ((addr >> 27) & 0x18)) &
                 a20_mask;
             pdpe = x86_ldq_phys(get_qemu_cpu(0), pdpe_addr);
+            x86_page_walk_record(path, pdpe_addr, pdpe, 8);
             if (!(pdpe & PG_PRESENT_MASK))
                 return (pyrebox_target_ulong)-1;
         }
@@ -1112,19 +1545,21 @@ pyrebox_target_ulong x86_get_pte(pyrebox_target_ulong pgd, pyrebox_target_ulong
         pde_addr = ((pdpe & PG_ADDRESS_MASK) +
                     (((addr >> 21) & 0x1ff) << 3)) & a20_mask;
         pde = x86_ldq_phys(get_qemu_cpu(0), pde_addr);
+        x86_page_walk_record(path, pde_addr, pde, 8);
         if (!(pde & PG_PRESENT_MASK)) {
             return (pyrebox_target_ulong)-1;
         }
         if (pde & PG_PSE_MASK) {
             /* 2 MB page */
-            //page_size = 2048 * 1024;
+            *page_size = 2048 * 1024;
             pte = pde;
         } else {
             /* 4 KB page */
             pte_addr = ((pde & PG_ADDRESS_MASK) +
                         (((addr >> 12) & 0x1ff) << 3)) & a20_mask;
-            //page_size = 4096;
+            *page_size = 4096;
             pte = x86_ldq_phys(get_qemu_cpu(0), pte_addr);
+            x86_page_walk_record(path, pte_addr, pte, 8);
         }
     } else {
         uint32_t pde;
@@ -1132,20 +1567,379 @@ pyrebox_target_ulong x86_get_pte(pyrebox_target_ulong pgd, pyrebox_target_ulong
         /* page directory entry */
         pde_addr = ((pgd & ~0xfff) + ((addr >> 20) & 0xffc)) & a20_mask;
         pde = x86_ldl_phys(get_qemu_cpu(0), pde_addr);
+        x86_page_walk_record(path, pde_addr, pde, 4);
         if (!(pde & PG_PRESENT_MASK))
             return (pyrebox_target_ulong)-1;
         if ((pde & PG_PSE_MASK) && (env->cr[4] & CR4_PSE_MASK)) {
             pte = pde | ((pde & 0x1fe000LL) << (32 - 13));
-            //page_size = 4096 * 1024;
+            *page_size = 4096 * 1024;
         } else {
             /* page directory entry */
             pte_addr = ((pde & ~0xfff) + ((addr >> 10) & 0xffc)) & a20_mask;
             pte = x86_ldl_phys(get_qemu_cpu(0), pte_addr);
-            //page_size = 4096;
+            *page_size = 4096;
+            x86_page_walk_record(path, pte_addr, (uint32_t) pte, 4);
         }
     }
     return pte;
 }
+
+pyrebox_target_ulong x86_get_pte(pyrebox_target_ulong pgd, pyrebox_target_ulong addr)
+{
+    pyrebox_target_ulong page_size;
+    return x86_walk_page_tables(pgd, addr, &page_size, NULL);
+}
+
+//Translations of the page walker, indexed by a hash of pgd and page. Every
+//entry belongs to a generation, and bumping the generation invalidates
+//them all. Generation 0 is never used, so zeroed entries are invalid.
+//
+//The guest can modify the page tables of an address space that is not
+//loaded on any cpu without flushing the TLB, at any level, so a hit is only
+//trusted if every entry read by the walk still holds the same value. A hit
+//reads the same entries as a walk, but skips its mode checks and address
+//computations. Entries and counters are shared by the vCPU threads and the
+//main loop, and are protected by page_walk_cache_lock
+#define PAGE_WALK_CACHE_BITS 12
+#define PAGE_WALK_CACHE_SIZE (1 << PAGE_WALK_CACHE_BITS)
+
+typedef struct page_walk_cache_entry {
+    unsigned long generation;
+    pyrebox_target_ulong pgd;
+    pyrebox_target_ulong page;
+    uint64_t phys_page;
+    x86_page_walk_path_t path;
+} page_walk_cache_entry_t;
+
+static page_walk_cache_entry_t page_walk_cache[PAGE_WALK_CACHE_SIZE];
+static unsigned long page_walk_cache_generation = 1;
+static page_walk_cache_stats_t page_walk_cache_stats = {0, 0, 0};
+//Zero initialized, which is the unlocked state
+static QemuSpin page_walk_cache_lock;
+
+//Called from the TLB flush paths (CR3 reloads, INVLPG, explicit flushes):
+//whatever invalidates the TLB of the guest invalidates the cached walks
+void page_walk_cache_invalidate(void){
+    qemu_spin_lock(&page_walk_cache_lock);
+    page_walk_cache_generation++;
+    page_walk_cache_stats.invalidations++;
+    qemu_spin_unlock(&page_walk_cache_lock);
+}
+
+void page_walk_cache_get_stats(page_walk_cache_stats_t* stats){
+    qemu_spin_lock(&page_walk_cache_lock);
+    *stats = page_walk_cache_stats;
+    qemu_spin_unlock(&page_walk_cache_lock);
+}
+
+static inline unsigned int page_walk_cache_hash(pyrebox_target_ulong pgd, pyrebox_target_ulong page){
+    return (unsigned int) (((page >> 12) ^ (pgd >> 12) * 0x9E3779B1) & (PAGE_WALK_CACHE_SIZE - 1));
+}
+
+//Check that none of the entries read by a cached walk has changed since
+//the walk, from the top level down
+static inline int page_walk_path_unchanged(const x86_page_walk_path_t* path){
+    int i;
+    if (path->levels == 0){
+        return 0;
+    }
+    for (i = 0; i < path->levels; ++i){
+        uint64_t value;
+        if (path->entries[i].size == 4){
+            value = (uint64_t) x86_ldl_phys(get_qemu_cpu(0), path->entries[i].addr);
+        } else {
+            value = x86_ldq_phys(get_qemu_cpu(0), path->entries[i].addr);
+        }
+        if (value != path->entries[i].value){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//Translate addr in the address space pgd. If use_cache is not set, the
+//page tables are always walked and the cache is neither read nor filled
+static int x86_translate_with_pgd_internal(pyrebox_target_ulong pgd, pyrebox_target_ulong addr,
+                                           uint64_t* phys_addr, int use_cache){
+    pyrebox_target_ulong page = addr & TARGET_PAGE_MASK;
+    X86CPU *cpu = X86_CPU(get_qemu_cpu(0));
+    if (!(cpu->env.cr[0] & CR0_PG_MASK)){
+        //Paging not yet enabled
+        *phys_addr = addr;
+        return 0;
+    }
+
+    page_walk_cache_entry_t* entry = &page_walk_cache[page_walk_cache_hash(pgd, page)];
+    unsigned long generation = 0;
+    if (use_cache){
+        page_walk_cache_entry_t cached;
+        qemu_spin_lock(&page_walk_cache_lock);
+        generation = page_walk_cache_generation;
+        cached = *entry;
+        qemu_spin_unlock(&page_walk_cache_lock);
+        if (cached.generation == generation && cached.pgd == pgd && cached.page == page &&
+            page_walk_path_unchanged(&cached.path)){
+            qemu_spin_lock(&page_walk_cache_lock);
+            page_walk_cache_stats.hits++;
+            qemu_spin_unlock(&page_walk_cache_lock);
+            *phys_addr = cached.phys_page | (addr & ~TARGET_PAGE_MASK);
+            return 0;
+        }
+    }
+
+    x86_page_walk_path_t path;
+    pyrebox_target_ulong page_size = TARGET_PAGE_SIZE;
+    uint64_t pte = (uint64_t) x86_walk_page_tables(pgd, addr, &page_size, &path);
+    if (pte == (uint64_t)(pyrebox_target_ulong)-1 || !(pte & PG_PRESENT_MASK)){
+        if (use_cache){
+            qemu_spin_lock(&page_walk_cache_lock);
+            page_walk_cache_stats.misses++;
+            qemu_spin_unlock(&page_walk_cache_lock);
+        }
+        return -1;
+    }
+    //Large pages are cached at TARGET_PAGE_SIZE granularity
+    uint64_t phys_page = (pte & (uint64_t) x86_get_a20_mask(&cpu->env) & PG_ADDRESS_MASK & ~((uint64_t) page_size - 1)) +
+                         ((addr & (page_size - 1)) & TARGET_PAGE_MASK);
+
+    if (use_cache){
+        qemu_spin_lock(&page_walk_cache_lock);
+        page_walk_cache_stats.misses++;
+        //Do not fill the entry if the cache was invalidated during the walk
+        if (page_walk_cache_generation == generation){
+            entry->generation = generation;
+            entry->pgd = pgd;
+            entry->page = page;
+            entry->phys_page = phys_page;
+            entry->path = path;
+        }
+        qemu_spin_unlock(&page_walk_cache_lock);
+    }
+    *phys_addr = phys_page | (addr & ~TARGET_PAGE_MASK);
+    return 0;
+}
+
+//Translate a virtual address of the address space pgd without touching the
+//state of any cpu. Returns 0 on success, -1 if the page is not mapped
+int x86_translate_with_pgd(pyrebox_target_ulong pgd, pyrebox_target_ulong addr, uint64_t* phys_addr){
+    return x86_translate_with_pgd_internal(pgd, addr, phys_addr, 1);
+}
+
+//Read or write the memory of the address space pgd through the page walker.
+//Writes always walk the page tables, they are never served from the cache
+int x86_memory_rw_with_pgd(pyrebox_target_ulong pgd, pyrebox_target_ulong addr,
+                           uint8_t *buf, pyrebox_target_ulong len, int is_write){
+    CPUState* cpu = (CPUState*) get_qemu_cpu(0);
+    while (len > 0){
+        uint64_t phys_addr;
+        pyrebox_target_ulong l = TARGET_PAGE_SIZE - (addr & ~TARGET_PAGE_MASK);
+        if (l > len){
+            l = len;
+        }
+        if (x86_translate_with_pgd_internal(pgd, addr, &phys_addr, !is_write) != 0){
+            return -1;
+        }
+        if (is_write){
+            address_space_write_rom(cpu->as, phys_addr, MEMTXATTRS_UNSPECIFIED, buf, l);
+        } else {
+            address_space_rw(cpu->as, phys_addr, MEMTXATTRS_UNSPECIFIED, buf, l, 0);
+        }
+        len -= l;
+        buf += l;
+        addr += l;
+    }
+    return 0;
+}
+
+//State of a walk of the paging structures over a range of addresses.
+//Addresses are handled in table coordinates: the canonical sign extension
+//is removed, so that the tree covers [0, 1 << va_bits)
+typedef struct x86_range_walk {
+    uint64_t first;
+    uint64_t last;
+    //Bits of the virtual addresses in long mode (48 or 57), 0 otherwise
+    int va_bits;
+    //Number of levels, and for each one the shift of the address and the
+    //number of index bits. Level 0 is the top level
+    int nb_levels;
+    int shifts[5];
+    int bits[5];
+    //Levels whose entries can map a page (PS bit)
+    int large_levels;
+    int entry_size;
+    //PDPT entries of PAE without long mode have no RW/US/NX bits
+    int pae_pdpt;
+    int pse;
+    uint64_t a20_mask;
+    CPUState* cpu;
+    x86_page_mapping_t* mappings;
+    unsigned int count;
+    unsigned int capacity;
+} x86_range_walk_t;
+
+static void x86_range_walk_add(x86_range_walk_t* w, uint64_t va, uint64_t pa, uint64_t flags, uint64_t size){
+    if (w->count == w->capacity){
+        w->capacity = (w->capacity == 0) ? 256 : w->capacity * 2;
+        w->mappings = (x86_page_mapping_t*) realloc(w->mappings, w->capacity * sizeof(x86_page_mapping_t));
+        assert(w->mappings != NULL);
+    }
+    //Restore the canonical form
+    if (w->va_bits != 0 && (va & (1ULL << (w->va_bits - 1)))){
+        va |= ~((1ULL << w->va_bits) - 1);
+    }
+    w->mappings[w->count].va = va;
+    w->mappings[w->count].pa = pa;
+    w->mappings[w->count].flags = flags;
+    w->mappings[w->count].size = size;
+    w->count++;
+}
+
+static void x86_range_walk_level(x86_range_walk_t* w, uint64_t table, int level, uint64_t va_base, uint64_t flags){
+    //At most 512 entries of 8 bytes or 1024 of 4 bytes
+    uint8_t entries[4096];
+    int shift = w->shifts[level];
+    uint64_t span = 1ULL << shift;
+    uint64_t table_last = va_base + ((uint64_t) (1 << w->bits[level]) << shift) - 1;
+    unsigned int first_index;
+    unsigned int last_index;
+    unsigned int i;
+
+    if (w->last < va_base || w->first > table_last){
+        return;
+    }
+    first_index = (w->first > va_base) ? (unsigned int) ((w->first - va_base) >> shift) : 0;
+    last_index = (unsigned int) ((((w->last < table_last) ? w->last : table_last) - va_base) >> shift);
+    //Read all the entries in range at once
+    address_space_rw(w->cpu->as, (table + first_index * w->entry_size) & w->a20_mask, MEMTXATTRS_UNSPECIFIED,
+                     entries, (last_index - first_index + 1) * w->entry_size, 0);
+
+    for (i = first_index; i <= last_index; ++i){
+        uint64_t entry;
+        uint64_t entry_flags;
+        uint64_t va = va_base + ((uint64_t) i << shift);
+        if (w->entry_size == 8){
+            entry = ldq_le_p(entries + (i - first_index) * 8);
+        } else {
+            entry = ldl_le_p(entries + (i - first_index) * 4);
+        }
+        //Absent entries skip the whole range they would map
+        if (!(entry & PG_PRESENT_MASK)){
+            continue;
+        }
+        //Effective permissions: writable and user only if every level allows it,
+        //not executable if any level forbids it
+        if (level == 0 && w->pae_pdpt){
+            entry_flags = flags;
+        } else {
+            entry_flags = (flags & ~(uint64_t) (PG_RW_MASK | PG_USER_MASK)) |
+                          (flags & entry & (PG_RW_MASK | PG_USER_MASK)) |
+                          (entry & PG_NX_MASK);
+        }
+        if (level == w->nb_levels - 1 || ((w->large_levels & (1 << level)) && (entry & PG_PSE_MASK))){
+            uint64_t pa;
+            if (w->entry_size == 4 && level == 0){
+                //4 MB page, with the PSE-36 bits
+                pa = (entry & 0xffc00000) | ((entry & 0x1fe000) << (32 - 13));
+            } else {
+                pa = entry & PG_ADDRESS_MASK & ~(span - 1);
+            }
+            //Leaf entry: its own flags, with the effective permissions
+            entry_flags = (entry & 0xfff & ~(uint64_t) (PG_RW_MASK | PG_USER_MASK)) | entry_flags;
+            x86_range_walk_add(w, va, pa & w->a20_mask, entry_flags, span);
+        } else {
+            uint64_t next = (w->entry_size == 8) ? (entry & PG_ADDRESS_MASK) : (entry & ~0xfffULL);
+            x86_range_walk_level(w, next, level + 1, va, entry_flags);
+        }
+    }
+}
+
+//Enumerate the pages mapped in the address space pgd that intersect
+//[start, end) (end 0 meaning the end of the address space), walking each
+//paging structure only once. Absent entries
+//skip everything below them. Large pages (2 MB, 4 MB and 1 GB) are returned
+//as a single mapping, starting at the beginning of the page. Returns an array
+//(to be freed by the caller) and sets count, or NULL if paging is disabled.
+x86_page_mapping_t* x86_walk_page_range(pyrebox_target_ulong pgd, pyrebox_target_ulong start,
+                                        pyrebox_target_ulong end, unsigned int* count){
+    X86CPU *cpu = X86_CPU(get_qemu_cpu(0));
+    CPUX86State *env = &cpu->env;
+    x86_range_walk_t w;
+    uint64_t top_table;
+    uint64_t initial_flags = PG_RW_MASK | PG_USER_MASK;
+
+    *count = 0;
+    if (!(env->cr[0] & CR0_PG_MASK)) {
+        //Paging not yet enabled
+        return NULL;
+    }
+    memset(&w, 0, sizeof(w));
+    w.cpu = CPU(cpu);
+    w.a20_mask = (uint64_t)(int64_t) x86_get_a20_mask(env);
+    w.first = start;
+    //An end of 0 stands for the end of the address space
+    w.last = (end == 0) ? ~0ULL : (uint64_t) end - 1;
+    if (end != 0 && end <= start){
+        return NULL;
+    }
+
+    if (env->cr[4] & CR4_PAE_MASK) {
+        w.entry_size = 8;
+#ifdef TARGET_X86_64
+        if (env->hflags & HF_LMA_MASK) {
+            int la57 = (env->cr[4] & CR4_LA57_MASK) != 0;
+            int level;
+            uint64_t hole_start;
+            uint64_t tree_mask;
+            w.va_bits = la57 ? 57 : 48;
+            w.nb_levels = la57 ? 5 : 4;
+            for (level = 0; level < w.nb_levels; ++level){
+                w.shifts[level] = 12 + 9 * (w.nb_levels - 1 - level);
+                w.bits[level] = 9;
+            }
+            //PDPT (1 GB) and PD (2 MB) entries
+            w.large_levels = (1 << (w.nb_levels - 3)) | (1 << (w.nb_levels - 2));
+            top_table = pgd & PG_ADDRESS_MASK;
+            //Move the range to table coordinates, dropping the non-canonical hole
+            hole_start = 1ULL << (w.va_bits - 1);
+            tree_mask = (1ULL << w.va_bits) - 1;
+            if (w.first >= hole_start){
+                w.first = (w.first >= ~(hole_start - 1)) ? (w.first & tree_mask) : hole_start;
+            }
+            if (w.last >= hole_start){
+                w.last = (w.last >= ~(hole_start - 1)) ? (w.last & tree_mask) : hole_start - 1;
+            }
+            if (w.last < w.first){
+                return NULL;
+            }
+        } else
+#endif
+        {
+            w.nb_levels = 3;
+            w.shifts[0] = 30;
+            w.bits[0] = 2;
+            w.shifts[1] = 21;
+            w.bits[1] = 9;
+            w.shifts[2] = 12;
+            w.bits[2] = 9;
+            w.large_levels = (1 << 1);
+            w.pae_pdpt = 1;
+            top_table = pgd & ~0x1fULL;
+        }
+    } else {
+        w.entry_size = 4;
+        w.nb_levels = 2;
+        w.shifts[0] = 22;
+        w.bits[0] = 10;
+        w.shifts[1] = 12;
+        w.bits[1] = 10;
+        w.large_levels = (env->cr[4] & CR4_PSE_MASK) ? 1 : 0;
+        top_table = pgd & ~0xfffULL;
+    }
+
+    x86_range_walk_level(&w, top_table, 0, 0, initial_flags);
+    *count = w.count;
+    return w.mappings;
+}
 #elif defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
 #elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
@@ -161,6 +161,13 @@ typedef void* qemu_tb_opaque_t;
 //python callback functions. This NEW objects must be decrefed once we return back from the
 //python funtion called with Py_Callobject so that the GC can delete them from memory.
 PyObject* get_cpu_state(qemu_cpu_opaque_t cpu_opaque);
+
+//Lazy alternative to get_cpu_state for the callbacks: the object reads the registers
+//of the cpu when its attributes are accessed. It must be released with
+//release_cpu_state_proxy (instead of decrefed) once the callbacks have returned.
+PyObject* get_cpu_state_proxy(qemu_cpu_opaque_t cpu_opaque);
+void release_cpu_state_proxy(PyObject* proxy);
+int init_cpu_state_proxy_type(PyObject* module);
 PyObject* get_tb(qemu_tb_opaque_t tb_opaque);
 
 /************************************************** MEM/REG RW FUNCTIONS **********************************************/
@@ -179,14 +186,32 @@ int qemu_virtual_memory_rw(qemu_cpu_opaque_t *cpu_opaque, pyrebox_target_ulong a
                         uint8_t *buf, pyrebox_target_ulong len, int is_write);
 int qemu_virtual_memory_rw_with_pgd(pyrebox_target_ulong pgd, pyrebox_target_ulong addr,
                         uint8_t *buf, pyrebox_target_ulong len, int is_write);
+unsigned int qemu_virtual_memory_read_pages(pyrebox_target_ulong pgd, pyrebox_target_ulong addr,
+                        uint8_t *buf, pyrebox_target_ulong len, uint8_t *page_bitmap);
+unsigned int qemu_virtual_memory_read_many(pyrebox_target_ulong pgd, const pyrebox_target_ulong* addrs,
+                        const pyrebox_target_ulong* lens, unsigned int count, uint8_t *buf, uint8_t *bitmap);
+unsigned int qemu_virtual_memory_walk_list(pyrebox_target_ulong pgd, pyrebox_target_ulong head,
+                        pyrebox_target_ulong link_offset, unsigned int ptr_size, pyrebox_target_ulong node_size,
+                        unsigned int max_nodes, pyrebox_target_ulong* nodes, uint8_t *buf);
 pyrebox_target_ulong qemu_virtual_to_physical_with_pgd(pyrebox_target_ulong pgd, pyrebox_target_ulong addr);
 
+//Invalidate the translated code that covers an address of a given address space,
+//falling back to a full flush if the address cannot be translated
+void pyrebox_invalidate_tb(pyrebox_target_ulong pgd, pyrebox_target_ulong addr);
+
+//Drop the TLB entries of a virtual page in every CPU, or the whole TLBs, so that
+//they are filled again (e.g., when the memory watches change)
+void pyrebox_flush_tlb_page(pyrebox_target_ulong vaddr);
+void pyrebox_flush_tlb(void);
+
 uint32_t qemu_ioport_read(uint16_t address, uint8_t size);
 void qemu_ioport_write(uint16_t address, uint8_t size, uint32_t value);
 
 /******************************************* CPU/TB DATA EXTRAcTION **********************************************/
 
 //Functions for retrieving QEMU CPU OPAQUE
+void init_qemu_cpus(void);
+void clear_qemu_cpu(int cpu_index);
 qemu_cpu_opaque_t get_qemu_cpu(int cpu_index);
 qemu_cpu_opaque_t get_qemu_cpu_with_pgd(pyrebox_target_ulong pgd);
 
@@ -201,8 +226,25 @@ pyrebox_target_ulong get_gs_base(qemu_cpu_opaque_t cpu_opaque);
 pyrebox_target_ulong get_fs_base(qemu_cpu_opaque_t cpu_opaque);
 int get_qemu_cpu_protected_mode(qemu_cpu_opaque_t cpu_opaque);
 int qemu_is_kernel_running(int cpu_index);
+int get_qemu_cpu_user_mode(qemu_cpu_opaque_t cpu_opaque);
 int x86_is_pae(void);
 pyrebox_target_ulong x86_get_pte(pyrebox_target_ulong pgd, pyrebox_target_ulong addr);
+int x86_translate_with_pgd(pyrebox_target_ulong pgd, pyrebox_target_ulong addr, uint64_t* phys_addr);
+int x86_memory_rw_with_pgd(pyrebox_target_ulong pgd, pyrebox_target_ulong addr,
+                           uint8_t *buf, pyrebox_target_ulong len, int is_write);
+
+//A page mapped in an address space. flags holds the low 12 bits of the
+//entry that maps it and the NX bit (63), with the RW and US bits of all
+//the levels combined
+typedef struct x86_page_mapping {
+    uint64_t va;
+    uint64_t pa;
+    uint64_t flags;
+    uint64_t size;
+} x86_page_mapping_t;
+
+x86_page_mapping_t* x86_walk_page_range(pyrebox_target_ulong pgd, pyrebox_target_ulong start,
+                                        pyrebox_target_ulong end, unsigned int* count);
 #endif
 
 //CPU Query functions
@@ -40,6 +40,7 @@
 #include "qemu_glue.h"
 #include "process_mgr.h"
 #include "qemu_glue_callbacks.h"
+#include "qemu_glue_callbacks_context.h"
 #include "callbacks.h"
 
 //This file should define the functions called by qemu hooks, 
@@ -50,10 +51,18 @@
 //if we include it in qemu headers, so we need 
 //this proxy to compile it easily
 
-target_ulong last_pgd = 0;
+//Last pgd seen on each vCPU, indexed by cpu_index. Allocated at machine
+//init, for every possible cpu (including hotplugged ones)
+static target_ulong* last_pgds = NULL;
 
 int flush_needed = 0;
 int cpu_loop_exit_needed = 0;
+tb_flush_stats_t tb_flush_stats = {0, 0, 0};
+//Maintained by the callback manager. All inactive until the first update
+callback_prefilter_t callback_prefilters[PREFILTER_LAST];
+//Maintained by the callback manager
+unsigned int watched_pages_count = 0;
+QEMU_BUILD_BUG_ON(WATCH_PAGE_BITS != TARGET_PAGE_BITS);
 
 void qemu_tlb_exec_callback(CPUState* cpu, target_ulong vaddr){
     //Transform parameters
@@ -64,7 +73,7 @@ void qemu_tlb_exec_callback(CPUState* cpu, target_ulong vaddr){
     tlb_exec_callback(params); 
 }
 
-void notify_cpu_executing(CPUState* cpu){
+static void check_context_change(CPUState* cpu){
 #if defined(TARGET_I386) || defined(TARGET_X86_64)
     CPUX86State* env = &(X86_CPU((CPUState*)cpu)->env);
     target_ulong cur_pgd = (target_ulong)env->cr[3];
@@ -73,43 +82,47 @@ void notify_cpu_executing(CPUState* cpu){
 #elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
 #endif
-    //If there was a context change
-    if(cur_pgd != last_pgd){
+    //If there was a context change on this vCPU. Switching
+    //between vCPUs running different processes is not one.
+    if(cur_pgd != last_pgds[cpu->cpu_index]){
         //Notify context change
         callback_params_t params;
-        params.vmi_context_change_params.old_pgd = last_pgd;
+        params.vmi_context_change_params.cpu_index = cpu->cpu_index;
+        params.vmi_context_change_params.old_pgd = last_pgds[cpu->cpu_index];
         params.vmi_context_change_params.new_pgd = cur_pgd;
+        last_pgds[cpu->cpu_index] = cur_pgd;
         context_change_callback(params);
-        last_pgd = cur_pgd;
     }
 }
 
-void helper_qemu_block_begin_callback(TranslationBlock* tb){
+void init_context_change_tracking(void){
+    last_pgds = g_new0(target_ulong, max_cpus);
+}
+
+void notify_cr3_write(CPUState* cpu){
+    //Precise detection point for MOV to CR3
+    check_context_change(cpu);
+}
+
+void notify_cpu_executing(CPUState* cpu){
+    //Fallback for CR3 changes that do not go through MOV to CR3
+    //(task switches, SMM and SVM transitions, loadvm...)
+    check_context_change(cpu);
+}
+
+void helper_qemu_block_begin_callback(TranslationBlock* tb, uint32_t dispatch_record){
     CPUState* cpu = current_cpu;
     callback_params_t params;
-#if defined(TARGET_I386) || defined(TARGET_X86_64)
-    CPUX86State* env = &(X86_CPU((CPUState*)cpu)->env);
-    params.block_begin_params.cpu_index = get_qemu_cpu_index_with_pgd((target_ulong)env->cr[3]);
-#elif defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#endif
+    params.block_begin_params.cpu_index = cpu->cpu_index;
     params.block_begin_params.tb = (qemu_tb_opaque_t) tb;
     params.block_begin_params.cpu = (qemu_cpu_opaque_t) cpu;
+    params.block_begin_params.dispatch_record = (int) dispatch_record;
     block_begin_callback(params);
 }
 void helper_qemu_block_end_callback(TranslationBlock* tb, target_ulong from, target_ulong to){
     CPUState* cpu = current_cpu;
     callback_params_t params;
-#if defined(TARGET_I386) || defined(TARGET_X86_64)
-    CPUX86State* env = &(X86_CPU((CPUState*)cpu)->env);
-    params.block_end_params.cpu_index = get_qemu_cpu_index_with_pgd((target_ulong)env->cr[3]);
-#elif defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#endif
+    params.block_end_params.cpu_index = cpu->cpu_index;
     params.block_end_params.tb = (qemu_tb_opaque_t) tb;
     params.block_end_params.cpu = (qemu_cpu_opaque_t) cpu;
     params.block_end_params.cur_pc = from;
@@ -117,62 +130,70 @@ void helper_qemu_block_end_callback(TranslationBlock* tb, target_ulong from, tar
     block_end_callback(params);
 }
 
-void helper_qemu_insn_begin_callback(void){
+void helper_qemu_insn_begin_callback(uint32_t dispatch_record){
     CPUState* cpu = current_cpu;
     callback_params_t params;
-#if defined(TARGET_I386) || defined(TARGET_X86_64)
-    CPUX86State* env = &(X86_CPU((CPUState*)cpu)->env);
-    params.insn_begin_params.cpu_index = get_qemu_cpu_index_with_pgd((target_ulong)env->cr[3]);
-#elif defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#endif
+    params.insn_begin_params.cpu_index = cpu->cpu_index;
     params.insn_begin_params.cpu = (qemu_cpu_opaque_t) cpu;
+    params.insn_begin_params.dispatch_record = (int) dispatch_record;
     insn_begin_callback(params);
 }
 
 void helper_qemu_insn_end_callback(void){
     CPUState* cpu = current_cpu;
     callback_params_t params;
-#if defined(TARGET_I386) || defined(TARGET_X86_64)
-    CPUX86State* env = &(X86_CPU((CPUState*)cpu)->env);
-    params.insn_end_params.cpu_index = get_qemu_cpu_index_with_pgd((target_ulong)env->cr[3]);
-#elif defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
-#error "Architecture not supported yet"
-#endif
+    params.insn_end_params.cpu_index = cpu->cpu_index;
     params.insn_end_params.cpu = (qemu_cpu_opaque_t) cpu;
     insn_end_callback(params);
 }
 
-void helper_qemu_opcode_range_callback(target_ulong from, target_ulong to, uint32_t opcode, target_ulong insn_size){
+void helper_qemu_opcode_range_callback(target_ulong from, target_ulong to, uint32_t opcode, target_ulong insn_size, uint32_t info){
+    CPUState* cpu = current_cpu;
+    callback_params_t params;
+    params.opcode_range_params.cpu_index = cpu->cpu_index;
+    params.opcode_range_params.cpu = (qemu_cpu_opaque_t) cpu; 
+    params.opcode_range_params.cur_pc = from;
+    params.opcode_range_params.next_pc = to;
+    params.opcode_range_params.opcode = opcode;
+    params.opcode_range_params.insn_size = insn_size;
+    params.opcode_range_params.prefix_len = INSN_INFO_PREFIX_LEN(info);
+    params.opcode_range_params.modrm_reg = INSN_INFO_MODRM_REG(info);
+    params.opcode_range_params.insn_class = INSN_INFO_CLASS(info);
+
+    opcode_range_callback(params);
+}
+
+void helper_qemu_branch_callback(target_ulong source, target_ulong return_addr, uint32_t kind){
     CPUState* cpu = current_cpu;
     callback_params_t params;
 #if defined(TARGET_I386) || defined(TARGET_X86_64)
     CPUX86State* env = &(X86_CPU((CPUState*)cpu)->env);
-    params.opcode_range_params.cpu_index = get_qemu_cpu_index_with_pgd((target_ulong)env->cr[3]);
+    params.branch_params.cpu_index = cpu->cpu_index;
+    //The destination has already been written to the cpu state
+    params.branch_params.target = env->segs[R_CS].base + env->eip;
 #elif defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
 #elif defined(TARGET_ARM) && !defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
 #endif
-    params.opcode_range_params.cpu = (qemu_cpu_opaque_t) cpu; 
-    params.opcode_range_params.cur_pc = from;
-    params.opcode_range_params.next_pc = to;
-    params.opcode_range_params.opcode = opcode;
-    params.opcode_range_params.insn_size = insn_size;
+    params.branch_params.cpu = (qemu_cpu_opaque_t) cpu;
+    params.branch_params.source = source;
+    params.branch_params.return_addr = return_addr;
+    params.branch_params.kind = kind;
 
-    opcode_range_callback(params);
+    branch_callback(params);
 }
 
-void helper_qemu_mem_read_callback(target_ulong vaddr, uintptr_t haddr, target_ulong size){
+static void deliver_mem_read_callback(target_ulong vaddr, uintptr_t haddr, target_ulong size, int prefilter){
     CPUState* cpu = current_cpu;
     callback_params_t params;
 #if defined(TARGET_I386) || defined(TARGET_X86_64)
     CPUX86State* env = &(X86_CPU((CPUState*)cpu)->env);
-    params.mem_read_params.cpu_index = get_qemu_cpu_index_with_pgd((target_ulong)env->cr[3]);
+    //The slow path of the softmmu calls this helper without the inline prefilter
+    if (prefilter && !callback_prefilter_check(PREFILTER_MEM_READ, vaddr, env->cr[3], (env->hflags & HF_CPL_MASK) == 3)){
+        return;
+    }
+    params.mem_read_params.cpu_index = cpu->cpu_index;
     params.mem_read_params.cpu = (qemu_cpu_opaque_t) cpu;
 #elif defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
@@ -185,12 +206,16 @@ void helper_qemu_mem_read_callback(target_ulong vaddr, uintptr_t haddr, target_u
     mem_read_callback(params);
 }
 
-void helper_qemu_mem_write_callback(target_ulong vaddr, uintptr_t haddr, target_ulong data, target_ulong size){
+static void deliver_mem_write_callback(target_ulong vaddr, uintptr_t haddr, target_ulong data, target_ulong size, int prefilter){
     CPUState* cpu = current_cpu;
     callback_params_t params;
 #if defined(TARGET_I386) || defined(TARGET_X86_64)
     CPUX86State* env = &(X86_CPU((CPUState*)cpu)->env);
-    params.mem_write_params.cpu_index = get_qemu_cpu_index_with_pgd((target_ulong)env->cr[3]);
+    //The slow path of the softmmu calls this helper without the inline prefilter
+    if (prefilter && !callback_prefilter_check(PREFILTER_MEM_WRITE, vaddr, env->cr[3], (env->hflags & HF_CPL_MASK) == 3)){
+        return;
+    }
+    params.mem_write_params.cpu_index = cpu->cpu_index;
     params.mem_write_params.cpu = (qemu_cpu_opaque_t) cpu;
 #elif defined(TARGET_AARCH64)
 #error "Architecture not supported yet"
@@ -205,6 +230,24 @@ void helper_qemu_mem_write_callback(target_ulong vaddr, uintptr_t haddr, target_
     mem_write_callback(params);
 }
 
+void helper_qemu_mem_read_callback(target_ulong vaddr, uintptr_t haddr, target_ulong size){
+    deliver_mem_read_callback(vaddr, haddr, size, 1);
+}
+
+void helper_qemu_mem_write_callback(target_ulong vaddr, uintptr_t haddr, target_ulong data, target_ulong size){
+    deliver_mem_write_callback(vaddr, haddr, data, size, 1);
+}
+
+//The merged prefilters do not account for the watches, so
+//the accesses to watched pages are delivered unconditionally
+void helper_qemu_mem_read_watch_callback(target_ulong vaddr, uintptr_t haddr, target_ulong size){
+    deliver_mem_read_callback(vaddr, haddr, size, 0);
+}
+
+void helper_qemu_mem_write_watch_callback(target_ulong vaddr, uintptr_t haddr, target_ulong data, target_ulong size){
+    deliver_mem_write_callback(vaddr, haddr, data, size, 0);
+}
+
 void qemu_keystroke_callback(unsigned int keycode){
     callback_params_t params;
     params.keystroke_params.keycode = keycode;
@@ -242,6 +285,10 @@ int is_opcode_range_callback_needed(target_ulong start_opcode){
     return is_callback_needed(OPCODE_RANGE_CB, start_opcode);
 }
 
+int is_branch_callback_needed(uint32_t kind){
+    return is_callback_needed(BRANCH_CB, kind);
+}
+
 int is_block_begin_callback_needed(target_ulong address){
     return is_callback_needed(BLOCK_BEGIN_CB, address);
 }
@@ -249,6 +296,20 @@ int is_insn_begin_callback_needed(target_ulong address){
     return is_callback_needed(INSN_BEGIN_CB, address);
 }
 
+int get_block_begin_dispatch_record(target_ulong address){
+    return get_dispatch_record(BLOCK_BEGIN_CB, address);
+}
+int get_insn_begin_dispatch_record(target_ulong address){
+    return get_dispatch_record(INSN_BEGIN_CB, address);
+}
+
+int is_block_begin_prefilter_applicable(target_ulong address){
+    return is_prefilter_applicable(BLOCK_BEGIN_CB, address);
+}
+int is_insn_begin_prefilter_applicable(target_ulong address){
+    return is_prefilter_applicable(INSN_BEGIN_CB, address);
+}
+
 int is_block_end_callback_needed(void){
     return is_callback_needed(BLOCK_END_CB, (pyrebox_target_ulong) INV_ADDR);
 }
@@ -294,11 +355,16 @@ int is_nic_send_callback_needed(void){
 int is_tb_flush_needed(void){
     if (flush_needed > 0){
         flush_needed = 0;
+        tb_flush_stats.full_flushes++;
         return 1;
     }
     return 0; 
 }
 
+int is_tb_flush_pending(void){
+    return (flush_needed > 0);
+}
+
 void pyrebox_flush_tb(void){
     flush_needed = 1;    
     // Exit the CPU loop too,
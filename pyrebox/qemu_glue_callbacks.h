@@ -26,8 +26,10 @@
 
 #include "qemu_glue_callbacks_needed.h"
 #include "qemu_glue_callbacks_flush.h"
+#include "qemu_glue_callbacks_prefilter.h"
 #include "qemu_glue_callbacks_target_independent.h"
 #include "qemu_glue_callbacks_memory.h"
+#include "qemu_glue_callbacks_context.h"
 
 // Disables the keystroke callback
 // every time we trigger it from the Python API
@@ -38,15 +40,17 @@ void disable_keystroke_callbacks(void);
 void enable_keystroke_callbacks(void);
 
 //At translation time
-void helper_qemu_block_begin_callback(TranslationBlock* tb);
+void helper_qemu_block_begin_callback(TranslationBlock* tb, uint32_t dispatch_record);
 
 void helper_qemu_block_end_callback(TranslationBlock* next_tb, target_ulong from, target_ulong to);
 
-void helper_qemu_insn_begin_callback(void);
+void helper_qemu_insn_begin_callback(uint32_t dispatch_record);
 
 void helper_qemu_insn_end_callback(void);
 
-void helper_qemu_opcode_range_callback(target_ulong from, target_ulong to, uint32_t opcode, target_ulong insn_size);
+void helper_qemu_opcode_range_callback(target_ulong from, target_ulong to, uint32_t opcode, target_ulong insn_size, uint32_t info);
+
+void helper_qemu_branch_callback(target_ulong source, target_ulong return_addr, uint32_t kind);
 
 void helper_qemu_trigger_cpu_loop_exit_if_needed(void);
 
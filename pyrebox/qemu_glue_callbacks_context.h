@@ -0,0 +1,35 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#ifndef QEMU_CALLBACKS_CONTEXT_H
+#define QEMU_CALLBACKS_CONTEXT_H
+
+//Separated in order to allow including it in misc_helper.c
+
+//Called after the guest writes CR3 (MOV to CR3)
+void notify_cr3_write(CPUState* cpu);
+
+//Called once at machine init, before any vCPU runs
+void init_context_change_tracking(void);
+
+#endif
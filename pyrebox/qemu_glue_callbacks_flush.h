@@ -27,8 +27,41 @@
 //Separated in order to allow including it in translate.c and callbacks.cpp
 
 int is_tb_flush_needed(void);
+int is_tb_flush_pending(void);
 void pyrebox_flush_tb(void);
 int is_cpu_loop_exit_needed(void);
 void pyrebox_cpu_loop_exit(void);
 
+//Translation cache invalidation counters
+typedef struct tb_flush_stats {
+    //Full flushes of the translation cache performed
+    uint64_t full_flushes;
+    //Invalidations of the translated code for a single address
+    uint64_t targeted_invalidations;
+    //Full flushes that were not needed, or that a targeted invalidation replaced
+    uint64_t flushes_avoided;
+} tb_flush_stats_t;
+
+extern tb_flush_stats_t tb_flush_stats;
+
+//Free the dispatch records of the address specific callbacks. Called when
+//the whole translation cache is flushed, with the vCPUs stopped
+void dispatch_records_flushed(void);
+
+//Page walker translation cache counters
+typedef struct page_walk_cache_stats {
+    //Translations served from the cache
+    uint64_t hits;
+    //Translations that required walking the page tables
+    uint64_t misses;
+    //Times the whole cache was invalidated (TLB flushes)
+    uint64_t invalidations;
+} page_walk_cache_stats_t;
+
+//Copy the page walker cache counters
+void page_walk_cache_get_stats(page_walk_cache_stats_t* stats);
+
+//Drop every cached page walk. Called from the TLB flush paths
+void page_walk_cache_invalidate(void);
+
 #endif
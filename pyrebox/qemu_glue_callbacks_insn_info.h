@@ -0,0 +1,145 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#ifndef QEMU_CALLBACKS_INSN_INFO_H
+#define QEMU_CALLBACKS_INSN_INFO_H
+
+//Separated in order to allow including it in translate.c, the glue helpers,
+//and callbacks.h
+//
+//Decoder state of the instruction that triggers an opcode range callback.
+//It is computed at translation time and passed to the helper as a single
+//immediate, so that callbacks (and triggers) do not need to read the
+//instruction back from guest memory to find out what it was.
+
+//Instruction classes
+#define INSN_CLASS_NONE 0
+#define INSN_CLASS_CALL 1
+#define INSN_CLASS_JMP 2
+#define INSN_CLASS_JCC 3
+#define INSN_CLASS_RET 4
+#define INSN_CLASS_MASK 0x7
+//The target is taken from a register or memory operand (FF /2 /3 /4 /5)
+#define INSN_CLASS_INDIRECT 0x8
+
+//Value of the modrm reg field for instructions without a modrm byte
+#define INSN_NO_MODRM_REG 0xFF
+
+//Layout of the immediate: prefix length in bits 0-7, modrm reg field in
+//bits 8-15, and instruction class in bits 16-23.
+#define INSN_INFO_PACK(prefix_len, modrm_reg, insn_class) \
+    ((uint32_t)(((prefix_len) & 0xFF) | (((modrm_reg) & 0xFF) << 8) | (((insn_class) & 0xFF) << 16)))
+#define INSN_INFO_PREFIX_LEN(info) ((uint8_t)((info) & 0xFF))
+#define INSN_INFO_MODRM_REG(info) ((uint8_t)(((info) >> 8) & 0xFF))
+#define INSN_INFO_CLASS(info) ((uint8_t)(((info) >> 16) & 0xFF))
+
+//Classify a control transfer instruction. The opcode follows the
+//normalization of the translator (two byte opcodes are 0x100 | second byte),
+//and modrm_reg is the reg field of the modrm byte (or INSN_NO_MODRM_REG).
+static inline uint8_t classify_insn(uint32_t opcode, uint8_t modrm_reg)
+{
+    switch (opcode) {
+    case 0xe8:
+    case 0x9a:
+        return INSN_CLASS_CALL;
+    case 0xe9:
+    case 0xea:
+    case 0xeb:
+        return INSN_CLASS_JMP;
+    case 0xc2:
+    case 0xc3:
+    case 0xca:
+    case 0xcb:
+        return INSN_CLASS_RET;
+    case 0xff:
+        switch (modrm_reg) {
+        case 2:
+        case 3:
+            return INSN_CLASS_CALL | INSN_CLASS_INDIRECT;
+        case 4:
+        case 5:
+            return INSN_CLASS_JMP | INSN_CLASS_INDIRECT;
+        default:
+            return INSN_CLASS_NONE;
+        }
+    default:
+        //jcc rel8, jcc rel16/32, loop/loopz/loopnz/jecxz
+        if ((opcode >= 0x70 && opcode <= 0x7f) ||
+            (opcode >= 0x180 && opcode <= 0x18f) ||
+            (opcode >= 0xe0 && opcode <= 0xe3)) {
+            return INSN_CLASS_JCC;
+        }
+        return INSN_CLASS_NONE;
+    }
+}
+
+//Kinds of the branch callbacks. Each callback selects the kinds it wants
+//with a mask of these bits. Far transfers carry BRANCH_KIND_FAR together
+//with their kind, and are only delivered if both bits are selected.
+#define BRANCH_KIND_CALL 0x1
+#define BRANCH_KIND_CALL_INDIRECT 0x2
+#define BRANCH_KIND_RET 0x4
+#define BRANCH_KIND_JMP 0x8
+#define BRANCH_KIND_JMP_INDIRECT 0x10
+#define BRANCH_KIND_FAR 0x20
+#define BRANCH_KIND_ALL 0x3F
+
+//Kind of a branch instruction, 0 if it is not a call, ret or jmp. Same
+//conventions as classify_insn.
+static inline uint32_t get_branch_kind(uint32_t opcode, uint8_t modrm_reg)
+{
+    switch (opcode) {
+    case 0xe8:
+        return BRANCH_KIND_CALL;
+    case 0x9a:
+        return BRANCH_KIND_CALL | BRANCH_KIND_FAR;
+    case 0xe9:
+    case 0xeb:
+        return BRANCH_KIND_JMP;
+    case 0xea:
+        return BRANCH_KIND_JMP | BRANCH_KIND_FAR;
+    case 0xc2:
+    case 0xc3:
+        return BRANCH_KIND_RET;
+    case 0xca:
+    case 0xcb:
+        return BRANCH_KIND_RET | BRANCH_KIND_FAR;
+    case 0xff:
+        switch (modrm_reg) {
+        case 2:
+            return BRANCH_KIND_CALL_INDIRECT;
+        case 3:
+            return BRANCH_KIND_CALL_INDIRECT | BRANCH_KIND_FAR;
+        case 4:
+            return BRANCH_KIND_JMP_INDIRECT;
+        case 5:
+            return BRANCH_KIND_JMP_INDIRECT | BRANCH_KIND_FAR;
+        default:
+            return 0;
+        }
+    default:
+        return 0;
+    }
+}
+
+#endif
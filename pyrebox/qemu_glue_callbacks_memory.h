@@ -25,10 +25,15 @@
 #define QEMU_CALLBACKS_MEMORY_H
 
 #include "qemu_glue_callbacks_needed.h"
+#include "qemu_glue_callbacks_prefilter.h"
+#include "qemu_glue_callbacks_watch.h"
 
 //In TCG code
 void helper_qemu_mem_read_callback(target_ulong vaddr, uintptr_t haddr, target_ulong size);
 
 void helper_qemu_mem_write_callback(target_ulong vaddr, uintptr_t haddr, target_ulong data, target_ulong size);
+//Accesses to watched pages, from the softmmu slow path. Not prefiltered
+void helper_qemu_mem_read_watch_callback(target_ulong vaddr, uintptr_t haddr, target_ulong size);
+void helper_qemu_mem_write_watch_callback(target_ulong vaddr, uintptr_t haddr, target_ulong data, target_ulong size);
 
 #endif
@@ -27,8 +27,16 @@
 //Separated in order to allow including it in translate.c
 
 int is_opcode_range_callback_needed(target_ulong start_opcode);
+//kind is a BRANCH_KIND_* value (see qemu_glue_callbacks_insn_info.h)
+int is_branch_callback_needed(uint32_t kind);
 int is_block_begin_callback_needed(target_ulong address);
 int is_insn_begin_callback_needed(target_ulong address);
+//Index of the dispatch record for the address specific callbacks, -1 if none
+int get_block_begin_dispatch_record(target_ulong address);
+int get_insn_begin_dispatch_record(target_ulong address);
+//1 if the inline prefilter can be emitted (no address specific or internal callbacks)
+int is_block_begin_prefilter_applicable(target_ulong address);
+int is_insn_begin_prefilter_applicable(target_ulong address);
 int is_block_end_callback_needed(void);
 int is_insn_end_callback_needed(void);
 int is_mem_read_callback_needed(void);
@@ -0,0 +1,106 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#ifndef QEMU_CALLBACKS_PREFILTER_H
+#define QEMU_CALLBACKS_PREFILTER_H
+
+//Separated in order to allow including it in translate.c, the TCG backend,
+//and callbacks.cpp
+//
+//Prefilters are evaluated by the generated code right before calling the
+//instrumentation helpers. An event that does not pass the prefilter of its
+//type cannot be delivered to any callback, so the helper is not called.
+//The structures are read at run time, so updating them (e.g., when the set
+//of monitored processes changes) does not require to invalidate translated
+//code. They are maintained by the callback manager.
+
+#ifndef TARGET_LONG_BITS
+#error TARGET_LONG_BITS must be defined before including this header
+#endif
+
+#if TARGET_LONG_BITS == 32
+typedef uint32_t prefilter_target_ulong;
+#elif TARGET_LONG_BITS == 64
+typedef uint64_t prefilter_target_ulong;
+#else
+#error TARGET_LONG_BITS undefined
+#endif
+
+#define CALLBACK_PREFILTER_MAX_PGDS 4
+
+typedef enum {
+    PREFILTER_BLOCK_BEGIN = 0,
+    PREFILTER_INSN_BEGIN,
+    PREFILTER_BLOCK_END,
+    PREFILTER_INSN_END,
+    PREFILTER_MEM_READ,
+    PREFILTER_MEM_WRITE,
+    PREFILTER_LAST,
+} callback_prefilter_kind_t;
+
+//Every field has the size of a target register, so that the generated
+//code can load them with a single instruction
+typedef struct callback_prefilter {
+    //0: the helper is called unconditionally
+    prefilter_target_ulong active;
+    //Skip the events generated in kernel mode
+    prefilter_target_ulong user_only;
+    //Range for the pc, or the accessed address for memory events. Unlike the
+    //[lo, hi) ranges declared by the callbacks, both bounds are included, so
+    //that the range can cover the whole address space: [first, last]
+    prefilter_target_ulong first;
+    prefilter_target_ulong last;
+    //Non zero: accept any pgd. Otherwise, accept only the ones in pgds
+    //(unused entries are set to INV_PGD)
+    prefilter_target_ulong any_pgd;
+    prefilter_target_ulong pgds[CALLBACK_PREFILTER_MAX_PGDS];
+} callback_prefilter_t;
+
+extern callback_prefilter_t callback_prefilters[PREFILTER_LAST];
+
+//Same checks as the generated code, for the helpers called from C code
+static inline int callback_prefilter_check(callback_prefilter_kind_t kind, prefilter_target_ulong address, prefilter_target_ulong pgd, int user_mode)
+{
+    callback_prefilter_t* filter = &callback_prefilters[kind];
+    int i;
+    if (!filter->active){
+        return 1;
+    }
+    if (filter->user_only && !user_mode){
+        return 0;
+    }
+    if (address < filter->first || address > filter->last){
+        return 0;
+    }
+    if (filter->any_pgd){
+        return 1;
+    }
+    for (i = 0; i < CALLBACK_PREFILTER_MAX_PGDS; ++i){
+        if (filter->pgds[i] == pgd){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,55 @@
+/*-------------------------------------------------------------------------------
+
+   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+
+   PyREBox: Python scriptable Reverse Engineering Sandbox 
+   Author: Xabier Ugarte-Pedrero 
+   
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA.
+   
+-------------------------------------------------------------------------------*/
+
+#ifndef QEMU_CALLBACKS_WATCH_H
+#define QEMU_CALLBACKS_WATCH_H
+
+//Separated in order to allow including it in cputlb.c and callbacks.cpp
+//
+//Memory watches are memory read / write callbacks restricted to an address
+//range. Instead of instrumenting every memory access, the TLB entries of the
+//watched pages are marked with TLB_WATCH when they are filled, so that only
+//the accesses to those pages leave the fast path. The softmmu slow path
+//reports them with helper_qemu_mem_read/write_watch_callback. Pages are
+//watched by virtual address (the pgd is checked on delivery), or by ram
+//address (the haddr parameter of the memory callbacks).
+
+//Granularity of the watches. Must match TARGET_PAGE_BITS
+#define WATCH_PAGE_BITS 12
+#define WATCH_PAGE_MASK (~(((uint64_t) 1 << WATCH_PAGE_BITS) - 1))
+
+//Larger watches fall back to the instrumentation of every memory access, so
+//that adding them does not walk (and flush) millions of pages
+#define WATCH_MAX_PAGES 4096
+
+#define WATCH_READ  0x1
+#define WATCH_WRITE 0x2
+
+//Number of pages watched, so that TLB fills only look for
+//watches if there are any. Maintained by the callback manager
+extern unsigned int watched_pages_count;
+
+//WATCH_READ / WATCH_WRITE flags for the TLB entries of a RAM page
+int get_page_watch_flags(uint64_t vaddr_page, uint64_t ram_page);
+
+#endif
@@ -43,6 +43,7 @@
 #include "pyrebox/qemu_glue_block.h"
 #include "pyrebox/qemu_glue_gdbstub.h"
 #include "pyrebox/qemu_glue_callbacks_flush.h"
+#include "pyrebox/python_symbols.h"
 
 #include "pyrebox/utils.h"
 #include "qapi/error.h"
@@ -169,10 +170,7 @@ static void pyrebox_update_threads(GDBState *s, int already_locked){
         // Already up to date;
         return;
     }
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_get_threads = PyObject_GetAttrString(py_vmi_module,"get_threads");
+    PyObject* py_get_threads = python_symbol_get(PY_SYM_GET_THREADS);
     if (py_get_threads) {
         if (PyCallable_Check(py_get_threads)){
             PyObject* py_args = PyTuple_New(0);
@@ -202,10 +200,7 @@ static int get_thread_description(GDBState* s, unsigned long long thread, char*
 
     pthread_mutex_lock(&pyrebox_mutex);
 
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_get_thread_description = PyObject_GetAttrString(py_vmi_module,"get_thread_description");
+    PyObject* py_get_thread_description = python_symbol_get(PY_SYM_GET_THREAD_DESCRIPTION);
     memset(buf, '\0', len);
     if (py_get_thread_description) {
         if (PyCallable_Check(py_get_thread_description)) {
@@ -241,10 +236,7 @@ static unsigned long long pyrebox_thread_gdb_index(GDBState* s, unsigned int thr
     pthread_mutex_lock(&pyrebox_mutex);
 
     //Return the Thread ID.
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_get_thread_id = PyObject_GetAttrString(py_vmi_module,"get_thread_id");
+    PyObject* py_get_thread_id = python_symbol_get(PY_SYM_GET_THREAD_ID);
     if (py_get_thread_id) {
         if (PyCallable_Check(py_get_thread_id)) {
             PyObject* py_args = PyTuple_New(2);
@@ -273,10 +265,7 @@ static unsigned long long pyrebox_get_running_thread_first_cpu(GDBState* s){
         pthread_mutex_lock(&pyrebox_mutex);
 
         //Return the Thread ID.
-        PyObject* py_module_name = PyString_FromString("vmi");
-        PyObject* py_vmi_module = PyImport_Import(py_module_name);
-        Py_DECREF(py_module_name);
-        PyObject* py_get_thread_id = PyObject_GetAttrString(py_vmi_module,"get_running_thread_first_cpu");
+        PyObject* py_get_thread_id = python_symbol_get(PY_SYM_GET_RUNNING_THREAD_FIRST_CPU);
         if (py_get_thread_id) {
             if (PyCallable_Check(py_get_thread_id)) {
                 PyObject* py_args = PyTuple_New(1);
@@ -308,10 +297,7 @@ static int does_thread_exist(GDBState* s, unsigned long long thread){
 
     pthread_mutex_lock(&pyrebox_mutex);
 
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_does_thread_exist = PyObject_GetAttrString(py_vmi_module,"does_thread_exist");
+    PyObject* py_does_thread_exist = python_symbol_get(PY_SYM_DOES_THREAD_EXIST);
     if (py_does_thread_exist) {
         if (PyCallable_Check(py_does_thread_exist)) {
             PyObject* py_args = PyTuple_New(2);
@@ -336,10 +322,7 @@ static int gdb_read_thread_register(GDBState* s, unsigned long long thread, int
     // and returns 0 if not, 1 if it exists
     pthread_mutex_lock(&pyrebox_mutex);
 
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_gdb_read_thread_register = PyObject_GetAttrString(py_vmi_module,"gdb_read_thread_register");
+    PyObject* py_gdb_read_thread_register = python_symbol_get(PY_SYM_GDB_READ_THREAD_REGISTER);
     Py_ssize_t length = 0;
     if (py_gdb_read_thread_register) {
         if (PyCallable_Check(py_gdb_read_thread_register)) {
@@ -405,10 +388,7 @@ static inline int target_memory_rw_debug(GDBState* s, unsigned long long thread,
 
     // Calls python function to check if a thread exists 
     // and returns 0 if not, 1 if it exists
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_gdb_memory_rw_debug = PyObject_GetAttrString(py_vmi_module, "gdb_memory_rw_debug");
+    PyObject* py_gdb_memory_rw_debug = python_symbol_get(PY_SYM_GDB_MEMORY_RW_DEBUG);
     if (py_gdb_memory_rw_debug) {
         if (PyCallable_Check(py_gdb_memory_rw_debug)) {
             PyObject* py_args = PyTuple_New(6);
@@ -456,10 +436,7 @@ static void gdb_set_cpu_pc(GDBState *s, target_ulong pc)
     int err = 0;
 
     // Calls python function to set cpu PC 
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_gdb_set_cpu_pc = PyObject_GetAttrString(py_vmi_module,"gdb_set_cpu_pc");
+    PyObject* py_gdb_set_cpu_pc = python_symbol_get(PY_SYM_GDB_SET_CPU_PC);
     if (py_gdb_set_cpu_pc) {
         if (PyCallable_Check(py_gdb_set_cpu_pc)) {
             PyObject* py_args = PyTuple_New(3);
@@ -514,10 +491,7 @@ static void pyrebox_gdb_breakpoint_remove_all(void)
 
     int err = 0;
 
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_gdb_breakpoint_remove_all = PyObject_GetAttrString(py_vmi_module,"gdb_breakpoint_remove_all");
+    PyObject* py_gdb_breakpoint_remove_all = python_symbol_get(PY_SYM_GDB_BREAKPOINT_REMOVE_ALL);
     if (py_gdb_breakpoint_remove_all) {
         if (PyCallable_Check(py_gdb_breakpoint_remove_all)) {
             PyObject* py_args = PyTuple_New(0);
@@ -554,10 +528,7 @@ static int pyrebox_gdb_breakpoint_insert(GDBState* s, unsigned long long thread,
     int err = 0;
     int ret_val = 0;
 
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_gdb_breakpoint_insert = PyObject_GetAttrString(py_vmi_module,"gdb_breakpoint_insert");
+    PyObject* py_gdb_breakpoint_insert = python_symbol_get(PY_SYM_GDB_BREAKPOINT_INSERT);
     if (py_gdb_breakpoint_insert) {
         if (PyCallable_Check(py_gdb_breakpoint_insert)) {
             PyObject* py_args = PyTuple_New(5);
@@ -607,10 +578,7 @@ static int pyrebox_gdb_breakpoint_remove(GDBState* s, unsigned long long thread,
     int ret_val = 0;
     pthread_mutex_lock(&pyrebox_mutex);
 
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_gdb_breakpoint_remove = PyObject_GetAttrString(py_vmi_module,"gdb_breakpoint_remove");
+    PyObject* py_gdb_breakpoint_remove = python_symbol_get(PY_SYM_GDB_BREAKPOINT_REMOVE);
     if (py_gdb_breakpoint_remove) {
         if (PyCallable_Check(py_gdb_breakpoint_remove)) {
             PyObject* py_args = PyTuple_New(5);
@@ -697,10 +665,7 @@ static int gdb_get_register_size(int gdb_register_index){
 
     pthread_mutex_lock(&pyrebox_mutex);
 
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_gdb_get_register_size = PyObject_GetAttrString(py_vmi_module,"gdb_get_register_size");
+    PyObject* py_gdb_get_register_size = python_symbol_get(PY_SYM_GDB_GET_REGISTER_SIZE);
     if (py_gdb_get_register_size) {
         if (PyCallable_Check(py_gdb_get_register_size)) {
             PyObject* py_args = PyTuple_New(1);
@@ -743,10 +708,7 @@ static int gdb_write_thread_register(GDBState* s, unsigned long long thread, int
 
     // Calls python function to check if a thread exists 
     // and returns 0 if not, 1 if it exists
-    PyObject* py_module_name = PyString_FromString("vmi");
-    PyObject* py_vmi_module = PyImport_Import(py_module_name);
-    Py_DECREF(py_module_name);
-    PyObject* py_gdb_write_thread_register = PyObject_GetAttrString(py_vmi_module,"gdb_write_thread_register");
+    PyObject* py_gdb_write_thread_register = python_symbol_get(PY_SYM_GDB_WRITE_THREAD_REGISTER);
     if (py_gdb_write_thread_register) {
         if (PyCallable_Check(py_gdb_write_thread_register)) {
             PyObject* py_args = PyTuple_New(4);
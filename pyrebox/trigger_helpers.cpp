@@ -28,6 +28,7 @@
 #include <set>
 extern "C"{
     #include "qemu_glue.h"
+    #include "utils.h"
 }
 #include "callbacks.h"
 #include "trigger_helpers.h"
@@ -37,9 +38,67 @@ using namespace std;
 map<callback_handle_t,map<string,void*> > trigger_vars;
 map<callback_handle_t,map<string,function_t> > trigger_functions;
 
+//ABI v2 contexts, and the slot assigned to each variable name
+typedef struct trigger_binding {
+    trigger_context_t* context;
+    map<string,unsigned int> slots;
+} trigger_binding_t;
+
+map<callback_handle_t,trigger_binding_t> trigger_bindings;
+
+static void update_slot(callback_handle_t handle, const string& key, void* val){
+    map<callback_handle_t,trigger_binding_t>::iterator it1 = trigger_bindings.find(handle);
+    if (it1 != trigger_bindings.end())
+    {
+        map<string,unsigned int>::iterator it2 = it1->second.slots.find(key);
+        if (it2 != it1->second.slots.end())
+        {
+            trigger_context_t* context = it1->second.context;
+            if (context->vars[it2->second].ptr == 0 && val != 0)
+            {
+                context->unset_vars--;
+            }
+            else if (context->vars[it2->second].ptr != 0 && val == 0)
+            {
+                context->unset_vars++;
+            }
+            context->vars[it2->second].ptr = val;
+        }
+    }
+}
+
 extern "C"{
 
+trigger_context_t* create_trigger_context(callback_handle_t handle, const char* const* var_names){
+    trigger_binding_t binding;
+    binding.context = (trigger_context_t*) calloc(1, sizeof(trigger_context_t));
+    binding.context->handle = handle;
+    for (unsigned int i = 0; var_names != 0 && var_names[i] != 0; ++i)
+    {
+        if (i >= TRIGGER_MAX_VARS)
+        {
+            utils_print_error("[!] Too many trigger variables declared, the maximum is %d\n", TRIGGER_MAX_VARS);
+            break;
+        }
+        binding.slots[string(var_names[i])] = i;
+        //Variables may have been set before
+        binding.context->vars[i].ptr = get_var(handle, var_names[i]);
+        if (binding.context->vars[i].ptr == 0)
+        {
+            binding.context->unset_vars++;
+        }
+    }
+    trigger_bindings[handle] = binding;
+    return binding.context;
+}
+
 void erase_trigger_vars(callback_handle_t handle){
+    map<callback_handle_t,trigger_binding_t>::iterator binding = trigger_bindings.find(handle);
+    if (binding != trigger_bindings.end())
+    {
+        retire_trigger_var(binding->second.context);
+        trigger_bindings.erase(binding);
+    }
     map<callback_handle_t,map<string,void*> >::iterator it1 = trigger_vars.find(handle); 
     if (it1 != trigger_vars.end())
     {
@@ -48,7 +107,7 @@ void erase_trigger_vars(callback_handle_t handle){
         {
             if(it2->second != 0)
             {
-                free(it2->second);
+                retire_trigger_var(it2->second);
             }
         }
         it1->second.clear();
@@ -77,13 +136,12 @@ void set_var(callback_handle_t handle, const char* key_str,void* val){
     string key(key_str);
     if (trigger_vars[handle].find(key) != trigger_vars[handle].end())
     {
-        if(trigger_vars[handle][key] != 0)
-        {
-            free(trigger_vars[handle][key]);
-        }
+        //Freed once no trigger can be reading it
+        retire_trigger_var(trigger_vars[handle][key]);
         trigger_vars[handle].erase(key);
     }
     trigger_vars[handle][key] = val;
+    update_slot(handle, key, val);
 }
 
 void delete_var(callback_handle_t handle, const char* key_str, int bool_free){
@@ -95,11 +153,13 @@ void delete_var(callback_handle_t handle, const char* key_str, int bool_free){
     string key(key_str);
     if (trigger_vars[handle].find(key) != trigger_vars[handle].end())
     {
-        if(trigger_vars[handle][key] != 0 && bool_free)
+        void* val = trigger_vars[handle][key];
+        trigger_vars[handle].erase(key);
+        update_slot(handle, key, 0);
+        if(val != 0 && bool_free)
         {
-            free(trigger_vars[handle][key]);
+            retire_trigger_var(val);
         }
-        trigger_vars[handle].erase(key);
     }
 }
 
@@ -32,6 +32,43 @@ extern "C" {
 // Type for a function name that can be called from Python
 typedef void (*function_t)(callback_handle_t);
 
+// Trigger ABI v2. Instead of trigger(), the trigger exports:
+//
+//   const char* const* get_var_names();
+//   int trigger_v2(trigger_context_t* context, callback_params_t params);
+//
+// get_var_names returns a 0 terminated list of variable names. When the trigger
+// is loaded, each variable is bound to the slot at the same position in
+// context->vars, that always points to the current value (0 if not set).
+// The variables are still set with set_var, and get_var keeps working.
+// Variables are usually set after the trigger is loaded, so trigger_v2 can be
+// called before they are: check trigger_vars_bound before reading the slots.
+// Replaced values are not freed while a trigger may still be reading them.
+#define TRIGGER_MAX_VARS 16
+
+typedef union trigger_var {
+    void* ptr;
+    pyrebox_target_ulong* target_ulong;
+    uint32_t* uint32;
+    uint64_t* uint64;
+    char* str;
+} trigger_var_t;
+
+struct trigger_context {
+    callback_handle_t handle;
+    trigger_var_t vars[TRIGGER_MAX_VARS];
+    // Number of declared variables that are not set
+    unsigned int unset_vars;
+};
+
+// Returns 1 if every declared variable is set
+static inline int trigger_vars_bound(const trigger_context_t* context){
+    return (context->unset_vars == 0);
+}
+
+trigger_context_t* create_trigger_context(callback_handle_t handle, const char* const* var_names);
+
+// Also releases the trigger context, if any
 void erase_trigger_vars(callback_handle_t handle);
 void* get_var(callback_handle_t handle, const char* key_str);
 void set_var(callback_handle_t handle, const char* key_str,void* val);
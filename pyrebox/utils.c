@@ -23,6 +23,7 @@
 
 #include <Python.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <inttypes.h>
 
 #include "qemu_glue.h"
@@ -99,3 +100,57 @@ void utils_print_plugin(const char *fmt, ...){
     fflush(stdout);
     va_end(ap);
 }
+
+//Buffered output. Messages are accumulated in a static buffer, and only
+//written to stdout by utils_flush_output (or when the buffer is full).
+//Triggers print from every vCPU thread, so the buffer is guarded by a mutex.
+#define OUTPUT_BUFFER_SIZE 65536
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static size_t output_buffer_pos = 0;
+static pthread_mutex_t output_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//Must be called with output_buffer_mutex held
+static void flush_output_buffer(void){
+    if (output_buffer_pos > 0){
+        fwrite(output_buffer, 1, output_buffer_pos, stdout);
+        output_buffer_pos = 0;
+    }
+}
+
+void utils_print_buffered(const char *fmt, ...){
+    va_list ap;
+    int len;
+    pthread_mutex_lock(&output_buffer_mutex);
+    va_start(ap, fmt);
+    len = vsnprintf(output_buffer + output_buffer_pos, OUTPUT_BUFFER_SIZE - output_buffer_pos, fmt, ap);
+    va_end(ap);
+    if (len < 0){
+        pthread_mutex_unlock(&output_buffer_mutex);
+        return;
+    }
+    if ((size_t)len >= OUTPUT_BUFFER_SIZE - output_buffer_pos){
+        //Did not fit, flush and retry
+        flush_output_buffer();
+        va_start(ap, fmt);
+        len = vsnprintf(output_buffer, OUTPUT_BUFFER_SIZE, fmt, ap);
+        va_end(ap);
+        if (len < 0){
+            pthread_mutex_unlock(&output_buffer_mutex);
+            return;
+        }
+        if ((size_t)len >= OUTPUT_BUFFER_SIZE){
+            //Truncated message
+            len = OUTPUT_BUFFER_SIZE - 1;
+        }
+    }
+    output_buffer_pos += len;
+    pthread_mutex_unlock(&output_buffer_mutex);
+}
+
+void utils_flush_output(void){
+    pthread_mutex_lock(&output_buffer_mutex);
+    flush_output_buffer();
+    pthread_mutex_unlock(&output_buffer_mutex);
+    fflush(stdout);
+    fflush(stderr);
+}
@@ -47,4 +47,10 @@ void utils_print_warning(const char *fmt, ...);
 void utils_print_error(const char *fmt, ...);
 void utils_print_plugin(const char *fmt, ...);
 
+//Buffered output, for messages printed at a high rate (e.g., from triggers).
+//The output is written by utils_flush_output, which is called around the
+//execution of python callbacks.
+void utils_print_buffered(const char *fmt, ...);
+void utils_flush_output(void);
+
 #endif
@@ -32,6 +32,7 @@ extern "C" {
 #include "qemu_glue.h"    
 #include "utils.h"
 #include "pyrebox.h"
+#include "python_symbols.h"
 }
 
 #include "vmi.h"
@@ -81,30 +82,20 @@ void update_modules(pyrebox_target_ulong pgd){
    fflush(stderr);
 
    //Call python for module scanning
-   PyObject* py_module_name = PyString_FromString("vmi");
-   PyObject* py_vmi_module = PyImport_Import(py_module_name);
-   Py_DECREF(py_module_name);
-
-   if(py_vmi_module != NULL){
-       PyObject* py_update_modules = PyObject_GetAttrString(py_vmi_module, "update_modules");
-       if (py_update_modules){
-           if (PyCallable_Check(py_update_modules)){
-                PyObject* py_args = PyTuple_New(1);
-                if (arch_bits[os_index] == 32){
-                    PyTuple_SetItem(py_args, 0, PyLong_FromUnsignedLong(pgd)); // The reference to the object in the tuple is stolen
-                }
-                else{
-                    PyTuple_SetItem(py_args, 0, PyLong_FromUnsignedLongLong(pgd)); // The reference to the object in the tuple is stolen
-                }
-                PyObject* ret = PyObject_CallObject(py_update_modules, py_args);
-                Py_DECREF(py_args);
-                if (ret){
-                    Py_DECREF(ret);
-                }
-           }
-           Py_XDECREF(py_update_modules);
-       }
-       Py_DECREF(py_vmi_module);
+   PyObject* py_update_modules = python_symbol_get(PY_SYM_UPDATE_MODULES);
+   if (py_update_modules){
+        PyObject* py_args = PyTuple_New(1);
+        if (arch_bits[os_index] == 32){
+            PyTuple_SetItem(py_args, 0, PyLong_FromUnsignedLong(pgd)); // The reference to the object in the tuple is stolen
+        }
+        else{
+            PyTuple_SetItem(py_args, 0, PyLong_FromUnsignedLongLong(pgd)); // The reference to the object in the tuple is stolen
+        }
+        PyObject* ret = PyObject_CallObject(py_update_modules, py_args);
+        Py_DECREF(py_args);
+        if (ret){
+            Py_DECREF(ret);
+        }
    }
 
    //Unlock the python mutex
@@ -30,6 +30,7 @@ extern "C"{
 #include "qemu_glue.h"
 #include "utils.h"
 #include "pyrebox.h"
+#include "python_symbols.h"
 }
 #include "vmi.h"
 #include "windows_vmi.h"
@@ -84,38 +85,28 @@ pyrebox_target_ulong scan_kdbg(pyrebox_target_ulong pgd){
    fflush(stdout);
    fflush(stderr);
 
-   PyObject* py_module_name = PyString_FromString("windows_vmi");
-   PyObject* py_vmi_module = PyImport_Import(py_module_name);
-   Py_DECREF(py_module_name);
-
    pyrebox_target_ulong kdbg = 0;
 
-   if(py_vmi_module != NULL){
-       PyObject* py_kdbgscan = PyObject_GetAttrString(py_vmi_module,"windows_kdbgscan_fast");
-       if (py_kdbgscan){
-           if (PyCallable_Check(py_kdbgscan)){
-                PyObject* py_args = PyTuple_New(1);
-                if (arch_bits[os_index] == 32){
-                    PyTuple_SetItem(py_args, 0, PyLong_FromUnsignedLong(pgd)); // The reference to the object in the tuple is stolen
-                }
-                else{
-                    PyTuple_SetItem(py_args, 0, PyLong_FromUnsignedLongLong(pgd)); // The reference to the object in the tuple is stolen
-                }
-                PyObject* addr = PyObject_CallObject(py_kdbgscan,py_args);
-                Py_DECREF(py_args);
-                if (addr){
-                    if (arch_bits[os_index] == 32){
-                        kdbg = PyLong_AsUnsignedLong(addr);
-                    }
-                    else{
-                        kdbg = PyLong_AsUnsignedLongLong(addr);
-                    }
-                    Py_DECREF(addr);
-                }
-           }
-           Py_XDECREF(py_kdbgscan);
-       }
-       Py_DECREF(py_vmi_module);
+   PyObject* py_kdbgscan = python_symbol_get(PY_SYM_WINDOWS_KDBGSCAN_FAST);
+   if (py_kdbgscan){
+        PyObject* py_args = PyTuple_New(1);
+        if (arch_bits[os_index] == 32){
+            PyTuple_SetItem(py_args, 0, PyLong_FromUnsignedLong(pgd)); // The reference to the object in the tuple is stolen
+        }
+        else{
+            PyTuple_SetItem(py_args, 0, PyLong_FromUnsignedLongLong(pgd)); // The reference to the object in the tuple is stolen
+        }
+        PyObject* addr = PyObject_CallObject(py_kdbgscan,py_args);
+        Py_DECREF(py_args);
+        if (addr){
+            if (arch_bits[os_index] == 32){
+                kdbg = PyLong_AsUnsignedLong(addr);
+            }
+            else{
+                kdbg = PyLong_AsUnsignedLongLong(addr);
+            }
+            Py_DECREF(addr);
+        }
    }
 
    //Unlock the python mutex
@@ -135,24 +126,14 @@ void windows_vmi_init(os_index_t os_index){
    utils_print_debug("[*] Searching for KDBG...\n");
 
    //Update the OS family in the Python VMI module
-   PyObject* py_module_name = PyString_FromString("vmi");
-   PyObject* py_vmi_module = PyImport_Import(py_module_name);
-   Py_DECREF(py_module_name);
-
-   if(py_vmi_module != NULL){
-       PyObject* py_setosfamily = PyObject_GetAttrString(py_vmi_module,"set_os_family_win");
-       if (py_setosfamily){
-           if (PyCallable_Check(py_setosfamily)){
-                PyObject* py_args = PyTuple_New(0);
-                PyObject* ret = PyObject_CallObject(py_setosfamily,py_args);
-                Py_DECREF(py_args);
-                if (ret){
-                    Py_DECREF(ret);
-                }
-           }
-           Py_XDECREF(py_setosfamily);
-       }
-       Py_DECREF(py_vmi_module);
+   PyObject* py_setosfamily = python_symbol_get(PY_SYM_SET_OS_FAMILY_WIN);
+   if (py_setosfamily){
+        PyObject* py_args = PyTuple_New(0);
+        PyObject* ret = PyObject_CallObject(py_setosfamily,py_args);
+        Py_DECREF(py_args);
+        if (ret){
+            Py_DECREF(ret);
+        }
    }
 
    //Unlock the python mutex
@@ -0,0 +1,129 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+
+# Stress benchmark for the callback manager. Registers 100k address
+# specific callbacks, accesses the trigger variables of the most recently
+# registered callback, and removes everything. The time per operation should
+# not depend on the number of registered callbacks.
+
+from __future__ import print_function
+import time
+
+# Callback manager
+cm = None
+pyrebox_print = None
+
+NUM_HANDLES = 100000
+# Addresses where no code is expected to run
+BASE_ADDRESS = 0xdead0000
+BASE_PGD = 0xfffff000
+
+bp_names = []
+state = {"step": "idle", "t0": 0.0}
+
+
+def dummy(params):
+    pass
+
+
+def report(what, t0, count):
+    elapsed = time.time() - t0
+    pyrebox_print("[*]    %s: %d operations in %.3f s (%.2f us/op)\n" %
+                  (what, count, elapsed, (elapsed * 1000000.0) / count))
+
+
+def remove_all(params):
+    global cm
+    # Deferred removals are committed once this callback returns
+    state["t0"] = time.time()
+    for name in bp_names:
+        cm.rm_callback(name)
+    cm.rm_callback("bp_trigger")
+    cm.rm_callback("remove_all")
+    state["step"] = "removing"
+
+
+def wait_commit(params):
+    global cm
+    if state["step"] == "removing":
+        # Same event as remove_all, the removals are still pending
+        state["step"] = "committing"
+    elif state["step"] == "committing":
+        report("Remove + commit", state["t0"], NUM_HANDLES)
+        cm.rm_callback("wait_commit")
+        state["step"] = "done"
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    pyrebox_print("[*]    Cleaning module\n")
+    cm.clean()
+    pyrebox_print("[*]    Cleaned module\n")
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    from api import CallbackManager
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks\n")
+    cm = CallbackManager(module_hdl, new_style = True)
+
+    t0 = time.time()
+    for i in range(0, NUM_HANDLES):
+        bp_names.append(cm.add_callback(CallbackManager.INSN_BEGIN_CB, dummy, name="bp_%d" % i,
+                                        addr=BASE_ADDRESS + (i * 0x10), pgd=BASE_PGD))
+    report("Add", t0, NUM_HANDLES)
+
+    # The most recent handle used to be the worst case for handle lookups
+    cm.add_callback(CallbackManager.CREATEPROC_CB, dummy, name="bp_trigger")
+    cm.add_trigger("bp_trigger", "triggers/trigger_getset_var_example.so")
+    t0 = time.time()
+    for i in range(0, NUM_HANDLES):
+        cm.set_trigger_var("bp_trigger", "var1", i)
+    report("Set trigger var", t0, NUM_HANDLES)
+    t0 = time.time()
+    for i in range(0, NUM_HANDLES):
+        cm.get_trigger_var("bp_trigger", "var1")
+    report("Get trigger var", t0, NUM_HANDLES)
+
+    # TLB callbacks are always delivered, regardless of the monitored processes
+    cm.add_callback(CallbackManager.TLB_EXEC_CB, remove_all, name="remove_all")
+    cm.add_callback(CallbackManager.TLB_EXEC_CB, wait_commit, name="wait_commit")
+    pyrebox_print("[*]    Initialized callbacks\n")
+    pyrebox_print("[!]    Resume the VM to measure callback removal.")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
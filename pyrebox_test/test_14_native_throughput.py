@@ -0,0 +1,95 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+
+# Throughput comparison between python and native callbacks. Counts the
+# basic blocks executed by the monitored processes with a python callback,
+# and then with the equivalent native plugin (native_plugins/native_block_counter.cpp),
+# reporting the number of blocks delivered per second in both cases.
+
+from __future__ import print_function
+import time
+
+# Callback manager
+cm = None
+pyrebox_print = None
+native_plugin = None
+
+REPORT_INTERVAL = 1000000
+
+state = {"blocks": 0, "start": 0.0}
+
+
+def block_begin(params):
+    global cm
+    global native_plugin
+    import api
+
+    if state["blocks"] == 0:
+        state["start"] = time.time()
+    state["blocks"] += 1
+    if state["blocks"] == REPORT_INTERVAL:
+        elapsed = time.time() - state["start"]
+        pyrebox_print("[*] python_block_counter: %d blocks in %.3f s (%.0f blocks/s)\n" %
+                      (state["blocks"], elapsed, state["blocks"] / elapsed))
+        cm.rm_callback("block_begin")
+        # Same measurement, without python
+        native_plugin = api.load_native_plugin("native_plugins/native_block_counter")
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    global native_plugin
+    import api
+    pyrebox_print("[*]    Cleaning module\n")
+    cm.clean()
+    if native_plugin is not None:
+        api.unload_native_plugin(native_plugin)
+        native_plugin = None
+    pyrebox_print("[*]    Cleaned module\n")
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    from api import CallbackManager
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks\n")
+    cm = CallbackManager(module_hdl, new_style = True)
+    cm.add_callback(CallbackManager.BLOCK_BEGIN_CB, block_begin, name="block_begin")
+    pyrebox_print("[*]    Initialized callbacks\n")
+    pyrebox_print("[!]    In order to perform the test, start monitoring some process")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
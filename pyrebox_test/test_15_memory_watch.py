@@ -0,0 +1,106 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+
+# Memory watches. When a process is created, watches the writes to the
+# page that holds its page directory (physical address), which the kernel
+# updates whenever the process maps new memory. Only the accesses to that
+# page are instrumented.
+
+from __future__ import print_function
+
+# Callback manager
+cm = None
+pyrebox_print = None
+
+MAX_WRITES = 100
+
+writes = {}
+
+
+def page_directory_write(pgd, params):
+    global cm
+
+    vaddr = params["vaddr"]
+    size = params["size"]
+    haddr = params["haddr"]
+    data = params["data"]
+
+    writes[pgd] += 1
+    pyrebox_print("Page directory write for %x: vaddr %x haddr %x size %x data %x\n" % (pgd, vaddr, haddr, size, data))
+    if writes[pgd] == MAX_WRITES:
+        pyrebox_print("[*] Removing page directory watch for %x\n" % pgd)
+        cm.rm_callback("pgd_%x" % pgd)
+
+
+def new_proc(params):
+    global cm
+    import functools
+    from api import CallbackManager
+
+    pid = params["pid"]
+    pgd = params["pgd"]
+    name = params["name"]
+
+    if pgd in writes:
+        return
+    writes[pgd] = 0
+    pyrebox_print("Watching the page directory of %s (pid %x, pgd %x)\n" % (name, pid, pgd))
+    cm.add_watch_callback(CallbackManager.MEM_WRITE_CB,
+                          functools.partial(page_directory_write, pgd),
+                          (pgd & ~0xFFF, (pgd & ~0xFFF) + 0x1000),
+                          name="pgd_%x" % pgd,
+                          physical=True)
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    pyrebox_print("[*]    Cleaning module\n")
+    cm.clean()
+    pyrebox_print("[*]    Cleaned module\n")
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    from api import CallbackManager
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks\n")
+    cm = CallbackManager(module_hdl, new_style = True)
+    cm.add_callback(CallbackManager.CREATEPROC_CB, new_proc, name="new_proc")
+    pyrebox_print("[*]    Initialized callbacks\n")
+    pyrebox_print("[!]    Test: Start a new process")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
@@ -0,0 +1,91 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+
+# Batched callbacks. Collects the basic block coverage of the processes
+# created after the script is loaded, receiving the block begin events
+# in batches of records instead of one python call per block.
+
+from __future__ import print_function
+
+# Callback manager
+cm = None
+pyrebox_print = None
+
+BATCH_SIZE = 4096
+
+batches = 0
+blocks = set()
+
+
+def block_batch(batch):
+    global batches
+    batches += 1
+    blocks.update(batch.column("tb_pc"))
+    if batches % 100 == 0:
+        pyrebox_print("%d batches, %d different blocks executed\n" % (batches, len(blocks)))
+
+
+def new_proc(params):
+    from api import start_monitoring_process
+
+    pid = params["pid"]
+    pgd = params["pgd"]
+    name = params["name"]
+
+    pyrebox_print("Collecting the coverage of %s (pid %x, pgd %x)\n" % (name, pid, pgd))
+    start_monitoring_process(pgd)
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    pyrebox_print("[*]    Cleaning module\n")
+    cm.clean()
+    pyrebox_print("[*]    Cleaned module: %d batches, %d different blocks executed\n" % (batches, len(blocks)))
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    from api import CallbackManager
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks\n")
+    cm = CallbackManager(module_hdl, new_style = True)
+    cm.add_callback(CallbackManager.CREATEPROC_CB, new_proc, name="new_proc")
+    cm.add_callback(CallbackManager.BLOCK_BEGIN_CB, block_batch, name="coverage", batch_size=BATCH_SIZE)
+    pyrebox_print("[*]    Initialized callbacks\n")
+    pyrebox_print("[!]    Test: Start a new process")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
@@ -0,0 +1,91 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+
+# Observe-only callbacks. Counts the memory writes of the processes created
+# after the script is loaded from the asynchronous callback worker, while
+# the guest keeps running, and prints the statistics of the event queue.
+
+from __future__ import print_function
+
+# Callback manager
+cm = None
+pyrebox_print = None
+
+writes = 0
+
+
+def mem_write(params):
+    global writes
+    writes += 1
+    if writes % 1000000 == 0:
+        from api import get_async_callback_stats
+        stats = get_async_callback_stats()
+        pyrebox_print("%d writes (last vaddr %x): %d queued, %d delivered, %d dropped, %d blocked\n" %
+                      (writes, params["vaddr"], stats["queued"], stats["delivered"], stats["dropped"], stats["blocked"]))
+
+
+def new_proc(params):
+    from api import start_monitoring_process
+
+    pid = params["pid"]
+    pgd = params["pgd"]
+    name = params["name"]
+
+    pyrebox_print("Counting the memory writes of %s (pid %x, pgd %x)\n" % (name, pid, pgd))
+    start_monitoring_process(pgd)
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    from api import get_async_callback_stats
+    pyrebox_print("[*]    Cleaning module\n")
+    cm.clean()
+    pyrebox_print("[*]    Cleaned module: %d writes, %s\n" % (writes, str(get_async_callback_stats())))
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    from api import CallbackManager
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks\n")
+    cm = CallbackManager(module_hdl, new_style = True)
+    cm.add_callback(CallbackManager.CREATEPROC_CB, new_proc, name="new_proc")
+    cm.add_callback(CallbackManager.MEM_WRITE_CB, mem_write, name="mem_write", observe_only=True, drop_when_full=True)
+    pyrebox_print("[*]    Initialized callbacks\n")
+    pyrebox_print("[!]    Test: Start a new process")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
@@ -0,0 +1,87 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+from __future__ import print_function
+
+# Callback manager
+cm = None
+pyrebox_print = None
+# Number of branches received per kind
+counts = {}
+
+
+def branch(params):
+    import api
+
+    kind = params["kind"]
+    source = params["source"]
+    target = params["target"]
+    return_addr = params["return_addr"]
+
+    # Only the requested kinds are delivered
+    assert((kind & ~(api.BRANCH_KIND_CALL | api.BRANCH_KIND_CALL_INDIRECT | api.BRANCH_KIND_RET)) == 0)
+    if kind & (api.BRANCH_KIND_CALL | api.BRANCH_KIND_CALL_INDIRECT):
+        assert(return_addr > source)
+    else:
+        assert(return_addr == 0)
+
+    counts[kind] = counts.get(kind, 0) + 1
+    if sum(counts.values()) % 100000 == 0:
+        pyrebox_print("Branches: %s (last %x -> %x)\n" % (str(counts), source, target))
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    print("[*]    Cleaning module")
+    cm.clean()
+    print("[*]    Cleaned module")
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    import api
+    from api import CallbackManager
+
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks")
+    cm = CallbackManager(module_hdl, new_style = True)
+    # Near calls and returns only: jumps and far transfers are not instrumented
+    cm.add_callback(CallbackManager.BRANCH_CB, branch, name="branch",
+                    branch_kinds=api.BRANCH_KIND_CALL | api.BRANCH_KIND_CALL_INDIRECT | api.BRANCH_KIND_RET)
+    pyrebox_print("[*]    Initialized callbacks")
+    pyrebox_print("[!]    Test: Open calc.exe and monitor the process")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
@@ -0,0 +1,105 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+from __future__ import print_function
+import time
+
+# Callback manager
+cm = None
+pyrebox_print = None
+
+
+def check_module(pgd, base, size):
+    '''
+    Read a module with a single bulk read and compare every page
+    that could be read with a page by page read
+    '''
+    import api
+    import c_api
+
+    buf = bytearray(size)
+    t0 = time.time()
+    failed, bitmap = api.r_va_into(pgd, base, buf)
+    elapsed = time.time() - t0
+    pages = (size + 0xFFF) // 0x1000
+    assert(len(bitmap) == (pages + 7) // 8)
+    seen_failed = 0
+    for i in range(0, pages):
+        offset = i * 0x1000
+        length = min(0x1000, size - offset)
+        if api.page_read(bitmap, i):
+            assert(buf[offset:offset + length] == c_api.r_va(pgd, base + offset, length))
+        else:
+            assert(buf[offset:offset + length] == bytearray(length))
+            seen_failed += 1
+    assert(seen_failed == failed)
+    return pages, failed, elapsed
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    print("[*]    Cleaning module")
+    cm.clean()
+    print("[*]    Cleaned module")
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    import api
+    from api import CallbackManager
+
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks")
+    cm = CallbackManager(module_hdl, new_style = True)
+    total_pages = 0
+    total_failed = 0
+    total_time = 0.0
+    for proc in api.get_process_list():
+        for mod in api.get_module_list(proc["pgd"]):
+            pages, failed, elapsed = check_module(proc["pgd"], mod["base"], mod["size"])
+            total_pages += pages
+            total_failed += failed
+            total_time += elapsed
+    pyrebox_print("[*]    Bulk read %d pages (%d unreadable) in %f seconds" % (total_pages, total_failed, total_time))
+    # Address spaces not running on any cpu go through the page walker cache,
+    # and the page by page reads of check_module hit it
+    stats = api.get_page_walk_cache_stats()
+    assert(stats["hits"] > 0)
+    pyrebox_print("[*]    Page walker cache: %d hits, %d misses, %d invalidations" %
+                  (stats["hits"], stats["misses"], stats["invalidations"]))
+    pyrebox_print("[!]    Test: Pause the VM once the system has booted before loading this module")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
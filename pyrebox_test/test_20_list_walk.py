@@ -0,0 +1,100 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+from __future__ import print_function
+import struct
+import time
+
+# Callback manager
+cm = None
+pyrebox_print = None
+
+
+def walk_processes():
+    '''
+    Walk the EPROCESS list with a single call, and compare it
+    with the process list and with a scatter-gather read
+    '''
+    import api
+    import windows_vmi
+    import volatility.obj as obj
+    from utils import get_addr_space
+
+    addr_space = get_addr_space()
+    kdbg = obj.Object("_KDDEBUGGER_DATA64", offset=windows_vmi.last_kdbg, vm=addr_space)
+    head = long(kdbg.PsActiveProcessHead)
+    links_offset = addr_space.profile.get_obj_offset("_EPROCESS", "ActiveProcessLinks")
+    pid_offset = addr_space.profile.get_obj_offset("_EPROCESS", "UniqueProcessId")
+    eproc_size = addr_space.profile.get_obj_size("_EPROCESS")
+    ptr_size = api.get_os_bits() // 8
+    # Kernel memory is mapped in every address space
+    procs = api.get_process_list()
+    pgd = [proc["pgd"] for proc in procs if proc["pgd"] != 0][0]
+
+    t0 = time.time()
+    nodes = api.r_va_list(pgd, head, links_offset, eproc_size, 4096)
+    elapsed = time.time() - t0
+
+    fmt = "<I" if ptr_size == 4 else "<Q"
+    pids = set(struct.unpack(fmt, data[pid_offset:pid_offset + ptr_size])[0] for (addr, data) in nodes)
+    # The idle process is not in the list
+    expected = set(proc["pid"] for proc in procs if proc["pid"] != 0)
+    assert(expected.issubset(pids))
+
+    contents = api.r_va_many(pgd, [(addr, eproc_size) for (addr, data) in nodes])
+    assert([data for (addr, data) in nodes] == contents)
+    return len(nodes), elapsed
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    print("[*]    Cleaning module")
+    cm.clean()
+    print("[*]    Cleaned module")
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    from api import CallbackManager
+
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks")
+    cm = CallbackManager(module_hdl, new_style = True)
+    count, elapsed = walk_processes()
+    pyrebox_print("[*]    Walked %d EPROCESS structures in %f seconds" % (count, elapsed))
+    pyrebox_print("[!]    Test: Pause a booted Windows VM before loading this module")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
@@ -0,0 +1,90 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+from __future__ import print_function
+import time
+
+# Callback manager
+cm = None
+pyrebox_print = None
+
+
+def check_mappings(pgd):
+    '''
+    Enumerate the pages of an address space and compare
+    a few of them with the translation of single addresses
+    '''
+    import api
+
+    t0 = time.time()
+    mappings = api.get_page_mappings(pgd)
+    elapsed = time.time() - t0
+    last_end = 0
+    for (va, pa, flags, size) in mappings:
+        # Present, sorted, aligned and not overlapping
+        assert(flags & 0x1)
+        assert(va % size == 0 and pa % size == 0)
+        assert(va >= last_end)
+        last_end = va + size
+    for (va, pa, flags, size) in mappings[::max(1, len(mappings) // 64)]:
+        offset = (size - 1) & 0xABC
+        assert(api.va_to_pa(pgd, va + offset) == pa + offset)
+    return len(mappings), sum(size for (va, pa, flags, size) in mappings), elapsed
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    print("[*]    Cleaning module")
+    cm.clean()
+    print("[*]    Cleaned module")
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    import api
+    from api import CallbackManager
+
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks")
+    cm = CallbackManager(module_hdl, new_style = True)
+    for proc in api.get_process_list():
+        if proc["pgd"] == 0:
+            continue
+        count, mapped, elapsed = check_mappings(proc["pgd"])
+        pyrebox_print("[*]    %s: %d mappings (%d KB) in %f seconds" % (proc["name"], count, mapped // 1024, elapsed))
+    pyrebox_print("[!]    Test: Pause the VM once the system has booted before loading this module")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
@@ -0,0 +1,110 @@
+# -------------------------------------------------------------------------------
+#
+#   Copyright (C) 2017 Cisco Talos Security Intelligence and Research Group
+#
+#   PyREBox: Python scriptable Reverse Engineering Sandbox
+#   Author: Xabier Ugarte-Pedrero
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License version 2 as
+#   published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#   MA 02110-1301, USA.
+#
+# -------------------------------------------------------------------------------
+from __future__ import print_function
+
+# Checks that no direct call is lost in hot loops, where the translated blocks
+# are chained to each other. Every call instruction that is seen is also
+# instrumented with an address specific instruction begin callback, and both
+# counters must match: each execution of the call produces one branch event.
+
+# Callback manager
+cm = None
+pyrebox_print = None
+# Number of sources (call instructions) checked
+MAX_SOURCES = 16
+# Minimum number of executions of a call to consider its loop hot
+HOT_THRESHOLD = 10000
+# (pgd, source) -> [times the call was executed, branch events received]
+counts = {}
+
+
+def call_executed(params):
+    import api
+
+    cpu = params["cpu"]
+    pgd = api.get_running_process(params["cpu_index"])
+    key = (pgd, cpu.PC)
+    if key in counts:
+        counts[key][0] += 1
+
+
+def branch(params):
+    import api
+    from api import CallbackManager
+
+    pgd = api.get_running_process(params["cpu_index"])
+    key = (pgd, params["source"])
+    if key in counts:
+        counts[key][1] += 1
+        executed, events = counts[key]
+        # The instruction begin callback runs before the call, the branch one after it
+        assert(executed - events in (0, 1))
+        if events % HOT_THRESHOLD == 0:
+            pyrebox_print("Call at %x: executed %d times, %d branch events\n" % (key[1], executed, events))
+    elif len(counts) < MAX_SOURCES:
+        # Start counting from the next execution of the call
+        counts[key] = [0, 0]
+        cm.add_callback(CallbackManager.INSN_BEGIN_CB, call_executed,
+                        name="call_%x_%x" % key, addr=key[1], pgd=pgd)
+
+
+def clean():
+    '''
+    Clean up everything. At least you need to place this
+    clean() call to the callback manager, that will
+    unregister all the registered callbacks.
+    '''
+    global cm
+    hot = [(key, value) for key, value in counts.items() if value[1] >= HOT_THRESHOLD]
+    for key, (executed, events) in hot:
+        pyrebox_print("Call at %x: executed %d times, %d branch events\n" % (key[1], executed, events))
+    if len(hot) == 0:
+        pyrebox_print("[!]    No hot loop was found, run a program with a loop that calls a function\n")
+    print("[*]    Cleaning module")
+    cm.clean()
+    print("[*]    Cleaned module")
+
+
+def initialize_callbacks(module_hdl, printer):
+    '''
+    Initilize callbacks for this module. This function
+    will be triggered whenever import_module command
+    is triggered.
+    '''
+    global cm
+    global pyrebox_print
+    import api
+    from api import CallbackManager
+
+    # Initialize printer
+    pyrebox_print = printer
+    pyrebox_print("[*]    Initializing callbacks")
+    cm = CallbackManager(module_hdl, new_style = True)
+    cm.add_callback(CallbackManager.BRANCH_CB, branch, name="branch", branch_kinds=api.BRANCH_KIND_CALL)
+    pyrebox_print("[*]    Initialized callbacks")
+    pyrebox_print("[!]    Test: Monitor a process that runs a loop calling a function, "
+                  "for instance: for (i = 0; i < 1000000; ++i) f(i);")
+
+
+if __name__ == "__main__":
+    print("[*] Loading python module %s" % (__file__))
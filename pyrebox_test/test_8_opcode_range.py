@@ -37,9 +37,14 @@ def opcode_range(params):
     cpu = params["cpu"]
     cur_pc = params["cur_pc"]
     next_pc = params["next_pc"]
+    # Decoder state: a nop has no modrm byte and is not a control transfer
+    assert(params["opcode"] == 0x90)
+    assert(params["modrm_reg"] == api.INSN_NO_MODRM_REG)
+    assert(params["insn_class"] == api.INSN_CLASS_NONE)
 
     pgd = api.get_running_process(cpu_index)
-    pyrebox_print("Opcode range callback (%x) PGD %x cur_pc %x next_pc %x\n" % (cpu_index, pgd, cur_pc, next_pc))
+    pyrebox_print("Opcode range callback (%x) PGD %x cur_pc %x next_pc %x prefix_len %d\n" %
+                  (cpu_index, pgd, cur_pc, next_pc, params["prefix_len"]))
     start_shell()
 
 
@@ -303,6 +303,9 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 
     tlb_debug("mmu_idx:0x%04" PRIx16 "\n", asked);
 
+    //Pyrebox: CR3 reloads and TLB flushes invalidate the page walker cache
+    page_walk_cache_invalidate();
+
     qemu_spin_lock(&env->tlb_c.lock);
 
     all_dirty = env->tlb_c.dirty;
@@ -461,6 +464,9 @@ static void tlb_flush_page_by_mmuidx_async_work(CPUState *cpu,
     tlb_debug("page addr:" TARGET_FMT_lx " mmu_map:0x%lx\n",
               addr, mmu_idx_bitmap);
 
+    //Pyrebox: INVLPG invalidates the page walker cache
+    page_walk_cache_invalidate();
+
     qemu_spin_lock(&env->tlb_c.lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         if (test_bit(mmu_idx, &mmu_idx_bitmap)) {
@@ -633,8 +639,9 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
 static inline void tlb_set_dirty1_locked(CPUTLBEntry *tlb_entry,
                                          target_ulong vaddr)
 {
-    if (tlb_entry->addr_write == (vaddr | TLB_NOTDIRTY)) {
-        tlb_entry->addr_write = vaddr;
+    /* PyREBox: keep the watch flag of the entry */
+    if ((tlb_entry->addr_write & ~TLB_WATCH) == (vaddr | TLB_NOTDIRTY)) {
+        tlb_entry->addr_write &= ~TLB_NOTDIRTY;
     }
 }
 
@@ -708,6 +715,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     hwaddr iotlb, xlat, sz, paddr_page;
     target_ulong vaddr_page;
     int asidx = cpu_asidx_from_attrs(cpu, attrs);
+    int watch_flags = 0;
 
     assert_cpu_is_self(cpu);
 
@@ -746,6 +754,13 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
         addend = (uintptr_t)memory_region_get_ram_ptr(section->mr) + xlat;
     }
 
+    /* PyREBox: look for memory watches on RAM pages (virtual or
+       ram address) before taking the TLB lock */
+    if (watched_pages_count > 0 && memory_region_is_ram(section->mr)) {
+        watch_flags = get_page_watch_flags(vaddr_page,
+                          memory_region_get_ram_addr(section->mr) + xlat);
+    }
+
     code_address = address;
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr_page,
                                             paddr_page, xlat, prot, &address);
@@ -830,6 +845,16 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
         }
     }
 
+    /* PyREBox: accesses to watched pages leave the fast path, and are
+       reported by the softmmu helpers */
+    if ((watch_flags & WATCH_READ) && tn.addr_read != -1) {
+        tn.addr_read |= TLB_WATCH;
+    }
+    if ((watch_flags & WATCH_WRITE) && tn.addr_write != -1
+        && !(tn.addr_write & TLB_MMIO)) {
+        tn.addr_write |= TLB_WATCH;
+    }
+
     copy_tlb_helper_locked(te, &tn);
     tlb_n_used_entries_inc(env, mmu_idx);
     qemu_spin_unlock(&env->tlb_c.lock);
@@ -885,7 +910,7 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
 
         entry = tlb_entry(env, mmu_idx, addr);
         tlb_addr = entry->addr_read;
-        if (!(tlb_addr & ~(TARGET_PAGE_MASK | TLB_RECHECK))) {
+        if (!(tlb_addr & ~(TARGET_PAGE_MASK | TLB_RECHECK | TLB_WATCH))) {
             /* RAM access */
             uintptr_t haddr = addr + entry->addend;
 
@@ -952,7 +977,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
 
         entry = tlb_entry(env, mmu_idx, addr);
         tlb_addr = tlb_addr_write(entry);
-        if (!(tlb_addr & ~(TARGET_PAGE_MASK | TLB_RECHECK))) {
+        if (!(tlb_addr & ~(TARGET_PAGE_MASK | TLB_RECHECK | TLB_WATCH))) {
             /* RAM access */
             uintptr_t haddr = addr + entry->addend;
 
@@ -1136,8 +1161,9 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
         tlb_addr = tlb_addr_write(tlbe) & ~TLB_INVALID_MASK;
     }
 
-    /* Notice an IO access or a needs-MMU-lookup access */
-    if (unlikely(tlb_addr & (TLB_MMIO | TLB_RECHECK))) {
+    /* Notice an IO access or a needs-MMU-lookup access. PyREBox: watched
+       pages too, so that the access is reported by the softmmu helpers */
+    if (unlikely(tlb_addr & (TLB_MMIO | TLB_RECHECK | TLB_WATCH))) {
         /* There's really nothing that can be done to
            support this apart from stop-the-world.  */
         goto stop_the_world;
@@ -118,6 +118,7 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr,
     unsigned a_bits = get_alignment_bits(get_memop(oi));
     uintptr_t haddr;
     DATA_TYPE res;
+    target_ulong watched;
 
     if (addr & ((1 << a_bits) - 1)) {
         cpu_unaligned_access(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
@@ -135,6 +136,10 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr,
         tlb_addr = entry->ADDR_READ;
     }
 
+    /* PyREBox: accesses to watched pages are reported to the watches */
+    watched = tlb_addr & TLB_WATCH;
+    tlb_addr &= ~TLB_WATCH;
+
     /* Handle an IO access.  */
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
         if ((addr & (DATA_SIZE - 1)) != 0) {
@@ -143,10 +148,14 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr,
 
         /* ??? Note that the io helpers always read data in the target
            byte ordering.  We should push the LE/BE request down into io.  */
+        haddr = addr + entry->addend;
         res = glue(io_read, SUFFIX)(env, mmu_idx, index, addr, retaddr,
                                     tlb_addr & TLB_RECHECK,
                                     READ_ACCESS_TYPE);
         res = TGT_LE(res);
+        if (watched) {
+            helper_qemu_mem_read_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), DATA_SIZE);
+        }
         return res;
     }
 
@@ -172,12 +181,16 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr,
     haddr = addr + entry->addend;
 #if DATA_SIZE == 1
     res = glue(glue(ld, LSUFFIX), _p)((uint8_t *)haddr);
-    if (is_mem_read_callback_needed()){
+    if (watched) {
+        helper_qemu_mem_read_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), DATA_SIZE);
+    } else if (is_mem_read_callback_needed()){
         helper_qemu_mem_read_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), DATA_SIZE);
     }
 #else
     res = glue(glue(ld, LSUFFIX), _le_p)((uint8_t *)haddr);
-    if (is_mem_read_callback_needed()){
+    if (watched) {
+        helper_qemu_mem_read_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), DATA_SIZE);
+    } else if (is_mem_read_callback_needed()){
         helper_qemu_mem_read_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), DATA_SIZE);
     }
 
@@ -196,6 +209,7 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr,
     unsigned a_bits = get_alignment_bits(get_memop(oi));
     uintptr_t haddr;
     DATA_TYPE res;
+    target_ulong watched;
 
     if (addr & ((1 << a_bits) - 1)) {
         cpu_unaligned_access(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
@@ -213,6 +227,10 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr,
         tlb_addr = entry->ADDR_READ;
     }
 
+    /* PyREBox: accesses to watched pages are reported to the watches */
+    watched = tlb_addr & TLB_WATCH;
+    tlb_addr &= ~TLB_WATCH;
+
     /* Handle an IO access.  */
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
         if ((addr & (DATA_SIZE - 1)) != 0) {
@@ -221,10 +239,14 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr,
 
         /* ??? Note that the io helpers always read data in the target
            byte ordering.  We should push the LE/BE request down into io.  */
+        haddr = addr + entry->addend;
         res = glue(io_read, SUFFIX)(env, mmu_idx, index, addr, retaddr,
                                     tlb_addr & TLB_RECHECK,
                                     READ_ACCESS_TYPE);
         res = TGT_BE(res);
+        if (watched) {
+            helper_qemu_mem_read_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), DATA_SIZE);
+        }
         return res;
     }
 
@@ -249,7 +271,9 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr,
 
     haddr = addr + entry->addend;
     res = glue(glue(ld, LSUFFIX), _be_p)((uint8_t *)haddr);
-    if (is_mem_read_callback_needed()){
+    if (watched) {
+        helper_qemu_mem_read_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), DATA_SIZE);
+    } else if (is_mem_read_callback_needed()){
         helper_qemu_mem_read_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), DATA_SIZE);
     }
 
@@ -298,6 +322,7 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
     target_ulong tlb_addr = tlb_addr_write(entry);
     unsigned a_bits = get_alignment_bits(get_memop(oi));
     uintptr_t haddr;
+    target_ulong watched;
 
     if (addr & ((1 << a_bits) - 1)) {
         cpu_unaligned_access(ENV_GET_CPU(env), addr, MMU_DATA_STORE,
@@ -315,6 +340,10 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
         tlb_addr = tlb_addr_write(entry) & ~TLB_INVALID_MASK;
     }
 
+    /* PyREBox: accesses to watched pages are reported to the watches */
+    watched = tlb_addr & TLB_WATCH;
+    tlb_addr &= ~TLB_WATCH;
+
     /* Handle an IO access.  */
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
         if ((addr & (DATA_SIZE - 1)) != 0) {
@@ -323,9 +352,13 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 
         /* ??? Note that the io helpers always read data in the target
            byte ordering.  We should push the LE/BE request down into io.  */
+        haddr = addr + entry->addend;
         val = TGT_LE(val);
         glue(io_write, SUFFIX)(env, mmu_idx, index, val, addr,
                                retaddr, tlb_addr & TLB_RECHECK);
+        if (watched) {
+            helper_qemu_mem_write_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), TGT_LE(val), DATA_SIZE);
+        }
         return;
     }
 
@@ -363,13 +396,17 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
     haddr = addr + entry->addend;
 #if DATA_SIZE == 1
     glue(glue(st, SUFFIX), _p)((uint8_t *)haddr, val);
-    if (is_mem_write_callback_needed()){
+    if (watched) {
+        helper_qemu_mem_write_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), val, DATA_SIZE);
+    } else if (is_mem_write_callback_needed()){
         helper_qemu_mem_write_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), val, DATA_SIZE);
     }
 
 #else
     glue(glue(st, SUFFIX), _le_p)((uint8_t *)haddr, val);
-    if (is_mem_write_callback_needed()){
+    if (watched) {
+        helper_qemu_mem_write_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), val, DATA_SIZE);
+    } else if (is_mem_write_callback_needed()){
         helper_qemu_mem_write_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), val, DATA_SIZE);
     }
 
@@ -386,6 +423,7 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
     target_ulong tlb_addr = tlb_addr_write(entry);
     unsigned a_bits = get_alignment_bits(get_memop(oi));
     uintptr_t haddr;
+    target_ulong watched;
 
     if (addr & ((1 << a_bits) - 1)) {
         cpu_unaligned_access(ENV_GET_CPU(env), addr, MMU_DATA_STORE,
@@ -403,6 +441,10 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
         tlb_addr = tlb_addr_write(entry) & ~TLB_INVALID_MASK;
     }
 
+    /* PyREBox: accesses to watched pages are reported to the watches */
+    watched = tlb_addr & TLB_WATCH;
+    tlb_addr &= ~TLB_WATCH;
+
     /* Handle an IO access.  */
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
         if ((addr & (DATA_SIZE - 1)) != 0) {
@@ -411,9 +453,13 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 
         /* ??? Note that the io helpers always read data in the target
            byte ordering.  We should push the LE/BE request down into io.  */
+        haddr = addr + entry->addend;
         val = TGT_BE(val);
         glue(io_write, SUFFIX)(env, mmu_idx, index, val, addr, retaddr,
                                tlb_addr & TLB_RECHECK);
+        if (watched) {
+            helper_qemu_mem_write_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), TGT_BE(val), DATA_SIZE);
+        }
         return;
     }
 
@@ -450,7 +496,9 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 
     haddr = addr + entry->addend;
     glue(glue(st, SUFFIX), _be_p)((uint8_t *)haddr, val);
-    if (is_mem_write_callback_needed()){
+    if (watched) {
+        helper_qemu_mem_write_watch_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), val, DATA_SIZE);
+    } else if (is_mem_write_callback_needed()){
         helper_qemu_mem_write_callback(addr, (uintptr_t)qemu_ram_addr_from_host((void*) haddr), val, DATA_SIZE);
     }
 
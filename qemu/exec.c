@@ -71,6 +71,8 @@
 
 #include "monitor/monitor.h"
 
+#include "pyrebox/pyrebox.h"
+
 //#define DEBUG_SUBPAGE
 
 #if !defined(CONFIG_USER_ONLY)
@@ -917,8 +919,14 @@ AddressSpace *cpu_get_address_space(CPUState *cpu, int asidx)
 void cpu_exec_unrealizefn(CPUState *cpu)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
+    int cpu_index = cpu->cpu_index;
 
     cpu_list_remove(cpu);
+#ifndef CONFIG_USER_ONLY
+    /* PyREBox: drop the cached pointer to this CPU. cpu_list_remove()
+     * unassigns cpu_index, and qemu_get_cpu() no longer finds the CPU */
+    pyrebox_unrealize_cpu(cpu_index);
+#endif
 
     if (cc->vmsd != NULL) {
         vmstate_unregister(NULL, cc->vmsd, cpu);
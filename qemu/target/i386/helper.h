@@ -1,16 +1,18 @@
 DEF_HELPER_FLAGS_4(cc_compute_all, TCG_CALL_NO_RWG_SE, tl, tl, tl, tl, int)
 DEF_HELPER_FLAGS_4(cc_compute_c, TCG_CALL_NO_RWG_SE, tl, tl, tl, tl, int)
 
-//void qemu_block_begin_callback(TranslationBlock* tb);
-DEF_HELPER_1(qemu_block_begin_callback, void, ptr)
+//void qemu_block_begin_callback(TranslationBlock* tb, uint32_t dispatch_record);
+DEF_HELPER_2(qemu_block_begin_callback, void, ptr, i32)
 //void qemu_block_end_callback(TranslationBlock* next_tb, target_ulong from);
 DEF_HELPER_3(qemu_block_end_callback, void, ptr, tl, tl)
-//void qemu_insn_begin_callback();
-DEF_HELPER_0(qemu_insn_begin_callback, void)
+//void qemu_insn_begin_callback(uint32_t dispatch_record);
+DEF_HELPER_1(qemu_insn_begin_callback, void, i32)
 //void qemu_insn_end_callback();
 DEF_HELPER_0(qemu_insn_end_callback, void)
-//void qemu_opcode_range_callback(target_ulong from, target_ulong to, uint32_t opcode);
-DEF_HELPER_4(qemu_opcode_range_callback, void, tl, tl, i32, tl)
+//void qemu_opcode_range_callback(target_ulong from, target_ulong to, uint32_t opcode, target_ulong insn_size, uint32_t info);
+DEF_HELPER_5(qemu_opcode_range_callback, void, tl, tl, i32, tl, i32)
+//void qemu_branch_callback(target_ulong source, target_ulong return_addr, uint32_t kind);
+DEF_HELPER_3(qemu_branch_callback, void, tl, tl, i32)
 DEF_HELPER_0(qemu_trigger_cpu_loop_exit_if_needed, void)
 
 DEF_HELPER_3(write_eflags, void, env, tl, i32)
@@ -25,6 +25,9 @@
 #include "exec/cpu_ldst.h"
 #include "exec/address-spaces.h"
 
+//Pyrebox: context change notification
+#include "pyrebox/qemu_glue_callbacks_context.h"
+
 void helper_outb(CPUX86State *env, uint32_t port, uint32_t data)
 {
 #ifdef CONFIG_USER_ONLY
@@ -151,6 +154,8 @@ void helper_write_crN(CPUX86State *env, int reg, target_ulong t0)
         break;
     case 3:
         cpu_x86_update_cr3(env, t0);
+        //Pyrebox: report the context change precisely
+        notify_cr3_write(CPU(x86_env_get_cpu(env)));
         break;
     case 4:
         cpu_x86_update_cr4(env, t0);
@@ -33,6 +33,8 @@
 #include "exec/log.h"
 
 #include "pyrebox/qemu_glue_callbacks_needed.h"
+#include "pyrebox/qemu_glue_callbacks_prefilter.h"
+#include "pyrebox/qemu_glue_callbacks_insn_info.h"
 
 
 #define PREFIX_REPZ   0x01
@@ -104,6 +106,10 @@ typedef struct DisasContext {
     //Pyrebox: Save the opcode while doing the dissasembly, in 
     //order to call the corresponding opcode range callback.
     uint32_t saved_opcode;
+    //Pyrebox: Number of prefix bytes, and reg field of the last modrm byte
+    //decoded (-1 if none), for the opcode range callback.
+    int saved_prefix_len;
+    int saved_modrm_reg;
 
     //---------------------------END PYREBOX ADDED------------------------------
 
@@ -1292,6 +1298,41 @@ static void gen_exception(DisasContext *s, int trapno, target_ulong cur_eip)
     s->base.is_jmp = DISAS_NORETURN;
 }
 
+//Pyrebox: Decoder state of the current instruction for the opcode range
+//callback (see qemu_glue_callbacks_insn_info.h)
+static inline TCGv_i32 gen_opcode_range_info(DisasContext *s)
+{
+    uint8_t modrm_reg = (s->saved_modrm_reg < 0) ? INSN_NO_MODRM_REG : s->saved_modrm_reg;
+    return tcg_const_i32(INSN_INFO_PACK(s->saved_prefix_len, modrm_reg,
+                                        classify_insn(s->saved_opcode, modrm_reg)));
+}
+
+//Pyrebox: branch callback, for the call / ret / jmp instructions of the kinds
+//requested by the branch callbacks. It must be emitted once the destination
+//has been written to the cpu state, because the helper takes it from there.
+static void gen_branch_callback(DisasContext *s)
+{
+    uint8_t modrm_reg = (s->saved_modrm_reg < 0) ? INSN_NO_MODRM_REG : s->saved_modrm_reg;
+    uint32_t kind = get_branch_kind(s->saved_opcode, modrm_reg);
+    target_ulong return_addr = 0;
+
+    if (kind == 0 || !is_branch_callback_needed(kind)) {
+        return;
+    }
+    if (kind & (BRANCH_KIND_CALL | BRANCH_KIND_CALL_INDIRECT)) {
+        return_addr = s->saved_pc + (s->pc - s->pc_start);
+    }
+    //Update flags before callback
+    gen_update_cc_op(s);
+    TCGv tcg_source = tcg_const_tl(s->saved_pc);
+    TCGv tcg_return_addr = tcg_const_tl(return_addr);
+    TCGv_i32 tcg_kind = tcg_const_i32(kind);
+    gen_helper_qemu_branch_callback(tcg_source, tcg_return_addr, tcg_kind);
+    tcg_temp_free(tcg_source);
+    tcg_temp_free(tcg_return_addr);
+    tcg_temp_free_i32(tcg_kind);
+}
+
 /* Generate #UD for the current instruction.  The assumption here is that
    the instruction is known, but it isn't allowed in the current cpu mode.  */
 static void gen_illegal_opcode(DisasContext *s)
@@ -1307,15 +1348,17 @@ static void gen_illegal_opcode(DisasContext *s)
         tcg_gen_movi_tl(tcg_saved_pc, s->saved_pc);
         TCGv tcg_next_pc = tcg_const_tl(0);
         TCGv_i32 tcg_opcode = tcg_const_i32(s->saved_opcode);
+        TCGv_i32 tcg_info = gen_opcode_range_info(s);
         TCGv tcg_insn_size = tcg_temp_new();
         tcg_gen_movi_tl(tcg_insn_size, insn_size);
     
         gen_helper_qemu_opcode_range_callback(tcg_saved_pc, 
-        tcg_next_pc, tcg_opcode, tcg_insn_size);
+        tcg_next_pc, tcg_opcode, tcg_insn_size, tcg_info);
         tcg_temp_free(tcg_saved_pc);
         tcg_temp_free(tcg_next_pc);
         tcg_temp_free(tcg_insn_size);
         tcg_temp_free_i32(tcg_opcode);
+        tcg_temp_free_i32(tcg_info);
 
     }
 
@@ -1975,6 +2018,15 @@ static inline uint8_t x86_ldub_code(CPUX86State *env, DisasContext *s)
     return cpu_ldub_code(env, advance_pc(env, s, 1));
 }
 
+//Pyrebox: Read a modrm byte, keeping its reg field for the opcode range
+//callback. For three byte opcodes the last byte read as modrm is the actual one.
+static inline uint8_t x86_ldub_modrm(CPUX86State *env, DisasContext *s)
+{
+    uint8_t modrm = x86_ldub_code(env, s);
+    s->saved_modrm_reg = (modrm >> 3) & 7;
+    return modrm;
+}
+
 static inline int16_t x86_ldsw_code(CPUX86State *env, DisasContext *s)
 {
     return cpu_ldsw_code(env, advance_pc(env, s, 2));
@@ -2268,6 +2320,53 @@ static inline bool use_goto_tb(DisasContext *s, target_ulong pc)
 #endif
 }
 
+//Pyrebox: load a field of a callback prefilter
+static void gen_ld_callback_prefilter(TCGv ret, callback_prefilter_kind_t kind, size_t offset)
+{
+    TCGv_ptr filter = tcg_const_ptr((tcg_target_ulong)&callback_prefilters[kind]);
+    tcg_gen_ld_tl(ret, filter, offset);
+    tcg_temp_free_ptr(filter);
+}
+
+//Pyrebox: inline prefilter (see qemu_glue_callbacks_prefilter.h). Emits the
+//checks of the prefilter for the event, and returns the label to set after
+//the helper call. The generated code jumps to it if the event cannot be
+//delivered to any callback. Regular temporaries do not survive the branches,
+//so the helper arguments must be created afterwards, or be local temporaries.
+static TCGLabel *gen_callback_prefilter(DisasContext *s, callback_prefilter_kind_t kind, target_ulong pc)
+{
+    TCGLabel *skip = gen_new_label();
+    TCGLabel *call = gen_new_label();
+    TCGv field = tcg_temp_new();
+    TCGv pgd = tcg_temp_new();
+    int i;
+
+    gen_ld_callback_prefilter(field, kind, offsetof(callback_prefilter_t, active));
+    tcg_gen_brcondi_tl(TCG_COND_EQ, field, 0, call);
+    //The privilege level is known at translation time
+    if (s->cpl != 3) {
+        gen_ld_callback_prefilter(field, kind, offsetof(callback_prefilter_t, user_only));
+        tcg_gen_brcondi_tl(TCG_COND_NE, field, 0, skip);
+    }
+    gen_ld_callback_prefilter(field, kind, offsetof(callback_prefilter_t, first));
+    tcg_gen_brcondi_tl(TCG_COND_GTU, field, pc, skip);
+    gen_ld_callback_prefilter(field, kind, offsetof(callback_prefilter_t, last));
+    tcg_gen_brcondi_tl(TCG_COND_LTU, field, pc, skip);
+    gen_ld_callback_prefilter(field, kind, offsetof(callback_prefilter_t, any_pgd));
+    tcg_gen_brcondi_tl(TCG_COND_NE, field, 0, call);
+    for (i = 0; i < CALLBACK_PREFILTER_MAX_PGDS; ++i) {
+        tcg_gen_ld_tl(pgd, cpu_env, offsetof(CPUX86State, cr[3]));
+        gen_ld_callback_prefilter(field, kind, offsetof(callback_prefilter_t, pgds) + i * sizeof(prefilter_target_ulong));
+        tcg_gen_brcond_tl(TCG_COND_EQ, field, pgd, call);
+    }
+    tcg_gen_br(skip);
+    gen_set_label(call);
+
+    tcg_temp_free(pgd);
+    tcg_temp_free(field);
+    return skip;
+}
+
 static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
 {
     target_ulong pc = s->cs_base + eip;
@@ -2275,7 +2374,9 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
 
     if (use_goto_tb(s, pc))  {
         /* jump to same page: we can use a direct jump */
-        tcg_gen_goto_tb(tb_num);
+        //Pyrebox: the instrumentation is emitted before the goto_tb. Once the
+        //TB is chained to its successor, goto_tb jumps to it directly, and the
+        //code that follows it (up to the exit_tb) is not executed any more.
         gen_jmp_im(s,eip);
 
         //Pyrebox: insn end 
@@ -2285,13 +2386,16 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
         if (is_insn_end_callback_needed()){
             //Update flags before callback
             gen_update_cc_op(s);
+            TCGLabel *skip = gen_callback_prefilter(s, PREFILTER_INSN_END, s->saved_pc);
             gen_helper_qemu_insn_end_callback();
+            gen_set_label(skip);
         }
         //Pyrebox: block_end
         //helper_qemu_block_end_callback(CPUState* cpu,TranslationBlock* next_tb, target_ulong from,target_ulong to)
         if (is_block_end_callback_needed()){
             //Update flags before callback
             gen_update_cc_op(s);
+            TCGLabel *skip = gen_callback_prefilter(s, PREFILTER_BLOCK_END, s->saved_pc);
             TCGv_ptr tcg_tb = tcg_const_ptr((tcg_target_ulong)s->base.tb);
             TCGv tcg_from = tcg_temp_new();
             tcg_gen_movi_tl(tcg_from, s->saved_pc);
@@ -2301,6 +2405,7 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
             tcg_temp_free(tcg_to);
             tcg_temp_free(tcg_from);
             tcg_temp_free_ptr(tcg_tb);
+            gen_set_label(skip);
         }
         //Pyrebox: opcode range
         //helper_qemu_opcode_range_callback(CPUState* cpu, target_ulong from, target_ulong to, uint16_t opcode)
@@ -2313,17 +2418,23 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
             TCGv tcg_next_pc = tcg_temp_new();
             tcg_gen_movi_tl(tcg_next_pc, pc);
             TCGv_i32 tcg_opcode = tcg_const_i32(s->saved_opcode);
+            TCGv_i32 tcg_info = gen_opcode_range_info(s);
             TCGv tcg_insn_size = tcg_temp_new();
             tcg_gen_movi_tl(tcg_insn_size, insn_size);
-            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_next_pc, tcg_opcode, tcg_insn_size);
+            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_next_pc, tcg_opcode, tcg_insn_size, tcg_info);
 
             tcg_temp_free(tcg_saved_pc);
             tcg_temp_free(tcg_next_pc);
             tcg_temp_free(tcg_insn_size);
             tcg_temp_free_i32(tcg_opcode);
+            tcg_temp_free_i32(tcg_info);
 
         }
+        //Pyrebox: branch
+        gen_branch_callback(s);
 
+        tcg_gen_goto_tb(tb_num);
+        gen_jmp_im(s,eip);
         tcg_gen_exit_tb(s->base.tb, tb_num);
         s->base.is_jmp = DISAS_NORETURN;
     } else {
@@ -2700,6 +2811,10 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr, TCGv
         gen_helper_single_step(cpu_env);
     } else if (jr) {
 
+        //Pyrebox: the prefilters branch, so keep the destination in a local temporary
+        TCGv tcg_to = tcg_temp_local_new();
+        tcg_gen_mov_tl(tcg_to, dest);
+
         //Pyrebox: insn end 
         //helper_qemu_insn_end_callback(CPUState* cpu)
         //At this point, we take the pgd from the DisasContext, 
@@ -2707,7 +2822,9 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr, TCGv
         if (is_insn_end_callback_needed()){
             //Update flags before callback
             gen_update_cc_op(s);
+            TCGLabel *skip = gen_callback_prefilter(s, PREFILTER_INSN_END, s->saved_pc);
             gen_helper_qemu_insn_end_callback();
+            gen_set_label(skip);
         }
 
         //Pyrebox: block_end
@@ -2715,12 +2832,14 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr, TCGv
         if (is_block_end_callback_needed()){
             //Update flags before callback
             gen_update_cc_op(s);
+            TCGLabel *skip = gen_callback_prefilter(s, PREFILTER_BLOCK_END, s->saved_pc);
             TCGv_ptr tcg_tb = tcg_const_ptr((tcg_target_ulong)s->base.tb);
             TCGv tcg_from = tcg_temp_new();
             tcg_gen_movi_tl(tcg_from, s->saved_pc);
-            gen_helper_qemu_block_end_callback(tcg_tb,tcg_from, dest);
+            gen_helper_qemu_block_end_callback(tcg_tb,tcg_from, tcg_to);
             tcg_temp_free(tcg_from);
             tcg_temp_free_ptr(tcg_tb);
+            gen_set_label(skip);
         }
 
         //Pyrebox: opcode range
@@ -2732,15 +2851,19 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr, TCGv
             TCGv tcg_saved_pc = tcg_temp_new();
             tcg_gen_movi_tl(tcg_saved_pc, s->saved_pc);
             TCGv_i32 tcg_opcode = tcg_const_i32(s->saved_opcode);
+            TCGv_i32 tcg_info = gen_opcode_range_info(s);
             TCGv tcg_insn_size = tcg_temp_new();
             tcg_gen_movi_tl(tcg_insn_size, insn_size);
 
-            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, dest, tcg_opcode, tcg_insn_size);
+            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_to, tcg_opcode, tcg_insn_size, tcg_info);
             tcg_temp_free(tcg_saved_pc);
             tcg_temp_free(tcg_insn_size);
             tcg_temp_free_i32(tcg_opcode);
+            tcg_temp_free_i32(tcg_info);
 
         }
+        //Pyrebox: branch
+        gen_branch_callback(s);
 
         //Pyrebox: trigger cpu loop exit if needed
         //Update flags. In QEMU flags are only updated when needed (on block
@@ -2749,9 +2872,14 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr, TCGv
         //transition
         gen_update_cc_op(s);
         gen_helper_qemu_trigger_cpu_loop_exit_if_needed();
+        tcg_temp_free(tcg_to);
 
         tcg_gen_lookup_and_goto_ptr();
     } else {
+        //Pyrebox: the prefilters branch, so keep the destination in a local temporary
+        TCGv tcg_to = tcg_temp_local_new();
+        tcg_gen_mov_tl(tcg_to, dest);
+
         //Pyrebox: insn end 
         //helper_qemu_insn_end_callback(CPUState* cpu)
         //At this point, we take the pgd from the DisasContext, 
@@ -2759,19 +2887,23 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr, TCGv
         if (is_insn_end_callback_needed()){
             //Update flags before callback
             gen_update_cc_op(s);
+            TCGLabel *skip = gen_callback_prefilter(s, PREFILTER_INSN_END, s->saved_pc);
             gen_helper_qemu_insn_end_callback();
+            gen_set_label(skip);
         }
         //Pyrebox: block_end
         //helper_qemu_block_end_callback(CPUState* cpu,TranslationBlock* next_tb, target_ulong from)
         if (is_block_end_callback_needed()){
             //Update flags before callback
             gen_update_cc_op(s);
+            TCGLabel *skip = gen_callback_prefilter(s, PREFILTER_BLOCK_END, s->saved_pc);
             TCGv_ptr tcg_tb = tcg_const_ptr((tcg_target_ulong)s->base.tb);
             TCGv tcg_from = tcg_temp_new();
             tcg_gen_movi_tl(tcg_from, s->saved_pc);
-            gen_helper_qemu_block_end_callback(tcg_tb,tcg_from, dest);
+            gen_helper_qemu_block_end_callback(tcg_tb,tcg_from, tcg_to);
             tcg_temp_free(tcg_from);
             tcg_temp_free_ptr(tcg_tb);
+            gen_set_label(skip);
         }
         //Pyrebox: opcode range
         //helper_qemu_opcode_range_callback(CPUState* cpu, target_ulong from, target_ulong to, uint16_t opcode)
@@ -2782,15 +2914,20 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr, TCGv
             TCGv tcg_saved_pc = tcg_temp_new();
             tcg_gen_movi_tl(tcg_saved_pc, s->saved_pc);
             TCGv_i32 tcg_opcode = tcg_const_i32(s->saved_opcode);
+            TCGv_i32 tcg_info = gen_opcode_range_info(s);
             TCGv tcg_insn_size = tcg_temp_new();
             tcg_gen_movi_tl(tcg_insn_size, insn_size);
 
-            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, dest, tcg_opcode, tcg_insn_size);
+            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_to, tcg_opcode, tcg_insn_size, tcg_info);
             tcg_temp_free(tcg_saved_pc);
             tcg_temp_free(tcg_insn_size);
             tcg_temp_free_i32(tcg_opcode);
+            tcg_temp_free_i32(tcg_info);
 
         }
+        //Pyrebox: branch
+        gen_branch_callback(s);
+        tcg_temp_free(tcg_to);
         tcg_gen_exit_tb(NULL, 0);
     }
     s->base.is_jmp = DISAS_NORETURN;
@@ -3300,7 +3437,7 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
         gen_helper_enter_mmx(cpu_env);
     }
 
-    modrm = x86_ldub_code(env, s);
+    modrm = x86_ldub_modrm(env, s);
     reg = ((modrm >> 3) & 7);
     if (is_xmm)
         reg |= rex_r;
@@ -3891,7 +4028,7 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             if ((b & 0xf0) == 0xf0) {
                 goto do_0f_38_fx;
             }
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             rm = modrm & 7;
             reg = ((modrm >> 3) & 7) | rex_r;
             mod = (modrm >> 6) & 3;
@@ -3968,7 +4105,7 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
         do_0f_38_fx:
             /* Various integer extensions at 0f 38 f[0-f].  */
             b = modrm | (b1 << 8);
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             reg = ((modrm >> 3) & 7) | rex_r;
 
             switch (b) {
@@ -4321,7 +4458,7 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
         case 0x03a:
         case 0x13a:
             b = modrm;
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             rm = modrm & 7;
             reg = ((modrm >> 3) & 7) | rex_r;
             mod = (modrm >> 6) & 3;
@@ -4511,7 +4648,7 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
         case 0x33a:
             /* Various integer extensions at 0f 3a f[0-f].  */
             b = modrm | (b1 << 8);
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             reg = ((modrm >> 3) & 7) | rex_r;
 
             switch (b) {
@@ -4707,8 +4844,10 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     prefixes = 0;
     rex_w = -1;
     rex_r = 0;
+    s->saved_modrm_reg = -1;
 
  next_byte:
+    s->saved_prefix_len = s->pc - pc_start;
     s->saved_opcode = b = x86_ldub_code(env, s);
     /* Collect prefixes.  */
     switch (b) {
@@ -4875,7 +5014,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
 
             switch(f) {
             case 0: /* OP Ev, Gv */
-                modrm = x86_ldub_code(env, s);
+                modrm = x86_ldub_modrm(env, s);
                 reg = ((modrm >> 3) & 7) | rex_r;
                 mod = (modrm >> 6) & 3;
                 rm = (modrm & 7) | REX_B(s);
@@ -4896,7 +5035,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
                 gen_op(s, op, ot, opreg);
                 break;
             case 1: /* OP Gv, Ev */
-                modrm = x86_ldub_code(env, s);
+                modrm = x86_ldub_modrm(env, s);
                 mod = (modrm >> 6) & 3;
                 reg = ((modrm >> 3) & 7) | rex_r;
                 rm = (modrm & 7) | REX_B(s);
@@ -4931,7 +5070,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
 
             ot = mo_b_d(b, dflag);
 
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             mod = (modrm >> 6) & 3;
             rm = (modrm & 7) | REX_B(s);
             op = (modrm >> 3) & 7;
@@ -4977,7 +5116,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0xf7:
         ot = mo_b_d(b, dflag);
 
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         rm = (modrm & 7) | REX_B(s);
         op = (modrm >> 3) & 7;
@@ -5209,7 +5348,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0xff: /* GRP5 */
         ot = mo_b_d(b, dflag);
 
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         rm = (modrm & 7) | REX_B(s);
         op = (modrm >> 3) & 7;
@@ -5317,7 +5456,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0x85:
         ot = mo_b_d(b, dflag);
 
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
 
         gen_ldst_modrm(env, s, modrm, ot, OR_TMP0, 0);
@@ -5389,7 +5528,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0x69: /* imul Gv, Ev, I */
     case 0x6b:
         ot = dflag;
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
         if (b == 0x69)
             s->rip_offset = insn_const_size(ot);
@@ -5441,7 +5580,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0x1c0:
     case 0x1c1: /* xadd Ev, Gv */
         ot = mo_b_d(b, dflag);
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
         mod = (modrm >> 6) & 3;
         gen_op_mov_v_reg(s, ot, s->T0, reg);
@@ -5473,7 +5612,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             TCGv oldv, newv, cmpv;
 
             ot = mo_b_d(b, dflag);
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             reg = ((modrm >> 3) & 7) | rex_r;
             mod = (modrm >> 6) & 3;
             oldv = tcg_temp_new();
@@ -5525,7 +5664,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         }
         break;
     case 0x1c7: /* cmpxchg8b */
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         if ((mod == 3) || ((modrm & 0x38) != 0x8))
             goto illegal_op;
@@ -5587,7 +5726,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         gen_push_v(s, s->T0);
         break;
     case 0x8f: /* pop Ev */
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         ot = gen_pop_T0(s);
         if (mod == 3) {
@@ -5673,7 +5812,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0x88:
     case 0x89: /* mov Gv, Ev */
         ot = mo_b_d(b, dflag);
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
 
         /* generate a generic store */
@@ -5682,7 +5821,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0xc6:
     case 0xc7: /* mov Ev, Iv */
         ot = mo_b_d(b, dflag);
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         if (mod != 3) {
             s->rip_offset = insn_const_size(ot);
@@ -5699,14 +5838,14 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0x8a:
     case 0x8b: /* mov Ev, Gv */
         ot = mo_b_d(b, dflag);
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
 
         gen_ldst_modrm(env, s, modrm, ot, OR_TMP0, 0);
         gen_op_mov_reg_v(s, ot, reg, s->T0);
         break;
     case 0x8e: /* mov seg, Gv */
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = (modrm >> 3) & 7;
         if (reg >= 6 || reg == R_CS)
             goto illegal_op;
@@ -5730,7 +5869,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         }
         break;
     case 0x8c: /* mov Gv, seg */
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = (modrm >> 3) & 7;
         mod = (modrm >> 6) & 3;
         if (reg >= 6)
@@ -5755,7 +5894,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             /* s_ot is the sign+size of source */
             s_ot = b & 8 ? MO_SIGN | ot : ot;
 
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             reg = ((modrm >> 3) & 7) | rex_r;
             mod = (modrm >> 6) & 3;
             rm = (modrm & 7) | REX_B(s);
@@ -5791,7 +5930,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         break;
 
     case 0x8d: /* lea */
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         if (mod == 3)
             goto illegal_op;
@@ -5876,7 +6015,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0x86:
     case 0x87: /* xchg Ev, Gv */
         ot = mo_b_d(b, dflag);
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
         mod = (modrm >> 6) & 3;
         if (mod == 3) {
@@ -5913,7 +6052,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         op = R_GS;
     do_lxx:
         ot = dflag != MO_16 ? MO_32 : MO_16;
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
         mod = (modrm >> 6) & 3;
         if (mod == 3)
@@ -5944,7 +6083,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     grp2:
         {
             ot = mo_b_d(b, dflag);
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             mod = (modrm >> 6) & 3;
             op = (modrm >> 3) & 7;
 
@@ -5997,7 +6136,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         shift = 0;
     do_shiftd:
         ot = dflag;
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         rm = (modrm & 7) | REX_B(s);
         reg = ((modrm >> 3) & 7) | rex_r;
@@ -6027,7 +6166,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             gen_exception(s, EXCP07_PREX, pc_start - s->cs_base);
             break;
         }
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         rm = modrm & 7;
         op = ((b & 7) << 3) | ((modrm >> 3) & 7);
@@ -6857,7 +6996,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         break;
 
     case 0x190 ... 0x19f: /* setcc Gv */
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         gen_setcc1(s, b, s->T0);
         gen_ldst_modrm(env, s, modrm, MO_8, OR_TMP0, 1);
         break;
@@ -6866,7 +7005,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             goto illegal_op;
         }
         ot = dflag;
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
         gen_cmovcc1(env, s, ot, b, modrm, reg);
         break;
@@ -6986,7 +7125,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         /* bit operations */
     case 0x1ba: /* bt/bts/btr/btc Gv, im */
         ot = dflag;
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         op = (modrm >> 3) & 7;
         mod = (modrm >> 6) & 3;
         rm = (modrm & 7) | REX_B(s);
@@ -7019,7 +7158,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         op = 3;
     do_btx:
         ot = dflag;
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
         mod = (modrm >> 6) & 3;
         rm = (modrm & 7) | REX_B(s);
@@ -7124,7 +7263,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0x1bc: /* bsf / tzcnt */
     case 0x1bd: /* bsr / lzcnt */
         ot = dflag;
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
         gen_ldst_modrm(env, s, modrm, ot, OR_TMP0, 0);
         gen_extu(ot, s->T0);
@@ -7257,14 +7396,16 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             TCGv tcg_next_pc = tcg_temp_new();
             tcg_gen_movi_tl(tcg_next_pc, s->pc);
             TCGv_i32 tcg_opcode = tcg_const_i32(s->saved_opcode);
+            TCGv_i32 tcg_info = gen_opcode_range_info(s);
             TCGv tcg_insn_size = tcg_temp_new();
             tcg_gen_movi_tl(tcg_insn_size, s->pc - s->pc_start);
 
-            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_next_pc, tcg_opcode, tcg_insn_size);
+            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_next_pc, tcg_opcode, tcg_insn_size, tcg_info);
             tcg_temp_free(tcg_saved_pc);
             tcg_temp_free(tcg_next_pc);
             tcg_temp_free(tcg_insn_size);
             tcg_temp_free_i32(tcg_opcode);
+            tcg_temp_free_i32(tcg_info);
 
         }
 
@@ -7285,14 +7426,16 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             TCGv tcg_next_pc = tcg_temp_new();
             tcg_gen_movi_tl(tcg_next_pc, s->pc);
             TCGv_i32 tcg_opcode = tcg_const_i32(s->saved_opcode);
+            TCGv_i32 tcg_info = gen_opcode_range_info(s);
             TCGv tcg_insn_size = tcg_temp_new();
             tcg_gen_movi_tl(tcg_insn_size, s->pc - s->pc_start);
 
-            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_next_pc, tcg_opcode, tcg_insn_size);
+            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_next_pc, tcg_opcode, tcg_insn_size, tcg_info);
             tcg_temp_free(tcg_saved_pc);
             tcg_temp_free(tcg_next_pc);
             tcg_temp_free(tcg_insn_size);
             tcg_temp_free_i32(tcg_opcode);
+            tcg_temp_free_i32(tcg_info);
 
         }
 
@@ -7349,7 +7492,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (CODE64(s))
             goto illegal_op;
         ot = dflag;
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = (modrm >> 3) & 7;
         mod = (modrm >> 6) & 3;
         if (mod == 3)
@@ -7547,7 +7690,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         }
         break;
     case 0x100:
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         op = (modrm >> 3) & 7;
         switch(op) {
@@ -7612,7 +7755,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         break;
 
     case 0x101:
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         switch (modrm) {
         CASE_MODRM_MEM_OP(0): /* sgdt */
             gen_svm_check_intercept(s, pc_start, SVM_EXIT_GDTR_READ);
@@ -7980,7 +8123,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             /* d_ot is the size of destination */
             d_ot = dflag;
 
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             reg = ((modrm >> 3) & 7) | rex_r;
             mod = (modrm >> 6) & 3;
             rm = (modrm & 7) | REX_B(s);
@@ -8009,7 +8152,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             t1 = tcg_temp_local_new();
             t2 = tcg_temp_local_new();
             ot = MO_16;
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             reg = (modrm >> 3) & 7;
             mod = (modrm >> 6) & 3;
             rm = modrm & 7;
@@ -8054,7 +8197,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             if (!s->pe || s->vm86)
                 goto illegal_op;
             ot = dflag != MO_16 ? MO_32 : MO_16;
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             reg = ((modrm >> 3) & 7) | rex_r;
             gen_ldst_modrm(env, s, modrm, MO_16, OR_TMP0, 0);
             t0 = tcg_temp_local_new();
@@ -8074,7 +8217,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         }
         break;
     case 0x118:
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         op = (modrm >> 3) & 7;
         switch(op) {
@@ -8093,7 +8236,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         }
         break;
     case 0x11a:
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         if (s->flags & HF_MPX_EN_MASK) {
             mod = (modrm >> 6) & 3;
             reg = ((modrm >> 3) & 7) | rex_r;
@@ -8183,7 +8326,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         gen_nop_modrm(env, s, modrm);
         break;
     case 0x11b:
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         if (s->flags & HF_MPX_EN_MASK) {
             mod = (modrm >> 6) & 3;
             reg = ((modrm >> 3) & 7) | rex_r;
@@ -8285,7 +8428,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         gen_nop_modrm(env, s, modrm);
         break;
     case 0x119: case 0x11c ... 0x11f: /* nop (multi byte) */
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         gen_nop_modrm(env, s, modrm);
         break;
     case 0x120: /* mov reg, crN */
@@ -8293,7 +8436,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (s->cpl != 0) {
             gen_exception(s, EXCP0D_GPF, pc_start - s->cs_base);
         } else {
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             /* Ignore the mod bits (assume (modrm&0xc0)==0xc0).
              * AMD documentation (24594.pdf) and testing of
              * intel 386 and 486 processors all show that the mod bits
@@ -8353,7 +8496,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (s->cpl != 0) {
             gen_exception(s, EXCP0D_GPF, pc_start - s->cs_base);
         } else {
-            modrm = x86_ldub_code(env, s);
+            modrm = x86_ldub_modrm(env, s);
             /* Ignore the mod bits (assume (modrm&0xc0)==0xc0).
              * AMD documentation (24594.pdf) and testing of
              * intel 386 and 486 processors all show that the mod bits
@@ -8405,7 +8548,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (!(s->cpuid_features & CPUID_SSE2))
             goto illegal_op;
         ot = mo_64_32(dflag);
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         if (mod == 3)
             goto illegal_op;
@@ -8414,7 +8557,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         gen_ldst_modrm(env, s, modrm, ot, reg, 1);
         break;
     case 0x1ae:
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         switch (modrm) {
         CASE_MODRM_MEM_OP(0): /* fxsave */
             if (!(s->cpuid_features & CPUID_FXSR)
@@ -8615,7 +8758,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         break;
 
     case 0x10d: /* 3DNow! prefetch(w) */
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         mod = (modrm >> 6) & 3;
         if (mod == 3)
             goto illegal_op;
@@ -8640,7 +8783,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (!(s->cpuid_ext_features & CPUID_EXT_POPCNT))
             goto illegal_op;
 
-        modrm = x86_ldub_code(env, s);
+        modrm = x86_ldub_modrm(env, s);
         reg = ((modrm >> 3) & 7) | rex_r;
 
         if (s->prefix & PREFIX_DATA) {
@@ -8690,7 +8833,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (is_insn_end_callback_needed()){
             //Update flags before callback
             gen_update_cc_op(s);
+            TCGLabel *skip = gen_callback_prefilter(s, PREFILTER_INSN_END, s->saved_pc);
             gen_helper_qemu_insn_end_callback();
+            gen_set_label(skip);
         }
         //Pyrebox: opcode range
         //helper_qemu_opcode_range_callback(CPUState* cpu, target_ulong from, target_ulong to, uint16_t opcode)
@@ -8702,14 +8847,16 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             TCGv tcg_next_pc = tcg_temp_new();
             tcg_gen_movi_tl(tcg_next_pc, s->pc);
             TCGv_i32 tcg_opcode = tcg_const_i32(s->saved_opcode);
+            TCGv_i32 tcg_info = gen_opcode_range_info(s);
             TCGv tcg_insn_size = tcg_temp_new();
             tcg_gen_movi_tl(tcg_insn_size, insn_size);
 
-            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_next_pc, tcg_opcode, tcg_insn_size);
+            gen_helper_qemu_opcode_range_callback(tcg_saved_pc, tcg_next_pc, tcg_opcode, tcg_insn_size, tcg_info);
             tcg_temp_free(tcg_saved_pc);
             tcg_temp_free(tcg_next_pc);
             tcg_temp_free(tcg_insn_size);
             tcg_temp_free_i32(tcg_opcode);
+            tcg_temp_free_i32(tcg_info);
 
         }
 
@@ -8890,11 +9037,23 @@ static void i386_tr_tb_start(DisasContextBase *db, CPUState *cpu)
     DisasContext *dc = container_of(db, DisasContext, base);
     //Pyrebox, block_begin
     //At this point in translation time, we can assume env points to the correct cr3
-    //helper_qemu_block_begin_callback(CPUState* cpu,TranslationBlock* tb);
+    //helper_qemu_block_begin_callback(TranslationBlock* tb, uint32_t dispatch_record);
+    //The address specific callbacks are resolved now, and passed as a dispatch record index
+    //Events that no callback accepts are discarded by the inline prefilter,
+    //unless there are address specific callbacks for the block
     if (is_block_begin_callback_needed(dc->base.tb->pc)){
+        TCGLabel *skip = NULL;
+        if (is_block_begin_prefilter_applicable(dc->base.tb->pc)) {
+            skip = gen_callback_prefilter(dc, PREFILTER_BLOCK_BEGIN, dc->base.tb->pc);
+        }
         TCGv_ptr tmpTb = tcg_const_ptr((tcg_target_ulong)dc->base.tb);
-        gen_helper_qemu_block_begin_callback(tmpTb);
+        TCGv_i32 tmpRecord = tcg_const_i32(get_block_begin_dispatch_record(dc->base.tb->pc));
+        gen_helper_qemu_block_begin_callback(tmpTb, tmpRecord);
+        tcg_temp_free_i32(tmpRecord);
         tcg_temp_free_ptr(tmpTb);
+        if (skip) {
+            gen_set_label(skip);
+        }
     }
 }
 
@@ -8905,9 +9064,18 @@ static void i386_tr_insn_start(DisasContextBase *dcbase, CPUState *cpu)
     tcg_gen_insn_start(dc->base.pc_next, dc->cc_op);
 
     //Pyrebox, insn_begin
-    //helper_qemu_insn_begin_callback(CPUState* cpu);
+    //helper_qemu_insn_begin_callback(uint32_t dispatch_record);
     if (is_insn_begin_callback_needed(dc->base.pc_next)){
-        gen_helper_qemu_insn_begin_callback();
+        TCGLabel *skip = NULL;
+        if (is_insn_begin_prefilter_applicable(dc->base.pc_next)) {
+            skip = gen_callback_prefilter(dc, PREFILTER_INSN_BEGIN, dc->base.pc_next);
+        }
+        TCGv_i32 tmpRecord = tcg_const_i32(get_insn_begin_dispatch_record(dc->base.pc_next));
+        gen_helper_qemu_insn_begin_callback(tmpRecord);
+        tcg_temp_free_i32(tmpRecord);
+        if (skip) {
+            gen_set_label(skip);
+        }
     }
     
     //Pyrebox, save the pc_ptr for using it in the generation of insn_end and block_end
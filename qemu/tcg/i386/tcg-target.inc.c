@@ -2044,6 +2044,60 @@ static void tcg_out_qemu_ld_direct(TCGContext *s, TCGReg datalo, TCGReg datahi,
     }
 }
 
+#if defined(CONFIG_SOFTMMU) && TCG_TARGET_REG_BITS == 64
+//Pyrebox: inline prefilter for the memory callbacks (see qemu_glue_callbacks_prefilter.h).
+//Must be emitted right after saving the registers on the stack, because it uses
+//call argument registers 0, 2 and 3 as scratch registers. Jumps to skip if the
+//access cannot be delivered to any callback. Otherwise, it reloads addrlo (and
+//datalo for stores) from the stack, as they may live in the scratch registers.
+static void tcg_out_mem_callback_prefilter(TCGContext *s, callback_prefilter_kind_t kind, int mem_index,
+                                           TCGReg addrlo, TCGReg datalo, bool is_store, TCGLabel *skip)
+{
+    TCGReg filter = tcg_target_call_iarg_regs[0];
+    TCGReg field = tcg_target_call_iarg_regs[2];
+    TCGReg value = tcg_target_call_iarg_regs[3];
+    TCGLabel *call = gen_new_label();
+    int rexw = (TARGET_LONG_BITS == 64 ? P_REXW : 0);
+    int i;
+
+    tcg_out_movi(s, TCG_TYPE_PTR, filter, (tcg_target_long)&callback_prefilters[kind]);
+    tcg_out_ld(s, TCG_TYPE_TL, field, filter, offsetof(callback_prefilter_t, active));
+    tcg_out_cmp(s, field, 0, 1, rexw);
+    tcg_out_jxx(s, JCC_JE, call, 0);
+    //The privilege level of the access is known at translation time
+    if (mem_index != MMU_USER_IDX) {
+        tcg_out_ld(s, TCG_TYPE_TL, field, filter, offsetof(callback_prefilter_t, user_only));
+        tcg_out_cmp(s, field, 0, 1, rexw);
+        tcg_out_jxx(s, JCC_JNE, skip, 0);
+    }
+    //addrlo is the second to last register saved on the stack
+    tcg_out_ld(s, TCG_TYPE_TL, value, TCG_REG_ESP, 8);
+    tcg_out_ld(s, TCG_TYPE_TL, field, filter, offsetof(callback_prefilter_t, first));
+    tcg_out_cmp(s, value, field, 0, rexw);
+    tcg_out_jxx(s, JCC_JB, skip, 0);
+    tcg_out_ld(s, TCG_TYPE_TL, field, filter, offsetof(callback_prefilter_t, last));
+    tcg_out_cmp(s, value, field, 0, rexw);
+    tcg_out_jxx(s, JCC_JA, skip, 0);
+    tcg_out_ld(s, TCG_TYPE_TL, field, filter, offsetof(callback_prefilter_t, any_pgd));
+    tcg_out_cmp(s, field, 0, 1, rexw);
+    tcg_out_jxx(s, JCC_JNE, call, 0);
+    tcg_out_ld(s, TCG_TYPE_TL, value, TCG_AREG0, offsetof(CPUArchState, cr[3]));
+    for (i = 0; i < CALLBACK_PREFILTER_MAX_PGDS; ++i) {
+        tcg_out_ld(s, TCG_TYPE_TL, field, filter, offsetof(callback_prefilter_t, pgds) + i * sizeof(prefilter_target_ulong));
+        tcg_out_cmp(s, value, field, 0, rexw);
+        tcg_out_jxx(s, JCC_JE, call, 0);
+    }
+    tcg_out_jxx(s, JCC_JMP, skip, 0);
+
+    tcg_out_label(s, call, s->code_ptr);
+    //Stack layout: addrhi, addrlo, datahi, datalo, arg 3, arg 2, arg 1, arg 0
+    if (is_store) {
+        tcg_out_ld(s, TCG_TYPE_I64, datalo, TCG_REG_ESP, 24);
+    }
+    tcg_out_ld(s, TCG_TYPE_I64, addrlo, TCG_REG_ESP, 8);
+}
+#endif
+
 /* XXX: qemu_ld and qemu_st could be modified to clobber only EDX and
    EAX. It will be useful once fixed registers globals are less
    common. */
@@ -2111,6 +2165,10 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args, bool is64)
         //Push 8 bytes to ensure stack alignment to 16 bytes are required by GCC.
         //tcg_out_push(s, 0);
 
+        //Skip the call if no callback accepts the access
+        TCGLabel *skip = gen_new_label();
+        tcg_out_mem_callback_prefilter(s, PREFILTER_MEM_READ, mem_index, addrlo, datalo, false, skip);
+
         //In 64 bit targets, the address is contained in addrlo
         tcg_out_mov(s, TCG_TYPE_I64,tcg_target_call_iarg_regs[0], addrlo);
 
@@ -2133,6 +2191,7 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args, bool is64)
             tcg_abort();
         }
         tcg_out_call(s, (tcg_insn_unit*)load_operation);
+        tcg_out_label(s, skip, s->code_ptr);
 
         //Undo stack alignment
         //TCGReg tmp = 0;
@@ -2312,6 +2371,10 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
         //Stack alignment
         //tcg_out_push(s, 0);
 
+        //Skip the call if no callback accepts the access
+        TCGLabel *skip = gen_new_label();
+        tcg_out_mem_callback_prefilter(s, PREFILTER_MEM_WRITE, mem_index, addrlo, datalo, true, skip);
+
         //In 64 bit targets, the address is contained in addrlo
         tcg_out_mov(s, TCG_TYPE_I64,tcg_target_call_iarg_regs[0], addrlo);
 
@@ -2337,6 +2400,7 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
           default:
             tcg_abort();
         }
+        tcg_out_label(s, skip, s->code_ptr);
 
         //Undo stack alignment
         //TCGReg tmp = 0;
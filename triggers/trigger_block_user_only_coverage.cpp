@@ -51,7 +51,7 @@ extern "C"{
         //Never return 1, so that we will never execute the python code on every block.
         //Skip any other process
         pyrebox_target_ulong* pgd = (pyrebox_target_ulong*) get_var(handle,"cr3");
-        if (get_running_process(params.block_begin_params.cpu_index) != *pgd)
+        if (get_pgd(params.block_begin_params.cpu) != *pgd)
             return 0;
 
         pyrebox_target_ulong pc = get_tb_addr(params.block_begin_params.tb);
@@ -70,7 +70,7 @@ extern "C"{
         pyrebox_target_ulong pc = get_tb_addr(params.block_begin_params.tb);
         pyrebox_target_ulong page_mask = (((pyrebox_target_ulong) -1) - 0xFFF);
         
-        if ((*(pgd[handle]) == (pyrebox_target_ulong) -1 || *(pgd[handle]) == get_running_process(params.block_begin_params.cpu_index)) &&  pc >= *(begin[handle]) && pc < *(end[handle])){
+        if ((*(pgd[handle]) == (pyrebox_target_ulong) -1 || *(pgd[handle]) == get_pgd(params.block_begin_params.cpu)) &&  pc >= *(begin[handle]) && pc < *(end[handle])){
             pyrebox_target_ulong page = pc & page_mask;
             std::unordered_set<pyrebox_target_ulong>::iterator it = page_status[handle].find(page);
             if (it == page_status[handle].end()){
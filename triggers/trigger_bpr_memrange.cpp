@@ -40,15 +40,25 @@ extern "C"{
     callback_type_t get_type(){
         return MEM_READ_CB;
     }
+    //Variables, bound to the context slots in this order
+    enum { VAR_BEGIN = 0, VAR_END, VAR_PGD };
+    const char* const* get_var_names(){
+        static const char* const names[] = {"begin", "end", "pgd", 0};
+        return names;
+    }
     //Trigger, return 1 if event should be passed to python callback 
-    int trigger(callback_handle_t handle, callback_params_t params){
-        pyrebox_target_ulong* begin = (pyrebox_target_ulong*) get_var(handle,"begin");
-        pyrebox_target_ulong* end = (pyrebox_target_ulong*) get_var(handle,"end");
-        pyrebox_target_ulong* pgd = (pyrebox_target_ulong*) get_var(handle,"pgd");
+    int trigger_v2(trigger_context_t* context, callback_params_t params){
+        //The variables are set after the trigger is loaded
+        if (!trigger_vars_bound(context)){
+            return 0;
+        }
+        pyrebox_target_ulong* begin = context->vars[VAR_BEGIN].target_ulong;
+        pyrebox_target_ulong* end = context->vars[VAR_END].target_ulong;
+        pyrebox_target_ulong* pgd = context->vars[VAR_PGD].target_ulong;
 
         pyrebox_target_ulong addr = params.mem_read_params.vaddr;
 
-        if ((*pgd == (pyrebox_target_ulong) -1 || *pgd == get_running_process(params.mem_read_params.cpu_index)) && addr >= *begin && addr < *end){
+        if ((*pgd == (pyrebox_target_ulong) -1 || *pgd == get_pgd(params.mem_read_params.cpu)) && addr >= *begin && addr < *end){
             return 1;
         }
         return 0;
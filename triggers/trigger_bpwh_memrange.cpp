@@ -34,43 +34,29 @@ extern "C"{
 #include "callbacks.h"
 #include "trigger_helpers.h"
 
-#define MAX_CALLBACKS 65536
-
-pyrebox_target_ulong vars[MAX_CALLBACKS][2];
-
-static void init() __attribute__((constructor));
-
-void init() {
-    for (unsigned int i = 0; i < MAX_CALLBACKS; i++){
-        //begin
-        vars[i][0] = 0;
-        //end
-        vars[i][1] = 0;
-    }
-}
-
 extern "C"{
     //Define trigger type. This type is checked when trigger is loaded
     callback_type_t get_type(){
         return MEM_WRITE_CB;
     }
+    //Variables, bound to the context slots in this order
+    enum { VAR_BEGIN = 0, VAR_END };
+    const char* const* get_var_names(){
+        static const char* const names[] = {"begin", "end", 0};
+        return names;
+    }
     //Trigger, return 1 if event should be passed to python callback 
-    int trigger(callback_handle_t handle, callback_params_t params){
-        if (handle >= MAX_CALLBACKS){
-            printf("Error in trigger_bpwh_memrange callback, MAX number of callbacks reached\n");
+    int trigger_v2(trigger_context_t* context, callback_params_t params){
+        //The variables are set after the trigger is loaded
+        if (!trigger_vars_bound(context)){
             return 0;
         }
-
-        // Check if var is initialized by comparing to 0. While begin can be 0, end will
-        // never be set to 0.
-        if (vars[handle][1] == 0){
-            vars[handle][0] = *((pyrebox_target_ulong*) get_var(handle,"begin"));
-            vars[handle][1] = *((pyrebox_target_ulong*) get_var(handle,"end"));
-        }
+        pyrebox_target_ulong* begin = context->vars[VAR_BEGIN].target_ulong;
+        pyrebox_target_ulong* end = context->vars[VAR_END].target_ulong;
 
         //We don't care about the PGD, just monitor the physical address
         pyrebox_target_ulong addr = params.mem_write_params.haddr;
-        if (addr >= vars[handle][0] && addr < vars[handle][1]){
+        if (addr >= *begin && addr < *end){
             return 1;
         }
         return 0;
@@ -70,7 +70,7 @@ extern "C"{
         pyrebox_target_ulong vaddr = params.mem_write_params.vaddr;
         pyrebox_target_ulong page_mask = (((pyrebox_target_ulong) -1) - 0xFFF);
 
-        if ((*(pgd[handle]) == (pyrebox_target_ulong) -1 || *(pgd[handle]) == get_running_process(params.mem_write_params.cpu_index)) &&  vaddr >= *(begin[handle]) && vaddr < *(end[handle])){
+        if ((*(pgd[handle]) == (pyrebox_target_ulong) -1 || *(pgd[handle]) == get_pgd(params.mem_write_params.cpu)) &&  vaddr >= *(begin[handle]) && vaddr < *(end[handle])){
             pyrebox_target_ulong page = vaddr & page_mask;
             std::unordered_set<pyrebox_target_ulong>::iterator it = page_status[handle].find(page);
             if (it == page_status[handle].end()){
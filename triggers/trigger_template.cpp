@@ -41,7 +41,7 @@ extern "C"{
         return OP_INSN_BEGIN_CB;
     }
     int trigger(callback_handle_t handle, callback_params_t params){
-        utils_print("Trigger called\n");
+        utils_print_buffered("Trigger called\n");
         return 1;
     }
     void clean(callback_handle_t handle)